@@ -1,386 +1,440 @@
-#include <iostream>      // For cin, cout, endl
-#include <string>        // For string class
-#include <vector>        // For std::vector
-#include <fstream>       // For file operations (if used)
-#include <sstream>       // For stringstream (optional, for parsing)
-#include <ctime>         // For timestamps (if used in transactions)
-#include <iomanip>       // For formatting output (like currency, dates)
-#include <cmath>         // For mathematical calculations (like pow function)
-using namespace std;
-
-// ========================
-// TransactionRecord Class
-// ========================
-class TransactionRecord {
-    int accountNumber;
-    string type;
-    double amount;
-    time_t timestamp;
-
-public:
-    TransactionRecord(int accNo, const string &type, double amt)
-        : accountNumber(accNo), type(type), amount(amt), timestamp(time(nullptr)) {}
-
-    void show() const {
-        cout << "\nAccount: " << accountNumber
-             << ", Type: " << type
-             << ", Amount: INR " << fixed << setprecision(2) << amount
-             << ", Date: " << ctime(&timestamp);
-    }
-};
+#include "WiseVault.h"
 
-// ========================
-// User Class
-// ========================
-class User {
-public:
-    string username;
-    string password;
-    string role; // "manager" or "user"
-
-    User() {}
-    User(string uname, string pwd, string r) : username(uname), password(pwd), role(r) {}
-};
+using namespace std;
 
-// ========================
-// Account Class
-// ========================
-class Account {
+// ==============================
+// UserInteraction Class
+// ==============================
+class UserInteraction
+{
 private:
-    int accountNumber;
-    string name;
-    double balance;
-    string accountType;
-    string ownerUsername;
-    vector<TransactionRecord> transactionLog;
-
-public:
-    Account() {}
-
-    Account(int accNo, const string &accName, double bal, const string &type, const string &owner)
-        : accountNumber(accNo), name(accName), balance(bal), accountType(type), ownerUsername(owner) {}
-
-    void addTransactionRecord(const TransactionRecord &record) {
-        transactionLog.push_back(record);
-    }
-
-    void showAccount() const {
-        cout << "\nAccount Number: " << accountNumber;
-        cout << "\nAccount Holder: " << name;
-        cout << "\nAccount Type  : " << accountType;
-        cout << fixed << setprecision(2);
-        cout << "\nBalance       : INR " << balance << endl;
-    }
+    UserStore users;
+    Journal journal;
+    Manager manager;
+    Ledger ledger; // after manager: its drainer feeds manager until it stops
+    Snapshotter snapshotter;
+    ColumnStore analytics;
+    RiskRules rules;
+    ofstream flagLog;
+    mutex flagLogLock;
+    Transaction transaction;
+    User loggedInUser;
+    SessionToken session;
 
-    void deposit(double amount) {
-        balance += amount;
-        cout << "Deposit successful! Current balance: INR " << balance << endl;
+    // A follower's users.db starts empty and is filled from the leader's
+    static UserStore::Options userOptions(bool replica)
+    {
+        UserStore::Options options;
+        options.seedDefaults = !replica;
+        if (replica)
+            options.legacyPath = "";
+        return options;
     }
 
-    void withdraw(double amount) {
-        if (amount > balance) {
-            cout << "Insufficient balance.\n";
-        } else {
-            balance -= amount;
-            cout << "Withdrawal successful! Current balance: INR " << balance << endl;
-        }
+    // The Prometheus file, with the risk rules' hits
+    bool writeMetrics()
+    {
+        return Metrics::writePrometheus(METRICS_FILE, [this](ostream &out) { rules.writePrometheus(out); });
     }
 
-    void showTransactionHistory() const {
-        if (transactionLog.empty()) {
-            cout << "No transactions found for this account.\n";
+    // Screens every posting with the bank's rules file, if it has one; postings
+    // a flag rule lets through are appended to FLAGS_FILE
+    void loadRules()
+    {
+        if (access(RULES_FILE, F_OK) != 0)
+            return;
+        if (!rules.load(RULES_FILE, cout))
+        {
+            cout << "Risk rules not loaded; postings are not screened.\n";
             return;
         }
-
-        cout << "\nTransaction History for Account " << accountNumber << ":\n";
-        for (const auto &record : transactionLog)
-            record.show();
+        flagLog.open(FLAGS_FILE, ios::app);
+        rules.onFlag([this](const string &rule, int accNo, TxType type, Money amount)
+        {
+            lock_guard<mutex> hold(flagLogLock);
+            flagLog << time(nullptr) << "," << rule << "," << accNo << "," << txTypeName(type) << "," << amount << endl;
+        });
+        transaction.attachRules(&rules);
     }
 
-    int getAccountNumber() const { return accountNumber; }
-    double getBalance() const { return balance; }
-    string getOwnerUsername() const { return ownerUsername; }
-
-    void modifyAccount(const string &newName, const string &newType) {
-        name = newName;
-        accountType = newType;
-        cout << "Account modified successfully.\n";
+    // Says why a deposit, withdrawal or transfer didn't go through
+    void reportRefusal(const char *what, const char *reason)
+    {
+        if (journal.hasFailed())
+            cout << what << " not saved: the journal could not be written.\n";
+        else if (const string *rule = RiskRules::blockedBy())
+            cout << what << " refused by risk rule " << *rule << ".\n";
+        else
+            cout << what << " failed: " << reason << ".\n";
     }
-};
-
-// =========================
-// Forward declaration for Manager
-// =========================
-class Manager;
-
-// =========================
-// Transaction Class
-// =========================
-class Transaction {
-public:
-    void deposit(Account &acc, double amount);
-    void withdraw(Account &acc, double amount);
-    void deposit(Account &acc, double amount, Manager &manager);
-    void withdraw(Account &acc, double amount, Manager &manager);
-};
-
-void Transaction::deposit(Account &acc, double amount) {
-    acc.deposit(amount);
-    acc.addTransactionRecord(TransactionRecord(acc.getAccountNumber(), "Deposit", amount));
-}
 
-void Transaction::withdraw(Account &acc, double amount) {
-    if (acc.getBalance() >= amount) {
-        acc.withdraw(amount);
-        acc.addTransactionRecord(TransactionRecord(acc.getAccountNumber(), "Withdraw", amount));
-    } else {
-        cout << "Withdrawal failed: insufficient balance.\n";
+    // Housekeeping once a second until SIGINT/SIGTERM. SIGUSR1 prints the
+    // stats dump; the Prometheus file is rewritten every second.
+    void serveUntilStopped(const function<void()> &everySecond)
+    {
+        static volatile sig_atomic_t stopRequested = 0, statsRequested = 0;
+        signal(SIGINT, [](int) { stopRequested = 1; });
+        signal(SIGTERM, [](int) { stopRequested = 1; });
+        signal(SIGUSR1, [](int) { statsRequested = 1; });
+        while (!stopRequested)
+        {
+            this_thread::sleep_for(chrono::seconds(1));
+            everySecond();
+            manager.pageOutHistory();
+            manager.expireSessions();
+            writeMetrics();
+            if (statsRequested)
+            {
+                statsRequested = 0;
+                Metrics::writeText(cout);
+                rules.writeText(cout);
+                cout.flush();
+            }
+        }
     }
-}
-
-void Transaction::deposit(Account &acc, double amount, Manager &manager) {
-    deposit(acc, amount); // No special logic for manager in current version
-}
-
-void Transaction::withdraw(Account &acc, double amount, Manager &manager) {
-    withdraw(acc, amount); // No special logic for manager in current version
-}
-
-// =========================
-// Loan Class
-// =========================
-class Loan {
-private:
-    int loanID;
-    string borrowerName;
-    string borrowerUsername;
-    double principal;
-    double rate;
-    int tenure; // in months
-    double emi;
-    double balance;
 
 public:
-    Loan() {}
-
-    Loan(int id, const string &name, const string &username, double p, int t, double r = 12.0)
-        : loanID(id), borrowerName(name), borrowerUsername(username), principal(p), rate(r), tenure(t * 12) {
-
-        double monthlyRate = (rate / 12) / 100;
-        emi = (principal * monthlyRate * pow(1 + monthlyRate, tenure)) / (pow(1 + monthlyRate, tenure) - 1);
-        balance = emi * tenure;
-    }
-
-    void showLoanDetails() const {
-        cout << "\nLoan ID          : " << loanID;
-        cout << "\nBorrower Name    : " << borrowerName;
-        cout << "\nPrincipal Amount : INR " << principal;
-        cout << "\nInterest Rate    : " << rate << "%";
-        cout << "\nTenure           : " << tenure / 12 << " years (" << tenure << " months)";
-        cout << "\nMonthly EMI      : INR " << emi;
-        cout << "\nTotal Payable    : INR " << balance << endl;
-    }
+    explicit UserInteraction(bool replica = false) : users(userOptions(replica))
+    {
+        // Snapshots refer to history paged out to the tier, so it opens first
+        HistoryTier::Options tierOptions;
+        if (const char *budget = getenv("WISEVAULT_HISTORY_BUDGET_MB"))
+            tierOptions.memoryBudget = (size_t)max(1L, atol(budget)) << 20;
+        if (!HistoryTier::instance().open(tierOptions))
+            cout << "Could not open " << tierOptions.directory << "; all history stays in memory.\n";
+
+        // Load the latest snapshot, replay the journal tail past it, then keep appending
+        uint64_t snapshotSequence = 0;
+        manager.loadSnapshot(snapshotter.path(), snapshotSequence);
+        snapshotter.setBaseline(snapshotSequence);
+        if (journal.open(Journal::Options(), [this](const JournalRecord &rec) { manager.apply(rec); }, snapshotSequence))
+        {
+            manager.attachJournal(&journal);
+            transaction.attachJournal(&journal);
+        }
+        else
+        {
+            cout << "Could not open journal; changes will not be saved.\n";
+        }
+        // Segments the snapshot doesn't refer to hold nothing the journal can't rebuild
+        HistoryTier::instance().removeUnused();
 
-    int getLoanID() const { return loanID; }
-    string getBorrowerUsername() const { return borrowerUsername; }
+        manager.attachLedger(&ledger);
+        transaction.attachLedger(&ledger);
+        ledger.start(Ledger::Options());
+        loadRules();
 
-    void makePayment(double amount) {
-        if (amount >= balance) {
-            cout << "Loan paid off successfully!\n";
-            balance = 0;
-        } else {
-            balance -= amount;
-            cout << "Payment successful. Remaining Balance: INR " << balance << endl;
-        }
+        users.load();
     }
-};
 
-// ============================
-// Manager Class
-// ============================
-class Manager
-{
-private:
-    vector<Account> accounts;
-    vector<Loan> loans;
-    int nextAccNo = 1001;
-    int nextLoanID = 1;
-    vector<TransactionRecord> transactions;
-    void recordTransaction(int accNo, const string &type, double amount)
-    {
-        transactions.push_back(TransactionRecord(accNo, type, amount));
-    }
 
-public:
-    void createAccount(const string &name, double balance, const string &type, const string &ownerUsername)
+    // Non-interactive mode: posts a settlement file, errors to stderr
+    int runBatch(const string &path)
     {
-        accounts.push_back(Account(nextAccNo, name, balance, type, ownerUsername));
-        cout << "Account created successfully! Account Number: " << nextAccNo++ << endl;
-    }
-
-    vector<Account> getUserAccounts(string username)
+        BatchIngest ingest(manager, transaction, journal.isOpen() ? &journal : nullptr, cerr);
+        BatchIngest::Result result;
+        if (!ingest.run(path, result))
+        {
+            cerr << "Could not open " << path << ".\n";
+            return 1;
+        }
+        snapshotter.maybeSnapshot(manager, journal);
+        manager.pageOutHistory();
+        cout << "Batch complete: " << result.records << " operations, " << result.posted << " posted, "
+             << result.failed << " failed.\n";
+        if (result.readError)
+            cerr << "Read error: input ended early.\n";
+        return result.failed || result.readError ? 2 : 0;
+    }
+
+    // Network mode: serves the protocol until SIGINT/SIGTERM, snapshotting as
+    // the journal grows, and ships the journal to followers that connect to
+    // replicationSocket if one is given
+    int runServer(uint16_t port, unsigned workers, const string &replicationSocket)
     {
-        vector<Account> result;
-        for (auto &acc : accounts)
+        NetServer::Options options;
+        options.port = port;
+        if (workers)
+            options.workers = workers;
+        NetServer server(manager, transaction, users, journal.isOpen() ? &journal : nullptr, options);
+        if (!server.start())
         {
-            if (acc.getOwnerUsername() == username)
-                result.push_back(acc);
+            cerr << "Could not listen on " << options.address << ":" << port << ": " << strerror(errno) << "\n";
+            return 1;
         }
-        return result;
-    }
+        cout << "Serving on " << options.address << ":" << server.port() << " with " << options.workers
+             << " workers. Press Ctrl+C to stop." << endl;
 
-    Account *findAccount(int accNo, string username = "", bool isManager = false)
-    {
-        for (auto &acc : accounts)
+        ReplicationServer::Options shipOptions;
+        shipOptions.socketPath = replicationSocket;
+        ReplicationServer shipper(manager, journal, users, shipOptions);
+        if (!replicationSocket.empty())
         {
-            if (acc.getAccountNumber() == accNo)
-            {
-                if (isManager || acc.getOwnerUsername() == username)
-                    return &acc;
-            }
+            if (!journal.isOpen() || !shipper.start())
+                cerr << "Could not ship the journal on " << replicationSocket << "; serving without followers.\n";
+            else
+                cout << "Shipping the journal to followers on " << replicationSocket << "." << endl;
         }
-        return nullptr;
+
+        serveUntilStopped([&] { snapshotter.maybeSnapshot(manager, journal); });
+        shipper.stop();
+        server.stop();
+        cout << "Server stopped.\n";
+        return 0;
     }
 
-    void closeAccount(int accNo, string username = "", bool isManager = false)
+    // Standby mode: keeps up with the leader on replicationSocket and serves
+    // the protocol read-only. SIGUSR2 promotes it: it stops following, takes
+    // changes, and ships its own journal on the same socket.
+    int runFollower(const string &replicationSocket, uint16_t port)
     {
-        for (auto it = accounts.begin(); it != accounts.end(); ++it)
+        if (!journal.isOpen())
+        {
+            cerr << "A follower needs its own journal.\n";
+            return 1;
+        }
+        NetServer::Options options;
+        options.port = port;
+        options.readOnly = true;
+        NetServer server(manager, transaction, users, &journal, options);
+        if (!server.start())
         {
-            if (it->getAccountNumber() == accNo && (isManager || it->getOwnerUsername() == username))
+            cerr << "Could not listen on " << options.address << ":" << port << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        ReplicationClient::Options followOptions;
+        followOptions.socketPath = replicationSocket;
+        ReplicationClient follower(manager, journal, users, snapshotter, followOptions);
+        follower.start();
+        cout << "Serving reads on " << options.address << ":" << server.port()
+             << ". Send SIGUSR2 to promote this follower to leader." << endl;
+
+        ReplicationServer::Options shipOptions;
+        shipOptions.socketPath = replicationSocket;
+        ReplicationServer shipper(manager, journal, users, shipOptions);
+        static volatile sig_atomic_t promoteRequested = 0;
+        signal(SIGUSR2, [](int) { promoteRequested = 1; });
+        bool promoted = false;
+        serveUntilStopped([&]
+        {
+            if (promoteRequested && !promoted)
             {
-                accounts.erase(it);
-                cout << "Account closed successfully.\n";
-                return;
+                follower.stop();
+                server.setReadOnly(false);
+                promoted = true;
+                cout << "Promoted to leader at record " << journal.lastSequence() << "." << endl;
+                if (!shipper.start())
+                    cerr << "Could not ship the journal on " << replicationSocket << ".\n";
             }
-        }
-        cout << "Account not found or permission denied.\n";
+            if (promoted)
+                snapshotter.maybeSnapshot(manager, journal); // the follower snapshots itself until then
+        });
+        follower.stop();
+        shipper.stop();
+        server.stop();
+        cout << "Server stopped.\n";
+        return 0;
     }
 
-    void showAllAccounts()
+    void changeLoanRate()
     {
-        if (accounts.empty())
+        double rate;
+        cout << "Current loan rate: " << fixed << setprecision(2) << manager.getLoanRate() << "%\n";
+        cout << "Enter new annual rate (%): ";
+        cin >> rate;
+        if (!cin || rate < 0 || rate > 100)
         {
-            cout << "No accounts available.\n";
+            cin.clear();
+            cout << "Invalid rate.\n";
             return;
         }
-        for (auto &acc : accounts)
+        if (!manager.repriceLoans(rate))
         {
-            acc.showAccount();
-            cout << "----------------------------\n";
+            cout << "Not saved: the journal could not be written.\n";
+            return;
         }
+        cout << "All open loans repriced at " << rate << "%.\n";
     }
 
-    void applyLoan(const string &name, const string &username, double principal, int tenure)
+    void showStats()
     {
-        loans.push_back(Loan(nextLoanID, name, username, principal, tenure));
-        cout << "Loan application successful! Loan ID: " << nextLoanID++ << endl;
+        Metrics::writeText(cout);
+        rules.writeText(cout);
+        if (writeMetrics())
+            cout << "Also written to " << METRICS_FILE << ".\n";
     }
 
-    vector<Loan> getUserLoans(string username)
+    void runMonthEnd()
     {
-        vector<Loan> result;
-        for (auto &loan : loans)
+        int year, month;
+        char dash;
+        cout << "Enter month to close (YYYY-MM): ";
+        cin >> year >> dash >> month;
+        if (!cin || dash != '-' || year < 1970 || month < 1 || month > 12)
+        {
+            cin.clear();
+            cout << "Invalid month.\n";
+            return;
+        }
+        size_t credited = 0;
+        Money paid;
+        int period = year * 100 + month;
+        if (!manager.closeMonth(period, credited, paid))
         {
-            if (loan.getBorrowerUsername() == username)
-                result.push_back(loan);
+            if (journal.hasFailed())
+                cout << "Not saved: the journal could not be written.\n";
+            else if (period <= manager.getLastClosedPeriod())
+                cout << "That month is already closed.\n";
+            else
+                cout << "That month hasn't ended yet.\n";
+            return;
         }
-        return result;
+        cout << "Month closed. Interest of INR " << paid << " credited to " << credited << " accounts.\n";
     }
 
-    Loan *findLoan(int loanID, string username = "", bool isManager = false)
+    // Book-wide aggregates from the column store, refreshed with whatever was posted since last time
+    void showAnalytics()
     {
-        for (auto &loan : loans)
+        int view;
+        cout << "1. Deposits and withdrawals per day (last 30 days)\n2. Totals by transaction type\n"
+                "3. Balances by account type\n4. Loan exposure per borrower\nEnter choice: ";
+        cin >> view;
+        if (view < 1 || view > 4)
+        {
+            cout << "Invalid choice.\n";
+            return;
+        }
+        size_t added = manager.refreshAnalytics(analytics);
+        cout << analytics.transactionCount() << " transactions (" << added << " new since the last refresh).\n";
+
+        vector<ColumnStore::Group> groups;
+        bool ok = true;
+        if (view == 1)
         {
-            if (loan.getLoanID() == loanID)
+            ColumnStore::Filter filter;
+            filter.toDay = dayNumber(time(nullptr)) + 1;
+            filter.fromDay = filter.toDay - 30;
+            for (TxType type : {TX_DEPOSIT, TX_WITHDRAW})
             {
-                if (isManager || loan.getBorrowerUsername() == username)
-                    return &loan;
+                filter.typeMask = 1u << type;
+                ok = analytics.sumTransactions(filter, ColumnStore::GROUP_DAY, groups) && ok;
+                cout << "\n" << (type == TX_DEPOSIT ? "Deposits" : "Withdrawals") << ":\n";
+                if (groups.empty())
+                    cout << "None.\n";
+                for (const ColumnStore::Group &group : groups)
+                {
+                    time_t day = (time_t)group.key * 86400;
+                    cout << put_time(gmtime(&day), "%Y-%m-%d") << "  " << setw(8) << group.count << "  INR " << group.sum
+                         << "\n";
+                }
             }
         }
-        return nullptr;
-    }
-
-    void showAllLoans()
-    {
-        if (loans.empty())
+        else if (view == 2)
         {
-            cout << "No loans available.\n";
-            return;
+            ok = analytics.sumTransactions(ColumnStore::Filter(), ColumnStore::GROUP_TX_TYPE, groups);
+            for (const ColumnStore::Group &group : groups)
+                cout << left << setw(12) << txTypeName(TxType(group.key)) << right << setw(10) << group.count << "  INR "
+                     << group.sum << "\n";
         }
-        for (auto &loan : loans)
+        else if (view == 3)
         {
-            loan.showLoanDetails();
-            cout << "----------------------------\n";
+            ok = analytics.sumBalances(ColumnStore::GROUP_ACCOUNT_TYPE, groups);
+            for (const ColumnStore::Group &group : groups)
+                cout << left << setw(12) << analytics.accountTypeName(group.key) << right << setw(10) << group.count
+                     << " accounts  INR " << group.sum << "\n";
         }
-    }
-
-    void recordGlobalTransaction(const TransactionRecord &record)
-    {
-        transactions.push_back(record);
-    }
-
-    // Optional: show all global transactions
-    void showAllTransactions()
-    {
-        if (transactions.empty())
+        else
         {
-            cout << "No transactions have been recorded.\n";
-            return;
+            ok = analytics.sumLoanExposure(ColumnStore::GROUP_OWNER, groups);
+            sort(groups.begin(), groups.end(),
+                 [](const ColumnStore::Group &a, const ColumnStore::Group &b) { return b.sum < a.sum; });
+            if (groups.size() > 20)
+                groups.resize(20);
+            for (const ColumnStore::Group &group : groups)
+                cout << left << setw(20) << analytics.userName(group.key) << right << setw(4) << group.count
+                     << " loans  INR " << group.sum << "\n";
         }
-        for (const auto &tr : transactions)
-            tr.show();
+        if (groups.empty() && view != 1)
+            cout << "Nothing to show.\n";
+        if (!ok)
+            cout << "A total was too large to show.\n";
     }
 
-};
-
-// ==============================
-// UserInteraction Class
-// ==============================
-class UserInteraction
-{
-private:
-    vector<User> users;
-    Manager manager;
-    Transaction transaction;
-    User *loggedInUser = nullptr;
-
-public:
-    UserInteraction()
+    void exportReport()
     {
-        // load users from file
-        ifstream inFile("users.txt");
-        string uname, pwd, role;
-        while (inFile >> uname >> pwd >> role)
-        {
-            users.push_back(User(uname, pwd, role));
-        }
-        ofstream outFile("users.txt", ios::app);
-        if (users.empty()) 
+        string path;
+        int format;
+        cout << "Enter output file: ";
+        cin >> path;
+        cout << "1. Text\n2. CSV\n3. Binary\nEnter format: ";
+        cin >> format;
+        if (format < 1 || format > 3)
         {
-            users.push_back(User("Prithvi", "admin123", "manager"));
-            outFile << "Prithvi admin123 manager\n";
+            cout << "Invalid format.\n";
+            return;
         }
-        outFile.close();
-
-        // Add default users for testing
-        users.push_back(User("Prithvi", "admin123", "manager"));
-        users.push_back(User("Atharv", "user123", "user"));
+        if (manager.exportReport(path, ReportFormat(format - 1)))
+            cout << "Report written to " << path << ".\n";
+        else
+            cout << "Nothing to export, or the file could not be written.\n";
     }
 
-
-    void viewTransactions(bool isManager)
+    // Latest transactions, or a month's statement, a page at a time
+    void viewTransactions()
     {
-        int accNo;
+        int accNo, view;
+        HistoryQuery query;
         cout << "Enter account number: ";
         cin >> accNo;
-        Account *acc = manager.findAccount(accNo, loggedInUser->username, isManager);
-        if (acc)
+        cout << "1. Latest transactions\n2. Monthly statement\nEnter choice: ";
+        cin >> view;
+        if (view == 2)
         {
-            acc->showTransactionHistory();
+            int year, month;
+            char dash;
+            cout << "Enter month (YYYY-MM): ";
+            cin >> year >> dash >> month;
+            if (!cin || dash != '-' || month < 1 || month > 12)
+            {
+                cin.clear();
+                cout << "Invalid month.\n";
+                return;
+            }
+            tm start = {};
+            start.tm_year = year - 1900;
+            start.tm_mon = month - 1;
+            start.tm_mday = 1;
+            start.tm_isdst = -1;
+            tm end = start;
+            end.tm_mon += 1; // mktime normalises December + 1
+            query.from = mktime(&start);
+            query.to = mktime(&end);
+            query.newestFirst = false;
         }
-        else
+
+        HistoryPage page;
+        while (true)
         {
-            cout << "Account not found or permission denied.\n";
+            if (!manager.queryHistory(accNo, session, query, page))
+            {
+                cout << "Account not found or permission denied.\n";
+                return;
+            }
+            if (page.records.empty() && query.cursor == 0)
+            {
+                cout << "No transactions found for this account.\n";
+                return;
+            }
+            for (const auto &record : page.records)
+                record.show();
+            if (page.nextCursor == 0)
+                return;
+            char more;
+            cout << "\nShow more? (y/n): ";
+            cin >> more;
+            if (more != 'y' && more != 'Y')
+                return;
+            query.cursor = page.nextCursor;
         }
     }
 
@@ -392,19 +446,40 @@ public:
         cout << "Password: ";
         cin >> pwd;
 
-        for (auto &user : users)
+        if (users.authenticate(uname, pwd, loggedInUser))
         {
-            if (user.username == uname && user.password == pwd)
+            session = manager.openSession(loggedInUser);
+            if (session.valid())
             {
-                loggedInUser = &user;
-                cout << "Login successful! Welcome, " << user.username << " (" << user.role << ")\n";
+                cout << "Login successful! Welcome, " << loggedInUser.username << " (" << loggedInUser.role << ")\n";
                 return;
             }
+            cout << "Too many active sessions. Try again later.\n";
+        }
+        else
+        {
+            cout << "Invalid credentials. Try again.\n";
         }
-        cout << "Invalid credentials. Try again.\n";
         login(); // Retry login
     }
 
+    void logout()
+    {
+        manager.closeSession(session);
+        session = SessionToken();
+    }
+
+    // Sends an idle user back to the login screen
+    bool sessionAlive()
+    {
+        SessionTable::Info info;
+        if (manager.sessionInfo(session, info))
+            return true;
+        cout << "\nSession expired. Please log in again.\n";
+        start();
+        return false;
+    }
+
     void start() {
         int choice;
         cout << "\n==== Welcome to WiseVault ====\n";
@@ -427,7 +502,7 @@ public:
                 return;
         }
     
-        if (loggedInUser->role == "manager")
+        if (loggedInUser.isManager())
             managerMenu();
         else
             userMenu();
@@ -440,7 +515,11 @@ public:
         int choice;
         do
         {
-            cout << "\n==== User Menu (" << loggedInUser->username << ") ====\n";
+            snapshotter.maybeSnapshot(manager, journal);
+            manager.pageOutHistory();
+            if (!sessionAlive())
+                return;
+            cout << "\n==== User Menu (" << loggedInUser.username << ") ====\n";
             cout << "1. View My Accounts\n";
             cout << "2. Modify My Account\n";
             cout << "3. Deposit\n";
@@ -449,7 +528,8 @@ public:
             cout << "6. View My Loans\n";
             cout << "7. Make Loan Payment\n";
             cout << "8. View Transaction History\n";
-            cout << "9. Logout\n";
+            cout << "9. Transfer Money\n";
+            cout << "10. Logout\n";
 
             cout << "Enter choice: ";
             cin >> choice;
@@ -457,32 +537,34 @@ public:
             switch (choice)
             {
             case 1:
-                for (auto &acc : manager.getUserAccounts(loggedInUser->username))
-                    acc.showAccount();
+                manager.forEachUserAccount(loggedInUser.username, [](const Account &acc) { acc.showAccount(); });
                 break;
             case 2:
-                modifyAccount(false);
+                modifyAccount();
                 break;
             case 3:
-                depositAmount(false);
+                depositAmount();
                 break;
             case 4:
-                withdrawAmount(false);
+                withdrawAmount();
                 break;
             case 5:
                 applyLoan();
                 break;
             case 6:
-                for (auto &loan : manager.getUserLoans(loggedInUser->username))
-                    loan.showLoanDetails();
+                manager.forEachUserLoan(loggedInUser.username, [](const Loan &loan) { loan.showLoanDetails(); });
                 break;
             case 7:
-                makeLoanPayment(false);
+                makeLoanPayment();
                 break;
             case 8:
-                viewTransactions(false);
+                viewTransactions();
                 break;
             case 9:
+                transferAmount();
+                break;
+            case 10:
+                logout();
                 cout << "Logged out.\nTeam Polymorphs wishes you a great day ahead!\n";
                 start();
                 return;
@@ -500,6 +582,10 @@ public:
         int choice;
         do
         {
+            snapshotter.maybeSnapshot(manager, journal);
+            manager.pageOutHistory();
+            if (!sessionAlive())
+                return;
             cout << "\n==== Manager Menu ====\n";
             cout << "1. Create Account\n";
             cout << "2. Show All Accounts\n";
@@ -508,7 +594,13 @@ public:
             cout << "5. Show All Loans\n";
             cout << "6. Make Loan Payment\n";
             cout << "7. View Account Transaction History\n";
-            cout << "8. Logout\n";
+            cout << "8. Export Report\n";
+            cout << "9. Change Loan Interest Rate\n";
+            cout << "10. Run Month-End Close\n";
+            cout << "11. Show Performance Stats\n";
+            cout << "12. Analytics\n";
+            cout << "13. Show All Transactions\n";
+            cout << "14. Logout\n";
 
             cout << "Enter choice: ";
             cin >> choice;
@@ -531,12 +623,31 @@ public:
                 manager.showAllLoans();
                 break;
             case 6:
-                makeLoanPayment(true);
+                makeLoanPayment();
                 break;
             case 7:
-                viewTransactions(true);
+                viewTransactions();
                 break;
             case 8:
+                exportReport();
+                break;
+            case 9:
+                changeLoanRate();
+                break;
+            case 10:
+                runMonthEnd();
+                break;
+            case 11:
+                showStats();
+                break;
+            case 12:
+                showAnalytics();
+                break;
+            case 13:
+                manager.showAllTransactions();
+                break;
+            case 14:
+                logout();
                 cout << "Logged out.\n";
                 start();
                 return;
@@ -552,14 +663,15 @@ public:
     void createAccount()
     {
         string name, type, uname, pwd;
-        double bal;
+        Money bal;
 
         cout << "Enter account holder name: ";
         cin.ignore();
         getline(cin, name);
 
         cout << "Enter initial deposit: INR ";
-        cin >> bal;
+        if (!readAmount(bal))
+            return;
 
         cout << "Enter account type (Saving/Current): ";
         cin.ignore();
@@ -571,29 +683,18 @@ public:
         cout << "Enter password for new user: ";
         getline(cin, pwd);
 
-        users.push_back(User(uname, pwd, "user"));
-        // Append new user to file
-        ofstream outFile("users.txt",ios::app);
-        if(outFile.is_open())
-        {
-            outFile<<uname<<" "<<pwd<<" user\n";
-            outFile.close();
-        }
-        else
-        {
-            cout<<"Error opening file\n";
-        }
+        users.add(User(uname, pwd, "user")); // an existing owner keeps their password
 
         manager.createAccount(name, bal, type, uname);
     }
 
-    void modifyAccount(bool isManager)
+    void modifyAccount()
     {
         int accNo;
         string name, type;
         cout << "Enter account number: ";
         cin >> accNo;
-        Account *acc = manager.findAccount(accNo, loggedInUser->username, isManager);
+        Account *acc = manager.findAccount(accNo, session);
         if (acc)
         {
             cout << "Enter new name: ";
@@ -601,7 +702,7 @@ public:
             getline(cin, name);
             cout << "Enter new account type: ";
             getline(cin, type);
-            acc->modifyAccount(name, type);
+            manager.modifyAccount(*acc, name, type);
         }
         else
         {
@@ -609,18 +710,35 @@ public:
         }
     }
 
-    void depositAmount(bool isManager)
+    // Reads a non-negative INR amount with at most two decimal places
+    bool readAmount(Money &amount)
+    {
+        string text;
+        cin >> text;
+        if (!Money::parse(text, amount) || amount < Money())
+        {
+            cout << "Invalid amount.\n";
+            return false;
+        }
+        return true;
+    }
+
+    void depositAmount()
     {
         int accNo;
-        double amount;
+        Money amount;
         cout << "Enter account number: ";
         cin >> accNo;
         cout << "Enter deposit amount: INR ";
-        cin >> amount;
-        Account *acc = manager.findAccount(accNo, loggedInUser->username, isManager);
+        if (!readAmount(amount))
+            return;
+        Account *acc = manager.findAccount(accNo, session);
         if (acc)
         {
-            transaction.deposit(*acc, amount, manager);
+            if (transaction.deposit(*acc, amount, manager))
+                cout << "Deposit successful! Current balance: INR " << transaction.balance(*acc) << endl;
+            else
+                reportRefusal("Deposit", "invalid amount");
         }
         else
         {
@@ -628,18 +746,22 @@ public:
         }
     }
 
-    void withdrawAmount(bool isManager)
+    void withdrawAmount()
     {
         int accNo;
-        double amount;
+        Money amount;
         cout << "Enter account number: ";
         cin >> accNo;
         cout << "Enter withdrawal amount: ";
-        cin >> amount;
-        Account *acc = manager.findAccount(accNo, loggedInUser->username, isManager);
+        if (!readAmount(amount))
+            return;
+        Account *acc = manager.findAccount(accNo, session);
         if (acc)
         {
-            transaction.withdraw(*acc, amount, manager);
+            if (transaction.withdraw(*acc, amount, manager))
+                cout << "Withdrawal successful! Current balance: INR " << transaction.balance(*acc) << endl;
+            else
+                reportRefusal("Withdrawal", "insufficient balance or invalid amount");
         }
         else
         {
@@ -647,51 +769,84 @@ public:
         }
     }
 
+    void transferAmount()
+    {
+        int fromAccNo, toAccNo;
+        Money amount;
+        cout << "Enter your account number: ";
+        cin >> fromAccNo;
+        cout << "Enter destination account number: ";
+        cin >> toAccNo;
+        cout << "Enter transfer amount: INR ";
+        if (!readAmount(amount))
+            return;
+        if (!manager.findAccount(fromAccNo, session))
+        {
+            cout << "Account not found or permission denied.\n";
+            return;
+        }
+        if (!manager.findAccount(toAccNo, "", true))
+        {
+            cout << "Destination account not found.\n";
+            return;
+        }
+        if (transaction.transfer(manager, fromAccNo, toAccNo, amount))
+            cout << "Transfer successful!\n";
+        else
+            reportRefusal("Transfer", "insufficient balance or invalid amount");
+    }
+
     void applyLoan()
     {
         string name;
-        double principal;
+        Money principal;
         int tenure;
         cout << "Enter borrower name: ";
         cin.ignore();
         getline(cin, name);
         cout << "Enter principal: ";
-        cin >> principal;
+        if (!readAmount(principal))
+            return;
         cout << "Enter tenure (years): ";
         cin >> tenure;
         cout << "Default Interest Rate is 12%\n";
-        manager.applyLoan(name, loggedInUser->username, principal, tenure);
+        manager.applyLoan(name, loggedInUser.username, principal, tenure);
     }
 
-    void makeLoanPayment(bool isManager)
+    void makeLoanPayment()
 {
     int loanID;
-    double amount;
+    Money amount;
     cout << "Enter Loan ID: ";
     cin >> loanID;
     cout << "Enter amount: ";
-    cin >> amount;
-    Loan *loan = manager.findLoan(loanID, loggedInUser->username, isManager);
+    if (!readAmount(amount))
+        return;
+    Loan *loan = manager.findLoan(loanID, session);
     if (loan)
     {
-        loan->makePayment(amount);
-
         // Find a related account for logging the transaction
-        auto accounts = manager.getUserAccounts(loggedInUser->username);
-        if (!accounts.empty())
+        Account *acc = nullptr;
+        if (int firstAccNo = manager.firstUserAccount(loggedInUser.username))
         {
             // Log to the first account (you can change this logic if needed)
-            Account* acc = manager.findAccount(accounts[0].getAccountNumber(), loggedInUser->username, isManager);
-            if (acc)
-            {
-                acc->addTransactionRecord(TransactionRecord(acc->getAccountNumber(), "Loan Payment", amount));
-                cout << "Loan payment recorded in transaction history of Account " << acc->getAccountNumber() << ".\n";
-            }
+            acc = manager.findAccount(firstAccNo, session);
         }
-        else
+
+        Money remaining;
+        if (!manager.payLoan(*loan, amount, acc, remaining))
         {
-            cout << "No account found to record the transaction.\n";
+            cout << "Payment not saved: the journal could not be written.\n";
+            return;
         }
+        if (remaining.isZero())
+            cout << "Loan paid off successfully!\n";
+        else
+            cout << "Payment successful. Remaining Balance: INR " << remaining << endl;
+        if (acc)
+            cout << "Loan payment recorded in transaction history of Account " << acc->getAccountNumber() << ".\n";
+        else
+            cout << "No account found to record the transaction.\n";
     }
     else
     {
@@ -705,7 +860,7 @@ public:
         int accNo;
         cout << "Enter account number to close: ";
         cin >> accNo;
-        manager.closeAccount(accNo, loggedInUser->username, isManager);
+        manager.closeAccount(accNo, loggedInUser.username, isManager);
     }
 
     void registerNewUser() {
@@ -717,30 +872,20 @@ public:
         cout << "Enter password: ";
         cin >> password;
     
-        // Check if username already exists
-        for (auto &user : users) {
-            if (user.username == username) {
-                cout << "Username already exists. Try a different one.\n";
-                return;
-            }
+        if (!UserStore::fits(username)) {
+            cout << "Username is too long (max " << JOURNAL_USER_LEN - 1 << " characters).\n";
+            return;
         }
-    
         User newUser(username, password, "user");
-        users.push_back(newUser);
-    
-        // Save to file
-        ofstream outFile("users.txt", ios::app);
-        if (outFile.is_open()) {
-            outFile << username << " " << password << " user\n";
-            outFile.close();
-            cout << "Registration successful! You are now logged in as " << username << ".\n";
-        } else {
-            cout << "Error saving user data to file.\n";
+        if (!users.add(newUser)) {
+            cout << "Username already exists. Try a different one.\n";
             return;
         }
+        cout << "Registration successful! You are now logged in as " << username << ".\n";
     
         // ✅ Automatically log the new user in
-        loggedInUser = &users.back();
+        loggedInUser = User(username, "", "user");
+        session = manager.openSession(loggedInUser);
     }
     
 };
@@ -748,9 +893,26 @@ public:
 // ==============================
 // Main Function
 // ==============================
-int main()
+int main(int argc, char **argv)
 {
-    UserInteraction ui;
+    // WiseVault --follow <socket> [port]  a read-only standby of the leader shipping on socket
+    bool follow = argc >= 3 && argc <= 4 && string(argv[1]) == "--follow";
+    UserInteraction ui(follow);
+    if (follow)
+        return ui.runFollower(argv[2], argc > 3 ? (uint16_t)atoi(argv[3]) : 7071);
+    // WiseVault --batch <file|->  posts a settlement file instead of starting the menus
+    if (argc == 3 && string(argv[1]) == "--batch")
+        return ui.runBatch(argv[2]);
+    // WiseVault --serve [port] [workers] [--replicate <socket>]  serves the network protocol instead
+    string replicationSocket;
+    if (argc >= 4 && string(argv[1]) == "--serve" && string(argv[argc - 2]) == "--replicate")
+    {
+        replicationSocket = argv[argc - 1];
+        argc -= 2;
+    }
+    if (argc >= 2 && argc <= 4 && string(argv[1]) == "--serve")
+        return ui.runServer(argc > 2 ? (uint16_t)atoi(argv[2]) : 7070, argc > 3 ? (unsigned)atoi(argv[3]) : 0,
+                            replicationSocket);
     ui.start();
     return 0;
 }
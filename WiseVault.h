@@ -0,0 +1,4267 @@
+// WiseVault core: money, accounts, loans, transactions, the Manager that
+// indexes them, and the persistence, batch and network layers around it.
+// This header declares them; the members are defined in WiseVaultCore.cpp,
+// WiseVaultStorage.cpp, WiseVaultManager.cpp and WiseVaultService.cpp, which
+// build the wisevault_core library that the menus (WiseVault.cpp), the
+// benchmarks and the tests link against.
+#pragma once
+
+#include <iostream>      // For cin, cout, endl
+#include <string>        // For string class
+#include <vector>        // For std::vector
+#include <fstream>       // For file operations (if used)
+#include <sstream>       // For stringstream (optional, for parsing)
+#include <ctime>         // For timestamps (if used in transactions)
+#include <iomanip>       // For formatting output (like currency, dates)
+#include <cmath>         // For mathematical calculations (like pow function)
+#include <unordered_map> // For account/loan lookup indexes
+#include <memory>        // For std::unique_ptr (arena pages)
+#include <new>           // For placement new
+#include <cstdint>       // For fixed-width integer types
+#include <cstring>       // For memcpy/strncpy on journal records
+#include <functional>    // For journal replay callbacks
+#include <thread>        // For the journal writer thread
+#include <mutex>         // For journal/group-commit and per-account locking
+#include <shared_mutex>  // For the Manager index lock
+#include <atomic>        // For lock-free counters
+#include <condition_variable> // For group-commit wakeups
+#include <chrono>        // For group-commit latency budget
+#include <fcntl.h>       // For open()
+#include <unistd.h>      // For write(), fdatasync(), close()
+#include <sys/mman.h>    // For mmap() of snapshots
+#include <sys/stat.h>    // For fstat()
+#include <sys/wait.h>    // For reaping the snapshot child process
+#include <cstddef>       // For offsetof
+#include <algorithm>     // For std::max
+#include <stdexcept>     // For overflow_error on money arithmetic
+#include <cctype>        // For isdigit when parsing amounts
+#include <type_traits>
+#include <utility>       // For as_const on read-only views
+#include <limits>
+#include <cerrno>
+#include <strings.h>
+#include <deque>         // For the batch ingestion stage queues
+#include <sys/socket.h>  // For the network service
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <random>        // For password salts
+#include <dirent.h>      // For the history tier's segment directory
+#include <sys/uio.h>     // For pwritev of history chunks
+#include <climits>       // For IOV_MAX
+#include <sys/un.h>      // For the replication socket
+#include <poll.h>
+
+// ========================
+// Money Class
+// ========================
+// Exact amount of INR held as a 64-bit count of paise. Arithmetic is checked:
+// the operators throw overflow_error, and checkedAdd/checkedSub report
+// overflow to callers that would rather fail the operation.
+class Money {
+    int64_t value; // paise
+
+    explicit constexpr Money(int64_t paise) : value(paise) {}
+
+public:
+    constexpr Money() : value(0) {}
+
+    static constexpr Money fromPaise(int64_t paise) { return Money(paise); }
+
+    // Rounds to the nearest paisa
+    static Money fromRupees(double rupees) {
+        double paise = std::round(rupees * 100.0);
+        if (!(paise > -9.2e18 && paise < 9.2e18))
+            throw std::overflow_error("amount out of range");
+        return Money((int64_t)paise);
+    }
+
+    // Parses "1234", "1234.5" or "-1234.56" exactly; false on anything else
+    static bool parse(const std::string &text, Money &out) { return parse(text.data(), text.size(), out); }
+
+    static bool parse(const char *text, size_t size, Money &out) {
+        size_t i = 0;
+        bool negative = false;
+        if (i < size && (text[i] == '-' || text[i] == '+'))
+            negative = text[i++] == '-';
+        int64_t rupees = 0, paise = 0;
+        int digits = 0, fractionDigits = 0;
+        for (; i < size && isdigit((unsigned char)text[i]); ++i, ++digits)
+            if (__builtin_mul_overflow(rupees, 10, &rupees) || __builtin_add_overflow(rupees, text[i] - '0', &rupees))
+                return false;
+        if (i < size && text[i] == '.') {
+            for (++i; i < size && isdigit((unsigned char)text[i]); ++i, ++fractionDigits) {
+                if (fractionDigits >= 2)
+                    return false; // finer than a paisa
+                paise = paise * 10 + (text[i] - '0');
+            }
+        }
+        if (i != size || digits + fractionDigits == 0)
+            return false;
+        if (fractionDigits == 1)
+            paise *= 10;
+        int64_t total;
+        if (__builtin_mul_overflow(rupees, 100, &total) || __builtin_add_overflow(total, paise, &total))
+            return false;
+        out = Money(negative ? -total : total);
+        return true;
+    }
+
+    // Sums n paise values exactly. Each value is split into high and low 32-bit
+    // halves that are summed separately, so the loops vectorize and can't
+    // overflow for fewer than 2^31 values. False if the total doesn't fit.
+    static bool sum(const int64_t *paise, size_t n, Money &out) {
+        const size_t BLOCK = size_t(1) << 30;
+        __int128 total = 0;
+        for (size_t start = 0; start < n; start += BLOCK) {
+            size_t end = std::min(n, start + BLOCK);
+            uint64_t low = 0;
+            int64_t high = 0;
+            for (size_t i = start; i < end; ++i) {
+                low += (uint64_t)paise[i] & 0xFFFFFFFFu;
+                high += paise[i] >> 32;
+            }
+            total += ((__int128)high << 32) + low;
+        }
+        if (total > INT64_MAX || total < INT64_MIN)
+            return false;
+        out = Money((int64_t)total);
+        return true;
+    }
+
+    int64_t paise() const { return value; }
+    double rupees() const { return value / 100.0; }
+    bool isPositive() const { return value > 0; }
+    bool isZero() const { return value == 0; }
+
+    bool checkedAdd(Money other, Money &result) const {
+        return !__builtin_add_overflow(value, other.value, &result.value);
+    }
+    bool checkedSub(Money other, Money &result) const {
+        return !__builtin_sub_overflow(value, other.value, &result.value);
+    }
+
+    Money operator+(Money other) const {
+        Money result;
+        if (!checkedAdd(other, result))
+            throw std::overflow_error("money overflow");
+        return result;
+    }
+    Money operator-(Money other) const {
+        Money result;
+        if (!checkedSub(other, result))
+            throw std::overflow_error("money overflow");
+        return result;
+    }
+    Money operator*(int64_t factor) const {
+        Money result;
+        if (__builtin_mul_overflow(value, factor, &result.value))
+            throw std::overflow_error("money overflow");
+        return result;
+    }
+    Money &operator+=(Money other) { return *this = *this + other; }
+    Money &operator-=(Money other) { return *this = *this - other; }
+
+    bool operator==(Money other) const { return value == other.value; }
+    bool operator!=(Money other) const { return value != other.value; }
+    bool operator<(Money other) const { return value < other.value; }
+    bool operator<=(Money other) const { return value <= other.value; }
+    bool operator>(Money other) const { return value > other.value; }
+    bool operator>=(Money other) const { return value >= other.value; }
+
+    // "1234.56", exact
+    std::string toString() const {
+        uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+        std::string text =
+            std::to_string(magnitude / 100) + "." + char('0' + magnitude % 100 / 10) + char('0' + magnitude % 10);
+        return value < 0 ? "-" + text : text;
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, Money amount) {
+    return out << amount.toString();
+}
+
+// ========================
+// TransactionRecord Class
+// ========================
+enum TxType : uint8_t {
+    TX_DEPOSIT = 1,
+    TX_WITHDRAW,
+    TX_LOAN_PAYMENT,
+    TX_TRANSFER_OUT,
+    TX_TRANSFER_IN,
+    TX_INTEREST,
+};
+
+inline const char *txTypeName(TxType type) {
+    switch (type) {
+    case TX_DEPOSIT: return "Deposit";
+    case TX_WITHDRAW: return "Withdraw";
+    case TX_LOAN_PAYMENT: return "Loan Payment";
+    case TX_TRANSFER_OUT: return "Transfer Out";
+    case TX_TRANSFER_IN: return "Transfer In";
+    case TX_INTEREST: return "Interest";
+    }
+    return "Unknown";
+}
+
+// A fixed 32-byte POD, so histories can live in bulk chunks and be copied
+// (and snapshotted) with memcpy
+class TransactionRecord {
+    int64_t amount;    // paise
+    int64_t timestamp;
+    uint64_t linkID;   // shared by both halves of a transfer; 0 otherwise
+    int32_t accountNumber;
+    TxType type;
+    uint8_t padding[3];
+
+    friend class TransactionLog; // keeps each log's timestamps non-decreasing
+
+public:
+    TransactionRecord() = default;
+
+    TransactionRecord(int accNo, TxType type, Money amt)
+        : TransactionRecord(accNo, type, amt, time(nullptr)) {}
+
+    // Used when rebuilding history from the journal, and for linked transfer pairs
+    TransactionRecord(int accNo, TxType type, Money amt, time_t when, uint64_t link = 0)
+        : amount(amt.paise()), timestamp(when), linkID(link), accountNumber(accNo), type(type), padding{} {}
+
+    int getAccountNumber() const { return accountNumber; }
+    TxType getType() const { return type; }
+    const char *getTypeName() const { return txTypeName(type); }
+    Money getAmount() const { return Money::fromPaise(amount); }
+    time_t getTimestamp() const { return (time_t)timestamp; }
+    uint64_t getLinkID() const { return linkID; }
+
+    void show() const {
+        time_t when = timestamp;
+        std::cout << "\nAccount: " << accountNumber
+             << ", Type: " << getTypeName()
+             << ", Amount: INR " << getAmount();
+        if (linkID)
+            std::cout << ", Ref: TRF" << linkID;
+        std::cout << ", Date: " << ctime(&when);
+    }
+};
+
+static_assert(sizeof(TransactionRecord) == 32, "TransactionRecord must stay 32 bytes");
+static_assert(std::is_trivially_copyable<TransactionRecord>::value, "TransactionRecord must stay a POD");
+
+// ========================
+// Metrics
+// ========================
+// Latency histograms and event counters for the hot paths. Every thread
+// records into a block of its own with plain relaxed stores, so a probe takes
+// no lock and shares no cache line; a reader sums the blocks whenever it is
+// asked. Histograms are log-linear like HdrHistogram: 16 sub-buckets per
+// power of two, so a recorded value lands within 1/16 of itself. Probes count
+// in raw timestamp-counter ticks, converted to time only when read.
+// Reading the clock costs more than the cheap operations themselves, so every
+// call is counted but only one in samplePeriod(op) is timed per thread.
+// Building with -DWISEVAULT_NO_METRICS compiles every probe out.
+enum MetricOp : uint8_t {
+    METRIC_DEPOSIT,
+    METRIC_WITHDRAW,
+    METRIC_FIND_ACCOUNT,
+    METRIC_FIND_LOAN,
+    METRIC_LOAN_PAYMENT,
+    METRIC_JOURNAL_FLUSH, // one batch written and fdatasync'd
+    METRIC_JOURNAL_WAIT,  // a caller blocked until its record was durable
+    METRIC_OP_COUNT
+};
+
+enum MetricCounter : uint8_t {
+    COUNTER_DEPOSIT_REJECTED,
+    COUNTER_WITHDRAW_REJECTED,
+    COUNTER_RULE_BLOCKED,
+    COUNTER_RULE_FLAGGED,
+    COUNTER_JOURNAL_RECORDS,
+    COUNTER_JOURNAL_BYTES,
+    COUNTER_JOURNAL_FAILURES,
+    COUNTER_HISTORY_PAGED_OUT,
+    COUNTER_LEDGER_RECORDS,
+    COUNTER_LEDGER_STALLS,
+    COUNTER_REPLICATION_SHIPPED,
+    COUNTER_REPLICATION_APPLIED,
+    COUNTER_TRANSFERS_STRANDED,
+    COUNTER_SUSPENSE_PAISE,
+    COUNTER_COUNT
+};
+
+const char *const METRIC_OP_NAMES[METRIC_OP_COUNT] = {
+    "deposit", "withdraw", "find_account", "find_loan", "loan_payment", "journal_flush", "journal_wait"};
+
+const char *const METRIC_COUNTER_NAMES[COUNTER_COUNT][2] = {
+    {"deposits_rejected", "Deposits refused: not positive, or the balance would overflow."},
+    {"withdrawals_rejected", "Withdrawals refused: not positive, or insufficient funds."},
+    {"postings_blocked", "Postings refused by a risk rule."},
+    {"postings_flagged", "Risk rule flags raised on postings that went through."},
+    {"journal_records", "Records written to the journal."},
+    {"journal_bytes", "Bytes written to the journal."},
+    {"journal_write_failures", "Journal batches that failed to reach disk."},
+    {"history_chunks_paged_out", "4 KiB history chunks moved to segment files."},
+    {"ledger_records", "Transactions handed to the global ledger's consumers."},
+    {"ledger_publish_stalls", "Postings that waited for room in a full ledger ring."},
+    {"replication_records_shipped", "Journal records sent to followers."},
+    {"replication_records_applied", "Journal records received from the leader and applied."},
+    {"transfers_stranded", "Failed cross-shard transfers whose source account couldn't take the refund."},
+    {"suspense_paise", "Paise those transfers left in the shards' suspense balances."}};
+
+// Where the server and the manager menu write the Prometheus text file
+const char METRICS_FILE[] = "wisevault_metrics.prom";
+
+inline uint64_t metricTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+class Metrics {
+public:
+    static const int SUB_BITS = 4;
+    static const int MAX_BITS = 40; // longer than 2^40 ticks (minutes) is clamped
+    static const size_t BUCKETS = (MAX_BITS - SUB_BITS + 2) << SUB_BITS;
+
+    static size_t bucketOf(uint64_t ticks) {
+        if (ticks < (1u << SUB_BITS))
+            return (size_t)ticks;
+        int top = 63 - __builtin_clzll(ticks);
+        if (top >= MAX_BITS)
+            return BUCKETS - 1;
+        int shift = top - SUB_BITS;
+        return ((size_t)(shift + 1) << SUB_BITS) + ((ticks >> shift) & ((1u << SUB_BITS) - 1));
+    }
+
+    // Midpoint of the ticks a bucket covers
+    static double bucketValue(size_t bucket) {
+        if (bucket < (1u << SUB_BITS))
+            return (double)bucket;
+        int shift = (int)(bucket >> SUB_BITS) - 1;
+        uint64_t low = ((uint64_t)(1u << SUB_BITS) + (bucket & ((1u << SUB_BITS) - 1))) << shift;
+        return low + ((uint64_t)1 << shift) / 2.0;
+    }
+
+    // Everything recorded so far, summed over threads
+    struct Snapshot {
+        std::vector<uint64_t> buckets; // METRIC_OP_COUNT x BUCKETS, timed calls only
+        uint64_t count[METRIC_OP_COUNT] = {};
+        uint64_t timed[METRIC_OP_COUNT] = {};
+        uint64_t totalTicks[METRIC_OP_COUNT] = {}; // of the timed calls
+        uint64_t maxTicks[METRIC_OP_COUNT] = {};
+        uint64_t counters[COUNTER_COUNT] = {};
+        double nsPerTick = 1;
+
+        // The q-quantile (0..1) of op's latencies in nanoseconds; 0 if none
+        double quantileNs(MetricOp op, double q) const {
+            if (timed[op] == 0)
+                return 0;
+            uint64_t rank = std::max<uint64_t>((uint64_t)ceil(q * timed[op]), 1), seen = 0;
+            const uint64_t *row = &buckets[op * BUCKETS];
+            for (size_t b = 0; b < BUCKETS; ++b)
+                if ((seen += row[b]) >= rank)
+                    return std::min(bucketValue(b), (double)maxTicks[op]) * nsPerTick;
+            return maxTicks[op] * nsPerTick;
+        }
+
+        double meanNs(MetricOp op) const { return timed[op] ? totalTicks[op] * nsPerTick / timed[op] : 0; }
+
+        // Estimated time spent in op over every call, timed or not
+        double totalNs(MetricOp op) const { return meanNs(op) * count[op]; }
+    };
+
+    // Times one call in every `period` of op on each thread (1 times them all)
+    static void setSamplePeriod(MetricOp op, uint32_t period) {
+        samplePeriods[op].store(std::max<uint32_t>(period, 1), std::memory_order_relaxed);
+    }
+
+    static uint32_t samplePeriod(MetricOp op) { return samplePeriods[op].load(std::memory_order_relaxed); }
+
+    static void count(MetricCounter counter, uint64_t n) { bump(block().counters[counter], n); }
+
+    static Snapshot snapshot() {
+        Snapshot s;
+        s.buckets.assign(METRIC_OP_COUNT * BUCKETS, 0);
+        for (Block *b = blocks.load(std::memory_order_acquire); b; b = b->next) {
+            for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+                uint64_t *row = &s.buckets[op * BUCKETS];
+                for (size_t i = 0; i < BUCKETS; ++i) {
+                    uint64_t n = b->buckets[op][i].load(std::memory_order_relaxed);
+                    row[i] += n;
+                    s.timed[op] += n;
+                }
+                s.count[op] += b->calls[op].load(std::memory_order_relaxed);
+                s.totalTicks[op] += b->totalTicks[op].load(std::memory_order_relaxed);
+                s.maxTicks[op] = std::max(s.maxTicks[op], b->maxTicks[op].load(std::memory_order_relaxed));
+            }
+            for (int c = 0; c < COUNTER_COUNT; ++c)
+                s.counters[c] += b->counters[c].load(std::memory_order_relaxed);
+        }
+        s.nsPerTick = nsPerTick();
+        return s;
+    }
+
+    // The stats dump: one line per operation, times in microseconds
+    static void writeText(std::ostream &out) {
+#ifdef WISEVAULT_NO_METRICS
+        out << "Metrics were compiled out of this build.\n";
+#else
+        Snapshot s = snapshot();
+        std::ios::fmtflags flags = out.flags();
+        out << std::left << std::setw(16) << "Operation" << std::right << std::setw(12) << "Count" << std::setw(10)
+            << "Mean us" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+            << std::setw(10) << "p99.9 us" << std::setw(12) << "Max us" << "\n";
+        out << std::fixed << std::setprecision(2);
+        for (int i = 0; i < METRIC_OP_COUNT; ++i) {
+            MetricOp op = (MetricOp)i;
+            out << std::left << std::setw(16) << METRIC_OP_NAMES[op] << std::right << std::setw(12) << s.count[op]
+                << std::setw(10) << s.meanNs(op) / 1e3 << std::setw(10) << s.quantileNs(op, 0.5) / 1e3
+                << std::setw(10) << s.quantileNs(op, 0.9) / 1e3 << std::setw(10) << s.quantileNs(op, 0.99) / 1e3
+                << std::setw(10) << s.quantileNs(op, 0.999) / 1e3 << std::setw(12)
+                << s.maxTicks[op] * s.nsPerTick / 1e3 << "\n";
+        }
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            out << std::left << std::setw(24) << METRIC_COUNTER_NAMES[c][0] << std::right << std::setw(12)
+                << s.counters[c] << "\n";
+        out.flags(flags);
+#endif
+    }
+
+    // Writes the Prometheus text exposition format to path (through a
+    // temporary file, so a scraper never reads half of it); more, if given,
+    // appends series of its own
+    static bool writePrometheus(const std::string &path, const std::function<void(std::ostream &)> &more = nullptr) {
+        Snapshot s = snapshot();
+        std::ostringstream out;
+        out << std::setprecision(9);
+        out << "# HELP wisevault_operation_seconds Latency of instrumented operations.\n"
+               "# TYPE wisevault_operation_seconds summary\n";
+        static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        for (int i = 0; i < METRIC_OP_COUNT; ++i) {
+            MetricOp op = (MetricOp)i;
+            for (double q : quantiles)
+                out << "wisevault_operation_seconds{op=\"" << METRIC_OP_NAMES[op] << "\",quantile=\"" << q << "\"} "
+                    << s.quantileNs(op, q) / 1e9 << "\n";
+            out << "wisevault_operation_seconds_sum{op=\"" << METRIC_OP_NAMES[op] << "\"} " << s.totalNs(op) / 1e9
+                << "\n";
+            out << "wisevault_operation_seconds_count{op=\"" << METRIC_OP_NAMES[op] << "\"} " << s.count[op] << "\n";
+        }
+        out << "# HELP wisevault_operation_max_seconds Slowest timed call since start.\n"
+               "# TYPE wisevault_operation_max_seconds gauge\n";
+        for (int op = 0; op < METRIC_OP_COUNT; ++op)
+            out << "wisevault_operation_max_seconds{op=\"" << METRIC_OP_NAMES[op] << "\"} "
+                << s.maxTicks[op] * s.nsPerTick / 1e9 << "\n";
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            out << "# HELP wisevault_" << METRIC_COUNTER_NAMES[c][0] << "_total " << METRIC_COUNTER_NAMES[c][1] << "\n"
+                << "# TYPE wisevault_" << METRIC_COUNTER_NAMES[c][0] << "_total counter\n"
+                << "wisevault_" << METRIC_COUNTER_NAMES[c][0] << "_total " << s.counters[c] << "\n";
+        if (more)
+            more(out);
+
+        std::string text = out.str(), temp = path + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = ::write(fd, text.data(), text.size()) == (ssize_t)text.size();
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+            unlink(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // One thread's histograms and counters. A block outlives its thread and is
+    // handed to the next thread that starts, so the totals keep counting and
+    // short-lived workers don't grow the list.
+    struct Block {
+        uint32_t countdown[METRIC_OP_COUNT] = {}; // calls left until the next timed one
+        std::atomic<uint64_t> calls[METRIC_OP_COUNT];
+        std::atomic<uint64_t> buckets[METRIC_OP_COUNT][BUCKETS];
+        std::atomic<uint64_t> totalTicks[METRIC_OP_COUNT];
+        std::atomic<uint64_t> maxTicks[METRIC_OP_COUNT];
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        std::atomic<bool> inUse{true};
+        Block *next = nullptr;
+
+        Block() {
+            for (auto &row : buckets)
+                for (auto &n : row)
+                    n.store(0, std::memory_order_relaxed);
+            for (int op = 0; op < METRIC_OP_COUNT; ++op) {
+                calls[op].store(0, std::memory_order_relaxed);
+                totalTicks[op].store(0, std::memory_order_relaxed);
+                maxTicks[op].store(0, std::memory_order_relaxed);
+            }
+            for (auto &n : counters)
+                n.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // Gives the thread's block back when the thread exits
+    struct Release {
+        ~Release() {
+            if (local)
+                local->inUse.store(false, std::memory_order_release);
+            local = nullptr;
+        }
+    };
+
+    static inline std::atomic<Block *> blocks{nullptr};
+    // The journal calls are slow and rare enough to time every one
+    static inline std::atomic<uint32_t> samplePeriods[METRIC_OP_COUNT] = {16, 16, 16, 16, 16, 1, 1};
+    static inline thread_local Block *local = nullptr;
+    // Captured at startup; ticks are scaled against the steady clock from here
+    static inline const uint64_t epochTicks = metricTicks();
+    static inline const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // Only this thread writes the block, so a load and a store is enough
+    static void bump(std::atomic<uint64_t> &n, uint64_t by) {
+        n.store(n.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static Block &block() {
+        Block *b = local;
+        return b ? *b : claim();
+    }
+
+    static Block &claim() {
+        static thread_local Release release;
+        (void)release;
+        Block *b = blocks.load(std::memory_order_acquire);
+        for (; b; b = b->next) {
+            bool idle = false;
+            if (!b->inUse.load(std::memory_order_relaxed) &&
+                b->inUse.compare_exchange_strong(idle, true, std::memory_order_acquire))
+                break;
+        }
+        if (!b) {
+            b = new Block();
+            b->next = blocks.load(std::memory_order_relaxed);
+            while (!blocks.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+        return *(local = b);
+    }
+
+    // Waits until enough time has passed since startup to measure the tick rate
+    static double nsPerTick() {
+        auto elapsed = std::chrono::steady_clock::now() - epoch;
+        if (elapsed < std::chrono::milliseconds(20)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20) - elapsed);
+            elapsed = std::chrono::steady_clock::now() - epoch;
+        }
+        uint64_t ticks = metricTicks() - epochTicks;
+        return ticks ? std::chrono::duration<double, std::nano>(elapsed).count() / ticks : 1;
+    }
+
+public:
+    // Counts the rest of the enclosing scope as one call of op, timing it if
+    // it is this thread's turn
+    class Timer {
+        Block &b;
+        MetricOp op;
+        bool timed = false;
+        uint64_t start = 0;
+
+    public:
+        explicit Timer(MetricOp o) : b(block()), op(o) {
+            if (b.countdown[op]-- == 0) {
+                b.countdown[op] = samplePeriod(op) - 1;
+                timed = true;
+                start = metricTicks();
+            }
+        }
+
+        ~Timer() {
+            bump(b.calls[op], 1);
+            if (!timed)
+                return;
+            uint64_t ticks = metricTicks() - start;
+            bump(b.buckets[op][bucketOf(ticks)], 1);
+            bump(b.totalTicks[op], ticks);
+            if (ticks > b.maxTicks[op].load(std::memory_order_relaxed))
+                b.maxTicks[op].store(ticks, std::memory_order_relaxed);
+        }
+    };
+};
+
+#ifndef WISEVAULT_NO_METRICS
+#define METRIC_JOIN_(a, b) a##b
+#define METRIC_JOIN(a, b) METRIC_JOIN_(a, b)
+#define METRIC_TIME(op) Metrics::Timer METRIC_JOIN(metricTimer, __LINE__)(op)
+#define METRIC_COUNT(counter, n) Metrics::count(counter, n)
+#else
+#define METRIC_TIME(op) ((void)0)
+#define METRIC_COUNT(counter, n) ((void)0)
+#endif
+
+// ========================
+// History Arena
+// ========================
+// Shared pool of fixed-size record chunks carved from 1 MiB slabs. Chunks come
+// in two sizes: a small one for an account's first records (most accounts
+// stay small) and a page-sized one for everything after. Released chunks are
+// recycled, so closing accounts doesn't fragment the heap. Large chunks are
+// page-aligned so that chunks paged out to the history tier can hand their
+// memory back to the OS.
+class HistoryArena {
+public:
+    static constexpr size_t SMALL_CHUNK = 8;   // records
+    static constexpr size_t LARGE_CHUNK = 128; // records, 4 KiB
+    static constexpr size_t LARGE_BYTES = LARGE_CHUNK * sizeof(TransactionRecord);
+
+    static HistoryArena &instance() {
+        static HistoryArena arena;
+        return arena;
+    }
+
+    TransactionRecord *allocate(size_t records) {
+        std::lock_guard<std::mutex> hold(lock);
+        bool small = records == SMALL_CHUNK;
+        live += records * sizeof(TransactionRecord);
+        std::vector<TransactionRecord *> &freeList = small ? smallFree : largeFree;
+        if (!freeList.empty()) {
+            TransactionRecord *chunk = freeList.back();
+            freeList.pop_back();
+            return chunk;
+        }
+        // Each size has its own slab so large chunks stay page-aligned
+        Cursor &cursor = small ? smallSlab : largeSlab;
+        if (cursor.left < records) {
+            void *slab = aligned_alloc(LARGE_BYTES, SLAB_RECORDS * sizeof(TransactionRecord));
+            if (!slab)
+                throw std::bad_alloc();
+            slabs.emplace_back(static_cast<TransactionRecord *>(slab));
+            cursor = {slabs.back().get(), SLAB_RECORDS};
+        }
+        TransactionRecord *chunk = cursor.next;
+        cursor.next += records;
+        cursor.left -= records;
+        return chunk;
+    }
+
+    void release(TransactionRecord *chunk, size_t records) {
+        std::lock_guard<std::mutex> hold(lock);
+        live -= records * sizeof(TransactionRecord);
+        (records == SMALL_CHUNK ? smallFree : largeFree).push_back(chunk);
+    }
+
+    // Releases large chunks whose records now live elsewhere and returns their
+    // pages to the OS; they read back as zeroes when reused
+    void discard(const std::vector<TransactionRecord *> &chunks) {
+        for (TransactionRecord *chunk : chunks)
+            madvise(chunk, LARGE_BYTES, MADV_DONTNEED);
+        std::lock_guard<std::mutex> hold(lock);
+        live -= chunks.size() * LARGE_BYTES;
+        largeFree.insert(largeFree.end(), chunks.begin(), chunks.end());
+    }
+
+    // Bytes held in slabs, live or free
+    size_t reservedBytes() {
+        std::lock_guard<std::mutex> hold(lock);
+        return slabs.size() * SLAB_RECORDS * sizeof(TransactionRecord);
+    }
+
+    // Bytes in chunks that belong to a log
+    size_t liveBytes() {
+        std::lock_guard<std::mutex> hold(lock);
+        return live;
+    }
+
+private:
+    static constexpr size_t SLAB_RECORDS = (1 << 20) / sizeof(TransactionRecord);
+
+    struct Cursor {
+        TransactionRecord *next = nullptr;
+        size_t left = 0;
+    };
+
+    struct SlabFree {
+        void operator()(TransactionRecord *slab) const { free(slab); }
+    };
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<TransactionRecord, SlabFree>> slabs;
+    Cursor smallSlab, largeSlab;
+    size_t live = 0;
+    std::vector<TransactionRecord *> smallFree;
+    std::vector<TransactionRecord *> largeFree;
+
+    HistoryArena() {}
+};
+
+// ========================
+// History Tier
+// ========================
+// Cold storage for account histories. The full chunks of accounts that
+// haven't been used lately are appended to segment files and read back
+// through read-only mmaps, so memory follows the histories in use rather than
+// all of them. A chunk never moves once written, which lets a snapshot refer
+// to it by segment and index instead of copying it. Manager::pageOutHistory
+// decides what moves; this class only stores it.
+class HistoryTier {
+public:
+    struct Options {
+        std::string directory = "wisevault_history";
+        // History kept in memory; least recently used accounts are paged out past it
+        size_t memoryBudget = size_t(256) << 20;
+        // Newest chunks every account keeps in memory (the one being appended to counts)
+        size_t hotChunks = 1;
+        size_t segmentBytes = size_t(64) << 20;
+        // Caps the work of one pass, which holds the Manager index lock shared
+        size_t maxPageOutBytes = size_t(16) << 20;
+        // How often (in passes) idle accounts' cold pages are dropped when under budget
+        uint32_t trimEveryPasses = 30;
+    };
+
+    struct Location {
+        uint32_t segment;
+        uint32_t index; // chunk number within the segment
+    };
+
+    static HistoryTier &instance();
+
+    HistoryTier(const HistoryTier &) = delete;
+    HistoryTier &operator=(const HistoryTier &) = delete;
+
+    // Creates the directory if needed. Existing segments are kept for
+    // snapshots to map; new chunks go to fresh ones.
+    bool open(const Options &opts);
+
+    bool isOpen() const { return opened; }
+    const Options &config() const { return options; }
+
+    // Pass counter that stands in for time in the LRU order
+    uint32_t now() const { return passes.load(std::memory_order_relaxed); }
+    uint32_t advance() { return passes.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+    // Appends n full chunks and makes them durable; mapped[i] is then where
+    // chunk i can be read. False on an I/O error.
+    bool write(const TransactionRecord *const *chunks, size_t n, TransactionRecord **mapped);
+
+    // The segment and index a mapped chunk was written to; false if p isn't in one.
+    // Segments only change during a page-out pass, so a forked snapshot can call this.
+    bool locate(const TransactionRecord *p, Location &out) const;
+
+    // Maps a chunk written by an earlier run (for a snapshot); nullptr if it isn't there
+    TransactionRecord *map(Location at);
+
+    // Deletes the segment files nothing has mapped. Call once after loading,
+    // before anything is paged out.
+    void removeUnused();
+
+    // Lets the kernel drop the pages of cold chunks; they are read back from
+    // the segment on next use
+    static void dropPages(const TransactionRecord *chunk, size_t count);
+
+    ~HistoryTier();
+
+private:
+    static constexpr size_t CHUNK_BYTES = HistoryArena::LARGE_BYTES;
+
+    struct Segment {
+        uint32_t id;
+        int fd;
+        TransactionRecord *base;
+        size_t mappedBytes;
+        size_t chunks;  // written so far
+        bool sealed;    // from an earlier run; never appended to
+    };
+
+    Options options;
+    bool opened = false;
+    uint32_t nextSegment = 1;
+    std::atomic<uint32_t> passes{1};
+    std::mutex lock;
+    std::deque<Segment> segments; // a deque so mapped segments don't move
+
+    HistoryTier() {}
+
+    std::string segmentPath(uint32_t id) const;
+
+    template <typename Fn>
+    void forEachSegmentFile(Fn fn) {
+        DIR *dir = opendir(options.directory.c_str());
+        if (!dir)
+            return;
+        while (dirent *entry = readdir(dir)) {
+            unsigned id;
+            char tail;
+            if (sscanf(entry->d_name, "segment-%u.wv%c", &id, &tail) == 2 && tail == 'h')
+                fn((uint32_t)id, options.directory + "/" + entry->d_name);
+        }
+        closedir(dir);
+    }
+
+    Segment *find(uint32_t id);
+
+    // The segment new chunks go to, starting another once it is full
+    Segment *writable();
+};
+
+// ========================
+// TransactionLog Class
+// ========================
+// Filter and page position for TransactionLog::query
+struct HistoryQuery {
+    time_t from = 0;                             // inclusive
+    time_t to = std::numeric_limits<time_t>::max();   // exclusive
+    uint32_t typeMask = 0;                       // bits (1u << TxType); 0 matches every type
+    size_t limit = 20;                           // 0 returns every match
+    bool newestFirst = true;
+    uint64_t cursor = 0;                         // nextCursor of the previous page; 0 starts afresh
+
+    bool matches(const TransactionRecord &record) const {
+        return typeMask == 0 || (typeMask >> record.getType() & 1);
+    }
+};
+
+struct HistoryPage {
+    std::vector<TransactionRecord> records;
+    uint64_t nextCursor = 0;                     // 0 once there is nothing more to read
+};
+
+// An account's history as a directory of arena chunks. Appends never move
+// existing records, and scans walk whole chunks sequentially. Records are kept
+// in timestamp order (a record stamped before its predecessor, e.g. after a
+// clock step, is filed at the predecessor's time), so the chunk directory
+// doubles as a time index. The oldest full chunks may be cold: paged out to
+// the history tier and read through its mappings, which is invisible to
+// readers.
+class TransactionLog {
+    TransactionRecord *head = nullptr;  // first SMALL_CHUNK records
+    std::vector<TransactionRecord *> chunks; // LARGE_CHUNK records each
+    size_t count = 0;
+    size_t cold = 0;                    // leading chunks that live in the history tier
+    mutable std::atomic<uint32_t> lastUsed{HistoryTier::instance().now()}; // tier pass of the last read or append
+    uint32_t trimmedAt = 0;             // lastUsed when the cold pages were last dropped
+
+    static constexpr size_t SMALL = HistoryArena::SMALL_CHUNK;
+    static constexpr size_t LARGE = HistoryArena::LARGE_CHUNK;
+
+    void releaseAll() {
+        HistoryArena &arena = HistoryArena::instance();
+        if (head)
+            arena.release(head, SMALL);
+        for (size_t c = cold; c < chunks.size(); ++c)
+            arena.release(chunks[c], LARGE);
+        head = nullptr;
+        chunks.clear();
+        count = 0;
+        cold = 0;
+    }
+
+    void touch() const {
+        uint32_t now = HistoryTier::instance().now();
+        if (lastUsed.load(std::memory_order_relaxed) != now)
+            lastUsed.store(now, std::memory_order_relaxed);
+    }
+
+public:
+    TransactionLog() {}
+    TransactionLog(const TransactionLog &other) { append(other); }
+    TransactionLog(TransactionLog &&other) noexcept
+        : head(other.head), chunks(std::move(other.chunks)), count(other.count), cold(other.cold),
+          lastUsed(other.lastUsed.load(std::memory_order_relaxed)), trimmedAt(other.trimmedAt) {
+        other.head = nullptr;
+        other.chunks.clear();
+        other.count = 0;
+        other.cold = 0;
+    }
+    TransactionLog &operator=(TransactionLog other) {
+        std::swap(head, other.head);
+        std::swap(chunks, other.chunks);
+        std::swap(count, other.count);
+        std::swap(cold, other.cold);
+        lastUsed.store(other.lastUsed.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        trimmedAt = other.trimmedAt;
+        return *this;
+    }
+    ~TransactionLog() { releaseAll(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const TransactionRecord &operator[](size_t i) const {
+        if (i < SMALL)
+            return head[i];
+        i -= SMALL;
+        return chunks[i / LARGE][i % LARGE];
+    }
+
+    void push_back(const TransactionRecord &record) {
+        touch();
+        TransactionRecord *slot;
+        if (count < SMALL) {
+            if (!head)
+                head = HistoryArena::instance().allocate(SMALL);
+            slot = head + count;
+        } else {
+            size_t offset = (count - SMALL) % LARGE;
+            if (offset == 0)
+                chunks.push_back(HistoryArena::instance().allocate(LARGE));
+            slot = chunks.back() + offset;
+        }
+        *slot = record;
+        if (count > 0)
+            slot->timestamp = std::max(slot->timestamp, (*this)[count - 1].timestamp);
+        ++count;
+    }
+
+    // Bulk append of records already in timestamp order, a chunk-sized memcpy at a time
+    void append(const TransactionRecord *records, size_t n) {
+        while (n > 0) {
+            if (count < SMALL || (count - SMALL) % LARGE == 0) {
+                push_back(*records++);
+                --n;
+                continue;
+            }
+            size_t offset = (count - SMALL) % LARGE;
+            size_t run = std::min(n, LARGE - offset);
+            memcpy(chunks.back() + offset, records, run * sizeof(TransactionRecord));
+            count += run;
+            records += run;
+            n -= run;
+        }
+    }
+
+    void append(const TransactionLog &other) {
+        other.forEachRun([&](const TransactionRecord *records, size_t n) { append(records, n); });
+    }
+
+    // Calls fn(records, n) for each contiguous run, oldest first
+    template <typename Fn>
+    void forEachRun(Fn fn) const {
+        if (count == 0)
+            return;
+        touch();
+        fn(head, std::min(count, SMALL));
+        size_t remaining = count > SMALL ? count - SMALL : 0;
+        for (size_t c = 0; remaining > 0; ++c) {
+            size_t n = std::min(remaining, LARGE);
+            fn(chunks[c], n);
+            remaining -= n;
+        }
+    }
+
+    // Runs covering records [from, size()), oldest first. Doesn't count as a
+    // use for the history tier, so background readers don't keep logs hot.
+    template <typename Fn>
+    void forEachRunFrom(size_t from, Fn fn) const {
+        if (from < SMALL && from < count)
+            fn(head + from, std::min(count, SMALL) - from);
+        size_t c = from > SMALL ? (from - SMALL) / LARGE : 0;
+        for (size_t start = std::max(from, SMALL + c * LARGE); start < count; ++c) {
+            size_t end = std::min(count, SMALL + (c + 1) * LARGE);
+            fn(chunks[c] + (start - SMALL - c * LARGE), end - start);
+            start = end;
+        }
+    }
+
+    // Like forEachRun, but skips the cold chunks
+    template <typename Fn>
+    void forEachHotRun(Fn fn) const {
+        if (count == 0)
+            return;
+        fn(head, std::min(count, SMALL));
+        size_t remaining = count > SMALL ? count - SMALL - cold * LARGE : 0;
+        for (size_t c = cold; remaining > 0; ++c) {
+            size_t n = std::min(remaining, LARGE);
+            fn(chunks[c], n);
+            remaining -= n;
+        }
+    }
+
+    // ----- History tier -----
+    // Callers that change the tiering hold the account's lock.
+
+    uint32_t lastUse() const { return lastUsed.load(std::memory_order_relaxed); }
+    size_t coldChunks() const { return cold; }
+    size_t hotSize() const { return count - cold * LARGE; }
+    const TransactionRecord *chunk(size_t c) const { return chunks[c]; }
+
+    // How many chunks after the cold ones could go cold while keeping the newest keep
+    size_t pageable(size_t keep) const {
+        return chunks.size() > cold + keep ? chunks.size() - cold - keep : 0;
+    }
+
+    // Points the next n hot chunks at their tier copies in mapped, and hands
+    // the arena chunks they replace to retired; the caller discards those once
+    // no reader can still be using them
+    void demote(size_t n, TransactionRecord *const *mapped, std::vector<TransactionRecord *> &retired) {
+        for (size_t i = 0; i < n; ++i, ++cold) {
+            retired.push_back(chunks[cold]);
+            chunks[cold] = mapped[i];
+        }
+    }
+
+    // Adds a full chunk that already lives in the tier, when loading a
+    // snapshot: only after the head and any earlier cold chunks
+    bool appendCold(TransactionRecord *chunk) {
+        if (count < SMALL || cold != chunks.size() || (count - SMALL) % LARGE != 0)
+            return false;
+        chunks.push_back(chunk);
+        ++cold;
+        count += LARGE;
+        return true;
+    }
+
+    // Drops the resident pages of the cold chunks if the log hasn't been used
+    // since before idleSince, once per idle spell
+    void trimCold(uint32_t idleSince) {
+        uint32_t used = lastUse();
+        if (cold == 0 || used >= idleSince || used == trimmedAt)
+            return;
+        trimmedAt = used;
+        // Chunks written in one pass usually sit next to each other in the segment
+        size_t start = 0;
+        for (size_t c = 1; c <= cold; ++c)
+            if (c == cold || chunks[c] != chunks[c - 1] + LARGE) {
+                HistoryTier::dropPages(chunks[start], c - start);
+                start = c;
+            }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        forEachRun([&](const TransactionRecord *records, size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                fn(records[i]);
+        });
+    }
+
+    // Index of the first record stamped at or after when (size() if none):
+    // a binary search over the chunk directory, then within one chunk
+    size_t lowerBound(time_t when) const {
+        auto before = [when](const TransactionRecord &record) { return record.timestamp < when; };
+        size_t headCount = std::min(count, SMALL);
+        if (headCount == 0 || !before(head[headCount - 1]))
+            return std::partition_point(head, head + headCount, before) - head;
+        auto startsBefore = [&](const TransactionRecord *chunk) { return before(chunk[0]); };
+        size_t c = std::partition_point(chunks.begin(), chunks.end(), startsBefore) - chunks.begin();
+        if (c == 0)
+            return headCount;
+        const TransactionRecord *chunk = chunks[c - 1];
+        size_t n = std::min(LARGE, count - SMALL - (c - 1) * LARGE);
+        return SMALL + (c - 1) * LARGE + (std::partition_point(chunk, chunk + n, before) - chunk);
+    }
+
+    // Records in [q.from, q.to) matching q.typeMask, at most q.limit of them,
+    // starting where q.cursor left off. Costs O(log n + records examined).
+    HistoryPage query(const HistoryQuery &q) const {
+        touch();
+        HistoryPage page;
+        size_t lo = lowerBound(q.from);
+        size_t hi = q.to == std::numeric_limits<time_t>::max() ? count : std::max(lo, lowerBound(q.to));
+        auto full = [&] { return q.limit != 0 && page.records.size() >= q.limit; };
+        page.records.reserve(q.limit ? std::min(q.limit, hi - lo) : hi - lo);
+        if (q.newestFirst) {
+            // The cursor is one past the next record to examine
+            size_t end = q.cursor ? std::min<size_t>(q.cursor, hi) : hi;
+            while (end > lo && !full()) {
+                const TransactionRecord &record = (*this)[--end];
+                if (q.matches(record))
+                    page.records.push_back(record);
+            }
+            page.nextCursor = end > lo ? end : 0;
+        } else {
+            // The cursor is the next record to examine, plus one
+            size_t next = q.cursor ? std::max<size_t>(q.cursor - 1, lo) : lo;
+            while (next < hi && !full()) {
+                const TransactionRecord &record = (*this)[next++];
+                if (q.matches(record))
+                    page.records.push_back(record);
+            }
+            page.nextCursor = next < hi ? next + 1 : 0;
+        }
+        return page;
+    }
+};
+
+// ========================
+// Journal Class
+// ========================
+// Append-only write-ahead log of every state-changing operation. Records are
+// fixed-size and CRC32-checked so a torn tail after a crash is detected and
+// dropped on replay. Appends are collected by a writer thread and made
+// durable with one fdatasync per batch (group commit).
+enum JournalOp : uint8_t {
+    JOURNAL_CREATE_ACCOUNT = 1,
+    JOURNAL_CLOSE_ACCOUNT,
+    JOURNAL_MODIFY_ACCOUNT,
+    JOURNAL_DEPOSIT,
+    JOURNAL_WITHDRAW,
+    JOURNAL_APPLY_LOAN,
+    JOURNAL_LOAN_PAYMENT,
+    JOURNAL_TRANSFER,
+    JOURNAL_REPRICE_LOANS,  // every open loan moves to rec.rate
+    JOURNAL_MONTH_END       // interest for period rec.counterparty; savings at rec.rate
+};
+
+const size_t JOURNAL_NAME_LEN = 24;
+const size_t JOURNAL_TYPE_LEN = 16;
+const size_t JOURNAL_USER_LEN = 32;
+const size_t JOURNAL_MAX_GROUP = 65536;
+// Records written before amounts became fixed-point carry format 0 and a double amount
+const uint8_t JOURNAL_FORMAT_PAISE = 1;
+
+struct JournalRecord {
+    uint32_t checksum;      // CRC32 of every byte after this field
+    uint8_t op;
+    uint8_t format;          // JOURNAL_FORMAT_* the amount field is written in
+    uint16_t groupRemaining; // records still to come in an all-or-nothing group
+    uint64_t sequence;
+    int64_t timestamp;
+    int32_t accountNumber;  // JOURNAL_TRANSFER: account debited
+    int32_t loanID;
+    int64_t amount;         // paise (JOURNAL_FORMAT_PAISE) or a double of rupees (legacy)
+    double rate;
+    int32_t tenure;         // loan tenure in years
+    int32_t counterparty;   // JOURNAL_TRANSFER: account credited; JOURNAL_MONTH_END: period (YYYYMM)
+    char name[JOURNAL_NAME_LEN];
+    char type[JOURNAL_TYPE_LEN];
+    char username[JOURNAL_USER_LEN];
+
+    JournalRecord() { memset(this, 0, sizeof(*this)); }
+
+    JournalRecord(JournalOp o, int accNo, int loan = 0, Money amt = Money()) : JournalRecord() {
+        op = o;
+        format = JOURNAL_FORMAT_PAISE;
+        accountNumber = accNo;
+        loanID = loan;
+        amount = amt.paise();
+        timestamp = time(nullptr);
+    }
+
+    Money getAmount() const {
+        if (format >= JOURNAL_FORMAT_PAISE)
+            return Money::fromPaise(amount);
+        double rupees;
+        memcpy(&rupees, &amount, sizeof(rupees));
+        return Money::fromRupees(rupees);
+    }
+
+    static void setField(char *dst, size_t len, const std::string &value) {
+        strncpy(dst, value.c_str(), len - 1);
+        dst[len - 1] = '\0';
+    }
+
+    static std::string getField(const char *src, size_t len) {
+        return std::string(src, strnlen(src, len));
+    }
+};
+static_assert(sizeof(JournalRecord) == 128, "journal records must stay fixed-size");
+
+// Slicing-by-8 tables: entries[k][b] is the CRC of byte b followed by k zero bytes
+struct Crc32Table {
+    uint32_t entries[8][256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[0][i] = c;
+        }
+        for (int k = 1; k < 8; ++k)
+            for (uint32_t i = 0; i < 256; ++i)
+                entries[k][i] = entries[0][entries[k - 1][i] & 0xFF] ^ (entries[k - 1][i] >> 8);
+    }
+};
+
+// previous continues a checksum: crc32(b, lb, crc32(a, la)) is the CRC of a
+// then b. Eight bytes a step (little-endian), so bulk data such as snapshot
+// bodies checks at memory speed rather than a byte at a time.
+inline uint32_t crc32(const void *data, size_t len, uint32_t previous = 0) {
+    static const Crc32Table table;
+    const auto &t = table.entries;
+    uint32_t crc = previous ^ 0xFFFFFFFFu;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+              t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+    }
+    for (; len > 0; ++p, --len)
+        crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+inline uint32_t journalChecksum(const JournalRecord &rec) {
+    return crc32(reinterpret_cast<const uint8_t *>(&rec) + sizeof(rec.checksum),
+                 sizeof(rec) - sizeof(rec.checksum));
+}
+
+class Journal {
+public:
+    struct Options {
+        std::string path = "wisevault.journal";
+        // How long the writer may hold a batch open before it must fsync
+        std::chrono::microseconds commitWindow = std::chrono::microseconds(2000);
+        // Flush early once this many records are waiting
+        size_t maxBatch = 4096;
+        // When true append() returns only after its record is on disk
+        bool waitForDurability = true;
+    };
+
+private:
+    Options options;
+    int fd = -1;
+    uint64_t nextSequence = 1;
+    uint64_t durableSequence = 0;
+    std::vector<JournalRecord> pending;
+    std::chrono::steady_clock::time_point batchOpened;
+    bool stopping = false;
+    std::atomic<bool> failed{false}; // a batch didn't reach disk; nothing more is written
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::condition_variable batchDurable;
+    std::thread writer;
+
+    void writerLoop();
+
+    bool writeAll(const void *data, size_t len);
+
+public:
+    Journal() {}
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+    ~Journal() { close(); }
+
+    // Where to start reading for the records after afterSequence. Sequences are
+    // dense from 1, so record N normally sits at (N - 1) * 128; if that guess is
+    // wrong (a follower's journal starts past a snapshot) the answer is 0, and the
+    // reader skips what it has already seen.
+    static size_t tailOffset(int in, uint64_t afterSequence);
+
+    // Reads every intact record after afterSequence in order; stops at the first
+    // torn or corrupt one. Returns the file offset just past the last valid record.
+    static size_t replay(const std::string &path, const std::function<void(const JournalRecord &)> &apply,
+                         uint64_t afterSequence = 0);
+
+    // Opens (or creates) the journal for appending. Records after afterSequence
+    // are passed to recover first so the caller can rebuild its state from them.
+    bool open(const Options &opts, const std::function<void(const JournalRecord &)> &recover = nullptr,
+              uint64_t afterSequence = 0);
+
+    bool isOpen() const { return fd >= 0; }
+    const std::string &path() const { return options.path; }
+
+    // True once a batch failed to reach disk; from then on no record becomes durable
+    bool hasFailed() const { return failed.load(std::memory_order_relaxed); }
+
+    // Waits up to timeout for a record past sequence to become durable and
+    // returns the durable sequence, e.g. for shipping the log to a follower
+    uint64_t waitBeyond(uint64_t sequence, std::chrono::milliseconds timeout);
+
+    // Empties the journal and continues numbering after sequence; a follower
+    // calls it after installing a snapshot that covers up to sequence
+    bool restartAfter(uint64_t sequence);
+
+    // Sequence number of the most recently appended record
+    uint64_t lastSequence();
+
+    // Queues a record for the next batch and returns its sequence number without
+    // waiting for it to reach disk. Records are written in sequence order. Once
+    // a write has failed the record is dropped; its sequence never turns durable,
+    // so waitDurable reports the failure.
+    uint64_t enqueue(const JournalRecord &rec);
+
+    // Queues up to JOURNAL_MAX_GROUP records that must be replayed all together or
+    // not at all (they are dropped on replay if a crash cuts the group short).
+    // Returns the first sequence.
+    uint64_t enqueueGroup(JournalRecord *recs, size_t count);
+
+    // Blocks until the record with this sequence is durable, if the journal is
+    // configured to wait for durability. False if it never will be: a write failed.
+    bool waitDurable(uint64_t sequence);
+
+    uint64_t append(const JournalRecord &rec);
+
+    // Blocks until every record appended so far is on disk; false if a write failed
+    bool sync();
+
+    void close();
+};
+
+// fn(begin, end) over [0, n) on up to `threads` threads, each taking at least
+// minPerThread items; chunk boundaries are multiples of align
+template <typename Fn>
+void parallelFor(size_t n, unsigned threads, size_t minPerThread, size_t align, Fn fn) {
+    size_t workers = std::min<size_t>(threads, std::max<size_t>(1, n / minPerThread));
+    if (workers <= 1) {
+        fn(0, n);
+        return;
+    }
+    size_t per = (n + workers - 1) / workers;
+    per = (per + align - 1) / align * align;
+    std::vector<std::thread> pool;
+    for (size_t begin = per; begin < n; begin += per)
+        pool.emplace_back([&fn, begin, n, per] { fn(begin, std::min(n, begin + per)); });
+    fn(0, std::min(n, per));
+    for (auto &worker : pool)
+        worker.join();
+}
+
+// ========================
+// Password Hashing
+// ========================
+// SHA-256 and PBKDF2-HMAC-SHA256 for the credential store. Each PBKDF2
+// iteration costs two compressions: the HMAC key pads are absorbed once and
+// their states reused.
+class Sha256 {
+public:
+    static const size_t DIGEST_LEN = 32;
+    static const size_t BLOCK_LEN = 64;
+
+private:
+    uint32_t state[8];
+    uint8_t block[BLOCK_LEN];
+    size_t used = 0;
+    uint64_t length = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+public:
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, initial, sizeof(state));
+        used = 0;
+        length = 0;
+    }
+
+    static void compress(uint32_t h[8], const uint8_t *p) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = uint32_t(p[4 * i]) << 24 | uint32_t(p[4 * i + 1]) << 16 | uint32_t(p[4 * i + 2]) << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+
+    void update(const void *data, size_t n) {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        length += n;
+        while (n > 0) {
+            size_t take = std::min(n, BLOCK_LEN - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            n -= take;
+            if (used == BLOCK_LEN) {
+                compress(state, block);
+                used = 0;
+            }
+        }
+    }
+
+    void finish(uint8_t out[DIGEST_LEN]) {
+        uint64_t bits = length * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != BLOCK_LEN - 8)
+            update(&pad, 1);
+        for (int i = 7; i >= 0; --i)
+            block[BLOCK_LEN - 8 + (7 - i)] = uint8_t(bits >> (8 * i));
+        compress(state, block);
+        storeState(state, out);
+        reset();
+    }
+
+    // The state after the blocks absorbed so far (used == 0)
+    const uint32_t *midstate() const { return state; }
+
+    static void storeState(const uint32_t h[8], uint8_t out[DIGEST_LEN]) {
+        for (int i = 0; i < 8; ++i) {
+            out[4 * i] = uint8_t(h[i] >> 24);
+            out[4 * i + 1] = uint8_t(h[i] >> 16);
+            out[4 * i + 2] = uint8_t(h[i] >> 8);
+            out[4 * i + 3] = uint8_t(h[i]);
+        }
+    }
+};
+
+// PBKDF2-HMAC-SHA256 with a single 32-byte output block
+inline void pbkdf2Sha256(const std::string &password, const uint8_t *salt, size_t saltLen, uint32_t iterations,
+                         uint8_t out[Sha256::DIGEST_LEN]) {
+    uint8_t key[Sha256::BLOCK_LEN] = {};
+    if (password.size() > Sha256::BLOCK_LEN) {
+        Sha256 keyHash;
+        keyHash.update(password.data(), password.size());
+        keyHash.finish(key);
+    } else {
+        memcpy(key, password.data(), password.size());
+    }
+
+    uint8_t pad[Sha256::BLOCK_LEN];
+    Sha256 inner, outer;
+    for (size_t i = 0; i < Sha256::BLOCK_LEN; ++i)
+        pad[i] = key[i] ^ 0x36;
+    inner.update(pad, sizeof(pad));
+    for (size_t i = 0; i < Sha256::BLOCK_LEN; ++i)
+        pad[i] = key[i] ^ 0x5c;
+    outer.update(pad, sizeof(pad));
+    uint32_t innerState[8], outerState[8];
+    memcpy(innerState, inner.midstate(), sizeof(innerState));
+    memcpy(outerState, outer.midstate(), sizeof(outerState));
+
+    // U1 = HMAC(password, salt || INT(1)) through the general path
+    const uint8_t blockIndex[4] = {0, 0, 0, 1};
+    uint8_t u[Sha256::DIGEST_LEN];
+    inner.update(salt, saltLen);
+    inner.update(blockIndex, sizeof(blockIndex));
+    inner.finish(u);
+    outer.update(u, sizeof(u));
+    outer.finish(u);
+    memcpy(out, u, sizeof(u));
+
+    // Later rounds hash a 32-byte message after a 64-byte pad: one final
+    // block each, with its padding and length (96 bytes) fixed in place
+    uint8_t message[Sha256::BLOCK_LEN] = {};
+    message[Sha256::DIGEST_LEN] = 0x80;
+    message[Sha256::BLOCK_LEN - 2] = (96 * 8) >> 8;
+    message[Sha256::BLOCK_LEN - 1] = (96 * 8) & 0xFF;
+    for (uint32_t round = 1; round < iterations; ++round) {
+        uint32_t h[8];
+        memcpy(message, u, sizeof(u));
+        memcpy(h, innerState, sizeof(h));
+        Sha256::compress(h, message);
+        Sha256::storeState(h, message);
+        memcpy(h, outerState, sizeof(h));
+        Sha256::compress(h, message);
+        Sha256::storeState(h, u);
+        for (size_t i = 0; i < sizeof(u); ++i)
+            out[i] ^= u[i];
+    }
+}
+
+// ========================
+// User Class
+// ========================
+class User {
+public:
+    std::string username;
+    std::string password; // set only on the way into UserStore, which keeps hashes
+    std::string role; // "manager" or "user"
+
+    User() {}
+    User(std::string uname, std::string pwd, std::string r) : username(uname), password(pwd), role(r) {}
+
+    bool isManager() const { return role == "manager"; }
+};
+
+// ========================
+// UserStore Class
+// ========================
+// The login registry, shared by the menus and every network session. Users
+// are indexed by name and kept as salted PBKDF2 hashes in users.db: a
+// header, then fixed-size records that load with one read. An older
+// plaintext users.txt is imported the first time.
+struct UserFileHeader {
+    char magic[8];       // "WVUSERS1"
+    uint32_t recordSize; // sizeof(UserFileRecord)
+    uint32_t reserved;
+};
+
+struct UserFileRecord {
+    uint32_t checksum; // crc32 of everything after it
+    char username[JOURNAL_USER_LEN];
+    uint8_t manager;
+    uint8_t reserved[3];
+    uint32_t iterations;
+    uint8_t salt[16];
+    uint8_t hash[Sha256::DIGEST_LEN];
+    uint8_t padding[4];
+};
+static_assert(sizeof(UserFileRecord) == 96, "user records must stay fixed-size");
+
+const char USER_FILE_MAGIC[8] = {'W', 'V', 'U', 'S', 'E', 'R', 'S', '1'};
+
+class UserStore {
+public:
+    struct Options {
+        std::string path = "users.db";
+        std::string legacyPath = "users.txt"; // imported if users.db doesn't exist yet; "" to skip
+        // PBKDF2 rounds for new passwords. Login costs scale linearly with it.
+        uint32_t iterations = 10000;
+        // A new file gets the default logins; a follower's copy starts empty instead
+        bool seedDefaults = true;
+    };
+
+    // Records claiming more rounds than this are refused rather than hashed
+    static constexpr uint32_t MAX_ITERATIONS = 1u << 22;
+
+private:
+    struct Credential {
+        bool manager;
+        uint32_t iterations;
+        uint8_t salt[16];
+        uint8_t hash[Sha256::DIGEST_LEN];
+    };
+
+    Options options;
+    int fd = -1;
+    size_t fileRecords = 0; // records in the file, in the order they were added
+    std::unordered_map<std::string, Credential> users;
+    mutable std::shared_mutex lock;
+
+    static uint32_t checksum(const UserFileRecord &rec);
+
+    Credential hashNew(const User &user, std::random_device &random) const;
+
+    static UserFileRecord toRecord(const std::string &username, const Credential &cred);
+
+    // Caller holds the write lock
+    bool appendLocked(const std::vector<UserFileRecord> &recs);
+
+    static bool sameHash(const uint8_t *a, const uint8_t *b);
+
+    // Imports "username password role" lines from the old plaintext file
+    void importLegacy();
+
+public:
+    UserStore() {}
+    explicit UserStore(const Options &opts);
+    UserStore(const UserStore &) = delete;
+    UserStore &operator=(const UserStore &) = delete;
+    ~UserStore();
+
+    // Reads users.db in one pass, creating it (from users.txt, or with the
+    // default logins) the first time. A torn record at the end is cut off.
+    void load();
+
+    // Checks a login; out gets the user's name and role (never the password)
+    bool authenticate(const std::string &username, const std::string &password, User &out) const;
+
+    bool exists(const std::string &username) const;
+
+    // Names are stored in fixed-width fields
+    static bool fits(const std::string &username) { return !username.empty() && username.size() < JOURNAL_USER_LEN; }
+
+    size_t size() const;
+
+    // Registers and saves a new user. False if the username is taken (or doesn't fit).
+    bool add(const User &user);
+
+    // Bulk registration (imports, provisioning): hashes on every core and
+    // saves with one write. Returns how many were new.
+    size_t addMany(const std::vector<User> &batch);
+
+    // Replication: a follower's file is a copy of the leader's, record for record
+    size_t recordCount() const;
+
+    // Up to max records from position from on; empty if there are none
+    std::vector<UserFileRecord> readRecords(size_t from, size_t max) const;
+
+    // Appends records read from the leader's file; a later record for the same name replaces the earlier
+    bool addRecords(const std::vector<UserFileRecord> &recs);
+};
+
+// ========================
+// SessionTable Class
+// ========================
+// Logged-in sessions, addressed by opaque tokens. Each session caches the
+// user's role and the account/loan IDs they own, so a permission check is a
+// lock-free read of one slot instead of comparing owner names. Slots are
+// read under a seqlock: writers (login, logout, ownership changes, expiry)
+// serialize on a mutex and bump the slot's version around each change;
+// readers retry if the version moved. Idle sessions expire through a
+// one-second timer wheel.
+enum SessionResource : uint8_t { SESSION_ACCOUNT, SESSION_LOAN };
+
+struct SessionToken {
+    uint32_t slot = 0;
+    uint32_t generation = 0; // 0: no session
+    uint64_t secret = 0;
+
+    bool valid() const { return generation != 0; }
+};
+static_assert(sizeof(SessionToken) == 16, "tokens travel as 16 raw bytes");
+
+class SessionTable {
+public:
+    struct Options {
+        uint32_t idleSeconds = 15 * 60;
+        size_t capacity = 1 << 20; // slots are allocated a page at a time as sessions open
+    };
+
+    struct Info {
+        std::string username;
+        bool manager = false;
+    };
+
+    // IDs cached per session; a user owning more falls back to an owner-name check
+    static const size_t CACHED_ACCOUNTS = 25;
+    static const size_t CACHED_LOANS = 16;
+
+private:
+    // A permission check reads the first two cache lines; the name is only
+    // needed for lookups and the overflow fallback
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> version{0}; // odd while a writer is changing the slot
+        mutable std::atomic<uint32_t> lastUsed{0}; // seconds tick; readers refresh it
+        uint64_t secret = 0;
+        uint32_t generation = 0;
+        bool live = false;
+        bool manager = false;
+        bool overflow[2] = {false, false}; // per SessionResource: not every owned ID fits
+        uint8_t count[2] = {0, 0};
+        int32_t accounts[CACHED_ACCOUNTS];
+        int32_t loans[CACHED_LOANS];
+        char username[JOURNAL_USER_LEN] = {};
+
+        int32_t *ids(SessionResource kind) { return kind == SESSION_ACCOUNT ? accounts : loans; }
+        const int32_t *ids(SessionResource kind) const { return kind == SESSION_ACCOUNT ? accounts : loans; }
+        static size_t capacity(SessionResource kind) { return kind == SESSION_ACCOUNT ? CACHED_ACCOUNTS : CACHED_LOANS; }
+    };
+
+    struct WheelEntry {
+        uint32_t slot;
+        uint32_t generation;
+    };
+
+    static const size_t PAGE_SLOTS = 256;
+    static const size_t WHEEL_SLOTS = 256; // one bucket per second
+
+    Options options;
+    time_t epoch;
+    std::unique_ptr<std::atomic<Slot *>[]> pages;
+    std::vector<std::unique_ptr<Slot[]>> owned; // keeps pages alive; only writers touch it
+
+    std::mutex writeLock;
+    std::vector<uint32_t> freeSlots;
+    uint32_t unusedSlot = 0; // slots below this have been handed out at least once
+    std::unordered_map<std::string, std::vector<uint32_t>> slotsByUser;
+    std::vector<WheelEntry> wheel[WHEEL_SLOTS];
+    uint32_t wheelTick = 0;
+    size_t live = 0;
+    std::random_device entropy;
+
+    // Whole seconds since construction, from the cheap coarse clock: checks read it on every call
+    static time_t monotonicSeconds();
+
+    uint32_t now() const { return (uint32_t)(monotonicSeconds() - epoch) + 1; }
+
+    Slot *slotAt(uint32_t index) const;
+
+    static void beginWrite(Slot &slot);
+
+    static void endWrite(Slot &slot) { slot.version.store(slot.version.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Runs fn(slot) on a consistent view of the token's slot. False if the
+    // token doesn't name a live session; fn's results only count on true.
+    template <typename Fn>
+    bool read(const SessionToken &token, Fn fn) const {
+        const Slot *slot = slotAt(token.slot);
+        if (!slot || !token.valid())
+            return false;
+        while (true) {
+            uint32_t before = slot->version.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+            bool ok = slot->live && slot->generation == token.generation && slot->secret == token.secret;
+            if (ok)
+                fn(*slot);
+            atomic_thread_fence(std::memory_order_acquire);
+            if (slot->version.load(std::memory_order_relaxed) != before)
+                continue;
+            if (!ok)
+                return false;
+            // Idle sessions are dead even before the wheel gets to them
+            uint32_t t = now();
+            if (t - slot->lastUsed.load(std::memory_order_relaxed) > options.idleSeconds)
+                return false;
+            if (slot->lastUsed.load(std::memory_order_relaxed) != t)
+                slot->lastUsed.store(t, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    void schedule(uint32_t index, const Slot &slot, uint32_t due);
+
+    // Caller holds writeLock
+    void closeLocked(uint32_t index, Slot &slot);
+
+    // Caller holds writeLock. Visits each second's bucket since the last
+    // call: idle sessions close, the rest move to their new due time.
+    size_t advanceLocked(uint32_t t);
+
+public:
+    SessionTable() : SessionTable(Options()) {}
+    explicit SessionTable(const Options &opts);
+    SessionTable(const SessionTable &) = delete;
+    SessionTable &operator=(const SessionTable &) = delete;
+
+    // Starts a session owning the given IDs. The token is invalid if every
+    // slot is taken.
+    SessionToken open(const std::string &username, bool manager, const std::vector<int> &accounts,
+                      const std::vector<int> &loans);
+
+    void close(const SessionToken &token);
+
+    // The session's user, if it is live. Counts as activity.
+    bool lookup(const SessionToken &token, Info &info) const;
+
+    bool active(const SessionToken &token) const;
+
+    // Whether the session may use the account or loan `id`, whose owner is
+    // `owner`. The name is only compared for users who own more than the
+    // cache holds.
+    bool permits(const SessionToken &token, SessionResource kind, int32_t id, const std::string &owner) const;
+
+    // Ownership changes, applied to every live session of the user
+    void grant(const std::string &username, SessionResource kind, int32_t id);
+
+    void revoke(const std::string &username, SessionResource kind, int32_t id);
+
+    // Ends sessions idle past the timeout; returns how many
+    size_t expire();
+
+    size_t size();
+};
+
+// ========================
+// RecordMutex Class
+// ========================
+// A mutex that can live inside copyable records. Copies get their own fresh,
+// unlocked mutex; the lock protects one object, not its value.
+class RecordMutex {
+    std::mutex m;
+
+public:
+    RecordMutex() {}
+    RecordMutex(const RecordMutex &) {}
+    RecordMutex &operator=(const RecordMutex &) { return *this; }
+
+    void lock() { m.lock(); }
+    void unlock() { m.unlock(); }
+    bool try_lock() { return m.try_lock(); }
+};
+
+// ========================
+// Interest Accrual
+// ========================
+// UTC days since the epoch
+inline int32_t dayNumber(time_t when) {
+    return (int32_t)(when >= 0 ? when / 86400 : (when - 86399) / 86400);
+}
+
+// Days since the epoch of a civil date (proleptic Gregorian)
+inline int32_t daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = (unsigned)(year - era * 400);
+    const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+// First day of the month holding day, as a day number
+inline int32_t monthStart(int32_t day) {
+    const int32_t shifted = day + 719468; // days since 0000-03-01
+    const int era = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+    const unsigned dayOfEra = (unsigned)(shifted - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned monthIndex = (5 * dayOfYear + 2) / 153; // March is 0
+    return day - (int32_t)(dayOfYear - (153 * monthIndex + 2) / 5);
+}
+
+// Day-count (ACT/365) accrual kept incrementally: every balance change first
+// folds the old balance times the days it was held into the running sums, so
+// closing a period needs only these, never the history. The sums are split at
+// the start of the month of the last day accrued: a posting made after a
+// month ended but before it was closed doesn't pay that month for its days.
+struct Accrual {
+    int32_t day = 0;           // the sums cover everything before this day
+    int32_t boundary = 0;      // a month start: balanceDays is before it, laterDays from it
+    __int128 balanceDays = 0;  // paise x days held since the last close, before boundary
+    __int128 laterDays = 0;    // the same, from boundary on
+
+    void start(time_t when) {
+        day = dayNumber(when);
+        boundary = monthStart(day);
+        balanceDays = 0;
+        laterDays = 0;
+    }
+
+    void advance(Money balance, int32_t today) {
+        if (today <= day)
+            return;
+        // No month is shorter than 28 days, so most postings skip the calendar
+        int32_t month = today - 1 < boundary + 28 ? boundary : monthStart(today - 1);
+        if (month > boundary) {
+            // The days before this month become closable
+            int32_t split = std::max(month, day);
+            balanceDays += laterDays + (__int128)balance.paise() * (split - day);
+            laterDays = (__int128)balance.paise() * (today - split);
+            boundary = month;
+        } else {
+            laterDays += (__int128)balance.paise() * (today - day);
+        }
+        day = today;
+    }
+
+    // Interest at annualRate (%) on everything accrued before endDay, to the
+    // nearest paisa. Starts the next period; days already accrued after endDay
+    // are carried into it. A close more than a month late also pays the
+    // months in between, which the next close then doesn't.
+    Money close(Money balance, int32_t endDay, double annualRate) {
+        advance(balance, endDay);
+        __int128 closing = balanceDays;
+        balanceDays = 0;
+        if (endDay >= day) {
+            closing += laterDays;
+            laterDays = 0;
+            boundary = monthStart(endDay);
+        }
+        const __int128 divisor = 365 * 10000; // days x basis points
+        __int128 scaled = closing * llround(annualRate * 100);
+        return Money::fromPaise((int64_t)((scaled + divisor / 2) / divisor));
+    }
+};
+
+// ========================
+// Account Class
+// ========================
+class Account {
+private:
+    int accountNumber;
+    std::string name;
+    Money balance;
+    std::string accountType;
+    std::string ownerUsername;
+    TransactionLog transactionLog;
+    Accrual accrual;
+    uint64_t riskSlot = 0; // RiskRules counters: the rules' tag << 32 | slot, 0 until first checked
+    RecordMutex guard; // held by Transaction while the balance or log changes
+
+public:
+    Account() {}
+
+    Account(int accNo, const std::string &accName, Money bal, const std::string &type, const std::string &owner,
+            time_t opened = time(nullptr));
+
+    void addTransactionRecord(const TransactionRecord &record);
+
+    void showAccount() const;
+
+    // Silent balance updates as of when; callers hold mutex() when other threads may be posting
+    void credit(Money amount, time_t when);
+    void debit(Money amount, time_t when);
+
+    // Interest earned up to endDay at annualRate; the caller credits it
+    Money closeInterest(int32_t endDay, double annualRate) { return accrual.close(balance, endDay, annualRate); }
+
+    bool earnsInterest() const;
+
+    RecordMutex &mutex() { return guard; }
+
+    void showTransactionHistory() const;
+
+    int getAccountNumber() const { return accountNumber; }
+    Money getBalance() const { return balance; }
+    const std::string &getName() const { return name; }
+    const std::string &getAccountType() const { return accountType; }
+    const std::string &getOwnerUsername() const { return ownerUsername; }
+    const TransactionLog &getTransactionLog() const { return transactionLog; }
+    TransactionLog &getTransactionLog() { return transactionLog; } // for the history tier; hold mutex()
+    const Accrual &getAccrual() const { return accrual; }
+    void restoreAccrual(const Accrual &saved) { accrual = saved; }
+    uint64_t getRiskSlot() const { return riskSlot; }
+    void setRiskSlot(uint64_t slot) { riskSlot = slot; } // hold mutex()
+    HistoryPage queryHistory(const HistoryQuery &query) const { return transactionLog.query(query); }
+    void appendTransactions(const TransactionRecord *records, size_t count) { transactionLog.append(records, count); }
+
+    void setDetails(const std::string &newName, const std::string &newType);
+
+};
+
+// =========================
+// RiskRules Class
+// =========================
+// Fraud and velocity limits checked inline on every posting, ahead of the
+// balance check. The rules file (RULES_FILE by default) has one rule per line;
+// '#' starts a comment:
+//   <name> <block|flag> <types> amount <limit>
+//   <name> <block|flag> <types> sum <window> <limit>
+//   <name> <block|flag> <types> count <window> <limit>
+// types is "any" or a comma-separated list of deposit, withdraw, transfer_out
+// and transfer_in; a window is seconds, or a number with an m, h or d suffix.
+// A rule trips when the posting's amount, the window's total with the posting
+// added, or the window's count of postings with it added goes over limit. A
+// tripped block rule refuses the posting; a tripped flag rule lets it through,
+// counts a hit and calls the flag handler.
+//
+// Compiling turns the file into per-type lists of rule and window indexes, so
+// a posting looks only at what its type can trip. Each distinct (types,
+// window) pair is one sliding counter per account: 8 buckets of a seventh of
+// the window each (128 bytes), so a window covers its length and at most a
+// seventh more. An account's counters sit in pages that never move, found
+// through a slot number the account carries, and are filled from its history
+// the first time it is checked, so limits hold across restarts. Everything
+// about one account runs under its lock, which Transaction already holds.
+const char RULES_FILE[] = "wisevault.rules";
+// Where the menus and the server log the postings a flag rule let through
+const char FLAGS_FILE[] = "wisevault_flags.csv";
+
+class RiskRules {
+public:
+    static constexpr size_t MAX_RULES = 64;
+    static constexpr size_t MAX_WINDOWS = 16;
+    static constexpr uint32_t BUCKETS = 8;
+    static constexpr uint32_t PAGE_ACCOUNTS = 4096;
+    static constexpr uint32_t MAX_PAGES = 1 << 14; // later accounts get amount rules only
+
+    enum Measure : uint8_t { RULE_AMOUNT, RULE_SUM, RULE_COUNT };
+
+    // What check() saw, for count() and flag() once the posting went through
+    struct Verdict {
+        time_t now = 0;
+        uint64_t flagged = 0; // a bit per tripped flag rule
+    };
+
+    // Called under the account lock, so it must be quick and must not post
+    typedef std::function<void(const std::string &rule, int accNo, TxType type, Money amount)> FlagHandler;
+
+    RiskRules() : tag((uint64_t)nextTag.fetch_add(1) << 32), pages(new std::atomic<Window *>[MAX_PAGES]()) {}
+    RiskRules(const RiskRules &) = delete;
+    RiskRules &operator=(const RiskRules &) = delete;
+    ~RiskRules();
+
+    // Replaces the rules with the ones in the file, or changes nothing and
+    // writes "rules line N: reason" to errors. Call before any posting is checked.
+    bool compile(std::istream &in, std::ostream &errors);
+    bool load(const std::string &path, std::ostream &errors);
+
+    void onFlag(FlagHandler handler) { flagHandler = std::move(handler); }
+
+    size_t size() const { return names.size(); }
+    const std::string &name(size_t rule) const { return names[rule]; }
+    bool blocks(size_t rule) const { return limits[rule].block; }
+    uint64_t hits(size_t rule) const { return hitCounts[rule].n.load(std::memory_order_relaxed); }
+
+    // False if a block rule trips; the caller holds the account lock
+    bool check(Account &acc, TxType type, Money amount, Verdict &verdict);
+
+    // Adds a posting that check() passed to the account's windows; sign -1
+    // takes it back out (a batch that failed after this leg)
+    void count(Account &acc, TxType type, Money amount, const Verdict &verdict, int sign = 1);
+
+    // Counts the flag rules check() tripped, once the posting went through
+    void flag(const Account &acc, TxType type, Money amount, const Verdict &verdict);
+
+    // The rule that refused the last posting this thread checked, if one did
+    static const std::string *blockedBy() { return lastBlocked; }
+    static void clearBlocked() { lastBlocked = nullptr; }
+
+    // Hits per rule, for the stats dump
+    void writeText(std::ostream &out) const;
+
+    void writePrometheus(std::ostream &out) const;
+
+private:
+    struct Bucket {
+        uint32_t epoch; // now / width when the bucket was last started
+        int32_t count;
+        int64_t sum;    // paise
+    };
+    struct alignas(64) Window {
+        Bucket buckets[BUCKETS];
+    };
+
+    // The compiled form of a rule, kept apart from its name
+    struct Limit {
+        int64_t limit;  // paise, or postings for RULE_COUNT
+        Measure measure;
+        bool block;
+        uint8_t window; // for RULE_SUM and RULE_COUNT
+    };
+
+    // Rules and windows a posting of one type can trip, in file order
+    struct Plan {
+        uint8_t ruleCount = 0;
+        uint8_t windowCount = 0;
+        uint8_t rules[MAX_RULES];
+        uint8_t windows[MAX_WINDOWS];
+    };
+
+    struct alignas(64) Hits {
+        std::atomic<uint64_t> n{0};
+    };
+
+    static inline std::atomic<uint32_t> nextTag{1};
+    static inline thread_local const std::string *lastBlocked = nullptr;
+
+    const uint64_t tag; // in Account::riskSlot, so another RiskRules' slot isn't taken for ours
+    std::vector<std::string> names;
+    std::vector<Limit> limits;
+    std::vector<uint32_t> widths;      // seconds per bucket, per window
+    std::vector<uint32_t> windowTypes; // 1u << TxType bits, per window
+    time_t horizon = 0;           // the longest window with its extra bucket
+    Plan plans[TX_INTEREST + 1];
+    Hits hitCounts[MAX_RULES];
+    FlagHandler flagHandler;
+
+    std::unique_ptr<std::atomic<Window *>[]> pages;
+    std::atomic<uint32_t> nextSlot{0};
+    std::mutex growLock;
+
+    static void total(const Window &w, uint32_t width, time_t now, int64_t &sum, int64_t &count);
+
+    static void add(Window &w, uint32_t width, time_t when, int64_t paise, int sign);
+
+    // The account's counters, assigned and filled from its history on first use;
+    // nullptr once every slot is taken
+    Window *windowsOf(Account &acc, time_t now);
+
+    Window *windowsAt(uint32_t slot);
+};
+
+// =========================
+// Ledger Class
+// =========================
+// Bank-wide stream of posted transactions. Posting threads publish each
+// record into a bounded ring without taking a lock; drainer threads take them
+// out in batches and hand every batch to each consumer in turn, so a slow
+// consumer holds up the others but not posting, unless it falls a whole ring
+// behind. The ring is Vyukov's bounded MPMC queue: each slot carries a turn
+// number saying whether it is free for the producer at a position or full for
+// the consumer at it, and a position is claimed with one compare-and-swap.
+// Records of one account are published under its lock, so a single drainer
+// delivers them in posting order; records of different accounts interleave.
+class Ledger {
+public:
+    typedef std::function<void(const TransactionRecord *records, size_t count)> Consumer;
+
+    struct Options {
+        size_t capacity = 1 << 14; // records, rounded up to a power of two
+        size_t maxBatch = 1024;    // records handed to the consumers at once
+        unsigned drainers = 1;     // more than one calls the consumers concurrently
+    };
+
+    Ledger() {}
+    Ledger(const Ledger &) = delete;
+    Ledger &operator=(const Ledger &) = delete;
+    ~Ledger() { stop(); }
+
+    // Consumers are added before start and run on the drainer threads
+    void addConsumer(Consumer consumer) { consumers.push_back(std::move(consumer)); }
+
+    void start(const Options &opts);
+
+    // Delivers everything already published, then stops the drainers
+    void stop();
+
+    bool isRunning() const { return running; }
+
+    // Adds a record to the stream; waits only while the ring is full
+    void publish(const TransactionRecord &record);
+
+    // Returns once as many records as had been published at the call have
+    // been consumed (with one drainer, exactly those records)
+    void flush();
+
+    // Published but not yet consumed
+    size_t backlog() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> turn;
+        TransactionRecord record;
+    };
+
+    Options options;
+    std::vector<Consumer> consumers;
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0}; // next position to publish
+    alignas(64) std::atomic<size_t> tail{0}; // next position to drain
+    alignas(64) std::atomic<size_t> consumed{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> idle{false};
+    bool running = false;
+    std::mutex sleepLock;
+    std::condition_variable wakeup;
+    std::vector<std::thread> drainers;
+
+    bool tryPush(const TransactionRecord &record);
+
+    bool tryPop(TransactionRecord &out);
+
+    void wake();
+
+    void drainLoop();
+};
+
+// =========================
+// Forward declaration for Manager
+// =========================
+class Manager;
+
+// =========================
+// Transaction Class
+// =========================
+// One leg of a multi-leg transfer
+struct TransferLeg {
+    int fromAccNo;
+    int toAccNo;
+    Money amount;
+};
+
+// Thread-safe posting engine. Each operation locks only the account it
+// touches, so postings to different accounts run in parallel while postings to
+// the same account are serialized. The balance check in withdraw happens
+// under the same lock as the debit. Operations spanning several accounts lock
+// them in ascending account-number order, so they can never deadlock.
+class Transaction {
+    Journal *journal = nullptr;
+    Ledger *ledger = nullptr;
+    RiskRules *rules = nullptr;
+    std::atomic<uint64_t> nextLinkID{1}; // transfer references when there is no journal
+    uint64_t linkStride = 1;
+
+    // Transfers are referenced by their journal sequence, which survives restarts
+    uint64_t linkFor(uint64_t sequence) { return sequence ? sequence : nextLinkID.fetch_add(linkStride); }
+
+    // Postings must be positive; credits must not overflow and debits must be covered
+    static bool canCredit(Money balance, Money amount) {
+        Money updated;
+        return amount.isPositive() && balance.checkedAdd(amount, updated);
+    }
+    static bool canDebit(Money balance, Money amount) {
+        return amount.isPositive() && balance >= amount;
+    }
+
+    static JournalRecord transferRecord(const TransferLeg &leg) {
+        JournalRecord rec(JOURNAL_TRANSFER, leg.fromAccNo, 0, leg.amount);
+        rec.counterparty = leg.toAccNo;
+        return rec;
+    }
+
+    // Adds a record to the account's history and the global ledger; the caller holds the account lock
+    void record(Account &acc, const TransactionRecord &record) {
+        acc.addTransactionRecord(record);
+        if (ledger)
+            ledger->publish(record);
+    }
+
+    // Moves amount between two accounts whose locks the caller holds, logging a linked pair.
+    // when is the journal record's timestamp, so replay accrues interest identically.
+    void postTransfer(Account &from, Account &to, Money amount, uint64_t linkID, time_t when) {
+        from.debit(amount, when);
+        to.credit(amount, when);
+        record(from, TransactionRecord(from.getAccountNumber(), TX_TRANSFER_OUT, amount, when, linkID));
+        record(to, TransactionRecord(to.getAccountNumber(), TX_TRANSFER_IN, amount, when, linkID));
+    }
+
+    // Counts a posting the rules passed in its account's windows and raises its flags
+    void passed(Account &acc, TxType type, Money amount, const RiskRules::Verdict &verdict) {
+        if (rules) {
+            rules->count(acc, type, amount, verdict);
+            rules->flag(acc, type, amount, verdict);
+        }
+    }
+
+    bool transferLocked(Account &from, Account &to, Money amount, uint64_t &sequence);
+    bool transferBatchLocked(const std::vector<TransferLeg> &legs, const std::vector<int> &accNos,
+                             std::vector<Account *> &accs, uint64_t &sequence);
+
+    // Nothing is posted once the journal has failed: it could never be saved
+    bool journalFailed() const {
+        if (!journal || !journal->hasFailed())
+            return false;
+        RiskRules::clearBlocked();
+        return true;
+    }
+
+    // Journals (in posting order) and applies a change while the caller holds the account lock
+    uint64_t post(Account &acc, JournalOp op, TxType type, Money amount) {
+        JournalRecord rec(op, acc.getAccountNumber(), 0, amount);
+        time_t when = (time_t)rec.timestamp;
+        uint64_t sequence = journal ? journal->enqueue(rec) : 0;
+        if (op == JOURNAL_DEPOSIT)
+            acc.credit(amount, when);
+        else
+            acc.debit(amount, when);
+        record(acc, TransactionRecord(acc.getAccountNumber(), type, amount, when));
+        return sequence;
+    }
+
+public:
+    void attachJournal(Journal *j) { journal = j; }
+    void attachLedger(Ledger *l) { ledger = l; }
+
+    // Checks every posting against the rules first; RiskRules::blockedBy()
+    // names the rule when one refused it
+    void attachRules(RiskRules *r) { rules = r; }
+    RiskRules *riskRules() const { return rules; }
+
+    // Unjournaled transfers are referenced first, first + stride, ..., so that
+    // several Transactions (one per shard) never hand out the same reference
+    void setLinkIDs(uint64_t first, uint64_t stride) {
+        nextLinkID = first;
+        linkStride = stride;
+    }
+
+    // A reference for a transfer posted one leg at a time
+    uint64_t newLinkID() { return linkFor(0); }
+
+    // One side of a transfer whose other side is posted elsewhere (another
+    // shard): TX_TRANSFER_OUT debits, TX_TRANSFER_IN credits. Not journaled.
+    bool postTransferLeg(Account &acc, TxType type, Money amount, uint64_t linkID);
+
+    // Waits for durability after the account lock is released, so one slow fsync
+    // doesn't hold up other postings to the same account. False if the record
+    // will never reach disk.
+    bool commit(uint64_t sequence) {
+        return !journal || !sequence || journal->waitDurable(sequence);
+    }
+
+    // As deposit/withdraw, but without waiting for the journal: sequence is set
+    // to the record to commit() (0 if none), so bulk callers wait once per batch
+    bool deposit(Account &acc, Money amount, uint64_t &sequence);
+    bool withdraw(Account &acc, Money amount, uint64_t &sequence);
+
+    // False (and nothing changes) for a non-positive amount, an overflowing
+    // credit, a withdrawal the balance doesn't cover, a blocking rule or a
+    // failed journal. Also false if the posting was made but couldn't be saved.
+    bool deposit(Account &acc, Money amount);
+    bool withdraw(Account &acc, Money amount);
+    bool deposit(Account &acc, Money amount, Manager &manager);
+    bool withdraw(Account &acc, Money amount, Manager &manager);
+
+    // Look the account up and post while it is pinned, so a concurrent
+    // closeAccount can't free it mid-operation. False if it doesn't exist.
+    bool deposit(Manager &manager, int accNo, Money amount);
+    bool withdraw(Manager &manager, int accNo, Money amount);
+
+    // Atomically debits one account and credits another. Fails (changing nothing)
+    // on insufficient funds, a missing account, a non-positive amount or a
+    // failed journal; like deposit, also false if it couldn't be saved.
+    bool transfer(Account &from, Account &to, Money amount);
+    bool transfer(Manager &manager, int fromAccNo, int toAccNo, Money amount);
+    // This form leaves the commit() to the caller, like the deferred deposit/withdraw
+    bool transfer(Manager &manager, int fromAccNo, int toAccNo, Money amount, uint64_t &sequence);
+
+    // Applies every leg in order or none of them; each leg must be covered by the
+    // source balance at the point it runs
+    bool transferBatch(Manager &manager, const std::vector<TransferLeg> &legs);
+
+    Money balance(Account &acc) {
+        std::lock_guard<RecordMutex> hold(acc.mutex());
+        return acc.getBalance();
+    }
+};
+
+// =========================
+// LoanEngine Class
+// =========================
+// Portfolio-wide loan math over a structure-of-arrays copy of the book. The
+// kernels work four loans at a time with GCC/Clang vector extensions and
+// split large books across threads.
+class LoanEngine {
+public:
+    // One entry per loan in parallel arrays; amounts in rupees
+    struct Book {
+        std::vector<int32_t> loanID;
+        std::vector<double> rate;        // annual %
+        std::vector<int32_t> months;     // payments remaining
+        std::vector<double> emi;
+        std::vector<double> balance;     // total still payable
+        std::vector<double> outstanding; // principal still owed, known or from computeOutstanding
+
+        size_t size() const { return loanID.size(); }
+
+        void resize(size_t n) {
+            loanID.resize(n);
+            rate.resize(n);
+            months.resize(n);
+            emi.resize(n);
+            balance.resize(n);
+            outstanding.resize(n);
+        }
+    };
+
+    struct ScheduleRow {
+        int32_t loanID;
+        int32_t month;
+        int64_t payment;   // paise
+        int64_t interest;  // paise
+        int64_t principal; // paise
+        int64_t balance;   // paise, principal left after this payment
+    };
+
+    explicit LoanEngine(unsigned threadCount = std::thread::hardware_concurrency());
+
+    // emi[i] = level payment repaying principal[i] over months[i] at rate[i]
+    void computeEmis(const double *principal, const double *rate, const int32_t *months, double *emi, size_t n) const;
+
+    // outstanding = present value of what is left: months - 1 payments of emi
+    // and a final one making up the rest of balance
+    void computeOutstanding(Book &book) const;
+
+    // Moves every loan to newRate: a new EMI for its outstanding principal over
+    // its remaining months (fill outstanding first)
+    void reprice(Book &book, double newRate) const;
+
+    // Month-by-month amortization of each loan from its outstanding principal. Loan i's rows are [offsets[i], offsets[i + 1]).
+    void schedules(const Book &book, std::vector<size_t> &offsets, std::vector<ScheduleRow> &rows) const;
+
+    // Scalar forms, used for single loans and for the lanes the kernels can't take
+    static double emiFor(double principal, double annualRate, int months);
+
+    static double presentValue(double annualRate, int months, double emi, double balance);
+
+    // (1 + r)^n by square-and-multiply; compoundLanes does the same
+    // multiplications per lane, so scalar and batch results agree to the bit
+    static double compoundFactor(double monthlyRate, int months);
+
+private:
+    typedef double Lanes __attribute__((vector_size(4 * sizeof(double))));
+    typedef int64_t LaneInts __attribute__((vector_size(4 * sizeof(int64_t))));
+    static constexpr size_t LANES = 4;
+    static constexpr size_t MIN_PER_THREAD = 1 << 16;
+
+    unsigned threads;
+
+    // Lanes go in and out by reference: passing 32-byte vectors by value
+    // changes the calling convention between AVX and non-AVX builds
+    static void load(Lanes &v, const double *p) { memcpy(&v, p, sizeof(v)); }
+    static void store(double *p, const Lanes &v) { memcpy(p, &v, sizeof(v)); }
+
+    static void compoundLanes(const Lanes &rateBase, const int32_t *months, Lanes &result);
+
+    static void amortize(const Book &book, size_t i, ScheduleRow *out);
+
+    template <typename Fn>
+    void parallelFor(size_t n, Fn fn) const {
+        ::parallelFor(n, threads, MIN_PER_THREAD, LANES, fn);
+    }
+};
+
+// =========================
+// Loan Class
+// =========================
+class Loan {
+private:
+    int loanID;
+    std::string borrowerName;
+    std::string borrowerUsername;
+    Money principal;
+    double rate;
+    int tenure; // in months
+    Money emi;
+    Money outstanding;  // principal still owed
+    Money interestDue;  // interest charged at month-end closes and not yet paid
+    int monthsLeft;     // installments still scheduled
+    Accrual accrual;    // on outstanding, charged into interestDue at each close
+    RecordMutex guard;  // held by Manager::payLoan while the balance changes
+
+public:
+    Loan() {}
+
+    Loan(int id, const std::string &name, const std::string &username, Money p, int t, double r = 12.0,
+         time_t opened = time(nullptr));
+
+    void showLoanDetails() const;
+
+    // Rebuilds a loan exactly as saved, without recomputing the EMI
+    static Loan restore(int id, const std::string &name, const std::string &username, Money p, double r, int months,
+                        Money emi, Money outstanding, Money interestDue, int monthsLeft, const Accrual &accrual);
+
+    RecordMutex &mutex() { return guard; }
+
+    int getLoanID() const { return loanID; }
+    const std::string &getBorrowerName() const { return borrowerName; }
+    const std::string &getBorrowerUsername() const { return borrowerUsername; }
+    Money getPrincipal() const { return principal; }
+    double getRate() const { return rate; }
+    int getTenureMonths() const { return tenure; }
+    Money getEmi() const { return emi; }
+    Money getOutstanding() const { return outstanding; }
+    Money getInterestDue() const { return interestDue; }
+    int getMonthsLeft() const { return monthsLeft; }
+    const Accrual &getAccrual() const { return accrual; }
+    // What it takes to close the loan as of the last month-end
+    Money getBalance() const { return outstanding + interestDue; }
+
+    // Installments to amortize the outstanding principal over; a loan past
+    // its term is given one
+    int remainingMonths() const;
+
+    // New terms after a rate change at when. Interest accrued so far is
+    // charged at the old rate first. The caller holds mutex() or the book exclusively.
+    void reprice(double newRate, Money newEmi, time_t when);
+
+    // Month-end: charges the period's interest and counts one installment off
+    void closeMonth(int32_t endDay);
+
+    // Pays interest due first, then principal. Returns true once the loan is
+    // paid off; callers hold mutex() when other threads may be paying.
+    bool makePayment(Money amount, time_t when);
+};
+
+// ============================
+// Snapshot File Format
+// ============================
+// A snapshot is a point-in-time image of Manager laid out as flat sections so
+// it can be mmap'd and bulk-loaded:
+//   header | accounts[] | loans[] | transactions[] | cold chunks[] | string pool
+// Strings are (offset, length) references into the pool. Transactions are raw
+// TransactionRecord images; each account points at a contiguous run of them. journalSequence is the last journal
+// record the image includes; only later records are replayed on startup.
+// History already paged out to the history tier isn't copied: an account's
+// cold chunks are (segment, index) references that sit between its head
+// chunk and the rest of its transactions. The header and the sections after
+// it carry separate CRC32s; a snapshot whose sections don't tile the file
+// exactly is rejected before anything is read from them.
+const char SNAPSHOT_MAGIC[8] = {'W', 'V', 'S', 'N', 'A', 'P', '0', '9'};
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t journalSequence;
+    int32_t nextAccNo;
+    int32_t nextLoanID;
+    uint64_t accountCount;
+    uint64_t loanCount;
+    uint64_t transactionCount;
+    uint64_t coldChunkCount;
+    uint64_t stringBytes;
+    uint64_t accountsOffset;
+    uint64_t loansOffset;
+    uint64_t transactionsOffset;
+    uint64_t coldChunksOffset;
+    uint64_t stringsOffset;
+    double loanRate;            // annual % for new loans
+    double savingRate;          // annual % paid on saving accounts
+    int32_t lastClosedPeriod;   // YYYYMM of the latest month-end close
+    uint32_t bodyChecksum;      // CRC32 of everything after the header
+    uint32_t headerChecksum;    // CRC32 of the header up to this field
+};
+
+// An Accrual, with each 128-bit balance-days sum split in two
+struct SnapshotAccrual {
+    int32_t day;
+    int32_t boundary;
+    uint64_t balanceDaysLo;
+    int64_t balanceDaysHi;
+    uint64_t laterDaysLo;
+    int64_t laterDaysHi;
+
+    static SnapshotAccrual from(const Accrual &accrual) {
+        SnapshotAccrual rec;
+        rec.day = accrual.day;
+        rec.boundary = accrual.boundary;
+        rec.balanceDaysLo = (uint64_t)accrual.balanceDays;
+        rec.balanceDaysHi = (int64_t)(accrual.balanceDays >> 64);
+        rec.laterDaysLo = (uint64_t)accrual.laterDays;
+        rec.laterDaysHi = (int64_t)(accrual.laterDays >> 64);
+        return rec;
+    }
+
+    Accrual toAccrual() const {
+        Accrual accrual;
+        accrual.day = day;
+        accrual.boundary = boundary;
+        accrual.balanceDays = ((__int128)balanceDaysHi << 64) | balanceDaysLo;
+        accrual.laterDays = ((__int128)laterDaysHi << 64) | laterDaysLo;
+        return accrual;
+    }
+};
+
+struct SnapshotAccount {
+    int32_t accountNumber;
+    uint32_t padding;
+    int64_t balance;            // paise
+    SnapshotString name;
+    SnapshotString type;
+    SnapshotString owner;
+    uint64_t transactionOffset; // index of the first transaction in the transactions section
+    uint64_t transactionCount;  // in memory when saved; the cold chunks hold the rest
+    uint64_t coldChunkOffset;   // index of the first reference in the cold chunks section
+    uint64_t coldChunkCount;
+    SnapshotAccrual accrual;
+};
+
+// A history chunk in a history tier segment
+struct SnapshotColdChunk {
+    uint32_t segment;
+    uint32_t index;
+};
+
+struct SnapshotLoan {
+    int32_t loanID;
+    int32_t tenureMonths;
+    int64_t principal;          // paise
+    double rate;
+    int64_t emi;                // paise
+    int64_t outstanding;        // paise
+    int64_t interestDue;        // paise
+    int32_t monthsLeft;
+    uint32_t padding;
+    SnapshotString name;
+    SnapshotString username;
+    SnapshotAccrual accrual;
+};
+
+// Buffered sequential writer used by the snapshot child process
+class SnapshotSink {
+    int fd;
+    std::vector<char> buffer;
+    bool ok = true;
+    uint32_t sum = 0; // CRC32 of everything put since resetChecksum()
+
+public:
+    explicit SnapshotSink(int out) : fd(out) { buffer.reserve(1 << 20); }
+
+    void resetChecksum() { sum = 0; }
+    uint32_t checksum() const { return sum; }
+
+    void put(const void *data, size_t len) {
+        const char *p = static_cast<const char *>(data);
+        sum = crc32(p, len, sum);
+        if (buffer.size() + len > buffer.capacity())
+            flush();
+        if (len > buffer.capacity()) {
+            writeOut(p, len);
+            return;
+        }
+        buffer.insert(buffer.end(), p, p + len);
+    }
+
+    void writeOut(const char *p, size_t len) {
+        while (ok && len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n < 0) {
+                ok = false;
+                break;
+            }
+            p += n;
+            len -= n;
+        }
+    }
+
+    bool flush() {
+        writeOut(buffer.data(), buffer.size());
+        buffer.clear();
+        return ok;
+    }
+};
+
+// ============================
+// SlotArena Class
+// ============================
+// Paged pool of T with generation-checked handles. Pages are never moved, so a
+// T* handed out stays valid until that slot is erased; erased slots are
+// tombstoned and reused from a free list, making insert and erase O(1).
+template <typename T>
+class SlotArena
+{
+public:
+    struct Handle
+    {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+
+        bool valid() const { return index != UINT32_MAX; }
+    };
+
+private:
+    static const uint32_t PAGE_SHIFT = 10;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+
+    struct Slot
+    {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t generation = 0;
+        bool live = false;
+
+        T *object() { return reinterpret_cast<T *>(storage); }
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> pages;
+    std::vector<uint32_t> freeList;
+    uint32_t slotCount = 0;
+    size_t liveCount = 0;
+
+    Slot &slot(uint32_t index) { return pages[index >> PAGE_SHIFT][index & (PAGE_SIZE - 1)]; }
+
+public:
+    SlotArena() {}
+    SlotArena(const SlotArena &) = delete;
+    SlotArena &operator=(const SlotArena &) = delete;
+
+    ~SlotArena()
+    {
+        for (uint32_t i = 0; i < slotCount; ++i)
+            if (slot(i).live)
+                slot(i).object()->~T();
+    }
+
+    Handle insert(T value)
+    {
+        uint32_t index;
+        if (!freeList.empty())
+        {
+            index = freeList.back();
+            freeList.pop_back();
+        }
+        else
+        {
+            if ((slotCount & (PAGE_SIZE - 1)) == 0)
+                pages.emplace_back(new Slot[PAGE_SIZE]);
+            index = slotCount++;
+        }
+
+        Slot &s = slot(index);
+        new (s.storage) T(std::move(value));
+        s.live = true;
+        ++liveCount;
+        return Handle{index, s.generation};
+    }
+
+    T *get(Handle h)
+    {
+        if (h.index >= slotCount)
+            return nullptr;
+        Slot &s = slot(h.index);
+        return (s.live && s.generation == h.generation) ? s.object() : nullptr;
+    }
+
+    bool erase(Handle h)
+    {
+        if (!get(h))
+            return false;
+        Slot &s = slot(h.index);
+        s.object()->~T();
+        s.live = false;
+        ++s.generation; // invalidates every outstanding handle to this slot
+        freeList.push_back(h.index);
+        --liveCount;
+        return true;
+    }
+
+    // Visits live objects in slot order, one page at a time
+    template <typename Fn>
+    void forEach(Fn fn)
+    {
+        forEachIn(0, slotCount, fn);
+    }
+
+    // Same, over slots [begin, end) only; disjoint ranges may be walked from
+    // different threads
+    template <typename Fn>
+    void forEachIn(uint32_t begin, uint32_t end, Fn fn)
+    {
+        for (uint32_t i = begin; i < std::min(end, slotCount); ++i)
+        {
+            Slot &s = slot(i);
+            if (s.live)
+                fn(*s.object());
+        }
+    }
+
+    // One past the highest slot ever used
+    uint32_t slotLimit() const { return slotCount; }
+    size_t size() const { return liveCount; }
+    bool empty() const { return liveCount == 0; }
+};
+
+// ============================
+// ReportWriter Class
+// ============================
+// Bulk report output for large books. Records are formatted straight into a
+// 1 MiB buffer (integer and fixed-point formatting by hand, dates from a
+// per-hour cache instead of ctime) and written out with one write() per
+// buffer. TEXT matches the interactive show*() layout, CSV has one header row
+// per section, and BINARY is a tagged native-endian stream:
+//   "WVREPORT" then per record 'A' | 'L' | 'T' and its fields; strings are a
+//   uint16 length and bytes, transactions the raw 32-byte TransactionRecord.
+enum ReportFormat {
+    REPORT_TEXT,
+    REPORT_CSV,
+    REPORT_BINARY,
+};
+
+class ReportWriter {
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    int fd;
+    ReportFormat format;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+    bool ok = true;
+
+    // Date cache: the hour containing the last timestamp, pre-formatted
+    time_t cachedHour = std::numeric_limits<time_t>::min();
+    char ctimeHour[32];  // "Www Mmm dd hh:"
+    char ctimeYear[16];  // " yyyy\n"
+    char isoHour[32];    // "yyyy-mm-dd hh:"
+
+    char *reserve(size_t n);
+
+    void put(const char *text, size_t n);
+    void put(const std::string &text) { put(text.data(), text.size()); }
+    template <size_t N>
+    void put(const char (&literal)[N]) { put(literal, N - 1); }
+    void put(char c) { *reserve(1) = c; ++used; }
+
+    template <typename T>
+    void putRaw(const T &value) { put(reinterpret_cast<const char *>(&value), sizeof(value)); }
+
+    static const char *digitPairs();
+
+    void putUnsigned(uint64_t value);
+
+    void putInt(int64_t value);
+
+    // hundredths as "units.hh", e.g. paise as rupees or a rate as a percentage
+    void putFixed2(int64_t hundredths);
+
+    void putMoney(Money amount) { putFixed2(amount.paise()); }
+
+    void putTwoDigits(int value);
+
+    // Re-formats the cached hour only when a timestamp falls outside it
+    void cacheHour(time_t when);
+
+    void putMinutesSeconds(time_t when);
+
+    // Same text as ctime(): "Www Mmm dd hh:mm:ss yyyy\n"
+    void putCtime(time_t when);
+
+    // "yyyy-mm-dd hh:mm:ss"
+    void putIsoTime(time_t when);
+
+    void putCsvField(const std::string &text);
+
+    void putBinaryString(const std::string &text);
+
+    void writeOut(const char *p, size_t len);
+
+public:
+    ReportWriter(int out, ReportFormat fmt);
+    ~ReportWriter() { flush(); }
+
+    ReportWriter(const ReportWriter &) = delete;
+    ReportWriter &operator=(const ReportWriter &) = delete;
+
+    // CSV header rows; no-ops in the other formats
+    void beginAccounts();
+    void beginLoans();
+    void beginTransactions();
+
+    void account(const Account &acc);
+
+    void loan(const Loan &loan);
+
+    void transaction(const TransactionRecord &record);
+
+    // A whole history, oldest first
+    void transactions(const TransactionLog &log);
+
+    bool flush();
+};
+
+// ============================
+// ColumnStore Class
+// ============================
+// Read-side copy of the book laid out as columns (one array per field) for
+// aggregate queries: totals per day, per transaction type, per account type,
+// balances by account type, loan exposure per borrower. Manager::refreshAnalytics
+// fills it; histories only grow, so a refresh copies just the records added
+// since the last one. Queries never touch Manager, so they don't hold up
+// posting. Filters are evaluated a block of rows at a time into lane masks
+// with GCC/Clang vector extensions, totals are masked vector sums, and large
+// tables are split across threads.
+class ColumnStore {
+public:
+    enum GroupBy {
+        GROUP_NONE,          // a single total
+        GROUP_DAY,           // UTC day; keys are days since the epoch
+        GROUP_TX_TYPE,       // keys are TxType
+        GROUP_ACCOUNT_TYPE,  // keys index the account type names
+        GROUP_OWNER,         // keys index the user names
+    };
+
+    struct Filter {
+        int32_t fromDay = INT32_MIN;  // inclusive
+        int32_t toDay = INT32_MAX;    // exclusive
+        uint32_t typeMask = ~0u;      // bit t set: TxType t included
+        int32_t accountType = -1;     // an account type key, or -1 for all
+    };
+
+    struct Group {
+        int32_t key;
+        uint64_t count;
+        Money sum;
+    };
+
+    explicit ColumnStore(unsigned threadCount = std::thread::hardware_concurrency());
+
+    ColumnStore(const ColumnStore &) = delete;
+    ColumnStore &operator=(const ColumnStore &) = delete;
+
+    // Held exclusively by a refresh, shared by queries
+    std::shared_mutex &mutex() const { return lock; }
+
+    // ----- Queries -----
+    // Each returns false if a sum doesn't fit in Money; groups with no rows are left out.
+
+    // Transactions passing filter, summed by amount
+    bool sumTransactions(const Filter &filter, GroupBy by, std::vector<Group> &out) const;
+
+    // Balances of open accounts, by GROUP_ACCOUNT_TYPE, GROUP_OWNER or GROUP_NONE
+    bool sumBalances(GroupBy by, std::vector<Group> &out) const;
+
+    // Outstanding principal plus interest due on loans, by GROUP_OWNER (the borrower) or GROUP_NONE
+    bool sumLoanExposure(GroupBy by, std::vector<Group> &out) const;
+
+    // What a GROUP_ACCOUNT_TYPE or GROUP_OWNER key stands for
+    std::string accountTypeName(int32_t key) const;
+    std::string userName(int32_t key) const;
+    // The key of an account type name, or -1 if no account has had it
+    int32_t accountTypeKey(const std::string &name) const;
+
+    size_t transactionCount() const;
+
+    // ----- Loading -----
+    // For Manager::refreshAnalytics, which holds mutex() exclusively.
+
+    // Every account is marked closed before a refresh; the ones still there are reopened
+    void beginAccounts() { std::fill(acct.open.begin(), acct.open.end(), 0); }
+
+    // The row of an account (added on first sight) with its current balance,
+    // type and owner. Sets copied to how many of its records the store has.
+    uint32_t account(int accountNumber, Money balance, const std::string &type, const std::string &owner,
+                     uint64_t &copied);
+
+    // Makes room for n more transactions; returns the index of the first
+    size_t reserveTransactions(size_t n);
+
+    // Copies records into the transaction rows from at, for account row; safe
+    // to call from several threads for disjoint rows. Call
+    // finishTransactions afterwards.
+    void putTransactions(size_t at, uint32_t row, const TransactionRecord *records, size_t n);
+
+    // Records that rows [from, size()) came from account row, now counted as copied
+    void finishTransactions(size_t from, const std::vector<std::pair<uint32_t, uint64_t>> &copiedPerRow);
+
+    // Loans are small next to histories, so each refresh replaces them
+    void beginLoans(size_t n) { loan.resize(n); }
+
+    void setLoan(size_t i, int loanID, const std::string &borrower, Money principal, Money exposure);
+
+private:
+    typedef int32_t Ints __attribute__((vector_size(16)));
+    typedef uint32_t Words __attribute__((vector_size(16)));
+    typedef int64_t Longs __attribute__((vector_size(16)));
+    static constexpr size_t LANES = 4;               // Ints per vector
+    static constexpr size_t BLOCK = 1024;            // rows filtered at a time
+    static constexpr size_t MIN_PER_THREAD = 1 << 18;
+
+    // Vectors go in and out through memcpy, as in LoanEngine
+    template <typename V, typename T>
+    static void load(V &v, const T *p) { memcpy(&v, p, sizeof(v)); }
+    template <typename V, typename T>
+    static void store(T *p, const V &v) { memcpy(p, &v, sizeof(v)); }
+
+    struct TransactionColumns {
+        std::vector<int32_t> day;
+        std::vector<int64_t> amount;     // paise
+        std::vector<uint8_t> type;       // TxType
+        std::vector<uint32_t> accountRow;
+
+        size_t size() const { return amount.size(); }
+
+        void resize(size_t n) {
+            day.resize(n);
+            amount.resize(n);
+            type.resize(n);
+            accountRow.resize(n);
+        }
+    };
+
+    struct AccountColumns {
+        std::vector<int32_t> number;
+        std::vector<int64_t> balance;    // paise
+        std::vector<int32_t> type;       // typeNames key
+        std::vector<int32_t> owner;      // userNames key
+        std::vector<int32_t> open;       // -1, or 0 once closed; closed accounts' transactions stay
+        std::vector<uint64_t> copied;    // records copied from its history
+
+        size_t size() const { return number.size(); }
+    };
+
+    struct LoanColumns {
+        std::vector<int32_t> id;
+        std::vector<int32_t> borrower;   // userNames key
+        std::vector<int64_t> principal;  // paise
+        std::vector<int64_t> exposure;   // paise, outstanding + interest due
+        std::vector<int32_t> live;       // always -1; lets loans share the masked kernels
+
+        size_t size() const { return id.size(); }
+
+        void resize(size_t n) {
+            id.resize(n);
+            borrower.resize(n);
+            principal.resize(n);
+            exposure.resize(n);
+            live.resize(n);
+        }
+    };
+
+    // One thread's running sums: dense per-group arrays, or for GROUP_NONE a
+    // single total summed in 32-bit halves like Money::sum, two lanes at a time
+    struct Partial {
+        std::vector<__int128> sum;
+        std::vector<uint64_t> count;
+        Longs low = {0, 0}, high = {0, 0};
+
+        explicit Partial(size_t groups) : sum(groups), count(groups) {}
+
+        // mask[i] is -1 for rows to add and 0 for the rest
+        void add(const int32_t *key, const int32_t *mask, const int64_t *value, size_t n, bool single) {
+            if (!single) {
+                // Unselected rows add zero to group 0 rather than branching
+                for (size_t i = 0; i < n; ++i) {
+                    int32_t k = key[i] & mask[i];
+                    sum[k] += value[i] & (int64_t)mask[i];
+                    count[k] -= mask[i];
+                }
+                return;
+            }
+            const Longs lowBits = {0xFFFFFFFF, 0xFFFFFFFF};
+            Ints rows = {0, 0, 0, 0};
+            size_t i = 0;
+            for (; i + LANES <= n; i += LANES) {
+                Ints m;
+                Longs v0, v1;
+                load(m, mask + i);
+                load(v0, value + i);
+                load(v1, value + i + 2);
+                v0 &= Longs{m[0], m[1]};
+                v1 &= Longs{m[2], m[3]};
+                low += (v0 & lowBits) + (v1 & lowBits);
+                high += (v0 >> 32) + (v1 >> 32);
+                rows -= m;
+            }
+            for (; i < n; ++i) {
+                int64_t v = value[i] & (int64_t)mask[i];
+                low[0] += v & 0xFFFFFFFF;
+                high[0] += v >> 32;
+                count[0] -= mask[i];
+            }
+            count[0] += (uint64_t)rows[0] + rows[1] + rows[2] + rows[3];
+        }
+
+        __int128 single() const {
+            return (__int128)(uint64_t)low[0] + (uint64_t)low[1] + (((__int128)high[0] + high[1]) << 32);
+        }
+    };
+
+    unsigned threads;
+    mutable std::shared_mutex lock;
+    TransactionColumns tx;
+    AccountColumns acct;
+    LoanColumns loan;
+    int32_t minDay = INT32_MAX, maxDay = INT32_MIN;
+    std::unordered_map<int, uint32_t> accountRows;
+    std::unordered_map<std::string, int32_t> typeIds, userIds;
+    std::vector<std::string> typeNames, userNames;
+
+    static int32_t intern(std::unordered_map<std::string, int32_t> &ids, std::vector<std::string> &names,
+                          const std::string &name);
+
+    // mask[j] = -1 if transaction row i + j passes filter, else 0
+    void select(const Filter &filter, size_t i, size_t n, int32_t *mask) const;
+
+    // key[j] = the group of transaction row i + j
+    void keys(GroupBy by, int32_t base, size_t i, size_t n, int32_t *key) const;
+
+    // Runs fn(begin, end, partial) over [0, rows) split across threads; one Partial each
+    template <typename Fn>
+    std::vector<Partial> aggregate(size_t rows, size_t groupCount, Fn fn) const {
+        size_t workers = std::min<size_t>(threads, std::max<size_t>(1, rows / MIN_PER_THREAD));
+        std::vector<Partial> partials(workers, Partial(std::max<size_t>(groupCount, 1)));
+        if (groupCount == 0)
+            return partials;
+        size_t per = (rows + workers - 1) / workers;
+        parallelFor(rows, threads, MIN_PER_THREAD, per ? per : 1, [&](size_t begin, size_t end) {
+            fn(begin, end, partials[per ? begin / per : 0]);
+        });
+        return partials;
+    }
+
+    static bool merge(const std::vector<Partial> &partials, int32_t base, std::vector<Group> &out);
+};
+
+// ============================
+// Manager Class
+// ============================
+class Manager
+{
+public:
+    typedef SlotArena<Account>::Handle AccountHandle;
+    typedef SlotArena<Loan>::Handle LoanHandle;
+
+private:
+    SlotArena<Account> accounts;
+    SlotArena<Loan> loans;
+    int nextAccNo = 1001;
+    int nextLoanID = 1;
+    int accNoEnd = std::numeric_limits<int>::max(); // new numbers stay below these (setIdRange)
+    int loanIDEnd = std::numeric_limits<int>::max();
+    double loanRate = 12.0; // annual % for new loans; moved by repriceLoans
+    double savingRate = 3.5; // annual % paid on saving accounts at month-end
+    int lastClosedPeriod = 0; // YYYYMM of the latest month-end close
+    LoanEngine loanEngine;
+    // Every posting since startup, bank-wide, in the order the ledger delivered them
+    TransactionLog transactions;
+    mutable std::mutex globalLock;
+
+    // Primary indexes: account number / loan ID -> arena handle
+    std::unordered_map<int, AccountHandle> accountIndex;
+    std::unordered_map<int, LoanHandle> loanIndex;
+    // Secondary indexes: owner username -> account numbers / loan IDs
+    std::unordered_map<std::string, std::vector<int>> accountsByOwner;
+    std::unordered_map<std::string, std::vector<int>> loansByBorrower;
+
+    // Guards the arenas and indexes: lookups share it, inserts and removals take
+    // it exclusively. Balances are guarded separately by each record's mutex.
+    mutable std::shared_mutex indexLock;
+
+    // Logged-in users and what they own; kept current by insert/remove below
+    SessionTable sessions;
+
+    Account *lookupAccount(int accNo);
+
+    Loan *lookupLoan(int loanID);
+
+    Journal *journal = nullptr;
+    Ledger *ledger = nullptr;
+
+    // An account's history and the ledger both get the record; the caller holds the account lock
+    void recordTransaction(Account &acc, const TransactionRecord &record);
+
+    Account *insertAccount(int accNo, const std::string &name, Money balance, const std::string &type,
+                           const std::string &ownerUsername, time_t opened);
+
+    void removeAccount(int accNo);
+
+    void insertLoan(int loanID, const std::string &name, const std::string &username, Money principal, int tenure,
+                    double rate, time_t opened);
+
+    // Copies the open loans (optionally just one) into engine form
+    void gatherLoans(LoanEngine::Book &book, std::vector<Loan *> &refs, int onlyLoanID = 0);
+
+    // Caller holds indexLock exclusively
+    void repriceLocked(double newRate, time_t when);
+
+    // Last day (exclusive) of period YYYYMM as a day number, or -1 if it isn't a month
+    static int32_t periodEnd(int period);
+
+    // Caller holds indexLock exclusively. Closes every account's and loan's
+    // accrual at the end of period: saving accounts are credited interest at
+    // rate, loans are charged theirs. A period at or before the last one
+    // closed is a no-op, so a replayed or repeated close changes nothing.
+    void closeMonthLocked(int period, double rate, time_t when, size_t *credited = nullptr, Money *paid = nullptr);
+
+    // Owner names are stored in fixed-size journal fields
+    bool journalCanHold(const std::string &username);
+
+    // Once the journal has failed nothing more can be saved, so changes are refused up front
+    bool journalFailed() const { return journal && journal->hasFailed(); }
+
+    // Waits for a change's record; false if it will never reach disk
+    bool durable(uint64_t sequence) { return !journal || journal->waitDurable(sequence); }
+
+    static void reportNotSaved() { std::cout << "Not saved: the journal could not be written.\n"; }
+
+public:
+    void attachJournal(Journal *j) { journal = j; }
+
+    // New accounts are numbered from firstAccNo and new loans from firstLoanID,
+    // count of each at most, so several Managers can share one number space
+    void setIdRange(int firstAccNo, int firstLoanID, int count);
+
+    // Postings from here on are published to l, and the global history is fed from it.
+    // Replayed journal records aren't published, so attach after replay.
+    void attachLedger(Ledger *l);
+
+    // Re-applies one journal record without re-journaling or printing
+    void apply(const JournalRecord &rec);
+
+    // Prints the outcome, as modifyAccount, closeAccount and applyLoan do. False
+    // if nothing changed or the change couldn't be saved.
+    bool createAccount(const std::string &name, Money balance, const std::string &type,
+                       const std::string &ownerUsername);
+
+    // The silent part of createAccount: returns the new account number (0 once
+    // the range is used up) and leaves the journal wait (for sequence) to the caller
+    int openAccount(const std::string &name, Money balance, const std::string &type, const std::string &ownerUsername,
+                    uint64_t &sequence);
+
+    bool modifyAccount(Account &acc, const std::string &name, const std::string &type);
+
+    // Copies of the user's accounts, history included. Prefer forEachUserAccount
+    // unless the copies must outlive the call.
+    std::vector<Account> getUserAccounts(std::string username);
+
+    // Runs fn(const Account &) on each of the user's accounts in place, in
+    // opening order, through the owner index: O(accounts owned), no copies or
+    // allocations. Each account is locked for its call and none can be opened
+    // or closed meanwhile, so fn must not call back into Manager to change
+    // accounts. Returns how many there were.
+    template <typename Fn>
+    size_t forEachUserAccount(const std::string &username, Fn fn)
+    {
+        std::shared_lock<std::shared_mutex> readLock(indexLock);
+        auto owned = accountsByOwner.find(username);
+        if (owned == accountsByOwner.end())
+            return 0;
+        for (int accNo : owned->second)
+        {
+            Account *acc = lookupAccount(accNo);
+            std::lock_guard<RecordMutex> hold(acc->mutex());
+            fn(std::as_const(*acc));
+        }
+        return owned->second.size();
+    }
+
+    // The user's first account number, or 0 if they have none
+    int firstUserAccount(const std::string &username);
+
+    // The pointer stays valid until the account is closed
+    Account *findAccount(int accNo, std::string username = "", bool isManager = false);
+
+    // Starts a session for an authenticated user. Invalid if the table is full.
+    SessionToken openSession(const User &user);
+
+    void closeSession(const SessionToken &session) { sessions.close(session); }
+
+    // False once the session has been closed or has expired
+    bool sessionInfo(const SessionToken &session, SessionTable::Info &info) const { return sessions.lookup(session, info); }
+
+    // Ends idle sessions; returns how many
+    size_t expireSessions() { return sessions.expire(); }
+
+    bool permits(const SessionToken &session, const Account &acc) const;
+
+    bool permits(const SessionToken &session, const Loan &loan) const;
+
+    // Session forms of the lookups: the permission check reads the session's
+    // cache instead of comparing owner names
+    Account *findAccount(int accNo, const SessionToken &session);
+
+    // One page of an account's history, read while the account is pinned and
+    // locked. False if it doesn't exist or the user may not see it.
+    bool queryHistory(int accNo, const std::string &username, bool isManager, const HistoryQuery &query,
+                      HistoryPage &page);
+
+    bool queryHistory(int accNo, const SessionToken &session, const HistoryQuery &query, HistoryPage &page);
+
+    // Handles survive later inserts and resolve to nullptr once the account is closed
+    AccountHandle getAccountHandle(int accNo);
+
+    Account *resolve(AccountHandle handle);
+
+    // Runs fn on the account while holding the index lock shared, so the account
+    // can't be closed underneath it. Returns false if the account doesn't exist.
+    template <typename Fn>
+    bool withAccount(int accNo, Fn fn)
+    {
+        std::shared_lock<std::shared_mutex> readLock(indexLock);
+        Account *acc = lookupAccount(accNo);
+        if (!acc)
+            return false;
+        fn(*acc);
+        return true;
+    }
+
+    // Like withAccount, for the two accounts of a transfer (fn(from, to))
+    template <typename Fn>
+    bool withAccountPair(int fromAccNo, int toAccNo, Fn fn)
+    {
+        std::shared_lock<std::shared_mutex> readLock(indexLock);
+        Account *from = lookupAccount(fromAccNo);
+        Account *to = lookupAccount(toAccNo);
+        if (!from || !to)
+            return false;
+        fn(*from, *to);
+        return true;
+    }
+
+    // Like withAccount, for a set of accounts; fn gets them in the order of accNos
+    template <typename Fn>
+    bool withAccounts(const std::vector<int> &accNos, Fn fn)
+    {
+        std::shared_lock<std::shared_mutex> readLock(indexLock);
+        std::vector<Account *> accs;
+        accs.reserve(accNos.size());
+        for (int accNo : accNos)
+        {
+            Account *acc = lookupAccount(accNo);
+            if (!acc)
+                return false;
+            accs.push_back(acc);
+        }
+        fn(accs);
+        return true;
+    }
+
+    // Runs fn with every index lock holder drained, e.g. to fork a consistent snapshot
+    template <typename Fn>
+    void whileQuiescent(Fn fn)
+    {
+        std::unique_lock<std::shared_mutex> writeLock(indexLock);
+        fn();
+    }
+
+    // One history tier pass; call it periodically. While the history in
+    // memory is over budget, the oldest chunks of the least recently used
+    // accounts are written to the tier and their memory released, down to 90%
+    // of the budget and at most maxPageOutBytes per pass. Every
+    // trimEveryPasses passes, accounts idle since the last trim also drop
+    // their resident cold pages. Returns the number of chunks paged out.
+    size_t pageOutHistory();
+
+    bool closeAccount(int accNo, std::string username = "", bool isManager = false);
+
+    void showAllAccounts();
+
+    // Sum of every balance, taken with postings drained so the total is consistent.
+    // False if the bank-wide total overflows.
+    bool totalBalance(Money &total);
+
+    bool applyLoan(const std::string &name, const std::string &username, Money principal, int tenure);
+
+    // The silent part of applyLoan: returns the new loan ID (0 once the range
+    // is used up) and leaves the journal wait (for sequence) to the caller
+    int openLoan(const std::string &name, const std::string &username, Money principal, int tenure, uint64_t &sequence);
+
+    // Applies a loan payment and logs it in recordIn's history (if given);
+    // remaining is the balance still owed. False if the journal has failed
+    // (nothing changes) or the payment couldn't be saved.
+    bool payLoan(Loan &loan, Money amount, Account *recordIn, Money &remaining);
+
+    // Same, leaving the journal wait to the caller (sequence is the record to wait for)
+    Money payLoan(Loan &loan, Money amount, Account *recordIn, uint64_t &sequence);
+
+    // A rate change: every open loan is re-amortized at newRate over its
+    // remaining months, and new loans are written at newRate. False as for payLoan.
+    bool repriceLoans(double newRate);
+
+    double getLoanRate();
+
+    double getSavingRate();
+
+    // Month-end close for period YYYYMM: posts interest to saving accounts and
+    // charges it on loans, all under one journal record. Each account's
+    // interest comes from a balance-days sum kept up to date as it posts, so
+    // the close does O(1) work per account. False if period isn't a month,
+    // hasn't ended yet or is already closed, if the journal has failed, or if
+    // the close couldn't be saved.
+    bool closeMonth(int period, size_t &credited, Money &paid);
+
+    int getLastClosedPeriod();
+
+    // Month-by-month amortization of what is left on a loan. False if it
+    // doesn't exist, is paid off, or the user may not see it.
+    bool loanSchedule(int loanID, const std::string &username, bool isManager,
+                      std::vector<LoanEngine::ScheduleRow> &rows);
+
+    // Like forEachUserAccount, for the loans the user has borrowed
+    template <typename Fn>
+    size_t forEachUserLoan(const std::string &username, Fn fn)
+    {
+        std::shared_lock<std::shared_mutex> readLock(indexLock);
+        auto owned = loansByBorrower.find(username);
+        if (owned == loansByBorrower.end())
+            return 0;
+        for (int loanID : owned->second)
+        {
+            Loan *loan = lookupLoan(loanID);
+            std::lock_guard<RecordMutex> hold(loan->mutex());
+            fn(std::as_const(*loan));
+        }
+        return owned->second.size();
+    }
+
+    // Copies of the user's loans; see forEachUserLoan
+    std::vector<Loan> getUserLoans(std::string username);
+
+    Loan *findLoan(int loanID, std::string username = "", bool isManager = false);
+
+    Loan *findLoan(int loanID, const SessionToken &session);
+
+    void showAllLoans();
+
+    enum ReportSection
+    {
+        REPORT_ACCOUNTS = 1,
+        REPORT_LOANS = 2,
+        REPORT_TRANSACTIONS = 4, // every account's history
+    };
+
+    // Writes the chosen sections (ReportSection bits) to fd through a
+    // ReportWriter. False if they are all empty or the write failed.
+    bool writeReport(int fd, ReportFormat format, unsigned sections);
+
+    // Full report (accounts, loans and all histories) to a file
+    bool exportReport(const std::string &path, ReportFormat format);
+
+    // Brings store up to date: account balances, types and owners, every
+    // loan, and the transactions added since its last refresh. Each account
+    // is locked only while the end of its history is noted, and the records
+    // are copied after, so posting carries on. Returns the transactions added.
+    size_t refreshAnalytics(ColumnStore &store);
+
+    // Writes a point-in-time image of every account, loan and transaction.
+    // Goes to path + ".tmp" first and is renamed into place once it is on disk.
+    // Takes no locks: run it on a quiesced Manager or in a forked child.
+    // A portable snapshot copies paged-out history in rather than referring to
+    // the history tier, so it can be loaded somewhere else (by a follower).
+    bool saveSnapshot(const std::string &path, uint64_t journalSequence, bool portable = false);
+
+    // Bulk-loads a snapshot into an empty Manager via mmap. On success returns
+    // true and sets journalSequence to the last journal record it covers.
+    bool loadSnapshot(const std::string &path, uint64_t &journalSequence);
+
+    // The ledger consumer behind the global history
+    void recordGlobalTransactions(const TransactionRecord *records, size_t count);
+
+    // Every transaction posted since startup, across all accounts
+    void showAllTransactions();
+
+};
+// ==============================
+// Snapshotter Class
+// ==============================
+// Takes periodic snapshots in a forked child. fork() gives the child a
+// copy-on-write image of Manager, so the parent keeps serving operations
+// while the child writes the file.
+class Snapshotter
+{
+public:
+    struct Options
+    {
+        std::string path = "wisevault.snapshot";
+        // Start a new snapshot once this many journal records have accumulated
+        uint64_t everyRecords = 10000;
+        // Copy paged-out history in (see Manager::saveSnapshot)
+        bool portable = false;
+    };
+
+private:
+    Options options;
+    pid_t child = -1;
+    uint64_t coveredSequence = 0;
+
+public:
+    Snapshotter() {}
+    explicit Snapshotter(const Options &opts) : options(opts) {}
+    Snapshotter(const Snapshotter &) = delete;
+    Snapshotter &operator=(const Snapshotter &) = delete;
+    ~Snapshotter() { wait(); }
+
+    const std::string &path() const { return options.path; }
+
+    // Records that state up to this journal sequence is already covered (e.g. after loading)
+    void setBaseline(uint64_t journalSequence) { coveredSequence = journalSequence; }
+    uint64_t baseline() const { return coveredSequence; }
+
+    bool inProgress();
+
+    // Forks while Manager is quiesced. Postings made through account pointers
+    // (rather than by account number) must not be running on other threads.
+    bool start(Manager &manager, Journal *journal, uint64_t journalSequence = 0);
+
+    void maybeSnapshot(Manager &manager, Journal &journal);
+
+    // False if the snapshot being waited for failed
+    bool wait();
+};
+
+// ==============================
+// ShardedManager Class
+// ==============================
+// Accounts and loans partitioned across several Managers by number, with one
+// worker thread per shard running its postings. Callers queue requests to
+// the shard that owns the account, and each worker drains its queue a batch
+// at a time, so a shard's accounts, indexes and locks are only ever touched by
+// one posting thread and shards share nothing on the posting path. Each
+// shard numbers its accounts and loans from its own range, so the number says
+// where a record lives. A transfer between shards is coordinated in steps:
+// the source shard debits and forwards a credit to the destination, which
+// sends a refund back if the credit can't be made; until then the money shows
+// in neither balance. Opening and closing accounts and loans, lookups and
+// reports go straight to the owning shard's Manager under its own locks.
+// Nothing is journaled in this mode.
+class ShardedManager
+{
+public:
+    static constexpr int ACCOUNTS_PER_SHARD = 1 << 24;
+    static constexpr int LOANS_PER_SHARD = 1 << 24;
+    static constexpr unsigned MAX_SHARDS = 64; // every shard's numbers stay within int32
+
+    enum Op : uint8_t
+    {
+        OP_DEPOSIT,
+        OP_WITHDRAW,
+        OP_TRANSFER, // accNo to counterparty
+        OP_BALANCE,  // into *balance
+        OP_CREDIT,   // queued by the source shard of a transfer to the destination's
+        OP_REFUND    // queued back when the destination couldn't take the credit; if the
+                     // source can't take it either, it goes to the shard's suspense balance
+    };
+
+    // Caller-owned completion count for a group of requests
+    struct Ticket
+    {
+        std::atomic<size_t> pending{0};
+        std::atomic<size_t> failed{0}; // requests that posted nothing
+        std::atomic<size_t> stranded{0}; // failed transfers whose amount went to suspense
+        std::atomic<int64_t> suspensePaise{0};
+
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+        Money suspense() const { return Money::fromPaise(suspensePaise.load(std::memory_order_relaxed)); }
+
+        void wait() const
+        {
+            for (unsigned spins = 0; !done(); ++spins)
+            {
+                if (spins < 64)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    };
+
+    struct Request
+    {
+        Op op;
+        int32_t accNo;
+        int32_t counterparty;
+        Money amount;
+        Money *balance;   // OP_BALANCE
+        Ticket *ticket;   // optional
+        uint64_t linkID;  // OP_CREDIT, OP_REFUND
+    };
+
+    static Request deposit(int accNo, Money amount, Ticket *ticket) { return {OP_DEPOSIT, accNo, 0, amount, nullptr, ticket, 0}; }
+    static Request withdraw(int accNo, Money amount, Ticket *ticket) { return {OP_WITHDRAW, accNo, 0, amount, nullptr, ticket, 0}; }
+    static Request transfer(int fromAccNo, int toAccNo, Money amount, Ticket *ticket);
+    static Request balance(int accNo, Money *out, Ticket *ticket) { return {OP_BALANCE, accNo, 0, Money(), out, ticket, 0}; }
+
+    struct Options
+    {
+        unsigned shards = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    explicit ShardedManager(const Options &opts);
+
+    ShardedManager(const ShardedManager &) = delete;
+    ShardedManager &operator=(const ShardedManager &) = delete;
+    ~ShardedManager() { stop(); }
+
+    unsigned shardCount() const { return (unsigned)shards.size(); }
+    Manager &shard(unsigned index) { return shards[index]->manager; }
+
+    // The shard that owns an account or loan, or -1 for a number no shard hands out
+    int shardOfAccount(int accNo) const;
+    int shardOfLoan(int loanID) const;
+
+    // A user's accounts and loans all open in one shard, so listing them stays local
+    unsigned shardOfOwner(const std::string &username) const
+    {
+        return std::hash<std::string>()(username) % shards.size();
+    }
+
+    Manager *accountShard(int accNo);
+    Manager *loanShard(int loanID);
+
+    // The new account number, or 0 once the owner's shard has used up its range
+    int openAccount(const std::string &name, Money balance, const std::string &type, const std::string &ownerUsername);
+
+    int openLoan(const std::string &name, const std::string &username, Money principal, int tenure);
+
+    // Balances across every shard plus their suspense; transfers between shards
+    // that are still in flight are missing
+    bool totalBalance(Money &total);
+
+    // Debited by a cross-shard transfer that then failed with no account to
+    // refund (it closed, or a rule or overflow refused the credit). Held by the
+    // source account's shard until someone settles it by hand.
+    Money suspense(unsigned index) const;
+
+    void submit(const Request &request) { submit(&request, 1); }
+
+    // Queues requests to their shards, taking each shard's queue lock once.
+    // Requests to the same account run in the order given.
+    void submit(const Request *requests, size_t count);
+
+    // Waits for every queued request, transfer steps included, then stops the workers.
+    // Requests submitted after this never run.
+    void stop();
+
+private:
+    struct Shard
+    {
+        Manager manager;
+        Transaction transaction;
+        std::mutex lock; // guards queue, idle and stopping
+        std::condition_variable wakeup;
+        std::vector<Request> queue;
+        bool idle = false;
+        bool stopping = false;
+        std::thread worker;
+        std::atomic<int64_t> suspense{0}; // paise; only the worker adds to it
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<size_t> inFlight{0}; // submitted and not yet finished, across all shards
+    bool stopped = false;
+
+    void enqueue(Shard &shard, const Request *requests, size_t count);
+
+    void finish(const Request &request, bool ok);
+
+    void run(Shard &shard);
+
+    void execute(Shard &shard, const Request &request);
+};
+
+// ==============================
+// BatchIngest Class
+// ==============================
+// Non-interactive bulk posting for settlement files. Input is CSV, one
+// operation per line ('#' comments and blank lines are skipped; fields may be
+// "quoted" as the CSV reports write them):
+//   deposit,<account>,<amount>
+//   withdraw,<account>,<amount>
+//   loan_payment,<loan id>,<amount>[,<account to record it in>]
+//   create_account,<holder>,<type>,<owner>,<opening balance>
+// or binary: "WVBATCH1" followed by fixed 96-byte BatchRecords. The file is
+// read, parsed and posted by three pipelined stages; posting waits for the
+// journal once per batch instead of once per operation. Failures are written
+// as "line N: reason" (N is the record number for binary input) to the error
+// stream and don't stop the run.
+enum BatchOp : uint8_t
+{
+    BATCH_DEPOSIT = 1,
+    BATCH_WITHDRAW,
+    BATCH_LOAN_PAYMENT,
+    BATCH_CREATE_ACCOUNT,
+};
+
+const char BATCH_MAGIC[8] = {'W', 'V', 'B', 'A', 'T', 'C', 'H', '1'};
+
+struct BatchRecord
+{
+    uint8_t op;             // BatchOp
+    uint8_t padding[3];
+    int32_t accountNumber;  // deposit/withdraw target; loan payments record in it if non-zero
+    int32_t loanID;
+    uint32_t reserved;
+    int64_t amount;         // paise
+    char name[JOURNAL_NAME_LEN];  // create_account fields, NUL-padded
+    char type[JOURNAL_TYPE_LEN];
+    char username[JOURNAL_USER_LEN];
+};
+static_assert(sizeof(BatchRecord) == 96, "batch records must stay fixed-size");
+
+// Fixed-capacity hand-off between pipeline stages; close() ends the stream
+template <typename T>
+class StageQueue
+{
+    std::mutex lock;
+    std::condition_variable notEmpty, notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit StageQueue(size_t cap) : capacity(cap) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> hold(lock);
+        notFull.wait(hold, [&] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // False once the queue is closed and drained
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> hold(lock);
+        notEmpty.wait(hold, [&] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+class BatchIngest
+{
+public:
+    struct Result
+    {
+        uint64_t records = 0; // operations read, blank and comment lines excluded
+        uint64_t posted = 0;
+        uint64_t failed = 0;
+        bool readError = false;
+    };
+
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+    static constexpr size_t BATCH_SIZE = 4096;
+    static constexpr size_t QUEUE_DEPTH = 4;
+    static constexpr const char *BLOCKED = "blocked by risk rule"; // followed by the rule's name
+    static constexpr const char *NOT_SAVED = "not saved: the journal could not be written";
+
+    // Whole lines (CSV) or whole records (binary) read from the input
+    struct Block
+    {
+        std::vector<char> data;
+    };
+
+    struct Item
+    {
+        BatchRecord rec;
+        uint64_t line;
+        const char *error; // set when the line couldn't be parsed
+    };
+
+    struct Field
+    {
+        const char *text;
+        size_t length;
+
+        bool is(const char *word) const { return length == strlen(word) && memcmp(text, word, length) == 0; }
+    };
+
+    Manager &manager;
+    Transaction &transaction;
+    Journal *journal;
+    std::ostream &errors;
+
+    static bool parseInt(const Field &field, int32_t &out);
+
+    static bool copyField(char *dst, size_t len, const Field &field);
+
+    // Splits [p, end) at commas, unquoting "..." fields in place. Returns the
+    // field count, or max + 1 if there are more than max.
+    static size_t splitCsv(char *p, char *end, Field *fields, size_t max);
+
+    static void parseLine(char *p, char *end, Item &item);
+
+    // Binary records get the checks the CSV parser makes
+    static void checkRecord(Item &item);
+
+    // Stage 1: reads the input in large blocks cut at a line (or record) boundary
+    static bool readStage(int fd, bool binary, std::vector<char> carry, StageQueue<Block> &blocks);
+
+    // Stage 2: turns blocks into batches of parsed operations
+    static void parseStage(bool binary, StageQueue<Block> &blocks, StageQueue<std::vector<Item>> &batches);
+
+    // Stage 3: posts one operation; returns the failure reason, or nullptr
+    const char *post(const BatchRecord &rec, uint64_t &sequence);
+
+public:
+    BatchIngest(Manager &m, Transaction &t, Journal *j, std::ostream &errorStream);
+
+    // Ingests everything readable from fd (a file or stdin)
+    Result run(int fd);
+
+    // Opens path ("-" for stdin) and ingests it. False if it can't be opened.
+    bool run(const std::string &path, Result &result);
+};
+
+// ==============================
+// Network Service
+// ==============================
+// A TCP front-end for many concurrent clients. Every frame, in either
+// direction, is
+//   uint32 length | uint32 requestID | uint8 op (or status) | body
+// where length counts everything after itself. Fields are native-endian;
+// strings are a uint16 length and bytes, amounts int64 paise. Clients may
+// pipeline: responses come back on the same connection in request order,
+// each echoing its requestID.
+//
+//   op                  request body                                     response body (on SVC_OK)
+//   SVC_LOGIN           username, password                               uint8 isManager, token[16]
+//   SVC_LOGOUT          -                                                -
+//   SVC_REGISTER        username, password (logs the new user in)        uint8 isManager, token[16]
+//   SVC_CREATE_ACCOUNT  holder, type, owner, int64 opening (managers)    int32 account
+//   SVC_BALANCE         int32 account                                    int64 balance
+//   SVC_DEPOSIT         int32 account, int64 amount                      int64 balance
+//   SVC_WITHDRAW        int32 account, int64 amount                      int64 balance
+//   SVC_TRANSFER        int32 from, int32 to, int64 amount               -
+//   SVC_HISTORY         int32 account, int64 from, int64 to (0: open),   uint64 nextCursor, uint32 n,
+//                       uint32 limit, uint64 cursor                      n raw TransactionRecords
+//   SVC_LIST_ACCOUNTS   -                                                uint32 n, n x (int32, int64, type)
+//   SVC_APPLY_LOAN      borrower, int64 principal, int32 years           int32 loanID
+//   SVC_PAY_LOAN        int32 loanID, int64 amount, int32 account or 0   int64 remaining
+//   SVC_RESUME          token[16] (rejoins a session, e.g. on reconnect) uint8 isManager
+//   SVC_STATS           - (managers)                                     the stats dump as text
+//   SVC_LIST_LOANS      -                                                uint32 n, n x (int32 loanID, int64
+//                                                                        balance, int64 emi, int32 monthsLeft)
+//
+// A session outlives its connection until LOGOUT or until it sits idle past
+// the session timeout. A read-only server (a follower) answers everything
+// that would change an account, loan or login with SVC_READ_ONLY. A deposit,
+// withdrawal or transfer a risk rule refuses gets SVC_BLOCKED. Once the journal
+// has failed, changes other than SVC_REGISTER get SVC_UNAVAILABLE, and requests
+// whose changes didn't reach disk get no reply: their connections are closed.
+enum ServiceOp : uint8_t
+{
+    SVC_LOGIN = 1,
+    SVC_LOGOUT,
+    SVC_REGISTER,
+    SVC_CREATE_ACCOUNT,
+    SVC_BALANCE,
+    SVC_DEPOSIT,
+    SVC_WITHDRAW,
+    SVC_TRANSFER,
+    SVC_HISTORY,
+    SVC_LIST_ACCOUNTS,
+    SVC_APPLY_LOAN,
+    SVC_PAY_LOAN,
+    SVC_RESUME,
+    SVC_STATS,
+    SVC_LIST_LOANS,
+};
+
+enum ServiceStatus : uint8_t
+{
+    SVC_OK = 0,
+    SVC_BAD_REQUEST,   // malformed body or unknown op
+    SVC_NOT_LOGGED_IN,
+    SVC_DENIED,        // wrong credentials, or not found / not permitted
+    SVC_REJECTED,      // invalid amount, insufficient funds, no numbers left
+    SVC_EXISTS,        // username taken
+    SVC_READ_ONLY,     // a follower; send changes to the leader
+    SVC_BLOCKED,       // refused by a risk rule; the body is the rule's name
+    SVC_UNAVAILABLE,   // the journal can't be written, so changes are refused
+};
+
+const size_t SVC_HEADER_LEN = 9;            // length, requestID, op/status
+const size_t SVC_MAX_REQUEST = 64 * 1024;   // larger request frames drop the connection
+const uint32_t SVC_MAX_HISTORY = 1024;      // rows per SVC_HISTORY page
+
+// Builds one frame; the length is patched in by finish()
+class FrameWriter
+{
+    std::string &out;
+    size_t start;
+
+public:
+    FrameWriter(std::string &buffer, uint32_t requestID, uint8_t code) : out(buffer), start(buffer.size())
+    {
+        put<uint32_t>(0);
+        put(requestID);
+        put(code);
+    }
+
+    template <typename T>
+    void put(T value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void putString(const std::string &text)
+    {
+        uint16_t n = (uint16_t)std::min<size_t>(text.size(), UINT16_MAX);
+        put(n);
+        out.append(text.data(), n);
+    }
+
+    void putBytes(const void *data, size_t n) { out.append(static_cast<const char *>(data), n); }
+
+    void finish()
+    {
+        uint32_t length = (uint32_t)(out.size() - start - sizeof(uint32_t));
+        memcpy(&out[start], &length, sizeof(length));
+    }
+};
+
+// Reads fields from a frame body; any overrun marks the reader bad
+class FrameReader
+{
+    const char *p, *end;
+    bool ok = true;
+
+public:
+    FrameReader(const char *data, size_t n) : p(data), end(data + n) {}
+
+    template <typename T>
+    T get()
+    {
+        T value{};
+        if ((size_t)(end - p) < sizeof(T))
+        {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::string getString()
+    {
+        uint16_t n = get<uint16_t>();
+        if (!ok || (size_t)(end - p) < n)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string text(p, n);
+        p += n;
+        return text;
+    }
+
+    const char *data() const { return p; }
+    size_t remaining() const { return end - p; }
+    // Every field was present and nothing is left over
+    bool complete() const { return ok && p == end; }
+};
+
+// Event-driven server: each worker runs its own epoll loop over the
+// connections it accepted, parsing and executing every complete request in
+// a read burst before answering. Postings in a burst are journaled without
+// waiting and the worker waits once for the last of them, so pipelined
+// requests share a group commit.
+class NetServer
+{
+public:
+    struct Options
+    {
+        std::string address = "127.0.0.1";
+        uint16_t port = 7070; // 0 picks a free port; see port()
+        unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+        // Refuse changes, e.g. on a follower; see setReadOnly
+        bool readOnly = false;
+    };
+
+private:
+    static constexpr size_t READ_CHUNK = 64 * 1024;
+    static constexpr size_t OUTPUT_LIMIT = 4 << 20; // stop executing requests past this much unsent output
+
+    struct Session
+    {
+        int fd;
+        std::string in;
+        size_t inUsed = 0; // bytes of `in` already executed
+        std::string out;
+        size_t outSent = 0;
+        SessionToken token;
+        bool peerClosed = false;
+        uint32_t watching = EPOLLIN | EPOLLRDHUP; // epoll events currently registered
+    };
+
+    struct Worker
+    {
+        int epfd = -1;
+        int wakeFd = -1;
+        std::thread loop;
+        std::unordered_map<int, std::unique_ptr<Session>> sessions;
+    };
+
+    Manager &manager;
+    Transaction &transaction;
+    UserStore &users;
+    Journal *journal;
+    Options options;
+    int listenFd = -1;
+    uint16_t boundPort = 0;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> readOnly{false};
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    static bool mutates(uint8_t op);
+
+    static bool validName(const std::string &text, size_t limit);
+
+    // The menus read credentials with >>, so neither part may hold whitespace
+    static bool validCredential(const std::string &text);
+
+    // Runs one request, appending its response to session.out. Postings raise
+    // sequence to their journal record instead of waiting for it.
+    void execute(Session &session, uint32_t requestID, uint8_t op, FrameReader &body, uint64_t &sequence);
+
+    // A whole request is buffered but not yet executed
+    static bool frameReady(const Session &session);
+
+    // Executes the complete frames buffered in session.in, raising sequence to
+    // the last journal record they wrote. False on a frame too large to be a
+    // request.
+    bool executeFrames(Session &session, uint64_t &sequence);
+
+    // Writes as much pending output as the socket takes. False on error.
+    bool flush(Session &session);
+
+    // Watches for writability while output is pending (or requests wait for
+    // room to answer them), and for input only while the peer is still
+    // sending and there is that room
+    void watch(Worker &worker, Session &session);
+
+    void closeSession(Worker &worker, int fd);
+
+    void acceptAll(Worker &worker);
+
+    // Reads everything available. False once the peer has gone.
+    bool readAll(Session &session);
+
+    // Each pass executes what every ready connection sent, waits once for the
+    // journal, then answers them all
+    void run(Worker &worker);
+
+public:
+    NetServer(Manager &m, Transaction &t, UserStore &u, Journal *j, const Options &opts);
+    NetServer(const NetServer &) = delete;
+    NetServer &operator=(const NetServer &) = delete;
+    ~NetServer() { stop(); }
+
+    // Binds, listens and starts the workers. False (with errno set) if the
+    // address can't be bound.
+    bool start();
+
+    uint16_t port() const { return boundPort; }
+
+    // Lets a follower start taking changes once it has been promoted
+    void setReadOnly(bool on) { readOnly = on; }
+
+    // Closes every connection and joins the workers
+    void stop();
+};
+
+// Blocking client for the service protocol, for tools and load generation.
+// send() and receive() can be used separately to pipeline requests.
+class ServiceClient
+{
+    int fd = -1;
+    uint32_t nextRequestID = 1;
+    std::string in;
+    size_t inUsed = 0;
+
+public:
+    ServiceClient() {}
+    ServiceClient(const ServiceClient &) = delete;
+    ServiceClient &operator=(const ServiceClient &) = delete;
+    ~ServiceClient() { close(); }
+
+    bool connect(const std::string &address, uint16_t port);
+
+    void close();
+
+    // Sends one request without waiting for its response; returns its requestID (0 on failure)
+    uint32_t send(uint8_t op, const std::string &body);
+
+    // Reads the next response. False if the connection closed.
+    bool receive(uint32_t &requestID, uint8_t &status, std::string &body);
+
+    // One request, one response
+    bool call(uint8_t op, const std::string &body, uint8_t &status, std::string &response);
+};
+
+// ==============================
+// Replication
+// ==============================
+// Journal shipping to a standby process on the same machine. The leader
+// listens on a Unix socket; a follower connects, says how far its own
+// journal goes, and is sent what it is missing: a snapshot first if it is
+// empty and the journal is long (or no longer reaches back far enough), then
+// the leader's journal itself, durable records a batch at a time. The
+// follower applies each batch to its Manager, journals it under the same
+// sequence numbers and acknowledges it once it is on disk. At most
+// maxUnacked records are in flight per follower, so a slow follower slows
+// its own shipping and nothing else. Logins are copied from users.db record
+// by record. Shipping is asynchronous: a follower promoted after the leader
+// dies has everything it acknowledged, and may lack the leader's last few
+// records.
+//
+// Every message is a ReplHeader followed by `bytes` of payload:
+//   REPL_HELLO      follower  sequence: its last record, count: its users.db records; payload REPL_MAGIC
+//   REPL_SNAPSHOT   leader    sequence: the last record the snapshot covers; payload the snapshot file
+//   REPL_RECORDS    leader    count JournalRecords; sequence: the first
+//   REPL_USERS      leader    count UserFileRecords; sequence: the position of the first
+//   REPL_HEARTBEAT  leader    sequence: the leader's last durable record
+//   REPL_ACK        follower  sequence: its last durable record
+//   REPL_ERROR      leader    payload a message for the follower's operator; the follower gives up
+enum ReplMessage : uint8_t
+{
+    REPL_HELLO = 1,
+    REPL_SNAPSHOT,
+    REPL_RECORDS,
+    REPL_USERS,
+    REPL_HEARTBEAT,
+    REPL_ACK,
+    REPL_ERROR,
+};
+
+struct ReplHeader
+{
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t count;
+    uint64_t sequence;
+    uint64_t bytes;
+};
+static_assert(sizeof(ReplHeader) == 24, "replication headers must stay fixed-size");
+
+const char REPL_MAGIC[8] = {'W', 'V', 'R', 'E', 'P', 'L', '0', '1'};
+const size_t REPL_MAX_PAYLOAD = 64 << 20; // larger messages (other than snapshots) drop the connection
+
+inline ReplHeader replHeader(ReplMessage type, uint64_t sequence, uint32_t count = 0, uint64_t bytes = 0)
+{
+    ReplHeader header = {};
+    header.type = type;
+    header.count = count;
+    header.sequence = sequence;
+    header.bytes = bytes;
+    return header;
+}
+
+// Sends all of data. False once the peer has gone.
+inline bool replSend(int fd, const void *data, size_t n)
+{
+    const char *p = static_cast<const char *>(data);
+    while (n > 0)
+    {
+        ssize_t sent = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        p += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+// Reads exactly n bytes, waiting at most timeout for each part of them.
+// False on timeout, error or end of stream.
+inline bool replReceive(int fd, void *data, size_t n, std::chrono::milliseconds timeout)
+{
+    char *p = static_cast<char *>(data);
+    while (n > 0)
+    {
+        pollfd ready = {fd, POLLIN, 0};
+        int polled = poll(&ready, 1, (int)timeout.count());
+        if (polled < 0 && errno == EINTR)
+            continue;
+        if (polled <= 0)
+            return false;
+        ssize_t got = ::recv(fd, p, n, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+inline bool replSocketAddress(const std::string &path, sockaddr_un &addr)
+{
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// The leader's side: one shipping thread per connected follower
+class ReplicationServer
+{
+public:
+    struct Options
+    {
+        std::string socketPath = "wisevault.repl";
+        // Most records in one REPL_RECORDS message
+        size_t maxBatch = 4096;
+        // Most records shipped to a follower and not yet acknowledged by it
+        uint64_t maxUnacked = 65536;
+        // An empty follower gets a snapshot instead of a journal longer than this
+        uint64_t snapshotAfter = 100000;
+        std::string snapshotPath = "wisevault.snapshot.ship";
+        // How often an idle follower hears from the leader
+        std::chrono::milliseconds heartbeat = std::chrono::milliseconds(500);
+    };
+
+private:
+    struct Follower
+    {
+        int fd = -1;
+        std::thread shipper;
+        std::atomic<bool> done{false};
+    };
+
+    Manager &manager;
+    Journal &journal;
+    UserStore &users;
+    Options options;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread acceptor;
+    std::mutex followersLock;
+    std::vector<std::unique_ptr<Follower>> followers;
+    std::mutex snapshotLock; // followers that need a snapshot take turns
+
+    bool sendError(int fd, const std::string &message);
+
+    // Reads the acknowledgements that have arrived, waiting up to timeout for
+    // the first. False once the follower has gone.
+    bool readAcks(int fd, uint64_t &acked, std::chrono::milliseconds timeout);
+
+    // Forks a portable snapshot, waits until the journal covers it and sends
+    // it. Returns the last record it covers, or 0 if it couldn't be sent.
+    uint64_t sendSnapshot(int fd);
+
+    void ship(Follower &follower);
+
+    void acceptLoop();
+
+public:
+    ReplicationServer(Manager &m, Journal &j, UserStore &u, const Options &opts);
+    ReplicationServer(const ReplicationServer &) = delete;
+    ReplicationServer &operator=(const ReplicationServer &) = delete;
+    ~ReplicationServer() { stop(); }
+
+    // Listens on the socket, replacing a stale one left by a process that
+    // died. False (with errno set) if it can't.
+    bool start();
+
+    size_t followerCount();
+
+    // Disconnects every follower and stops listening
+    void stop();
+};
+
+// The follower's side: a thread that keeps this process's Manager, journal
+// and users.db in step with the leader's, reconnecting whenever it loses the
+// leader. The Manager must not be changed by anything else meanwhile; the
+// follower also takes its own snapshots, between batches.
+class ReplicationClient
+{
+public:
+    struct Options
+    {
+        std::string socketPath = "wisevault.repl";
+        // The leader is taken to be gone after this long without a message
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(3000);
+        std::chrono::milliseconds retry = std::chrono::milliseconds(1000);
+    };
+
+private:
+    Manager &manager;
+    Journal &journal;
+    UserStore &users;
+    Snapshotter &snapshotter;
+    Options options;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> gaveUp{false};
+    std::atomic<uint64_t> leaderSequence{0};
+    std::mutex socketLock;
+    int fd = -1;
+    std::thread loop;
+    std::vector<JournalRecord> group; // an all-or-nothing group still arriving
+    std::vector<char> payload;
+
+    // Installs the leader's snapshot in place of an empty state
+    std::string receiveSnapshot(const ReplHeader &header);
+
+    // Journals and applies a batch, then acknowledges it once it is durable
+    std::string applyRecords(const ReplHeader &header);
+
+    // Follows one connection until it fails; returns why
+    std::string follow();
+
+    void run();
+
+public:
+    ReplicationClient(Manager &m, Journal &j, UserStore &u, Snapshotter &s, const Options &opts);
+    ReplicationClient(const ReplicationClient &) = delete;
+    ReplicationClient &operator=(const ReplicationClient &) = delete;
+    ~ReplicationClient() { stop(); }
+
+    void start();
+
+    // Records the leader is known to have that aren't applied here yet
+    uint64_t lag();
+
+    // False once the leader has refused this follower
+    bool following() const { return !gaveUp; }
+
+    // Disconnects and waits for the batch being applied; a group still
+    // arriving is dropped, as a crash would drop it
+    void stop();
+};
@@ -0,0 +1,913 @@
+// Out-of-line members of the core classes in WiseVault.h: accounts,
+// transactions, risk rules, the ledger and loans.
+#include "WiseVault.h"
+
+using namespace std;
+
+// =========================
+// Account Class
+// =========================
+Account::Account(int accNo, const string &accName, Money bal, const string &type, const string &owner,
+                 time_t opened)
+    : accountNumber(accNo), name(accName), balance(bal), accountType(type), ownerUsername(owner) {
+    accrual.start(opened);
+}
+
+void Account::addTransactionRecord(const TransactionRecord &record) {
+    transactionLog.push_back(record);
+}
+
+void Account::showAccount() const {
+    cout << "\nAccount Number: " << accountNumber;
+    cout << "\nAccount Holder: " << name;
+    cout << "\nAccount Type  : " << accountType;
+    cout << "\nBalance       : INR " << balance << endl;
+}
+
+void Account::credit(Money amount, time_t when) {
+    accrual.advance(balance, dayNumber(when));
+    balance += amount;
+}
+
+void Account::debit(Money amount, time_t when) {
+    accrual.advance(balance, dayNumber(when));
+    balance -= amount;
+}
+
+bool Account::earnsInterest() const {
+    return accountType.size() >= 6 && strncasecmp(accountType.c_str(), "saving", 6) == 0;
+}
+
+void Account::showTransactionHistory() const {
+    if (transactionLog.empty()) {
+        cout << "No transactions found for this account.\n";
+        return;
+    }
+
+    cout << "\nTransaction History for Account " << accountNumber << ":\n";
+    transactionLog.forEach([](const TransactionRecord &record) { record.show(); });
+}
+
+void Account::setDetails(const string &newName, const string &newType) {
+    name = newName;
+    accountType = newType;
+}
+
+// =========================
+// Transaction Class
+// =========================
+bool Transaction::deposit(Account &acc, Money amount, uint64_t &sequence) {
+    METRIC_TIME(METRIC_DEPOSIT);
+    if (journalFailed())
+        return false;
+    lock_guard<RecordMutex> hold(acc.mutex());
+    RiskRules::Verdict verdict;
+    if (rules && !rules->check(acc, TX_DEPOSIT, amount, verdict))
+        return false;
+    if (!canCredit(acc.getBalance(), amount)) {
+        METRIC_COUNT(COUNTER_DEPOSIT_REJECTED, 1);
+        return false;
+    }
+    sequence = post(acc, JOURNAL_DEPOSIT, TX_DEPOSIT, amount);
+    passed(acc, TX_DEPOSIT, amount, verdict);
+    return true;
+}
+
+bool Transaction::deposit(Account &acc, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = deposit(acc, amount, sequence);
+    return commit(sequence) && posted;
+}
+
+bool Transaction::withdraw(Account &acc, Money amount, uint64_t &sequence) {
+    METRIC_TIME(METRIC_WITHDRAW);
+    if (journalFailed())
+        return false;
+    lock_guard<RecordMutex> hold(acc.mutex());
+    RiskRules::Verdict verdict;
+    if (rules && !rules->check(acc, TX_WITHDRAW, amount, verdict))
+        return false;
+    if (!canDebit(acc.getBalance(), amount)) {
+        METRIC_COUNT(COUNTER_WITHDRAW_REJECTED, 1);
+        return false;
+    }
+    sequence = post(acc, JOURNAL_WITHDRAW, TX_WITHDRAW, amount);
+    passed(acc, TX_WITHDRAW, amount, verdict);
+    return true;
+}
+
+bool Transaction::withdraw(Account &acc, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = withdraw(acc, amount, sequence);
+    return commit(sequence) && posted;
+}
+
+bool Transaction::transferLocked(Account &from, Account &to, Money amount, uint64_t &sequence) {
+    if (journalFailed())
+        return false;
+    if (&from == &to) {
+        RiskRules::clearBlocked();
+        return false;
+    }
+    Account &first = from.getAccountNumber() < to.getAccountNumber() ? from : to;
+    Account &second = &first == &from ? to : from;
+    lock_guard<RecordMutex> holdFirst(first.mutex());
+    lock_guard<RecordMutex> holdSecond(second.mutex());
+    RiskRules::Verdict out, in;
+    if (rules && (!rules->check(from, TX_TRANSFER_OUT, amount, out) || !rules->check(to, TX_TRANSFER_IN, amount, in)))
+        return false;
+    if (!canDebit(from.getBalance(), amount) || !canCredit(to.getBalance(), amount))
+        return false;
+    JournalRecord rec = transferRecord(TransferLeg{from.getAccountNumber(), to.getAccountNumber(), amount});
+    if (journal)
+        sequence = journal->enqueue(rec);
+    postTransfer(from, to, amount, linkFor(sequence), (time_t)rec.timestamp);
+    passed(from, TX_TRANSFER_OUT, amount, out);
+    passed(to, TX_TRANSFER_IN, amount, in);
+    return true;
+}
+
+bool Transaction::postTransferLeg(Account &acc, TxType type, Money amount, uint64_t linkID) {
+    lock_guard<RecordMutex> hold(acc.mutex());
+    bool debit = type == TX_TRANSFER_OUT;
+    RiskRules::Verdict verdict;
+    if (rules && !rules->check(acc, type, amount, verdict))
+        return false;
+    if (debit ? !canDebit(acc.getBalance(), amount) : !canCredit(acc.getBalance(), amount))
+        return false;
+    time_t when = time(nullptr);
+    if (debit)
+        acc.debit(amount, when);
+    else
+        acc.credit(amount, when);
+    record(acc, TransactionRecord(acc.getAccountNumber(), type, amount, when, linkID));
+    passed(acc, type, amount, verdict);
+    return true;
+}
+
+bool Transaction::transfer(Account &from, Account &to, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = transferLocked(from, to, amount, sequence);
+    return commit(sequence) && posted;
+}
+
+// accNos is sorted and unique, accs holds the matching accounts
+bool Transaction::transferBatchLocked(const vector<TransferLeg> &legs, const vector<int> &accNos,
+                                      vector<Account *> &accs, uint64_t &sequence) {
+    auto slotOf = [&](int accNo) { return lower_bound(accNos.begin(), accNos.end(), accNo) - accNos.begin(); };
+    if (journalFailed())
+        return false;
+
+    for (Account *acc : accs)
+        acc->mutex().lock();
+
+    // Dry-run the legs in order against working balances before touching anything.
+    // Each leg that passes goes into the rule windows so later legs see it, and
+    // comes back out if a later one fails.
+    vector<Money> balances(accs.size());
+    for (size_t i = 0; i < accs.size(); ++i)
+        balances[i] = accs[i]->getBalance();
+    vector<RiskRules::Verdict> verdicts(rules ? legs.size() * 2 : 0);
+    size_t counted = 0;
+    RiskRules::clearBlocked();
+    bool feasible = true;
+    for (const auto &leg : legs) {
+        size_t from = slotOf(leg.fromAccNo), to = slotOf(leg.toAccNo);
+        RiskRules::Verdict *out = rules ? &verdicts[counted * 2] : nullptr;
+        RiskRules::Verdict *in = rules ? out + 1 : nullptr;
+        if (from == to ||
+            (rules && (!rules->check(*accs[from], TX_TRANSFER_OUT, leg.amount, *out) ||
+                       !rules->check(*accs[to], TX_TRANSFER_IN, leg.amount, *in))) ||
+            !canDebit(balances[from], leg.amount) || !canCredit(balances[to], leg.amount)) {
+            feasible = false;
+            break;
+        }
+        balances[from] -= leg.amount;
+        balances[to] += leg.amount;
+        if (rules) {
+            rules->count(*accs[from], TX_TRANSFER_OUT, leg.amount, *out);
+            rules->count(*accs[to], TX_TRANSFER_IN, leg.amount, *in);
+            ++counted;
+        }
+    }
+    if (!feasible)
+        for (size_t i = counted; i-- > 0;) {
+            const TransferLeg &leg = legs[i];
+            rules->count(*accs[slotOf(leg.fromAccNo)], TX_TRANSFER_OUT, leg.amount, verdicts[i * 2], -1);
+            rules->count(*accs[slotOf(leg.toAccNo)], TX_TRANSFER_IN, leg.amount, verdicts[i * 2 + 1], -1);
+        }
+
+    if (feasible) {
+        time_t now = time(nullptr);
+        vector<JournalRecord> recs;
+        if (journal) {
+            recs.reserve(legs.size());
+            for (const auto &leg : legs) {
+                recs.push_back(transferRecord(leg));
+                recs.back().timestamp = now;
+            }
+            sequence = journal->enqueueGroup(recs.data(), recs.size());
+        }
+        for (size_t i = 0; i < legs.size(); ++i) {
+            const TransferLeg &leg = legs[i];
+            uint64_t linkID = linkFor(sequence ? sequence + i : 0);
+            Account &from = *accs[slotOf(leg.fromAccNo)], &to = *accs[slotOf(leg.toAccNo)];
+            postTransfer(from, to, leg.amount, linkID, now);
+            if (rules) {
+                rules->flag(from, TX_TRANSFER_OUT, leg.amount, verdicts[i * 2]);
+                rules->flag(to, TX_TRANSFER_IN, leg.amount, verdicts[i * 2 + 1]);
+            }
+        }
+        if (sequence)
+            sequence += legs.size() - 1; // wait for the whole group
+    }
+
+    for (size_t i = accs.size(); i-- > 0;)
+        accs[i]->mutex().unlock();
+    return feasible;
+}
+
+bool Transaction::deposit(Account &acc, Money amount, Manager &manager) {
+    return deposit(acc, amount); // No special logic for manager in current version
+}
+
+bool Transaction::withdraw(Account &acc, Money amount, Manager &manager) {
+    return withdraw(acc, amount); // No special logic for manager in current version
+}
+
+// ==============================
+// Transaction posting by account number
+// ==============================
+bool Transaction::deposit(Manager &manager, int accNo, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = false;
+    manager.withAccount(accNo, [&](Account &acc) { posted = deposit(acc, amount, sequence); });
+    return commit(sequence) && posted;
+}
+
+bool Transaction::transfer(Manager &manager, int fromAccNo, int toAccNo, Money amount, uint64_t &sequence) {
+    bool posted = false;
+    manager.withAccountPair(fromAccNo, toAccNo, [&](Account &from, Account &to) {
+        posted = transferLocked(from, to, amount, sequence);
+    });
+    return posted;
+}
+
+bool Transaction::transfer(Manager &manager, int fromAccNo, int toAccNo, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = transfer(manager, fromAccNo, toAccNo, amount, sequence);
+    return commit(sequence) && posted;
+}
+
+bool Transaction::transferBatch(Manager &manager, const vector<TransferLeg> &legs) {
+    if (legs.empty() || legs.size() > JOURNAL_MAX_GROUP)
+        return false;
+    vector<int> accNos;
+    accNos.reserve(legs.size() * 2);
+    for (const auto &leg : legs) {
+        accNos.push_back(leg.fromAccNo);
+        accNos.push_back(leg.toAccNo);
+    }
+    // Ascending account order is the global lock order
+    sort(accNos.begin(), accNos.end());
+    accNos.erase(unique(accNos.begin(), accNos.end()), accNos.end());
+
+    uint64_t sequence = 0;
+    bool posted = false;
+    manager.withAccounts(accNos, [&](vector<Account *> &accs) {
+        posted = transferBatchLocked(legs, accNos, accs, sequence);
+    });
+    return commit(sequence) && posted;
+}
+
+bool Transaction::withdraw(Manager &manager, int accNo, Money amount) {
+    uint64_t sequence = 0;
+    bool posted = false;
+    manager.withAccount(accNo, [&](Account &acc) { posted = withdraw(acc, amount, sequence); });
+    return commit(sequence) && posted;
+}
+
+// =========================
+// RiskRules Class
+// =========================
+// Seconds in "90", "15m", "24h" or "7d"; false past a year
+static bool parseWindow(const string &text, uint32_t &seconds) {
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long n = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || !isdigit((unsigned char)text[0]) || errno)
+        return false;
+    unsigned long long unit = 1;
+    if (*end == 'm')
+        unit = 60;
+    else if (*end == 'h')
+        unit = 3600;
+    else if (*end == 'd')
+        unit = 86400;
+    else if (*end == 's' || *end == '\0')
+        unit = 1;
+    else
+        return false;
+    if (*end && end[1])
+        return false;
+    if (n == 0 || n > 366ull * 86400 / unit)
+        return false;
+    seconds = (uint32_t)(n * unit);
+    return true;
+}
+
+static bool parseCount(const string &text, int64_t &out) {
+    char *end = nullptr;
+    errno = 0;
+    out = strtoll(text.c_str(), &end, 10);
+    return isdigit((unsigned char)text[0]) && *end == '\0' && !errno;
+}
+
+static bool parseTypes(const string &text, uint32_t &mask) {
+    const uint32_t any = 1u << TX_DEPOSIT | 1u << TX_WITHDRAW | 1u << TX_TRANSFER_OUT | 1u << TX_TRANSFER_IN;
+    mask = 0;
+    stringstream list(text);
+    string type;
+    while (getline(list, type, ',')) {
+        if (type == "any")
+            mask |= any;
+        else if (type == "deposit")
+            mask |= 1u << TX_DEPOSIT;
+        else if (type == "withdraw")
+            mask |= 1u << TX_WITHDRAW;
+        else if (type == "transfer_out")
+            mask |= 1u << TX_TRANSFER_OUT;
+        else if (type == "transfer_in")
+            mask |= 1u << TX_TRANSFER_IN;
+        else
+            return false;
+    }
+    return mask != 0;
+}
+
+bool RiskRules::compile(istream &in, ostream &errors) {
+    vector<string> newNames;
+    vector<Limit> newLimits;
+    vector<uint32_t> newWidths, newTypes, seconds;
+    vector<uint32_t> ruleTypes;
+    bool ok = true;
+    string line;
+    for (size_t lineNo = 1; getline(in, line); ++lineNo) {
+        line.resize(min(line.size(), line.find('#')));
+        stringstream split(line);
+        vector<string> fields;
+        for (string field; split >> field;)
+            fields.push_back(field);
+        if (fields.empty())
+            continue;
+
+        Limit limit{};
+        uint32_t types = 0, window = 0;
+        string error;
+        bool windowed = fields.size() > 3 && (fields[3] == "sum" || fields[3] == "count");
+        Money amount;
+        int64_t postings = 0;
+        if (fields.size() < 5 || fields.size() != (windowed ? 6u : 5u) || (!windowed && fields[3] != "amount"))
+            error = "expected <name> <block|flag> <types> amount <limit> or <name> <block|flag> <types> sum|count "
+                    "<window> <limit>";
+        else if (find(newNames.begin(), newNames.end(), fields[0]) != newNames.end())
+            error = "rule " + fields[0] + " is already defined";
+        else if (fields[1] != "block" && fields[1] != "flag")
+            error = "action must be block or flag";
+        else if (!parseTypes(fields[2], types))
+            error = "types must be any, or a list of deposit, withdraw, transfer_out, transfer_in";
+        else if (windowed && !parseWindow(fields[4], window))
+            error = "invalid window (seconds, or a number with m, h or d, up to a year)";
+        else if (fields[3] == "count" ? !parseCount(fields[5], postings)
+                                      : !Money::parse(fields.back(), amount) || amount < Money())
+            error = "invalid limit";
+        else if (newNames.size() == MAX_RULES)
+            error = "more than " + to_string(MAX_RULES) + " rules";
+        if (error.empty() && windowed) {
+            size_t k = 0;
+            while (k < seconds.size() && (seconds[k] != window || newTypes[k] != types))
+                ++k;
+            if (k == MAX_WINDOWS)
+                error = "more than " + to_string(MAX_WINDOWS) + " distinct windows";
+            else if (k == seconds.size()) {
+                seconds.push_back(window);
+                newTypes.push_back(types);
+                newWidths.push_back((window + BUCKETS - 2) / (BUCKETS - 1));
+            }
+            limit.window = (uint8_t)k;
+        }
+        if (!error.empty()) {
+            errors << "rules line " << lineNo << ": " << error << "\n";
+            ok = false;
+            continue;
+        }
+        limit.measure = fields[3] == "amount" ? RULE_AMOUNT : fields[3] == "sum" ? RULE_SUM : RULE_COUNT;
+        limit.limit = limit.measure == RULE_COUNT ? postings : amount.paise();
+        limit.block = fields[1] == "block";
+        newNames.push_back(fields[0]);
+        newLimits.push_back(limit);
+        ruleTypes.push_back(types);
+    }
+    if (!ok)
+        return false;
+
+    names = move(newNames);
+    limits = move(newLimits);
+    widths = move(newWidths);
+    windowTypes = move(newTypes);
+    horizon = 0;
+    for (uint32_t width : widths)
+        horizon = max(horizon, (time_t)width * BUCKETS);
+    for (int type = 0; type <= TX_INTEREST; ++type) {
+        Plan &plan = plans[type];
+        plan.ruleCount = plan.windowCount = 0;
+        for (size_t r = 0; r < limits.size(); ++r)
+            if (ruleTypes[r] & (1u << type))
+                plan.rules[plan.ruleCount++] = (uint8_t)r;
+        for (size_t k = 0; k < widths.size(); ++k)
+            if (windowTypes[k] & (1u << type))
+                plan.windows[plan.windowCount++] = (uint8_t)k;
+    }
+    for (Hits &h : hitCounts)
+        h.n.store(0, memory_order_relaxed);
+    return true;
+}
+
+bool RiskRules::load(const string &path, ostream &errors) {
+    ifstream in(path);
+    if (!in) {
+        errors << "Could not open " << path << ".\n";
+        return false;
+    }
+    return compile(in, errors);
+}
+
+RiskRules::~RiskRules() {
+    for (uint32_t p = 0; p < MAX_PAGES; ++p)
+        delete[] pages[p].load(memory_order_relaxed);
+}
+
+bool RiskRules::check(Account &acc, TxType type, Money amount, Verdict &verdict) {
+    lastBlocked = nullptr;
+    verdict.flagged = 0;
+    const Plan &plan = plans[type];
+    if (plan.ruleCount == 0)
+        return true;
+    verdict.now = time(nullptr);
+    int64_t sums[MAX_WINDOWS];
+    int64_t counts[MAX_WINDOWS];
+    if (plan.windowCount) {
+        Window *w = windowsOf(acc, verdict.now);
+        for (uint8_t i = 0; i < plan.windowCount; ++i) {
+            uint8_t k = plan.windows[i];
+            sums[k] = counts[k] = 0;
+            if (w)
+                total(w[k], widths[k], verdict.now, sums[k], counts[k]);
+        }
+    }
+    for (uint8_t i = 0; i < plan.ruleCount; ++i) {
+        uint8_t r = plan.rules[i];
+        const Limit &rule = limits[r];
+        int64_t value = rule.measure == RULE_AMOUNT ? amount.paise()
+                        : rule.measure == RULE_SUM  ? sums[rule.window] + amount.paise()
+                                                    : counts[rule.window] + 1;
+        if (value <= rule.limit)
+            continue;
+        if (!rule.block) {
+            verdict.flagged |= (uint64_t)1 << r;
+            continue;
+        }
+        hitCounts[r].n.fetch_add(1, memory_order_relaxed);
+        METRIC_COUNT(COUNTER_RULE_BLOCKED, 1);
+        lastBlocked = &names[r];
+        return false;
+    }
+    return true;
+}
+
+void RiskRules::count(Account &acc, TxType type, Money amount, const Verdict &verdict, int sign) {
+    const Plan &plan = plans[type];
+    if (plan.windowCount == 0)
+        return;
+    Window *w = windowsOf(acc, verdict.now);
+    if (!w)
+        return;
+    for (uint8_t i = 0; i < plan.windowCount; ++i) {
+        uint8_t k = plan.windows[i];
+        add(w[k], widths[k], verdict.now, amount.paise() * sign, sign);
+    }
+}
+
+void RiskRules::flag(const Account &acc, TxType type, Money amount, const Verdict &verdict) {
+    for (uint64_t bits = verdict.flagged; bits; bits &= bits - 1) {
+        size_t r = (size_t)__builtin_ctzll(bits);
+        hitCounts[r].n.fetch_add(1, memory_order_relaxed);
+        METRIC_COUNT(COUNTER_RULE_FLAGGED, 1);
+        if (flagHandler)
+            flagHandler(names[r], acc.getAccountNumber(), type, amount);
+    }
+}
+
+void RiskRules::writeText(ostream &out) const {
+    if (names.empty())
+        return;
+    ios::fmtflags flags = out.flags();
+    out << left << setw(24) << "Rule" << setw(8) << "Action" << right << setw(12) << "Hits" << "\n";
+    for (size_t r = 0; r < names.size(); ++r)
+        out << left << setw(24) << names[r] << setw(8) << (limits[r].block ? "block" : "flag") << right << setw(12)
+            << hits(r) << "\n";
+    out.flags(flags);
+}
+
+void RiskRules::writePrometheus(ostream &out) const {
+    if (names.empty())
+        return;
+    out << "# HELP wisevault_rule_hits_total Postings that tripped each risk rule.\n"
+           "# TYPE wisevault_rule_hits_total counter\n";
+    for (size_t r = 0; r < names.size(); ++r)
+        out << "wisevault_rule_hits_total{rule=\"" << names[r] << "\",action=\""
+            << (limits[r].block ? "block" : "flag") << "\"} " << hits(r) << "\n";
+}
+
+void RiskRules::total(const Window &w, uint32_t width, time_t now, int64_t &sum, int64_t &count) {
+    uint32_t epoch = (uint32_t)(now / width);
+    for (const Bucket &b : w.buckets)
+        if ((int32_t)(epoch - b.epoch) < (int32_t)BUCKETS) { // a later epoch too, if the clock stepped back
+            sum += b.sum;
+            count += b.count;
+        }
+}
+
+void RiskRules::add(Window &w, uint32_t width, time_t when, int64_t paise, int sign) {
+    uint32_t epoch = (uint32_t)(when / width);
+    Bucket &b = w.buckets[epoch % BUCKETS];
+    if (b.epoch != epoch) {
+        if (sign < 0 || (int32_t)(epoch - b.epoch) < 0)
+            return; // older than what the bucket holds now
+        b = Bucket{epoch, 0, 0};
+    }
+    b.count += sign;
+    b.sum += paise;
+}
+
+RiskRules::Window *RiskRules::windowsOf(Account &acc, time_t now) {
+    uint64_t slot = acc.getRiskSlot();
+    if ((slot & ~(uint64_t)UINT32_MAX) == tag)
+        return windowsAt((uint32_t)slot);
+    uint32_t fresh = nextSlot.fetch_add(1, memory_order_relaxed);
+    if (fresh >= MAX_PAGES * PAGE_ACCOUNTS)
+        return nullptr;
+    Window *w = windowsAt(fresh);
+    const TransactionLog &log = acc.getTransactionLog();
+    for (size_t i = log.lowerBound(now - horizon); i < log.size(); ++i) {
+        const TransactionRecord &record = log[i];
+        for (size_t k = 0; k < widths.size(); ++k)
+            if (windowTypes[k] & (1u << record.getType()))
+                add(w[k], widths[k], record.getTimestamp(), record.getAmount().paise(), 1);
+    }
+    acc.setRiskSlot(tag | fresh);
+    return w;
+}
+
+RiskRules::Window *RiskRules::windowsAt(uint32_t slot) {
+    atomic<Window *> &page = pages[slot / PAGE_ACCOUNTS];
+    Window *w = page.load(memory_order_acquire);
+    if (!w) {
+        lock_guard<mutex> hold(growLock);
+        w = page.load(memory_order_relaxed);
+        if (!w) {
+            w = new Window[(size_t)PAGE_ACCOUNTS * widths.size()]();
+            page.store(w, memory_order_release);
+        }
+    }
+    return w + (size_t)(slot % PAGE_ACCOUNTS) * widths.size();
+}
+
+// =========================
+// Ledger Class
+// =========================
+void Ledger::start(const Options &opts) {
+    if (running)
+        return;
+    options = opts;
+    options.maxBatch = max<size_t>(options.maxBatch, 1);
+    size_t capacity = 2;
+    while (capacity < options.capacity)
+        capacity <<= 1;
+    slots.reset(new Slot[capacity]);
+    mask = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i)
+        slots[i].turn.store(i, memory_order_relaxed);
+    head.store(0, memory_order_relaxed);
+    tail.store(0, memory_order_relaxed);
+    consumed.store(0, memory_order_relaxed);
+    stopping.store(false, memory_order_relaxed);
+    running = true;
+    for (unsigned i = 0; i < max(1u, options.drainers); ++i)
+        drainers.emplace_back(&Ledger::drainLoop, this);
+}
+
+void Ledger::stop() {
+    if (!running)
+        return;
+    stopping.store(true, memory_order_release);
+    wake();
+    for (thread &drainer : drainers)
+        drainer.join();
+    drainers.clear();
+    running = false;
+}
+
+void Ledger::publish(const TransactionRecord &record) {
+    if (!running)
+        return;
+    if (!tryPush(record)) {
+        METRIC_COUNT(COUNTER_LEDGER_STALLS, 1);
+        do {
+            wake();
+            this_thread::yield();
+        } while (!tryPush(record));
+    }
+    // An idle drainer is woken once a full batch waits; fewer records wait
+    // out its sleep, so a trickle of postings isn't a context switch each
+    if (idle.load(memory_order_relaxed) && backlog() >= options.maxBatch &&
+        idle.exchange(false, memory_order_relaxed))
+        wake();
+}
+
+void Ledger::flush() {
+    if (!running)
+        return;
+    size_t target = head.load(memory_order_acquire);
+    wake();
+    while (consumed.load(memory_order_acquire) < target)
+        this_thread::sleep_for(chrono::microseconds(100));
+}
+
+size_t Ledger::backlog() const {
+    return head.load(memory_order_relaxed) - consumed.load(memory_order_relaxed);
+}
+
+bool Ledger::tryPush(const TransactionRecord &record) {
+    size_t pos = head.load(memory_order_relaxed);
+    while (true) {
+        Slot &slot = slots[pos & mask];
+        intptr_t diff = (intptr_t)slot.turn.load(memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                slot.record = record;
+                slot.turn.store(pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = head.load(memory_order_relaxed);
+        }
+    }
+}
+
+bool Ledger::tryPop(TransactionRecord &out) {
+    size_t pos = tail.load(memory_order_relaxed);
+    while (true) {
+        Slot &slot = slots[pos & mask];
+        intptr_t diff = (intptr_t)slot.turn.load(memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                out = slot.record;
+                slot.turn.store(pos + mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // empty, or the next record is still being written
+        } else {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+void Ledger::wake() {
+    lock_guard<mutex> hold(sleepLock);
+    wakeup.notify_all();
+}
+
+void Ledger::drainLoop() {
+    vector<TransactionRecord> batch(options.maxBatch);
+    while (true) {
+        size_t n = 0;
+        while (n < batch.size() && tryPop(batch[n]))
+            ++n;
+        if (n > 0) {
+            for (const Consumer &consumer : consumers)
+                consumer(batch.data(), n);
+            METRIC_COUNT(COUNTER_LEDGER_RECORDS, n);
+            consumed.fetch_add(n, memory_order_release);
+            continue;
+        }
+        bool drained = tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+        if (drained && stopping.load(memory_order_acquire))
+            return;
+        if (!drained) {
+            this_thread::yield(); // a producer is mid-write
+            continue;
+        }
+        // Sleeps at most a millisecond, which bounds how late a record is delivered
+        unique_lock<mutex> guard(sleepLock);
+        idle.store(true, memory_order_relaxed);
+        wakeup.wait_for(guard, chrono::milliseconds(1));
+        idle.store(false, memory_order_relaxed);
+    }
+}
+
+// =========================
+// LoanEngine Class
+// =========================
+LoanEngine::LoanEngine(unsigned threadCount)
+    : threads(max(1u, threadCount)) {}
+
+void LoanEngine::computeEmis(const double *principal, const double *rate, const int32_t *months, double *emi,
+                             size_t n) const {
+    parallelFor(n, [&](size_t begin, size_t end) {
+        size_t i = begin;
+        for (; i + LANES <= end; i += LANES) {
+            Lanes p, monthlyRate, factor;
+            load(p, principal + i);
+            load(monthlyRate, rate + i);
+            monthlyRate = monthlyRate / 12 / 100;
+            compoundLanes(1 + monthlyRate, months + i, factor);
+            store(emi + i, p * monthlyRate * factor / (factor - 1));
+        }
+        for (; i < end; ++i)
+            emi[i] = emiFor(principal[i], rate[i], months[i]);
+        for (i = begin; i < end; ++i)
+            if (months[i] <= 0 || rate[i] == 0)
+                emi[i] = emiFor(principal[i], rate[i], months[i]);
+    });
+}
+
+void LoanEngine::computeOutstanding(Book &book) const {
+    const double *rate = book.rate.data(), *emi = book.emi.data(), *balance = book.balance.data();
+    const int32_t *months = book.months.data();
+    double *outstanding = book.outstanding.data();
+    parallelFor(book.size(), [&](size_t begin, size_t end) {
+        size_t i = begin;
+        for (; i + LANES <= end; i += LANES) {
+            Lanes monthlyRate, payment, total, factor;
+            load(monthlyRate, rate + i);
+            load(payment, emi + i);
+            load(total, balance + i);
+            monthlyRate = monthlyRate / 12 / 100;
+            Lanes m = {double(months[i]), double(months[i + 1]), double(months[i + 2]), double(months[i + 3])};
+            compoundLanes(1 + monthlyRate, months + i, factor);
+            Lanes fullFactor = factor / (1 + monthlyRate);
+            Lanes last = total - (m - 1) * payment;
+            store(outstanding + i, payment * (fullFactor - 1) / (monthlyRate * fullFactor) + last / factor);
+        }
+        for (; i < end; ++i)
+            outstanding[i] = presentValue(rate[i], months[i], emi[i], balance[i]);
+        for (i = begin; i < end; ++i)
+            if (months[i] <= 1 || rate[i] == 0)
+                outstanding[i] = presentValue(rate[i], months[i], emi[i], balance[i]);
+    });
+}
+
+void LoanEngine::reprice(Book &book, double newRate) const {
+    fill(book.rate.begin(), book.rate.end(), newRate);
+    computeEmis(book.outstanding.data(), book.rate.data(), book.months.data(), book.emi.data(), book.size());
+}
+
+void LoanEngine::schedules(const Book &book, vector<size_t> &offsets, vector<ScheduleRow> &rows) const {
+    offsets.assign(book.size() + 1, 0);
+    for (size_t i = 0; i < book.size(); ++i)
+        offsets[i + 1] = offsets[i] + max(0, book.months[i]);
+    rows.resize(offsets.back());
+    parallelFor(book.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            amortize(book, i, rows.data() + offsets[i]);
+    });
+}
+
+double LoanEngine::emiFor(double principal, double annualRate, int months) {
+    if (months <= 0)
+        return principal;
+    double monthlyRate = (annualRate / 12) / 100;
+    if (monthlyRate == 0)
+        return principal / months;
+    double factor = compoundFactor(monthlyRate, months);
+    return principal * monthlyRate * factor / (factor - 1);
+}
+
+double LoanEngine::presentValue(double annualRate, int months, double emi, double balance) {
+    double monthlyRate = (annualRate / 12) / 100;
+    if (months <= 1 || monthlyRate == 0)
+        return months <= 1 ? balance / (1 + max(0.0, monthlyRate)) : balance;
+    double factor = compoundFactor(monthlyRate, months);
+    double fullFactor = factor / (1 + monthlyRate);
+    double last = balance - (months - 1) * emi;
+    return emi * (fullFactor - 1) / (monthlyRate * fullFactor) + last / factor;
+}
+
+double LoanEngine::compoundFactor(double monthlyRate, int months) {
+    double base = 1 + monthlyRate, result = 1;
+    for (unsigned n = months; n != 0; n >>= 1) {
+        if (n & 1)
+            result *= base;
+        base *= base;
+    }
+    return result;
+}
+
+void LoanEngine::compoundLanes(const Lanes &rateBase, const int32_t *months, Lanes &result) {
+    LaneInts n = {(uint32_t)months[0], (uint32_t)months[1], (uint32_t)months[2], (uint32_t)months[3]};
+    Lanes one = {1, 1, 1, 1}, base = rateBase;
+    result = one;
+    for (uint32_t bits = (uint32_t)(months[0] | months[1] | months[2] | months[3]); bits != 0; bits >>= 1) {
+        // Branch-free per-lane select of base or 1 (plain SSE2 has no 64-bit compare)
+        LaneInts take = -(n & 1);
+        result *= (Lanes)((take & (LaneInts)base) | (~take & (LaneInts)one));
+        base *= base;
+        n >>= 1;
+    }
+}
+
+void LoanEngine::amortize(const Book &book, size_t i, ScheduleRow *out) {
+    double monthlyRate = (book.rate[i] / 12) / 100;
+    int64_t left = Money::fromRupees(book.outstanding[i]).paise();
+    int64_t emi = Money::fromRupees(book.emi[i]).paise();
+    for (int32_t month = 1; month <= book.months[i]; ++month) {
+        ScheduleRow &row = out[month - 1];
+        row.loanID = book.loanID[i];
+        row.month = month;
+        row.interest = llround(left * monthlyRate);
+        row.principal = month == book.months[i] ? left : max<int64_t>(0, min(emi - row.interest, left));
+        row.payment = row.principal + row.interest;
+        left -= row.principal;
+        row.balance = left;
+    }
+}
+
+// =========================
+// Loan Class
+// =========================
+Loan::Loan(int id, const string &name, const string &username, Money p, int t, double r,
+           time_t opened)
+    : loanID(id), borrowerName(name), borrowerUsername(username), principal(p), rate(r), tenure(t * 12),
+      outstanding(p), monthsLeft(t * 12) {
+
+    // The EMI is rounded to whole paise once
+    emi = Money::fromRupees(LoanEngine::emiFor(principal.rupees(), rate, tenure));
+    accrual.start(opened);
+}
+
+void Loan::showLoanDetails() const {
+    cout << "\nLoan ID          : " << loanID;
+    cout << "\nBorrower Name    : " << borrowerName;
+    cout << "\nPrincipal Amount : INR " << principal;
+    cout << "\nInterest Rate    : " << fixed << setprecision(2) << rate << "%";
+    cout << "\nTenure           : " << tenure / 12 << " years (" << tenure << " months)";
+    cout << "\nMonthly EMI      : INR " << emi;
+    cout << "\nOutstanding      : INR " << outstanding;
+    cout << "\nInterest Due     : INR " << interestDue << endl;
+}
+
+Loan Loan::restore(int id, const string &name, const string &username, Money p, double r, int months,
+                   Money emi, Money outstanding, Money interestDue, int monthsLeft, const Accrual &accrual) {
+    Loan loan;
+    loan.loanID = id;
+    loan.borrowerName = name;
+    loan.borrowerUsername = username;
+    loan.principal = p;
+    loan.rate = r;
+    loan.tenure = months;
+    loan.emi = emi;
+    loan.outstanding = outstanding;
+    loan.interestDue = interestDue;
+    loan.monthsLeft = monthsLeft;
+    loan.accrual = accrual;
+    return loan;
+}
+
+int Loan::remainingMonths() const {
+    return monthsLeft > 0 ? monthsLeft : (outstanding.isPositive() ? 1 : 0);
+}
+
+void Loan::reprice(double newRate, Money newEmi, time_t when) {
+    interestDue += accrual.close(outstanding, dayNumber(when), rate);
+    rate = newRate;
+    emi = newEmi;
+}
+
+void Loan::closeMonth(int32_t endDay) {
+    interestDue += accrual.close(outstanding, endDay, rate);
+    if (monthsLeft > 0)
+        --monthsLeft;
+}
+
+bool Loan::makePayment(Money amount, time_t when) {
+    accrual.advance(outstanding, dayNumber(when));
+    Money toInterest = min(amount, interestDue);
+    interestDue -= toInterest;
+    amount -= toInterest;
+    outstanding = amount >= outstanding ? Money() : outstanding - amount;
+    return getBalance().isZero();
+}
@@ -0,0 +1,1935 @@
+// Out-of-line members of Manager and what it drives in WiseVault.h: reports,
+// the column store, snapshots and the sharded front end.
+#include "WiseVault.h"
+
+using namespace std;
+
+// =========================
+// ReportWriter Class
+// =========================
+char *ReportWriter::reserve(size_t n) {
+    if (used + n > BUFFER_SIZE)
+        flush();
+    return buffer.get() + used;
+}
+
+void ReportWriter::put(const char *text, size_t n) {
+    if (n > BUFFER_SIZE) {
+        flush();
+        writeOut(text, n);
+        return;
+    }
+    memcpy(reserve(n), text, n);
+    used += n;
+}
+
+const char *ReportWriter::digitPairs() {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    return pairs;
+}
+
+void ReportWriter::putUnsigned(uint64_t value) {
+    char digits[20];
+    char *end = digits + sizeof(digits), *p = end;
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, digitPairs() + value % 100 * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, digitPairs() + value * 2, 2);
+    } else {
+        *--p = char('0' + value);
+    }
+    put(p, end - p);
+}
+
+void ReportWriter::putInt(int64_t value) {
+    if (value < 0) {
+        put('-');
+        putUnsigned(0 - (uint64_t)value);
+    } else {
+        putUnsigned(value);
+    }
+}
+
+void ReportWriter::putFixed2(int64_t hundredths) {
+    uint64_t magnitude = hundredths < 0 ? 0 - (uint64_t)hundredths : (uint64_t)hundredths;
+    if (hundredths < 0)
+        put('-');
+    putUnsigned(magnitude / 100);
+    char *p = reserve(3);
+    p[0] = '.';
+    memcpy(p + 1, digitPairs() + magnitude % 100 * 2, 2);
+    used += 3;
+}
+
+void ReportWriter::putTwoDigits(int value) {
+    memcpy(reserve(2), digitPairs() + value * 2, 2);
+    used += 2;
+}
+
+void ReportWriter::cacheHour(time_t when) {
+    if (when >= cachedHour && when < cachedHour + 3600)
+        return;
+    tm parts;
+    localtime_r(&when, &parts);
+    cachedHour = when - parts.tm_min * 60 - parts.tm_sec;
+    static const char days[][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    snprintf(ctimeHour, sizeof(ctimeHour), "%s %s%3d %02d:", days[parts.tm_wday], months[parts.tm_mon],
+             parts.tm_mday, parts.tm_hour);
+    snprintf(ctimeYear, sizeof(ctimeYear), " %d\n", parts.tm_year + 1900);
+    snprintf(isoHour, sizeof(isoHour), "%04d-%02d-%02d %02d:", parts.tm_year + 1900, parts.tm_mon + 1,
+             parts.tm_mday, parts.tm_hour);
+}
+
+void ReportWriter::putMinutesSeconds(time_t when) {
+    long offset = (long)(when - cachedHour);
+    putTwoDigits(int(offset / 60));
+    put(':');
+    putTwoDigits(int(offset % 60));
+}
+
+void ReportWriter::putCtime(time_t when) {
+    cacheHour(when);
+    put(ctimeHour, strlen(ctimeHour));
+    putMinutesSeconds(when);
+    put(ctimeYear, strlen(ctimeYear));
+}
+
+void ReportWriter::putIsoTime(time_t when) {
+    cacheHour(when);
+    put(isoHour, strlen(isoHour));
+    putMinutesSeconds(when);
+}
+
+void ReportWriter::putCsvField(const string &text) {
+    if (text.find_first_of(",\"\n") == string::npos) {
+        put(text);
+        return;
+    }
+    put('"');
+    for (char c : text) {
+        if (c == '"')
+            put('"');
+        put(c);
+    }
+    put('"');
+}
+
+void ReportWriter::putBinaryString(const string &text) {
+    uint16_t length = (uint16_t)min<size_t>(text.size(), UINT16_MAX);
+    putRaw(length);
+    put(text.data(), length);
+}
+
+void ReportWriter::writeOut(const char *p, size_t len) {
+    while (ok && len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+ReportWriter::ReportWriter(int out, ReportFormat fmt)
+    : fd(out), format(fmt), buffer(new char[BUFFER_SIZE]) {
+    if (format == REPORT_BINARY)
+        put("WVREPORT");
+}
+
+void ReportWriter::beginAccounts() {
+    if (format == REPORT_CSV)
+        put("account_number,holder,type,owner,balance\n");
+}
+
+void ReportWriter::beginLoans() {
+    if (format == REPORT_CSV)
+        put("loan_id,borrower,username,principal,rate,tenure_months,emi,outstanding,interest_due\n");
+}
+
+void ReportWriter::beginTransactions() {
+    if (format == REPORT_CSV)
+        put("account_number,type,amount,timestamp,link_id\n");
+}
+
+void ReportWriter::account(const Account &acc) {
+    switch (format) {
+    case REPORT_TEXT:
+        put("\nAccount Number: ");
+        putInt(acc.getAccountNumber());
+        put("\nAccount Holder: ");
+        put(acc.getName());
+        put("\nAccount Type  : ");
+        put(acc.getAccountType());
+        put("\nBalance       : INR ");
+        putMoney(acc.getBalance());
+        put("\n----------------------------\n");
+        break;
+    case REPORT_CSV:
+        putInt(acc.getAccountNumber());
+        put(',');
+        putCsvField(acc.getName());
+        put(',');
+        putCsvField(acc.getAccountType());
+        put(',');
+        putCsvField(acc.getOwnerUsername());
+        put(',');
+        putMoney(acc.getBalance());
+        put('\n');
+        break;
+    case REPORT_BINARY:
+        put('A');
+        putRaw((int32_t)acc.getAccountNumber());
+        putRaw(acc.getBalance().paise());
+        putBinaryString(acc.getName());
+        putBinaryString(acc.getAccountType());
+        putBinaryString(acc.getOwnerUsername());
+        break;
+    }
+}
+
+void ReportWriter::loan(const Loan &loan) {
+    int64_t rateHundredths = llround(loan.getRate() * 100);
+    switch (format) {
+    case REPORT_TEXT:
+        put("\nLoan ID          : ");
+        putInt(loan.getLoanID());
+        put("\nBorrower Name    : ");
+        put(loan.getBorrowerName());
+        put("\nPrincipal Amount : INR ");
+        putMoney(loan.getPrincipal());
+        put("\nInterest Rate    : ");
+        putFixed2(rateHundredths);
+        put("%\nTenure           : ");
+        putInt(loan.getTenureMonths() / 12);
+        put(" years (");
+        putInt(loan.getTenureMonths());
+        put(" months)\nMonthly EMI      : INR ");
+        putMoney(loan.getEmi());
+        put("\nOutstanding      : INR ");
+        putMoney(loan.getOutstanding());
+        put("\nInterest Due     : INR ");
+        putMoney(loan.getInterestDue());
+        put("\n----------------------------\n");
+        break;
+    case REPORT_CSV:
+        putInt(loan.getLoanID());
+        put(',');
+        putCsvField(loan.getBorrowerName());
+        put(',');
+        putCsvField(loan.getBorrowerUsername());
+        put(',');
+        putMoney(loan.getPrincipal());
+        put(',');
+        putFixed2(rateHundredths);
+        put(',');
+        putInt(loan.getTenureMonths());
+        put(',');
+        putMoney(loan.getEmi());
+        put(',');
+        putMoney(loan.getOutstanding());
+        put(',');
+        putMoney(loan.getInterestDue());
+        put('\n');
+        break;
+    case REPORT_BINARY:
+        put('L');
+        putRaw((int32_t)loan.getLoanID());
+        putRaw((int32_t)loan.getTenureMonths());
+        putRaw(loan.getPrincipal().paise());
+        putRaw(loan.getRate());
+        putRaw(loan.getEmi().paise());
+        putRaw(loan.getOutstanding().paise());
+        putRaw(loan.getInterestDue().paise());
+        putBinaryString(loan.getBorrowerName());
+        putBinaryString(loan.getBorrowerUsername());
+        break;
+    }
+}
+
+void ReportWriter::transaction(const TransactionRecord &record) {
+    switch (format) {
+    case REPORT_TEXT:
+        put("\nAccount: ");
+        putInt(record.getAccountNumber());
+        put(", Type: ");
+        put(record.getTypeName(), strlen(record.getTypeName()));
+        put(", Amount: INR ");
+        putMoney(record.getAmount());
+        if (record.getLinkID()) {
+            put(", Ref: TRF");
+            putUnsigned(record.getLinkID());
+        }
+        put(", Date: ");
+        putCtime(record.getTimestamp());
+        break;
+    case REPORT_CSV:
+        putInt(record.getAccountNumber());
+        put(',');
+        put(record.getTypeName(), strlen(record.getTypeName()));
+        put(',');
+        putMoney(record.getAmount());
+        put(',');
+        putIsoTime(record.getTimestamp());
+        put(',');
+        putUnsigned(record.getLinkID());
+        put('\n');
+        break;
+    case REPORT_BINARY:
+        put('T');
+        putRaw(record);
+        break;
+    }
+}
+
+void ReportWriter::transactions(const TransactionLog &log) {
+    log.forEach([this](const TransactionRecord &record) { transaction(record); });
+}
+
+bool ReportWriter::flush() {
+    writeOut(buffer.get(), used);
+    used = 0;
+    return ok;
+}
+
+// =========================
+// ColumnStore Class
+// =========================
+ColumnStore::ColumnStore(unsigned threadCount)
+    : threads(max(1u, threadCount)) {}
+
+bool ColumnStore::sumTransactions(const Filter &filter, GroupBy by, vector<Group> &out) const {
+    shared_lock<shared_mutex> hold(lock);
+    int32_t base = 0;
+    size_t groupCount = 1;
+    switch (by) {
+    case GROUP_NONE: break;
+    case GROUP_DAY:
+        if (tx.size() == 0)
+            break;
+        base = max(filter.fromDay, minDay);
+        groupCount = max<int64_t>(0, min<int64_t>((int64_t)filter.toDay - 1, maxDay) - base + 1);
+        break;
+    case GROUP_TX_TYPE: groupCount = 32; break;
+    case GROUP_ACCOUNT_TYPE: groupCount = typeNames.size(); break;
+    case GROUP_OWNER: groupCount = userNames.size(); break;
+    }
+    vector<Partial> partials = aggregate(tx.size(), groupCount, [&](size_t begin, size_t end, Partial &partial) {
+        int32_t selected[BLOCK];
+        int32_t key[BLOCK];
+        for (size_t i = begin; i < end; i += BLOCK) {
+            size_t n = min(BLOCK, end - i);
+            select(filter, i, n, selected);
+            keys(by, base, i, n, key);
+            partial.add(key, selected, tx.amount.data() + i, n, by == GROUP_NONE);
+        }
+    });
+    return merge(partials, base, out);
+}
+
+bool ColumnStore::sumBalances(GroupBy by, vector<Group> &out) const {
+    shared_lock<shared_mutex> hold(lock);
+    if (by == GROUP_DAY || by == GROUP_TX_TYPE)
+        return false;
+    const vector<int32_t> &keyColumn = by == GROUP_OWNER ? acct.owner : acct.type;
+    size_t groupCount = by == GROUP_NONE ? 1 : by == GROUP_OWNER ? userNames.size() : typeNames.size();
+    vector<Partial> partials = aggregate(acct.size(), groupCount, [&](size_t begin, size_t end, Partial &partial) {
+        partial.add(keyColumn.data() + begin, acct.open.data() + begin, acct.balance.data() + begin, end - begin,
+                    by == GROUP_NONE);
+    });
+    return merge(partials, 0, out);
+}
+
+bool ColumnStore::sumLoanExposure(GroupBy by, vector<Group> &out) const {
+    shared_lock<shared_mutex> hold(lock);
+    if (by != GROUP_OWNER && by != GROUP_NONE)
+        return false;
+    vector<Partial> partials = aggregate(loan.size(), by == GROUP_NONE ? 1 : userNames.size(),
+                                         [&](size_t begin, size_t end, Partial &partial) {
+        partial.add(loan.borrower.data() + begin, loan.live.data() + begin, loan.exposure.data() + begin,
+                    end - begin, by == GROUP_NONE);
+    });
+    return merge(partials, 0, out);
+}
+
+string ColumnStore::accountTypeName(int32_t key) const {
+    shared_lock<shared_mutex> hold(lock);
+    return typeNames.at(key);
+}
+
+string ColumnStore::userName(int32_t key) const {
+    shared_lock<shared_mutex> hold(lock);
+    return userNames.at(key);
+}
+
+int32_t ColumnStore::accountTypeKey(const string &name) const {
+    shared_lock<shared_mutex> hold(lock);
+    auto it = typeIds.find(name);
+    return it == typeIds.end() ? -1 : it->second;
+}
+
+size_t ColumnStore::transactionCount() const {
+    shared_lock<shared_mutex> hold(lock);
+    return tx.size();
+}
+
+uint32_t ColumnStore::account(int accountNumber, Money balance, const string &type, const string &owner,
+                              uint64_t &copied) {
+    auto it = accountRows.find(accountNumber);
+    uint32_t row;
+    if (it == accountRows.end()) {
+        row = (uint32_t)acct.size();
+        accountRows.emplace(accountNumber, row);
+        acct.number.push_back(accountNumber);
+        acct.balance.push_back(0);
+        acct.type.push_back(intern(typeIds, typeNames, type));
+        acct.owner.push_back(intern(userIds, userNames, owner));
+        acct.open.push_back(0);
+        acct.copied.push_back(0);
+    } else {
+        row = it->second;
+    }
+    acct.balance[row] = balance.paise();
+    if (typeNames[acct.type[row]] != type) // types rarely change; skip the hash when they haven't
+        acct.type[row] = intern(typeIds, typeNames, type);
+    acct.open[row] = -1;
+    copied = acct.copied[row];
+    return row;
+}
+
+size_t ColumnStore::reserveTransactions(size_t n) {
+    size_t first = tx.size();
+    tx.resize(first + n);
+    return first;
+}
+
+void ColumnStore::putTransactions(size_t at, uint32_t row, const TransactionRecord *records, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        tx.day[at + i] = dayNumber(records[i].getTimestamp());
+        tx.amount[at + i] = records[i].getAmount().paise();
+        tx.type[at + i] = (uint8_t)records[i].getType();
+        tx.accountRow[at + i] = row;
+    }
+}
+
+void ColumnStore::finishTransactions(size_t from, const vector<pair<uint32_t, uint64_t>> &copiedPerRow) {
+    for (const auto &[row, n] : copiedPerRow)
+        acct.copied[row] += n;
+    for (size_t i = from; i < tx.size(); ++i) {
+        minDay = min(minDay, tx.day[i]);
+        maxDay = max(maxDay, tx.day[i]);
+    }
+}
+
+void ColumnStore::setLoan(size_t i, int loanID, const string &borrower, Money principal, Money exposure) {
+    loan.id[i] = loanID;
+    loan.borrower[i] = intern(userIds, userNames, borrower);
+    loan.principal[i] = principal.paise();
+    loan.exposure[i] = exposure.paise();
+    loan.live[i] = -1;
+}
+
+int32_t ColumnStore::intern(unordered_map<string, int32_t> &ids, vector<string> &names, const string &name) {
+    auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+    names.push_back(name);
+    return ids[name] = (int32_t)names.size() - 1;
+}
+
+void ColumnStore::select(const Filter &filter, size_t i, size_t n, int32_t *mask) const {
+    const int32_t *day = tx.day.data() + i;
+    const uint8_t *type = tx.type.data() + i;
+    const Ints from = {filter.fromDay, filter.fromDay, filter.fromDay, filter.fromDay};
+    const Ints to = {filter.toDay, filter.toDay, filter.toDay, filter.toDay};
+    const Words types = {filter.typeMask, filter.typeMask, filter.typeMask, filter.typeMask};
+    size_t j = 0;
+    for (; j + LANES <= n; j += LANES) {
+        Ints d;
+        load(d, day + j);
+        Words t = {type[j], type[j + 1], type[j + 2], type[j + 3]};
+        store(mask + j, (d >= from) & (d < to) & -(Ints)((types >> (t & 31)) & 1));
+    }
+    for (; j < n; ++j)
+        mask[j] = -(int32_t)((day[j] >= filter.fromDay) & (day[j] < filter.toDay) & ((filter.typeMask >> (type[j] & 31)) & 1));
+    if (filter.accountType >= 0) {
+        const uint32_t *row = tx.accountRow.data() + i;
+        for (j = 0; j < n; ++j)
+            mask[j] &= -(int32_t)(acct.type[row[j]] == filter.accountType);
+    }
+}
+
+void ColumnStore::keys(GroupBy by, int32_t base, size_t i, size_t n, int32_t *key) const {
+    const uint32_t *row = tx.accountRow.data() + i;
+    switch (by) {
+    case GROUP_NONE: break;
+    case GROUP_DAY: {
+        const Ints shift = {base, base, base, base};
+        size_t j = 0;
+        for (; j + LANES <= n; j += LANES) {
+            Ints d;
+            load(d, tx.day.data() + i + j);
+            store(key + j, d - shift);
+        }
+        for (; j < n; ++j)
+            key[j] = tx.day[i + j] - base;
+        break;
+    }
+    case GROUP_TX_TYPE:
+        for (size_t j = 0; j < n; ++j)
+            key[j] = tx.type[i + j] & 31;
+        break;
+    case GROUP_ACCOUNT_TYPE:
+        for (size_t j = 0; j < n; ++j)
+            key[j] = acct.type[row[j]];
+        break;
+    case GROUP_OWNER:
+        for (size_t j = 0; j < n; ++j)
+            key[j] = acct.owner[row[j]];
+        break;
+    }
+}
+
+bool ColumnStore::merge(const vector<Partial> &partials, int32_t base, vector<Group> &out) {
+    out.clear();
+    if (partials.empty())
+        return true;
+    size_t groups = partials[0].sum.size();
+    for (size_t k = 0; k < groups; ++k) {
+        __int128 total = 0;
+        uint64_t rows = 0;
+        for (const Partial &p : partials) {
+            total += p.sum[k];
+            if (k == 0)
+                total += p.single();
+            rows += p.count[k];
+        }
+        if (rows == 0)
+            continue;
+        if (total > INT64_MAX || total < INT64_MIN)
+            return false;
+        out.push_back({base + (int32_t)k, rows, Money::fromPaise((int64_t)total)});
+    }
+    return true;
+}
+
+// =========================
+// Manager Class
+// =========================
+Account *Manager::lookupAccount(int accNo)
+{
+    auto it = accountIndex.find(accNo);
+    return it == accountIndex.end() ? nullptr : accounts.get(it->second);
+}
+
+Loan *Manager::lookupLoan(int loanID)
+{
+    auto it = loanIndex.find(loanID);
+    return it == loanIndex.end() ? nullptr : loans.get(it->second);
+}
+
+void Manager::recordTransaction(Account &acc, const TransactionRecord &record)
+{
+    acc.addTransactionRecord(record);
+    if (ledger)
+        ledger->publish(record);
+}
+
+Account *Manager::insertAccount(int accNo, const string &name, Money balance, const string &type,
+                                const string &ownerUsername, time_t opened)
+{
+    AccountHandle handle = accounts.insert(Account(accNo, name, balance, type, ownerUsername, opened));
+    accountIndex[accNo] = handle;
+    accountsByOwner[ownerUsername].push_back(accNo);
+    sessions.grant(ownerUsername, SESSION_ACCOUNT, accNo);
+    if (accNo >= nextAccNo)
+        nextAccNo = accNo + 1;
+    return accounts.get(handle);
+}
+
+void Manager::removeAccount(int accNo)
+{
+    auto idx = accountIndex.find(accNo);
+    Account *acc = idx == accountIndex.end() ? nullptr : accounts.get(idx->second);
+    if (!acc)
+        return;
+
+    auto owned = accountsByOwner.find(acc->getOwnerUsername());
+    for (auto it = owned->second.begin(); it != owned->second.end(); ++it)
+    {
+        if (*it == accNo)
+        {
+            owned->second.erase(it);
+            break;
+        }
+    }
+    if (owned->second.empty())
+        accountsByOwner.erase(owned);
+    sessions.revoke(acc->getOwnerUsername(), SESSION_ACCOUNT, accNo);
+
+    accounts.erase(idx->second);
+    accountIndex.erase(idx);
+}
+
+void Manager::insertLoan(int loanID, const string &name, const string &username, Money principal, int tenure,
+                         double rate, time_t opened)
+{
+    loanIndex[loanID] = loans.insert(Loan(loanID, name, username, principal, tenure, rate, opened));
+    loansByBorrower[username].push_back(loanID);
+    sessions.grant(username, SESSION_LOAN, loanID);
+    if (loanID >= nextLoanID)
+        nextLoanID = loanID + 1;
+}
+
+void Manager::gatherLoans(LoanEngine::Book &book, vector<Loan *> &refs, int onlyLoanID)
+{
+    refs.clear();
+    if (onlyLoanID)
+    {
+        if (Loan *loan = lookupLoan(onlyLoanID))
+            refs.push_back(loan);
+    }
+    else
+    {
+        refs.reserve(loans.size());
+        loans.forEach([&](Loan &loan) { refs.push_back(&loan); });
+    }
+    refs.erase(remove_if(refs.begin(), refs.end(), [](Loan *loan) { return loan->getBalance().isZero(); }),
+               refs.end());
+    book.resize(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i)
+    {
+        const Loan &loan = *refs[i];
+        book.loanID[i] = loan.getLoanID();
+        book.rate[i] = loan.getRate();
+        book.months[i] = loan.remainingMonths();
+        book.emi[i] = loan.getEmi().rupees();
+        book.balance[i] = loan.getBalance().rupees();
+        book.outstanding[i] = loan.getOutstanding().rupees();
+    }
+}
+
+void Manager::repriceLocked(double newRate, time_t when)
+{
+    LoanEngine::Book book;
+    vector<Loan *> refs;
+    gatherLoans(book, refs);
+    loanEngine.reprice(book, newRate);
+    for (size_t i = 0; i < refs.size(); ++i)
+        refs[i]->reprice(newRate, Money::fromRupees(book.emi[i]), when);
+    loanRate = newRate;
+}
+
+int32_t Manager::periodEnd(int period)
+{
+    int year = period / 100, month = period % 100;
+    if (year < 1970 || month < 1 || month > 12)
+        return -1;
+    return month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, month + 1, 1);
+}
+
+void Manager::closeMonthLocked(int period, double rate, time_t when, size_t *credited, Money *paid)
+{
+    int32_t endDay = periodEnd(period);
+    if (endDay < 0 || period <= lastClosedPeriod)
+        return;
+    atomic<size_t> creditedCount{0};
+    atomic<int64_t> paidPaise{0};
+    const unsigned threads = max(1u, thread::hardware_concurrency());
+    parallelFor(accounts.slotLimit(), threads, 1 << 14, 1, [&](size_t begin, size_t end)
+    {
+        size_t count = 0;
+        int64_t total = 0;
+        accounts.forEachIn(begin, end, [&](Account &acc)
+        {
+            lock_guard<RecordMutex> hold(acc.mutex());
+            Money interest = acc.closeInterest(endDay, rate);
+            Money updated;
+            if (!acc.earnsInterest() || !interest.isPositive() || !acc.getBalance().checkedAdd(interest, updated))
+                return;
+            acc.credit(interest, when);
+            recordTransaction(acc, TransactionRecord(acc.getAccountNumber(), TX_INTEREST, interest, when));
+            ++count;
+            total += interest.paise();
+        });
+        creditedCount += count;
+        paidPaise += total;
+    });
+    parallelFor(loans.slotLimit(), threads, 1 << 14, 1, [&](size_t begin, size_t end)
+    {
+        loans.forEachIn(begin, end, [&](Loan &loan)
+        {
+            lock_guard<RecordMutex> hold(loan.mutex());
+            if (loan.getBalance().isPositive())
+                loan.closeMonth(endDay);
+        });
+    });
+    lastClosedPeriod = period;
+    savingRate = rate;
+    if (credited)
+        *credited = creditedCount;
+    if (paid)
+        *paid = Money::fromPaise(paidPaise);
+}
+
+bool Manager::journalCanHold(const string &username)
+{
+    if (journal && username.size() >= JOURNAL_USER_LEN)
+    {
+        cout << "Username is too long (max " << JOURNAL_USER_LEN - 1 << " characters).\n";
+        return false;
+    }
+    return true;
+}
+
+void Manager::setIdRange(int firstAccNo, int firstLoanID, int count)
+{
+    unique_lock<shared_mutex> writeLock(indexLock);
+    nextAccNo = firstAccNo;
+    nextLoanID = firstLoanID;
+    accNoEnd = firstAccNo + count;
+    loanIDEnd = firstLoanID + count;
+}
+
+void Manager::attachLedger(Ledger *l)
+{
+    ledger = l;
+    ledger->addConsumer([this](const TransactionRecord *records, size_t count)
+                        { recordGlobalTransactions(records, count); });
+}
+
+void Manager::apply(const JournalRecord &rec)
+{
+    unique_lock<shared_mutex> writeLock(indexLock);
+    time_t when = (time_t)rec.timestamp;
+    Money amount = rec.getAmount();
+    switch (rec.op)
+    {
+    case JOURNAL_CREATE_ACCOUNT:
+        insertAccount(rec.accountNumber, JournalRecord::getField(rec.name, JOURNAL_NAME_LEN), amount,
+                      JournalRecord::getField(rec.type, JOURNAL_TYPE_LEN),
+                      JournalRecord::getField(rec.username, JOURNAL_USER_LEN), when);
+        break;
+    case JOURNAL_CLOSE_ACCOUNT:
+        removeAccount(rec.accountNumber);
+        break;
+    case JOURNAL_MODIFY_ACCOUNT:
+        if (Account *acc = lookupAccount(rec.accountNumber))
+            acc->setDetails(JournalRecord::getField(rec.name, JOURNAL_NAME_LEN),
+                            JournalRecord::getField(rec.type, JOURNAL_TYPE_LEN));
+        break;
+    case JOURNAL_DEPOSIT:
+        if (Account *acc = lookupAccount(rec.accountNumber))
+        {
+            acc->credit(amount, when);
+            acc->addTransactionRecord(TransactionRecord(rec.accountNumber, TX_DEPOSIT, amount, when));
+        }
+        break;
+    case JOURNAL_WITHDRAW:
+        if (Account *acc = lookupAccount(rec.accountNumber))
+        {
+            acc->debit(amount, when);
+            acc->addTransactionRecord(TransactionRecord(rec.accountNumber, TX_WITHDRAW, amount, when));
+        }
+        break;
+    case JOURNAL_APPLY_LOAN:
+        insertLoan(rec.loanID, JournalRecord::getField(rec.name, JOURNAL_NAME_LEN),
+                   JournalRecord::getField(rec.username, JOURNAL_USER_LEN), amount, rec.tenure, rec.rate, when);
+        break;
+    case JOURNAL_REPRICE_LOANS:
+        repriceLocked(rec.rate, when);
+        break;
+    case JOURNAL_MONTH_END:
+        closeMonthLocked(rec.counterparty, rec.rate, when);
+        break;
+    case JOURNAL_LOAN_PAYMENT:
+        if (Loan *loan = lookupLoan(rec.loanID))
+            loan->makePayment(amount, when);
+        if (Account *acc = lookupAccount(rec.accountNumber))
+            acc->addTransactionRecord(TransactionRecord(rec.accountNumber, TX_LOAN_PAYMENT, amount, when));
+        break;
+    case JOURNAL_TRANSFER:
+    {
+        Account *from = lookupAccount(rec.accountNumber);
+        Account *to = lookupAccount(rec.counterparty);
+        if (from && to)
+        {
+            from->debit(amount, when);
+            to->credit(amount, when);
+            from->addTransactionRecord(TransactionRecord(rec.accountNumber, TX_TRANSFER_OUT, amount, when, rec.sequence));
+            to->addTransactionRecord(TransactionRecord(rec.counterparty, TX_TRANSFER_IN, amount, when, rec.sequence));
+        }
+        break;
+    }
+    }
+}
+
+bool Manager::createAccount(const string &name, Money balance, const string &type, const string &ownerUsername)
+{
+    if (!journalCanHold(ownerUsername))
+        return false;
+    if (journalFailed())
+    {
+        reportNotSaved();
+        return false;
+    }
+    uint64_t sequence = 0;
+    int accNo = openAccount(name, balance, type, ownerUsername, sequence);
+    if (!accNo)
+    {
+        cout << "No account numbers are left.\n";
+        return false;
+    }
+    if (!durable(sequence))
+    {
+        reportNotSaved();
+        return false;
+    }
+    cout << "Account created successfully! Account Number: " << accNo << endl;
+    return true;
+}
+
+int Manager::openAccount(const string &name, Money balance, const string &type, const string &ownerUsername,
+                         uint64_t &sequence)
+{
+    unique_lock<shared_mutex> writeLock(indexLock);
+    int accNo = nextAccNo;
+    if (accNo >= accNoEnd)
+        return 0;
+    JournalRecord rec(JOURNAL_CREATE_ACCOUNT, accNo, 0, balance);
+    if (journal)
+    {
+        JournalRecord::setField(rec.name, JOURNAL_NAME_LEN, name);
+        JournalRecord::setField(rec.type, JOURNAL_TYPE_LEN, type);
+        JournalRecord::setField(rec.username, JOURNAL_USER_LEN, ownerUsername);
+        sequence = journal->enqueue(rec);
+    }
+    insertAccount(accNo, name, balance, type, ownerUsername, (time_t)rec.timestamp);
+    return accNo;
+}
+
+bool Manager::modifyAccount(Account &acc, const string &name, const string &type)
+{
+    if (journalFailed())
+    {
+        reportNotSaved();
+        return false;
+    }
+    uint64_t sequence = 0;
+    {
+        lock_guard<RecordMutex> hold(acc.mutex());
+        if (journal)
+        {
+            JournalRecord rec(JOURNAL_MODIFY_ACCOUNT, acc.getAccountNumber());
+            JournalRecord::setField(rec.name, JOURNAL_NAME_LEN, name);
+            JournalRecord::setField(rec.type, JOURNAL_TYPE_LEN, type);
+            sequence = journal->enqueue(rec);
+        }
+        acc.setDetails(name, type);
+    }
+    if (!durable(sequence))
+    {
+        reportNotSaved();
+        return false;
+    }
+    cout << "Account modified successfully.\n";
+    return true;
+}
+
+vector<Account> Manager::getUserAccounts(string username)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    vector<Account> result;
+    auto owned = accountsByOwner.find(username);
+    if (owned == accountsByOwner.end())
+        return result;
+    result.reserve(owned->second.size());
+    for (int accNo : owned->second)
+    {
+        Account *acc = lookupAccount(accNo);
+        lock_guard<RecordMutex> hold(acc->mutex());
+        result.push_back(*acc);
+    }
+    return result;
+}
+
+int Manager::firstUserAccount(const string &username)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    auto owned = accountsByOwner.find(username);
+    return owned == accountsByOwner.end() ? 0 : owned->second.front();
+}
+
+Account *Manager::findAccount(int accNo, string username, bool isManager)
+{
+    METRIC_TIME(METRIC_FIND_ACCOUNT);
+    shared_lock<shared_mutex> readLock(indexLock);
+    Account *acc = lookupAccount(accNo);
+    if (acc && (isManager || acc->getOwnerUsername() == username))
+        return acc;
+    return nullptr;
+}
+
+SessionToken Manager::openSession(const User &user)
+{
+    static const vector<int> none;
+    shared_lock<shared_mutex> readLock(indexLock); // ownership can't change while the cache fills
+    auto owned = accountsByOwner.find(user.username);
+    auto borrowed = loansByBorrower.find(user.username);
+    return sessions.open(user.username, user.isManager(), owned == accountsByOwner.end() ? none : owned->second,
+                         borrowed == loansByBorrower.end() ? none : borrowed->second);
+}
+
+bool Manager::permits(const SessionToken &session, const Account &acc) const
+{
+    return sessions.permits(session, SESSION_ACCOUNT, acc.getAccountNumber(), acc.getOwnerUsername());
+}
+
+bool Manager::permits(const SessionToken &session, const Loan &loan) const
+{
+    return sessions.permits(session, SESSION_LOAN, loan.getLoanID(), loan.getBorrowerUsername());
+}
+
+Account *Manager::findAccount(int accNo, const SessionToken &session)
+{
+    METRIC_TIME(METRIC_FIND_ACCOUNT);
+    shared_lock<shared_mutex> readLock(indexLock);
+    Account *acc = lookupAccount(accNo);
+    return acc && permits(session, *acc) ? acc : nullptr;
+}
+
+bool Manager::queryHistory(int accNo, const string &username, bool isManager, const HistoryQuery &query,
+                           HistoryPage &page)
+{
+    bool allowed = false;
+    withAccount(accNo, [&](Account &acc)
+    {
+        if (!isManager && acc.getOwnerUsername() != username)
+            return;
+        lock_guard<RecordMutex> hold(acc.mutex());
+        page = acc.queryHistory(query);
+        allowed = true;
+    });
+    return allowed;
+}
+
+bool Manager::queryHistory(int accNo, const SessionToken &session, const HistoryQuery &query, HistoryPage &page)
+{
+    bool allowed = false;
+    withAccount(accNo, [&](Account &acc)
+    {
+        if (!permits(session, acc))
+            return;
+        lock_guard<RecordMutex> hold(acc.mutex());
+        page = acc.queryHistory(query);
+        allowed = true;
+    });
+    return allowed;
+}
+
+Manager::AccountHandle Manager::getAccountHandle(int accNo)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    auto it = accountIndex.find(accNo);
+    return it == accountIndex.end() ? AccountHandle() : it->second;
+}
+
+Account *Manager::resolve(AccountHandle handle)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    return accounts.get(handle);
+}
+
+size_t Manager::pageOutHistory()
+{
+    HistoryTier &tier = HistoryTier::instance();
+    if (!tier.isOpen())
+        return 0;
+    const HistoryTier::Options &options = tier.config();
+    HistoryArena &arena = HistoryArena::instance();
+    uint32_t pass = tier.advance();
+    size_t live = arena.liveBytes();
+    bool trim = pass % options.trimEveryPasses == 0;
+    if (live <= options.memoryBudget && !trim)
+        return 0;
+
+    vector<TransactionRecord *> retired;
+    {
+        shared_lock<shared_mutex> readLock(indexLock);
+        // acc is null for the global history, which globalLock guards instead
+        struct Candidate
+        {
+            uint32_t lastUse;
+            TransactionLog *log;
+            Account *acc;
+        };
+        auto locked = [&](Account *acc, auto fn)
+        {
+            if (acc)
+            {
+                lock_guard<RecordMutex> hold(acc->mutex());
+                fn();
+            }
+            else
+            {
+                lock_guard<mutex> hold(globalLock);
+                fn();
+            }
+        };
+        vector<Candidate> candidates;
+        auto consider = [&](TransactionLog &log, Account *acc)
+        {
+            size_t pageable = 0;
+            locked(acc, [&]
+            {
+                if (trim)
+                    log.trimCold(pass - options.trimEveryPasses);
+                pageable = log.pageable(options.hotChunks);
+            });
+            if (pageable > 0)
+                candidates.push_back({log.lastUse(), &log, acc});
+        };
+        accounts.forEach([&](Account &acc) { consider(acc.getTransactionLog(), &acc); });
+        consider(transactions, nullptr);
+        if (live <= options.memoryBudget)
+            return 0;
+        sort(candidates.begin(), candidates.end(),
+             [](const Candidate &a, const Candidate &b) { return a.lastUse < b.lastUse; });
+
+        size_t wanted = min(live - options.memoryBudget / 10 * 9, options.maxPageOutBytes);
+        size_t chunkCount = 0;
+        vector<pair<Candidate, size_t>> plan;
+        for (const Candidate &c : candidates)
+        {
+            if (chunkCount * HistoryArena::LARGE_BYTES >= wanted)
+                break;
+            size_t n = 0;
+            locked(c.acc, [&] { n = c.log->pageable(options.hotChunks); });
+            plan.push_back({c, n});
+            chunkCount += n;
+        }
+        if (plan.empty())
+            return 0;
+
+        // Full chunks never change, so they can be written without the account locks
+        vector<const TransactionRecord *> sources;
+        sources.reserve(chunkCount);
+        for (const auto &[c, n] : plan)
+            locked(c.acc, [&, &c = c, n = n]
+            {
+                for (size_t i = 0; i < n; ++i)
+                    sources.push_back(c.log->chunk(c.log->coldChunks() + i));
+            });
+        vector<TransactionRecord *> mapped(sources.size());
+        if (!tier.write(sources.data(), sources.size(), mapped.data()))
+        {
+            cout << "History tier: could not write to " << options.directory << "\n";
+            return 0;
+        }
+        size_t next = 0;
+        for (const auto &[c, n] : plan)
+        {
+            locked(c.acc, [&, &c = c, n = n] { c.log->demote(n, mapped.data() + next, retired); });
+            next += n;
+        }
+    }
+    // Reports read histories under the shared lock alone; once it has
+    // drained, nothing can still be reading the old chunks
+    whileQuiescent([] {});
+    arena.discard(retired);
+    METRIC_COUNT(COUNTER_HISTORY_PAGED_OUT, retired.size());
+    return retired.size();
+}
+
+bool Manager::closeAccount(int accNo, string username, bool isManager)
+{
+    if (journalFailed())
+    {
+        reportNotSaved();
+        return false;
+    }
+    uint64_t sequence = 0;
+    {
+        unique_lock<shared_mutex> writeLock(indexLock);
+        Account *acc = lookupAccount(accNo);
+        if (!acc || !(isManager || acc->getOwnerUsername() == username))
+        {
+            cout << "Account not found or permission denied.\n";
+            return false;
+        }
+
+        if (journal)
+            sequence = journal->enqueue(JournalRecord(JOURNAL_CLOSE_ACCOUNT, accNo));
+        removeAccount(accNo);
+    }
+    if (!durable(sequence))
+    {
+        reportNotSaved();
+        return false;
+    }
+    cout << "Account closed successfully.\n";
+    return true;
+}
+
+void Manager::showAllAccounts()
+{
+    if (!writeReport(STDOUT_FILENO, REPORT_TEXT, REPORT_ACCOUNTS))
+        cout << "No accounts available.\n";
+}
+
+bool Manager::totalBalance(Money &total)
+{
+    vector<int64_t> paise;
+    whileQuiescent([&]
+    {
+        paise.reserve(accounts.size());
+        accounts.forEach([&](Account &acc) { paise.push_back(acc.getBalance().paise()); });
+    });
+    return Money::sum(paise.data(), paise.size(), total);
+}
+
+bool Manager::applyLoan(const string &name, const string &username, Money principal, int tenure)
+{
+    if (!journalCanHold(username))
+        return false;
+    if (journalFailed())
+    {
+        reportNotSaved();
+        return false;
+    }
+    uint64_t sequence = 0;
+    int loanID = openLoan(name, username, principal, tenure, sequence);
+    if (!loanID)
+    {
+        cout << "No loan IDs are left.\n";
+        return false;
+    }
+    if (!durable(sequence))
+    {
+        reportNotSaved();
+        return false;
+    }
+    cout << "Loan application successful! Loan ID: " << loanID << endl;
+    return true;
+}
+
+int Manager::openLoan(const string &name, const string &username, Money principal, int tenure, uint64_t &sequence)
+{
+    unique_lock<shared_mutex> writeLock(indexLock);
+    const double rate = loanRate;
+    int loanID = nextLoanID;
+    if (loanID >= loanIDEnd)
+        return 0;
+    JournalRecord rec(JOURNAL_APPLY_LOAN, 0, loanID, principal);
+    if (journal)
+    {
+        rec.rate = rate;
+        rec.tenure = tenure;
+        JournalRecord::setField(rec.name, JOURNAL_NAME_LEN, name);
+        JournalRecord::setField(rec.username, JOURNAL_USER_LEN, username);
+        sequence = journal->enqueue(rec);
+    }
+    insertLoan(loanID, name, username, principal, tenure, rate, (time_t)rec.timestamp);
+    return loanID;
+}
+
+bool Manager::payLoan(Loan &loan, Money amount, Account *recordIn, Money &remaining)
+{
+    if (journalFailed())
+        return false;
+    uint64_t sequence = 0;
+    remaining = payLoan(loan, amount, recordIn, sequence);
+    return durable(sequence);
+}
+
+Money Manager::payLoan(Loan &loan, Money amount, Account *recordIn, uint64_t &sequence)
+{
+    int accNo = recordIn ? recordIn->getAccountNumber() : 0;
+    Money remaining;
+    JournalRecord rec(JOURNAL_LOAN_PAYMENT, accNo, loan.getLoanID(), amount);
+    {
+        METRIC_TIME(METRIC_LOAN_PAYMENT); // replay calls Loan::makePayment directly and isn't counted
+        // Also keeps a snapshot from forking between the payment and its
+        // history row. Locks are taken loan first, then account
+        shared_lock<shared_mutex> readLock(indexLock); // orders payments against repriceLoans and closeMonth
+        lock_guard<RecordMutex> hold(loan.mutex());
+        if (journal)
+            sequence = journal->enqueue(rec);
+        loan.makePayment(amount, (time_t)rec.timestamp);
+        remaining = loan.getBalance();
+        if (recordIn)
+        {
+            lock_guard<RecordMutex> holdAccount(recordIn->mutex());
+            recordTransaction(*recordIn, TransactionRecord(accNo, TX_LOAN_PAYMENT, amount, (time_t)rec.timestamp));
+        }
+    }
+    return remaining;
+}
+
+bool Manager::repriceLoans(double newRate)
+{
+    if (journalFailed())
+        return false;
+    uint64_t sequence = 0;
+    {
+        unique_lock<shared_mutex> writeLock(indexLock);
+        JournalRecord rec(JOURNAL_REPRICE_LOANS, 0);
+        rec.rate = newRate;
+        if (journal)
+            sequence = journal->enqueue(rec);
+        repriceLocked(newRate, (time_t)rec.timestamp);
+    }
+    return durable(sequence);
+}
+
+double Manager::getLoanRate()
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    return loanRate;
+}
+
+double Manager::getSavingRate()
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    return savingRate;
+}
+
+bool Manager::closeMonth(int period, size_t &credited, Money &paid)
+{
+    int32_t endDay = periodEnd(period);
+    if (endDay < 0 || endDay > dayNumber(time(nullptr)) || journalFailed())
+        return false;
+    uint64_t sequence = 0;
+    {
+        unique_lock<shared_mutex> writeLock(indexLock);
+        if (period <= lastClosedPeriod)
+            return false;
+        JournalRecord rec(JOURNAL_MONTH_END, 0);
+        rec.counterparty = period;
+        rec.rate = savingRate;
+        if (journal)
+            sequence = journal->enqueue(rec);
+        closeMonthLocked(period, savingRate, (time_t)rec.timestamp, &credited, &paid);
+    }
+    return durable(sequence);
+}
+
+int Manager::getLastClosedPeriod()
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    return lastClosedPeriod;
+}
+
+bool Manager::loanSchedule(int loanID, const string &username, bool isManager, vector<LoanEngine::ScheduleRow> &rows)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    Loan *loan = lookupLoan(loanID);
+    if (!loan || !(isManager || loan->getBorrowerUsername() == username))
+        return false;
+    LoanEngine::Book book;
+    vector<Loan *> refs;
+    {
+        lock_guard<RecordMutex> hold(loan->mutex());
+        gatherLoans(book, refs, loanID);
+    }
+    if (book.size() == 0)
+        return false;
+    vector<size_t> offsets;
+    loanEngine.schedules(book, offsets, rows);
+    return true;
+}
+
+vector<Loan> Manager::getUserLoans(string username)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    vector<Loan> result;
+    auto owned = loansByBorrower.find(username);
+    if (owned == loansByBorrower.end())
+        return result;
+    result.reserve(owned->second.size());
+    for (int loanID : owned->second)
+    {
+        Loan *loan = lookupLoan(loanID);
+        lock_guard<RecordMutex> hold(loan->mutex());
+        result.push_back(*loan);
+    }
+    return result;
+}
+
+Loan *Manager::findLoan(int loanID, string username, bool isManager)
+{
+    METRIC_TIME(METRIC_FIND_LOAN);
+    shared_lock<shared_mutex> readLock(indexLock);
+    Loan *loan = lookupLoan(loanID);
+    if (loan && (isManager || loan->getBorrowerUsername() == username))
+        return loan;
+    return nullptr;
+}
+
+Loan *Manager::findLoan(int loanID, const SessionToken &session)
+{
+    METRIC_TIME(METRIC_FIND_LOAN);
+    shared_lock<shared_mutex> readLock(indexLock);
+    Loan *loan = lookupLoan(loanID);
+    return loan && permits(session, *loan) ? loan : nullptr;
+}
+
+void Manager::showAllLoans()
+{
+    if (!writeReport(STDOUT_FILENO, REPORT_TEXT, REPORT_LOANS))
+        cout << "No loans available.\n";
+}
+
+bool Manager::writeReport(int fd, ReportFormat format, unsigned sections)
+{
+    shared_lock<shared_mutex> readLock(indexLock);
+    bool any = ((sections & (REPORT_ACCOUNTS | REPORT_TRANSACTIONS)) && !accounts.empty()) ||
+               ((sections & REPORT_LOANS) && !loans.empty());
+    if (!any)
+        return false;
+    cout.flush(); // keep console output in order when fd is stdout
+    ReportWriter writer(fd, format);
+    if (sections & REPORT_ACCOUNTS)
+    {
+        writer.beginAccounts();
+        accounts.forEach([&](Account &acc) { writer.account(acc); });
+    }
+    if (sections & REPORT_LOANS)
+    {
+        writer.beginLoans();
+        loans.forEach([&](Loan &loan) { writer.loan(loan); });
+    }
+    if (sections & REPORT_TRANSACTIONS)
+    {
+        writer.beginTransactions();
+        accounts.forEach([&](Account &acc) { writer.transactions(acc.getTransactionLog()); });
+    }
+    return writer.flush();
+}
+
+bool Manager::exportReport(const string &path, ReportFormat format)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = writeReport(fd, format, REPORT_ACCOUNTS | REPORT_LOANS | REPORT_TRANSACTIONS);
+    ::close(fd);
+    return ok;
+}
+
+size_t Manager::refreshAnalytics(ColumnStore &store)
+{
+    shared_lock<shared_mutex> readLock(indexLock); // also keeps paged-out chunks' memory in place
+    unique_lock<shared_mutex> storeLock(store.mutex());
+    struct Run
+    {
+        const TransactionRecord *records;
+        size_t count;
+        uint32_t row;
+        size_t at; // position among the added transactions
+    };
+    vector<Run> runs;
+    vector<pair<uint32_t, uint64_t>> copied;
+    size_t added = 0;
+    store.beginAccounts();
+    accounts.forEach([&](Account &acc)
+    {
+        lock_guard<RecordMutex> hold(acc.mutex());
+        uint64_t have = 0;
+        uint32_t row = store.account(acc.getAccountNumber(), acc.getBalance(), acc.getAccountType(),
+                                     acc.getOwnerUsername(), have);
+        const TransactionLog &log = acc.getTransactionLog();
+        if (log.size() <= have)
+            return;
+        // Records before size() never change, so their runs can be read unlocked
+        log.forEachRunFrom(have, [&](const TransactionRecord *records, size_t n)
+        {
+            runs.push_back({records, n, row, added});
+            added += n;
+        });
+        copied.push_back({row, log.size() - have});
+    });
+
+    size_t first = store.reserveTransactions(added);
+    parallelFor(runs.size(), max(1u, thread::hardware_concurrency()), 1 << 12, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            store.putTransactions(first + runs[i].at, runs[i].row, runs[i].records, runs[i].count);
+    });
+    store.finishTransactions(first, copied);
+
+    store.beginLoans(loans.size());
+    size_t i = 0;
+    loans.forEach([&](Loan &loan)
+    {
+        lock_guard<RecordMutex> hold(loan.mutex());
+        store.setLoan(i++, loan.getLoanID(), loan.getBorrowerUsername(), loan.getPrincipal(), loan.getBalance());
+    });
+    return added;
+}
+
+bool Manager::saveSnapshot(const string &path, uint64_t journalSequence, bool portable)
+{
+    string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.journalSequence = journalSequence;
+    header.nextAccNo = nextAccNo;
+    header.nextLoanID = nextLoanID;
+    header.loanRate = loanRate;
+    header.savingRate = savingRate;
+    header.lastClosedPeriod = lastClosedPeriod;
+    header.accountCount = accounts.size();
+    header.loanCount = loans.size();
+    auto inlineCount = [&](const TransactionLog &log) { return portable ? log.size() : log.hotSize(); };
+    auto coldCount = [&](const TransactionLog &log) { return portable ? 0 : log.coldChunks(); };
+    accounts.forEach([&](Account &acc)
+    {
+        header.transactionCount += inlineCount(acc.getTransactionLog());
+        header.coldChunkCount += coldCount(acc.getTransactionLog());
+    });
+    header.accountsOffset = sizeof(SnapshotHeader);
+    header.loansOffset = header.accountsOffset + header.accountCount * sizeof(SnapshotAccount);
+    header.transactionsOffset = header.loansOffset + header.loanCount * sizeof(SnapshotLoan);
+    header.coldChunksOffset = header.transactionsOffset + header.transactionCount * sizeof(TransactionRecord);
+    header.stringsOffset = header.coldChunksOffset + header.coldChunkCount * sizeof(SnapshotColdChunk);
+
+    // Owner names and transaction types repeat heavily, so store each once
+    string pool;
+    unordered_map<string, SnapshotString> interned;
+    auto addString = [&](const string &value)
+    {
+        SnapshotString ref = {(uint32_t)pool.size(), (uint32_t)value.size()};
+        pool += value;
+        return ref;
+    };
+    auto internString = [&](const string &value)
+    {
+        auto it = interned.find(value);
+        if (it != interned.end())
+            return it->second;
+        return interned[value] = addString(value);
+    };
+
+    SnapshotSink sink(fd);
+    sink.put(&header, sizeof(header)); // rewritten once the string pool size is known
+    sink.resetChecksum();
+
+    uint64_t transactionOffset = 0, coldChunkOffset = 0;
+    accounts.forEach([&](Account &acc)
+    {
+        SnapshotAccount rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.accountNumber = acc.getAccountNumber();
+        rec.balance = acc.getBalance().paise();
+        rec.name = addString(acc.getName());
+        rec.type = internString(acc.getAccountType());
+        rec.owner = internString(acc.getOwnerUsername());
+        rec.transactionOffset = transactionOffset;
+        rec.transactionCount = inlineCount(acc.getTransactionLog());
+        rec.coldChunkOffset = coldChunkOffset;
+        rec.coldChunkCount = coldCount(acc.getTransactionLog());
+        rec.accrual = SnapshotAccrual::from(acc.getAccrual());
+        transactionOffset += rec.transactionCount;
+        coldChunkOffset += rec.coldChunkCount;
+        sink.put(&rec, sizeof(rec));
+    });
+
+    loans.forEach([&](Loan &loan)
+    {
+        SnapshotLoan rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.loanID = loan.getLoanID();
+        rec.tenureMonths = loan.getTenureMonths();
+        rec.principal = loan.getPrincipal().paise();
+        rec.rate = loan.getRate();
+        rec.emi = loan.getEmi().paise();
+        rec.outstanding = loan.getOutstanding().paise();
+        rec.interestDue = loan.getInterestDue().paise();
+        rec.monthsLeft = loan.getMonthsLeft();
+        rec.name = addString(loan.getBorrowerName());
+        rec.username = internString(loan.getBorrowerUsername());
+        rec.accrual = SnapshotAccrual::from(loan.getAccrual());
+        sink.put(&rec, sizeof(rec));
+    });
+
+    accounts.forEach([&](Account &acc)
+    {
+        auto put = [&](const TransactionRecord *records, size_t n) { sink.put(records, n * sizeof(TransactionRecord)); };
+        if (portable)
+            acc.getTransactionLog().forEachRunFrom(0, put);
+        else
+            acc.getTransactionLog().forEachHotRun(put);
+    });
+
+    // Cold chunks are already durable in their segments; only where they are goes in
+    bool located = true;
+    HistoryTier &tier = HistoryTier::instance();
+    accounts.forEach([&](Account &acc)
+    {
+        const TransactionLog &log = acc.getTransactionLog();
+        for (size_t c = 0; c < coldCount(log); ++c)
+        {
+            HistoryTier::Location at = {0, 0};
+            located = tier.locate(log.chunk(c), at) && located;
+            SnapshotColdChunk ref = {at.segment, at.index};
+            sink.put(&ref, sizeof(ref));
+        }
+    });
+
+    sink.put(pool.data(), pool.size());
+    header.stringBytes = pool.size();
+    header.bodyChecksum = sink.checksum();
+    header.headerChecksum = crc32(&header, offsetof(SnapshotHeader, headerChecksum));
+
+    bool ok = located && pool.size() <= UINT32_MAX && sink.flush() &&
+              pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fdatasync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Manager::loadSnapshot(const string &path, uint64_t &journalSequence)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, size, MADV_SEQUENTIAL);
+    unique_lock<shared_mutex> writeLock(indexLock);
+
+    const char *base = static_cast<const char *>(map);
+    const SnapshotHeader &header = *reinterpret_cast<const SnapshotHeader *>(base);
+    // The sections must tile the file exactly. Each count is bounded by the
+    // file size first, so the products below can't wrap.
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.headerChecksum == crc32(&header, offsetof(SnapshotHeader, headerChecksum)) &&
+                 header.accountCount <= size / sizeof(SnapshotAccount) &&
+                 header.loanCount <= size / sizeof(SnapshotLoan) &&
+                 header.transactionCount <= size / sizeof(TransactionRecord) &&
+                 header.coldChunkCount <= size / sizeof(SnapshotColdChunk) &&
+                 header.stringBytes <= size &&
+                 header.accountsOffset == sizeof(SnapshotHeader) &&
+                 header.loansOffset == header.accountsOffset + header.accountCount * sizeof(SnapshotAccount) &&
+                 header.transactionsOffset == header.loansOffset + header.loanCount * sizeof(SnapshotLoan) &&
+                 header.coldChunksOffset == header.transactionsOffset + header.transactionCount * sizeof(TransactionRecord) &&
+                 header.stringsOffset == header.coldChunksOffset + header.coldChunkCount * sizeof(SnapshotColdChunk) &&
+                 header.stringsOffset + header.stringBytes == size &&
+                 header.bodyChecksum == crc32(base + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader));
+    // Every cold chunk must map before anything is loaded: a missing segment
+    // fails the snapshot rather than leaving holes in histories
+    const SnapshotColdChunk *coldRefs = reinterpret_cast<const SnapshotColdChunk *>(base + header.coldChunksOffset);
+    vector<TransactionRecord *> coldChunks(valid ? header.coldChunkCount : 0);
+    for (size_t i = 0; i < coldChunks.size() && valid; ++i)
+        valid = (coldChunks[i] = HistoryTier::instance().map({coldRefs[i].segment, coldRefs[i].index})) != nullptr;
+    if (!valid)
+    {
+        munmap(map, size);
+        return false;
+    }
+
+    const char *strings = base + header.stringsOffset;
+    auto text = [&](SnapshotString ref)
+    {
+        if ((uint64_t)ref.offset + ref.length > header.stringBytes)
+            return string();
+        return string(strings + ref.offset, ref.length);
+    };
+
+    const SnapshotAccount *accountRecs = reinterpret_cast<const SnapshotAccount *>(base + header.accountsOffset);
+    const SnapshotLoan *loanRecs = reinterpret_cast<const SnapshotLoan *>(base + header.loansOffset);
+    const TransactionRecord *txRecs = reinterpret_cast<const TransactionRecord *>(base + header.transactionsOffset);
+
+    accountIndex.reserve(header.accountCount);
+    loanIndex.reserve(header.loanCount);
+    for (uint64_t i = 0; i < header.accountCount; ++i)
+    {
+        const SnapshotAccount &rec = accountRecs[i];
+        Account *acc = insertAccount(rec.accountNumber, text(rec.name), Money::fromPaise(rec.balance), text(rec.type),
+                                     text(rec.owner), 0);
+        acc->restoreAccrual(rec.accrual.toAccrual());
+        if (rec.transactionOffset > header.transactionCount ||
+            rec.transactionCount > header.transactionCount - rec.transactionOffset ||
+            rec.coldChunkOffset > header.coldChunkCount ||
+            rec.coldChunkCount > header.coldChunkCount - rec.coldChunkOffset)
+            continue;
+        // The head chunk, then the cold chunks, then whatever was in memory after them
+        const TransactionRecord *hot = txRecs + rec.transactionOffset;
+        size_t headCount = rec.coldChunkCount ? min<uint64_t>(rec.transactionCount, HistoryArena::SMALL_CHUNK)
+                                              : rec.transactionCount;
+        acc->appendTransactions(hot, headCount);
+        TransactionLog &log = acc->getTransactionLog();
+        for (uint64_t c = 0; c < rec.coldChunkCount; ++c)
+            log.appendCold(coldChunks[rec.coldChunkOffset + c]);
+        acc->appendTransactions(hot + headCount, rec.transactionCount - headCount);
+    }
+    for (uint64_t i = 0; i < header.loanCount; ++i)
+    {
+        const SnapshotLoan &rec = loanRecs[i];
+        string username = text(rec.username);
+        loanIndex[rec.loanID] = loans.insert(Loan::restore(rec.loanID, text(rec.name), username,
+                                                           Money::fromPaise(rec.principal), rec.rate, rec.tenureMonths,
+                                                           Money::fromPaise(rec.emi), Money::fromPaise(rec.outstanding),
+                                                           Money::fromPaise(rec.interestDue), rec.monthsLeft,
+                                                           rec.accrual.toAccrual()));
+        loansByBorrower[username].push_back(rec.loanID);
+    }
+    nextAccNo = max(nextAccNo, (int)header.nextAccNo);
+    nextLoanID = max(nextLoanID, (int)header.nextLoanID);
+    loanRate = header.loanRate;
+    savingRate = header.savingRate;
+    lastClosedPeriod = header.lastClosedPeriod;
+    journalSequence = header.journalSequence;
+
+    munmap(map, size);
+    return true;
+}
+
+void Manager::recordGlobalTransactions(const TransactionRecord *records, size_t count)
+{
+    lock_guard<mutex> hold(globalLock);
+    for (size_t i = 0; i < count; ++i)
+        transactions.push_back(records[i]);
+}
+
+void Manager::showAllTransactions()
+{
+    if (ledger)
+        ledger->flush();
+    shared_lock<shared_mutex> readLock(indexLock); // keeps paged-out chunks alive, as for reports
+    // Appends never move records, so the runs can be written without globalLock
+    vector<pair<const TransactionRecord *, size_t>> runs;
+    {
+        lock_guard<mutex> hold(globalLock);
+        transactions.forEachRunFrom(0, [&](const TransactionRecord *records, size_t n) { runs.push_back({records, n}); });
+    }
+    if (runs.empty())
+    {
+        cout << "No transactions have been recorded.\n";
+        return;
+    }
+    cout.flush();
+    ReportWriter writer(STDOUT_FILENO, REPORT_TEXT);
+    for (const auto &[records, n] : runs)
+        for (size_t i = 0; i < n; ++i)
+            writer.transaction(records[i]);
+    writer.flush();
+}
+
+// =========================
+// Snapshotter Class
+// =========================
+bool Snapshotter::inProgress()
+{
+    if (child > 0 && waitpid(child, nullptr, WNOHANG) == child)
+        child = -1;
+    return child > 0;
+}
+
+bool Snapshotter::start(Manager &manager, Journal *journal, uint64_t journalSequence)
+{
+    if (inProgress())
+        return false;
+    pid_t pid = -1;
+    manager.whileQuiescent([&]
+    {
+        if (journal)
+            journalSequence = journal->lastSequence();
+        pid = fork();
+    });
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+        _exit(manager.saveSnapshot(options.path, journalSequence, options.portable) ? 0 : 1);
+    child = pid;
+    coveredSequence = journalSequence;
+    return true;
+}
+
+void Snapshotter::maybeSnapshot(Manager &manager, Journal &journal)
+{
+    if (!journal.isOpen() || inProgress())
+        return;
+    if (journal.lastSequence() - coveredSequence >= options.everyRecords)
+        start(manager, &journal);
+}
+
+bool Snapshotter::wait()
+{
+    int status = 0;
+    bool ok = child <= 0 || (waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    child = -1;
+    return ok;
+}
+
+// =========================
+// ShardedManager Class
+// =========================
+ShardedManager::Request ShardedManager::transfer(int fromAccNo, int toAccNo, Money amount, Ticket *ticket)
+{
+    return {OP_TRANSFER, fromAccNo, toAccNo, amount, nullptr, ticket, 0};
+}
+
+ShardedManager::ShardedManager(const Options &opts)
+{
+    unsigned count = min(max(opts.shards, 1u), MAX_SHARDS);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        shards.emplace_back(new Shard);
+        shards.back()->manager.setIdRange(1001 + (int)i * ACCOUNTS_PER_SHARD, 1 + (int)i * LOANS_PER_SHARD,
+                                          ACCOUNTS_PER_SHARD);
+        shards.back()->transaction.setLinkIDs(i + 1, count);
+    }
+    for (auto &shard : shards)
+        shard->worker = thread(&ShardedManager::run, this, ref(*shard));
+}
+
+int ShardedManager::shardOfAccount(int accNo) const
+{
+    if (accNo < 1001)
+        return -1;
+    unsigned index = (unsigned)(accNo - 1001) / ACCOUNTS_PER_SHARD;
+    return index < shards.size() ? (int)index : -1;
+}
+
+int ShardedManager::shardOfLoan(int loanID) const
+{
+    if (loanID < 1)
+        return -1;
+    unsigned index = (unsigned)(loanID - 1) / LOANS_PER_SHARD;
+    return index < shards.size() ? (int)index : -1;
+}
+
+Manager *ShardedManager::accountShard(int accNo)
+{
+    int index = shardOfAccount(accNo);
+    return index < 0 ? nullptr : &shards[index]->manager;
+}
+
+Manager *ShardedManager::loanShard(int loanID)
+{
+    int index = shardOfLoan(loanID);
+    return index < 0 ? nullptr : &shards[index]->manager;
+}
+
+int ShardedManager::openAccount(const string &name, Money balance, const string &type, const string &ownerUsername)
+{
+    uint64_t sequence = 0;
+    return shards[shardOfOwner(ownerUsername)]->manager.openAccount(name, balance, type, ownerUsername, sequence);
+}
+
+int ShardedManager::openLoan(const string &name, const string &username, Money principal, int tenure)
+{
+    uint64_t sequence = 0;
+    return shards[shardOfOwner(username)]->manager.openLoan(name, username, principal, tenure, sequence);
+}
+
+bool ShardedManager::totalBalance(Money &total)
+{
+    total = Money();
+    for (auto &shard : shards)
+    {
+        Money part;
+        if (!shard->manager.totalBalance(part) || !total.checkedAdd(part, total) ||
+            !total.checkedAdd(Money::fromPaise(shard->suspense.load(memory_order_relaxed)), total))
+            return false;
+    }
+    return true;
+}
+
+Money ShardedManager::suspense(unsigned index) const
+{
+    return Money::fromPaise(shards[index]->suspense.load(memory_order_relaxed));
+}
+
+void ShardedManager::submit(const Request *requests, size_t count)
+{
+    static thread_local vector<vector<Request>> groups;
+    groups.resize(shards.size());
+    inFlight.fetch_add(count, memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Request &request = requests[i];
+        if (request.ticket)
+            request.ticket->pending.fetch_add(1, memory_order_relaxed);
+        int index = shardOfAccount(request.accNo);
+        if (index < 0)
+            finish(request, false);
+        else
+            groups[index].push_back(request);
+    }
+    for (size_t s = 0; s < groups.size(); ++s)
+    {
+        if (groups[s].empty())
+            continue;
+        enqueue(*shards[s], groups[s].data(), groups[s].size());
+        groups[s].clear();
+    }
+}
+
+void ShardedManager::stop()
+{
+    if (stopped)
+        return;
+    while (inFlight.load(memory_order_acquire) > 0)
+        this_thread::sleep_for(chrono::microseconds(100));
+    for (auto &shard : shards)
+    {
+        lock_guard<mutex> hold(shard->lock);
+        shard->stopping = true;
+        shard->wakeup.notify_one();
+    }
+    for (auto &shard : shards)
+        shard->worker.join();
+    stopped = true;
+}
+
+void ShardedManager::enqueue(Shard &shard, const Request *requests, size_t count)
+{
+    bool wake;
+    {
+        lock_guard<mutex> hold(shard.lock);
+        shard.queue.insert(shard.queue.end(), requests, requests + count);
+        wake = shard.idle;
+        shard.idle = false;
+    }
+    if (wake)
+        shard.wakeup.notify_one();
+}
+
+void ShardedManager::finish(const Request &request, bool ok)
+{
+    if (request.ticket)
+    {
+        if (!ok)
+            request.ticket->failed.fetch_add(1, memory_order_relaxed);
+        request.ticket->pending.fetch_sub(1, memory_order_release);
+    }
+    inFlight.fetch_sub(1, memory_order_release);
+}
+
+void ShardedManager::run(Shard &shard)
+{
+    vector<Request> batch;
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(shard.lock);
+            while (shard.queue.empty() && !shard.stopping)
+            {
+                shard.idle = true;
+                shard.wakeup.wait(guard);
+            }
+            shard.idle = false;
+            if (shard.queue.empty())
+                return;
+            batch.swap(shard.queue);
+        }
+        for (const Request &request : batch)
+            execute(shard, request);
+        batch.clear();
+    }
+}
+
+void ShardedManager::execute(Shard &shard, const Request &request)
+{
+    Manager &manager = shard.manager;
+    Transaction &transaction = shard.transaction;
+    bool ok = false;
+    switch (request.op)
+    {
+    case OP_DEPOSIT:
+        ok = transaction.deposit(manager, request.accNo, request.amount);
+        break;
+    case OP_WITHDRAW:
+        ok = transaction.withdraw(manager, request.accNo, request.amount);
+        break;
+    case OP_BALANCE:
+        ok = manager.withAccount(request.accNo, [&](Account &acc) { *request.balance = transaction.balance(acc); });
+        break;
+    case OP_TRANSFER:
+    {
+        int to = shardOfAccount(request.counterparty);
+        if (to < 0)
+            break;
+        if (shards[to].get() == &shard)
+        {
+            ok = transaction.transfer(manager, request.accNo, request.counterparty, request.amount);
+            break;
+        }
+        Request credit = request;
+        credit.op = OP_CREDIT;
+        credit.linkID = transaction.newLinkID();
+        bool debited = false;
+        manager.withAccount(request.accNo, [&](Account &acc)
+                            { debited = transaction.postTransferLeg(acc, TX_TRANSFER_OUT, request.amount, credit.linkID); });
+        if (!debited)
+            break;
+        enqueue(*shards[to], &credit, 1);
+        return; // the destination finishes it
+    }
+    case OP_CREDIT:
+    {
+        manager.withAccount(request.counterparty, [&](Account &acc)
+                            { ok = transaction.postTransferLeg(acc, TX_TRANSFER_IN, request.amount, request.linkID); });
+        if (ok)
+            break;
+        Request refund = request;
+        refund.op = OP_REFUND;
+        enqueue(*shards[shardOfAccount(request.accNo)], &refund, 1);
+        return; // the source finishes it
+    }
+    case OP_REFUND:
+    {
+        // The transfer has failed either way. The money goes back, or into
+        // suspense if the account closed or can't take it meanwhile.
+        bool refunded = false;
+        manager.withAccount(request.accNo, [&](Account &acc)
+                            { refunded = transaction.postTransferLeg(acc, TX_TRANSFER_IN, request.amount, request.linkID); });
+        if (!refunded)
+        {
+            shard.suspense.fetch_add(request.amount.paise(), memory_order_relaxed);
+            METRIC_COUNT(COUNTER_TRANSFERS_STRANDED, 1);
+            METRIC_COUNT(COUNTER_SUSPENSE_PAISE, request.amount.paise());
+            if (request.ticket)
+            {
+                request.ticket->stranded.fetch_add(1, memory_order_relaxed);
+                request.ticket->suspensePaise.fetch_add(request.amount.paise(), memory_order_relaxed);
+            }
+        }
+        break;
+    }
+    }
+    finish(request, ok);
+}
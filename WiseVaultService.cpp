@@ -0,0 +1,1438 @@
+// Out-of-line members of the service classes in WiseVault.h: batch ingest,
+// the network server and client, and replication.
+#include "WiseVault.h"
+
+using namespace std;
+
+// =========================
+// BatchIngest Class
+// =========================
+bool BatchIngest::parseInt(const Field &field, int32_t &out)
+{
+    if (field.length == 0 || field.length > 10)
+        return false;
+    int64_t value = 0;
+    for (size_t i = 0; i < field.length; ++i)
+    {
+        if (!isdigit((unsigned char)field.text[i]))
+            return false;
+        value = value * 10 + (field.text[i] - '0');
+    }
+    if (value > INT32_MAX)
+        return false;
+    out = (int32_t)value;
+    return true;
+}
+
+bool BatchIngest::copyField(char *dst, size_t len, const Field &field)
+{
+    if (field.length == 0 || field.length >= len || memchr(field.text, '\0', field.length))
+        return false;
+    memcpy(dst, field.text, field.length);
+    return true;
+}
+
+size_t BatchIngest::splitCsv(char *p, char *end, Field *fields, size_t max)
+{
+    size_t count = 0;
+    while (true)
+    {
+        if (count == max)
+            return max + 1;
+        Field &field = fields[count++];
+        if (p < end && *p == '"')
+        {
+            char *out = ++p;
+            field.text = out;
+            for (; p < end; ++p)
+            {
+                if (*p == '"')
+                {
+                    if (p + 1 < end && p[1] == '"')
+                        ++p; // "" is a literal quote
+                    else
+                    {
+                        ++p;
+                        break;
+                    }
+                }
+                *out++ = *p;
+            }
+            field.length = out - field.text;
+        }
+        else
+        {
+            field.text = p;
+            while (p < end && *p != ',')
+                ++p;
+            field.length = p - field.text;
+        }
+        if (p >= end)
+            return count;
+        if (*p != ',')
+            return max + 1; // text after a closing quote
+        ++p;
+    }
+}
+
+void BatchIngest::parseLine(char *p, char *end, Item &item)
+{
+    Field fields[5];
+    size_t n = splitCsv(p, end, fields, 5);
+    BatchRecord &rec = item.rec;
+    Money amount;
+    const Field &op = fields[0];
+    if (op.is("deposit") || op.is("withdraw"))
+    {
+        rec.op = op.is("deposit") ? BATCH_DEPOSIT : BATCH_WITHDRAW;
+        if (n != 3)
+            item.error = "expected <op>,<account>,<amount>";
+        else if (!parseInt(fields[1], rec.accountNumber))
+            item.error = "invalid account number";
+        else if (!Money::parse(fields[2].text, fields[2].length, amount) || !amount.isPositive())
+            item.error = "invalid amount";
+    }
+    else if (op.is("loan_payment"))
+    {
+        rec.op = BATCH_LOAN_PAYMENT;
+        if (n != 3 && n != 4)
+            item.error = "expected loan_payment,<loan id>,<amount>[,<account>]";
+        else if (!parseInt(fields[1], rec.loanID))
+            item.error = "invalid loan ID";
+        else if (!Money::parse(fields[2].text, fields[2].length, amount) || !amount.isPositive())
+            item.error = "invalid amount";
+        else if (n == 4 && !parseInt(fields[3], rec.accountNumber))
+            item.error = "invalid account number";
+    }
+    else if (op.is("create_account"))
+    {
+        rec.op = BATCH_CREATE_ACCOUNT;
+        if (n != 5)
+            item.error = "expected create_account,<holder>,<type>,<owner>,<opening balance>";
+        else if (!copyField(rec.name, JOURNAL_NAME_LEN, fields[1]))
+            item.error = "holder name is empty or too long";
+        else if (!copyField(rec.type, JOURNAL_TYPE_LEN, fields[2]))
+            item.error = "account type is empty or too long";
+        else if (!copyField(rec.username, JOURNAL_USER_LEN, fields[3]))
+            item.error = "owner is empty or too long";
+        else if (!Money::parse(fields[4].text, fields[4].length, amount) || amount < Money())
+            item.error = "invalid opening balance";
+    }
+    else
+    {
+        item.error = "unknown operation";
+    }
+    rec.amount = amount.paise();
+}
+
+void BatchIngest::checkRecord(Item &item)
+{
+    const BatchRecord &rec = item.rec;
+    switch (rec.op)
+    {
+    case BATCH_DEPOSIT:
+    case BATCH_WITHDRAW:
+    case BATCH_LOAN_PAYMENT:
+        if (rec.amount <= 0)
+            item.error = "invalid amount";
+        break;
+    case BATCH_CREATE_ACCOUNT:
+        if (rec.amount < 0)
+            item.error = "invalid opening balance";
+        else if (!rec.name[0] || rec.name[JOURNAL_NAME_LEN - 1] || !rec.type[0] || rec.type[JOURNAL_TYPE_LEN - 1] ||
+                 !rec.username[0] || rec.username[JOURNAL_USER_LEN - 1])
+            item.error = "name, type or owner is empty or unterminated";
+        break;
+    default:
+        item.error = "unknown operation";
+    }
+}
+
+bool BatchIngest::readStage(int fd, bool binary, vector<char> carry, StageQueue<Block> &blocks)
+{
+    bool ok = true;
+    while (true)
+    {
+        Block block;
+        block.data = std::move(carry);
+        size_t used = block.data.size();
+        block.data.resize(max(BLOCK_SIZE, used * 2));
+        ssize_t n = ::read(fd, block.data.data() + used, block.data.size() - used);
+        if (n < 0 && errno == EINTR)
+        {
+            carry.assign(block.data.begin(), block.data.begin() + used);
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            block.data.resize(used); // whatever is left is the final, unterminated line
+            if (!block.data.empty())
+                blocks.push(std::move(block));
+            break;
+        }
+        used += n;
+        size_t cut = used;
+        if (binary)
+            cut -= used % sizeof(BatchRecord);
+        else
+        {
+            while (cut > 0 && block.data[cut - 1] != '\n')
+                --cut;
+        }
+        carry.assign(block.data.begin() + cut, block.data.begin() + used);
+        block.data.resize(cut);
+        if (!block.data.empty())
+            blocks.push(std::move(block));
+    }
+    blocks.close();
+    return ok;
+}
+
+void BatchIngest::parseStage(bool binary, StageQueue<Block> &blocks, StageQueue<vector<Item>> &batches)
+{
+    uint64_t line = 0;
+    vector<Item> batch;
+    batch.reserve(BATCH_SIZE);
+    auto emit = [&](Item &item)
+    {
+        batch.push_back(item);
+        if (batch.size() == BATCH_SIZE)
+        {
+            batches.push(std::move(batch));
+            batch = vector<Item>();
+            batch.reserve(BATCH_SIZE);
+        }
+    };
+
+    Block block;
+    while (blocks.pop(block))
+    {
+        char *p = block.data.data(), *end = p + block.data.size();
+        if (binary)
+        {
+            // A short final record is reported rather than dropped
+            for (; p < end; p += sizeof(BatchRecord))
+            {
+                Item item = {};
+                item.line = ++line;
+                if (end - p < (ptrdiff_t)sizeof(BatchRecord))
+                    item.error = "truncated record";
+                else
+                {
+                    memcpy(&item.rec, p, sizeof(BatchRecord));
+                    checkRecord(item);
+                }
+                emit(item);
+            }
+            continue;
+        }
+        while (p < end)
+        {
+            char *eol = static_cast<char *>(memchr(p, '\n', end - p));
+            char *next = eol ? eol + 1 : end;
+            if (!eol)
+                eol = end;
+            ++line;
+            if (eol > p && eol[-1] == '\r')
+                --eol;
+            if (eol > p && *p != '#')
+            {
+                Item item = {};
+                item.line = line;
+                parseLine(p, eol, item);
+                emit(item);
+            }
+            p = next;
+        }
+    }
+    if (!batch.empty())
+        batches.push(std::move(batch));
+    batches.close();
+}
+
+const char *BatchIngest::post(const BatchRecord &rec, uint64_t &sequence)
+{
+    if (journal && journal->hasFailed())
+        return NOT_SAVED;
+    Money amount = Money::fromPaise(rec.amount);
+    bool posted = false;
+    switch (rec.op)
+    {
+    case BATCH_DEPOSIT:
+        if (!manager.withAccount(rec.accountNumber, [&](Account &acc) { posted = transaction.deposit(acc, amount, sequence); }))
+            return "account not found";
+        return posted ? nullptr : RiskRules::blockedBy() ? BLOCKED : "balance would overflow";
+    case BATCH_WITHDRAW:
+        if (!manager.withAccount(rec.accountNumber, [&](Account &acc) { posted = transaction.withdraw(acc, amount, sequence); }))
+            return "account not found";
+        return posted ? nullptr : RiskRules::blockedBy() ? BLOCKED : "insufficient funds";
+    case BATCH_LOAN_PAYMENT:
+    {
+        Loan *loan = manager.findLoan(rec.loanID, "", true);
+        if (!loan)
+            return "loan not found";
+        Account *recordIn = nullptr;
+        if (rec.accountNumber && !(recordIn = manager.findAccount(rec.accountNumber, "", true)))
+            return "account not found";
+        manager.payLoan(*loan, amount, recordIn, sequence);
+        return nullptr;
+    }
+    case BATCH_CREATE_ACCOUNT:
+        if (!manager.openAccount(JournalRecord::getField(rec.name, JOURNAL_NAME_LEN), amount,
+                                 JournalRecord::getField(rec.type, JOURNAL_TYPE_LEN),
+                                 JournalRecord::getField(rec.username, JOURNAL_USER_LEN), sequence))
+            return "no account numbers left";
+        return nullptr;
+    }
+    return "unknown operation";
+}
+
+BatchIngest::BatchIngest(Manager &m, Transaction &t, Journal *j, ostream &errorStream)
+    : manager(m), transaction(t), journal(j), errors(errorStream)
+{}
+
+BatchIngest::Result BatchIngest::run(int fd)
+{
+    Result result;
+    vector<char> head(sizeof(BATCH_MAGIC));
+    size_t got = 0;
+    while (got < head.size())
+    {
+        ssize_t n = ::read(fd, head.data() + got, head.size() - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    head.resize(got);
+    bool binary = got == sizeof(BATCH_MAGIC) && memcmp(head.data(), BATCH_MAGIC, got) == 0;
+    if (binary)
+        head.clear();
+
+    StageQueue<Block> blocks(QUEUE_DEPTH);
+    StageQueue<vector<Item>> batches(QUEUE_DEPTH);
+    bool readOk = true;
+    thread reader([&] { readOk = readStage(fd, binary, std::move(head), blocks); });
+    thread parser([&] { parseStage(binary, blocks, batches); });
+
+    vector<Item> batch;
+    while (batches.pop(batch))
+    {
+        uint64_t sequence = 0, last = 0;
+        vector<uint64_t> posted; // lines of this batch, until the journal has them
+        for (const Item &item : batch)
+        {
+            const char *error = item.error ? item.error : post(item.rec, sequence);
+            last = max(last, sequence);
+            if (error)
+            {
+                ++result.failed;
+                errors << "line " << item.line << ": " << error;
+                if (error == BLOCKED)
+                    errors << " " << *RiskRules::blockedBy();
+                errors << '\n';
+            }
+            else
+            {
+                posted.push_back(item.line);
+            }
+        }
+        result.records += batch.size();
+        if (journal && last && !journal->waitDurable(last))
+        {
+            for (uint64_t line : posted)
+                errors << "line " << line << ": " << NOT_SAVED << '\n';
+            result.failed += posted.size();
+            posted.clear();
+        }
+        result.posted += posted.size();
+    }
+    reader.join();
+    parser.join();
+    result.readError = !readOk;
+    errors.flush();
+    return result;
+}
+
+bool BatchIngest::run(const string &path, Result &result)
+{
+    int fd = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    result = run(fd);
+    if (fd != STDIN_FILENO)
+        ::close(fd);
+    return true;
+}
+
+// =========================
+// NetServer Class
+// =========================
+bool NetServer::mutates(uint8_t op)
+{
+    return op == SVC_REGISTER || op == SVC_CREATE_ACCOUNT || op == SVC_DEPOSIT || op == SVC_WITHDRAW ||
+           op == SVC_TRANSFER || op == SVC_APPLY_LOAN || op == SVC_PAY_LOAN;
+}
+
+bool NetServer::validName(const string &text, size_t limit)
+{
+    return !text.empty() && text.size() < limit;
+}
+
+bool NetServer::validCredential(const string &text)
+{
+    return !text.empty() && text.size() < JOURNAL_USER_LEN &&
+           none_of(text.begin(), text.end(), [](char c) { return isspace((unsigned char)c); });
+}
+
+void NetServer::execute(Session &session, uint32_t requestID, uint8_t op, FrameReader &body, uint64_t &sequence)
+{
+    string payload;
+    uint8_t status = SVC_OK;
+    auto reply = [&](uint8_t code) { status = code; };
+    auto putValue = [&](auto value) { payload.append(reinterpret_cast<const char *>(&value), sizeof(value)); };
+    // A posting that didn't go through: a rule's refusal names the rule
+    auto refuse = [&]
+    {
+        if (const string *rule = RiskRules::blockedBy())
+        {
+            reply(SVC_BLOCKED);
+            payload = *rule;
+        }
+        else
+            reply(SVC_REJECTED);
+    };
+
+    // One lock-free read of the session per request; it also keeps the session alive
+    SessionTable::Info info;
+    if (op != SVC_LOGIN && op != SVC_REGISTER && op != SVC_RESUME && !manager.sessionInfo(session.token, info))
+    {
+        FrameWriter frame(session.out, requestID, SVC_NOT_LOGGED_IN);
+        frame.finish();
+        return;
+    }
+    const string &username = info.username;
+    const bool isManager = info.manager;
+    if (mutates(op) && readOnly.load(memory_order_relaxed))
+    {
+        FrameWriter frame(session.out, requestID, SVC_READ_ONLY);
+        frame.finish();
+        return;
+    }
+    // Logins live in users.db; everything else that changes needs the journal
+    if (mutates(op) && op != SVC_REGISTER && journal && journal->hasFailed())
+    {
+        FrameWriter frame(session.out, requestID, SVC_UNAVAILABLE);
+        frame.finish();
+        return;
+    }
+
+    switch (op)
+    {
+    case SVC_LOGIN:
+    case SVC_REGISTER:
+    {
+        string name = body.getString(), password = body.getString();
+        User user(name, "", "user");
+        if (!body.complete())
+            reply(SVC_BAD_REQUEST);
+        else if (op == SVC_LOGIN && !users.authenticate(name, password, user))
+            reply(SVC_DENIED);
+        else if (op == SVC_REGISTER && (!validCredential(name) || !validCredential(password)))
+            reply(SVC_BAD_REQUEST);
+        else if (op == SVC_REGISTER && !users.add(User(name, password, "user")))
+            reply(SVC_EXISTS);
+        else
+        {
+            manager.closeSession(session.token);
+            session.token = manager.openSession(user);
+            if (!session.token.valid())
+                reply(SVC_DENIED); // every session slot is taken
+            putValue((uint8_t)user.isManager());
+            putValue(session.token);
+        }
+        break;
+    }
+    case SVC_RESUME:
+    {
+        SessionToken token = body.get<SessionToken>();
+        if (!body.complete())
+            reply(SVC_BAD_REQUEST);
+        else if (!manager.sessionInfo(token, info))
+            reply(SVC_DENIED);
+        else
+        {
+            session.token = token;
+            putValue((uint8_t)info.manager);
+        }
+        break;
+    }
+    case SVC_LOGOUT:
+        manager.closeSession(session.token);
+        session.token = SessionToken();
+        break;
+    case SVC_CREATE_ACCOUNT:
+    {
+        string holder = body.getString(), type = body.getString(), owner = body.getString();
+        Money opening = Money::fromPaise(body.get<int64_t>());
+        int32_t accNo = 0;
+        if (!body.complete() || !validName(holder, JOURNAL_NAME_LEN) || !validName(type, JOURNAL_TYPE_LEN) ||
+            !validName(owner, JOURNAL_USER_LEN) || opening < Money())
+            reply(SVC_BAD_REQUEST);
+        else if (!isManager)
+            reply(SVC_DENIED);
+        else if (!(accNo = manager.openAccount(holder, opening, type, owner, sequence)))
+            reply(SVC_REJECTED); // no account numbers are left
+        else
+            putValue(accNo);
+        break;
+    }
+    case SVC_BALANCE:
+    case SVC_DEPOSIT:
+    case SVC_WITHDRAW:
+    {
+        int32_t accNo = body.get<int32_t>();
+        Money amount = op == SVC_BALANCE ? Money() : Money::fromPaise(body.get<int64_t>());
+        if (!body.complete())
+        {
+            reply(SVC_BAD_REQUEST);
+            break;
+        }
+        bool allowed = false, posted = true;
+        Money balance;
+        manager.withAccount(accNo, [&](Account &acc)
+        {
+            if (!(allowed = manager.permits(session.token, acc)))
+                return;
+            if (op == SVC_DEPOSIT)
+                posted = transaction.deposit(acc, amount, sequence);
+            else if (op == SVC_WITHDRAW)
+                posted = transaction.withdraw(acc, amount, sequence);
+            balance = transaction.balance(acc);
+        });
+        if (!allowed)
+            reply(SVC_DENIED);
+        else if (!posted)
+            refuse();
+        else
+            putValue(balance.paise());
+        break;
+    }
+    case SVC_TRANSFER:
+    {
+        int32_t fromAccNo = body.get<int32_t>(), toAccNo = body.get<int32_t>();
+        Money amount = Money::fromPaise(body.get<int64_t>());
+        bool allowed = false;
+        if (!body.complete())
+            reply(SVC_BAD_REQUEST);
+        else if (!manager.withAccount(fromAccNo, [&](Account &acc) { allowed = manager.permits(session.token, acc); }) ||
+                 !allowed ||
+                 !manager.findAccount(toAccNo, "", true))
+            reply(SVC_DENIED);
+        else if (!transaction.transfer(manager, fromAccNo, toAccNo, amount, sequence))
+            refuse();
+        break;
+    }
+    case SVC_HISTORY:
+    {
+        int32_t accNo = body.get<int32_t>();
+        HistoryQuery query;
+        query.from = (time_t)body.get<int64_t>();
+        query.to = (time_t)body.get<int64_t>();
+        if (query.to == 0)
+            query.to = numeric_limits<time_t>::max();
+        query.limit = min(body.get<uint32_t>(), SVC_MAX_HISTORY);
+        query.cursor = body.get<uint64_t>();
+        if (query.limit == 0)
+            query.limit = SVC_MAX_HISTORY;
+        HistoryPage page;
+        if (!body.complete())
+            reply(SVC_BAD_REQUEST);
+        else if (!manager.queryHistory(accNo, session.token, query, page))
+            reply(SVC_DENIED);
+        else
+        {
+            putValue(page.nextCursor);
+            putValue((uint32_t)page.records.size());
+            payload.append(reinterpret_cast<const char *>(page.records.data()),
+                           page.records.size() * sizeof(TransactionRecord));
+        }
+        break;
+    }
+    case SVC_LIST_ACCOUNTS:
+    {
+        if (!body.complete())
+        {
+            reply(SVC_BAD_REQUEST);
+            break;
+        }
+        size_t countAt = payload.size();
+        putValue((uint32_t)0);
+        uint32_t count = (uint32_t)manager.forEachUserAccount(username, [&](const Account &acc)
+        {
+            putValue((int32_t)acc.getAccountNumber());
+            putValue(acc.getBalance().paise());
+            uint16_t n = (uint16_t)min<size_t>(acc.getAccountType().size(), UINT16_MAX);
+            putValue(n);
+            payload.append(acc.getAccountType().data(), n);
+        });
+        memcpy(&payload[countAt], &count, sizeof(count));
+        break;
+    }
+    case SVC_LIST_LOANS:
+    {
+        if (!body.complete())
+        {
+            reply(SVC_BAD_REQUEST);
+            break;
+        }
+        size_t countAt = payload.size();
+        putValue((uint32_t)0);
+        uint32_t count = (uint32_t)manager.forEachUserLoan(username, [&](const Loan &loan)
+        {
+            putValue((int32_t)loan.getLoanID());
+            putValue(loan.getBalance().paise());
+            putValue(loan.getEmi().paise());
+            putValue((int32_t)loan.getMonthsLeft());
+        });
+        memcpy(&payload[countAt], &count, sizeof(count));
+        break;
+    }
+    case SVC_APPLY_LOAN:
+    {
+        string borrower = body.getString();
+        Money principal = Money::fromPaise(body.get<int64_t>());
+        int32_t years = body.get<int32_t>();
+        int32_t loanID = 0;
+        if (!body.complete() || !validName(borrower, JOURNAL_NAME_LEN) || username.size() >= JOURNAL_USER_LEN)
+            reply(SVC_BAD_REQUEST);
+        else if (!principal.isPositive() || years < 1 || years > 50)
+            reply(SVC_REJECTED);
+        else if (!(loanID = manager.openLoan(borrower, username, principal, years, sequence)))
+            reply(SVC_REJECTED); // no loan IDs are left
+        else
+            putValue(loanID);
+        break;
+    }
+    case SVC_PAY_LOAN:
+    {
+        int32_t loanID = body.get<int32_t>();
+        Money amount = Money::fromPaise(body.get<int64_t>());
+        int32_t accNo = body.get<int32_t>();
+        Loan *loan = nullptr;
+        Account *recordIn = nullptr;
+        if (!body.complete())
+            reply(SVC_BAD_REQUEST);
+        else if (!(loan = manager.findLoan(loanID, session.token)) ||
+                 (accNo && !(recordIn = manager.findAccount(accNo, session.token))))
+            reply(SVC_DENIED);
+        else if (!amount.isPositive())
+            reply(SVC_REJECTED);
+        else
+            putValue(manager.payLoan(*loan, amount, recordIn, sequence).paise());
+        break;
+    }
+    case SVC_STATS:
+        if (!isManager)
+            reply(SVC_DENIED);
+        else
+        {
+            ostringstream text;
+            Metrics::writeText(text);
+            if (RiskRules *rules = transaction.riskRules())
+                rules->writeText(text);
+            payload = text.str();
+        }
+        break;
+    default:
+        reply(SVC_BAD_REQUEST);
+    }
+
+    FrameWriter frame(session.out, requestID, status);
+    if (status == SVC_OK || status == SVC_BLOCKED)
+        frame.putBytes(payload.data(), payload.size());
+    frame.finish();
+}
+
+bool NetServer::frameReady(const Session &session)
+{
+    uint32_t length;
+    size_t available = session.in.size() - session.inUsed;
+    if (available < SVC_HEADER_LEN)
+        return false;
+    memcpy(&length, session.in.data() + session.inUsed, sizeof(length));
+    return available >= sizeof(length) + length;
+}
+
+bool NetServer::executeFrames(Session &session, uint64_t &sequence)
+{
+    bool ok = true;
+    while (session.out.size() - session.outSent < OUTPUT_LIMIT)
+    {
+        size_t available = session.in.size() - session.inUsed;
+        if (available < sizeof(uint32_t))
+            break;
+        const char *frame = session.in.data() + session.inUsed;
+        uint32_t length, requestID;
+        memcpy(&length, frame, sizeof(length));
+        if (length < SVC_HEADER_LEN - sizeof(uint32_t) || length > SVC_MAX_REQUEST)
+        {
+            ok = false;
+            break;
+        }
+        if (available < sizeof(uint32_t) + length)
+            break;
+        memcpy(&requestID, frame + 4, sizeof(requestID));
+        FrameReader body(frame + SVC_HEADER_LEN, length + sizeof(uint32_t) - SVC_HEADER_LEN);
+        execute(session, requestID, (uint8_t)frame[8], body, sequence);
+        session.inUsed += sizeof(uint32_t) + length;
+    }
+    session.in.erase(0, session.inUsed);
+    session.inUsed = 0;
+    return ok;
+}
+
+bool NetServer::flush(Session &session)
+{
+    while (session.outSent < session.out.size())
+    {
+        ssize_t n = ::send(session.fd, session.out.data() + session.outSent, session.out.size() - session.outSent,
+                           MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        session.outSent += n;
+    }
+    if (session.outSent == session.out.size())
+    {
+        session.out.clear();
+        session.outSent = 0;
+    }
+    return true;
+}
+
+void NetServer::watch(Worker &worker, Session &session)
+{
+    size_t pending = session.out.size() - session.outSent;
+    uint32_t writes = pending || frameReady(session) ? (uint32_t)EPOLLOUT : 0;
+    uint32_t reads = !session.peerClosed && pending < OUTPUT_LIMIT ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0;
+    uint32_t events = writes | reads;
+    if (events == session.watching)
+        return;
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = session.fd;
+    epoll_ctl(worker.epfd, EPOLL_CTL_MOD, session.fd, &ev);
+    session.watching = events;
+}
+
+void NetServer::closeSession(Worker &worker, int fd)
+{
+    epoll_ctl(worker.epfd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    worker.sessions.erase(fd);
+}
+
+void NetServer::acceptAll(Worker &worker)
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return; // EAGAIN, or another worker took it
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        unique_ptr<Session> session(new Session());
+        session->fd = fd;
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(worker.epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            ::close(fd);
+            continue;
+        }
+        worker.sessions[fd] = std::move(session);
+    }
+}
+
+bool NetServer::readAll(Session &session)
+{
+    while (true)
+    {
+        size_t used = session.in.size();
+        session.in.resize(used + READ_CHUNK);
+        ssize_t n = ::read(session.fd, &session.in[used], READ_CHUNK);
+        session.in.resize(used + max<ssize_t>(n, 0));
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return false;
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+void NetServer::run(Worker &worker)
+{
+    epoll_event events[64];
+    vector<Session *> ready;
+    while (!stopping)
+    {
+        int n = epoll_wait(worker.epfd, events, 64, -1);
+        uint64_t sequence = 0;
+        ready.clear();
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == worker.wakeFd)
+                continue;
+            if (fd == listenFd)
+            {
+                acceptAll(worker);
+                continue;
+            }
+            auto it = worker.sessions.find(fd);
+            if (it == worker.sessions.end())
+                continue;
+            Session &session = *it->second;
+            if (events[i].events & EPOLLERR)
+            {
+                closeSession(worker, fd);
+                continue;
+            }
+            // A peer that half-closed still gets answers to what it sent
+            if (!session.peerClosed && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+                session.peerClosed = !readAll(session);
+            if (!executeFrames(session, sequence))
+            {
+                closeSession(worker, fd);
+                continue;
+            }
+            ready.push_back(&session);
+        }
+        // Replies to changes that never reached disk must not go out: the
+        // clients see their connections drop, as they would in a crash
+        if (journal && sequence && !journal->waitDurable(sequence))
+        {
+            for (Session *session : ready)
+                closeSession(worker, session->fd);
+            continue;
+        }
+        for (Session *session : ready)
+        {
+            if (!flush(*session) || (session->peerClosed && session->out.empty() && !frameReady(*session)))
+                closeSession(worker, session->fd);
+            else
+                watch(worker, *session);
+        }
+    }
+    for (auto &entry : worker.sessions)
+        ::close(entry.first);
+    worker.sessions.clear();
+}
+
+NetServer::NetServer(Manager &m, Transaction &t, UserStore &u, Journal *j, const Options &opts)
+    : manager(m), transaction(t), users(u), journal(j), options(opts), readOnly(opts.readOnly)
+{}
+
+bool NetServer::start()
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.address.c_str(), &addr.sin_addr) != 1)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t len = sizeof(addr);
+    if (listenFd < 0 || ::bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 1024) != 0 ||
+        getsockname(listenFd, (sockaddr *)&addr, &len) != 0)
+    {
+        int saved = errno;
+        if (listenFd >= 0)
+            ::close(listenFd);
+        listenFd = -1;
+        errno = saved;
+        return false;
+    }
+    boundPort = ntohs(addr.sin_port);
+
+    stopping = false;
+    for (unsigned i = 0; i < max(1u, options.workers); ++i)
+    {
+        unique_ptr<Worker> worker(new Worker());
+        worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE; // one worker wakes per new connection
+        ev.data.fd = listenFd;
+        epoll_ctl(worker->epfd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = worker->wakeFd;
+        epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakeFd, &ev);
+        Worker *w = worker.get();
+        worker->loop = thread([this, w] { run(*w); });
+        workers.push_back(std::move(worker));
+    }
+    return true;
+}
+
+void NetServer::stop()
+{
+    if (workers.empty())
+        return;
+    stopping = true;
+    for (auto &worker : workers)
+    {
+        uint64_t one = 1;
+        ssize_t written = ::write(worker->wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+    for (auto &worker : workers)
+    {
+        worker->loop.join();
+        ::close(worker->epfd);
+        ::close(worker->wakeFd);
+    }
+    workers.clear();
+    ::close(listenFd);
+    listenFd = -1;
+}
+
+// =========================
+// ServiceClient Class
+// =========================
+bool ServiceClient::connect(const string &address, uint16_t port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+        return false;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close();
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+void ServiceClient::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+uint32_t ServiceClient::send(uint8_t op, const string &body)
+{
+    string frame;
+    uint32_t requestID = nextRequestID++;
+    FrameWriter writer(frame, requestID, op);
+    writer.putBytes(body.data(), body.size());
+    writer.finish();
+    for (size_t sent = 0; sent < frame.size();)
+    {
+        ssize_t n = ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        sent += n;
+    }
+    return requestID;
+}
+
+bool ServiceClient::receive(uint32_t &requestID, uint8_t &status, string &body)
+{
+    while (true)
+    {
+        size_t available = in.size() - inUsed;
+        uint32_t length = 0;
+        if (available >= sizeof(length))
+            memcpy(&length, in.data() + inUsed, sizeof(length));
+        if (available >= SVC_HEADER_LEN && available >= sizeof(length) + length)
+        {
+            const char *frame = in.data() + inUsed;
+            memcpy(&requestID, frame + 4, sizeof(requestID));
+            status = (uint8_t)frame[8];
+            body.assign(frame + SVC_HEADER_LEN, length + sizeof(uint32_t) - SVC_HEADER_LEN);
+            inUsed += sizeof(uint32_t) + length;
+            if (inUsed == in.size())
+            {
+                in.clear();
+                inUsed = 0;
+            }
+            return true;
+        }
+        char buffer[64 * 1024];
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        in.append(buffer, n);
+    }
+}
+
+bool ServiceClient::call(uint8_t op, const string &body, uint8_t &status, string &response)
+{
+    uint32_t requestID;
+    return send(op, body) && receive(requestID, status, response);
+}
+
+// =========================
+// ReplicationServer Class
+// =========================
+bool ReplicationServer::sendError(int fd, const string &message)
+{
+    ReplHeader header = replHeader(REPL_ERROR, 0, 0, message.size());
+    return replSend(fd, &header, sizeof(header)) && replSend(fd, message.data(), message.size());
+}
+
+bool ReplicationServer::readAcks(int fd, uint64_t &acked, chrono::milliseconds timeout)
+{
+    while (true)
+    {
+        pollfd ready = {fd, POLLIN, 0};
+        int polled = poll(&ready, 1, (int)timeout.count());
+        if (polled < 0 && errno == EINTR)
+            continue;
+        if (polled <= 0)
+            return polled == 0;
+        ReplHeader header;
+        if (!replReceive(fd, &header, sizeof(header), options.heartbeat) || header.type != REPL_ACK || header.bytes)
+            return false;
+        acked = max(acked, header.sequence);
+        timeout = chrono::milliseconds(0);
+    }
+}
+
+uint64_t ReplicationServer::sendSnapshot(int fd)
+{
+    lock_guard<mutex> turn(snapshotLock);
+    Snapshotter::Options snapshotOptions;
+    snapshotOptions.path = options.snapshotPath;
+    snapshotOptions.portable = true;
+    Snapshotter shipment(snapshotOptions);
+    if (!shipment.start(manager, &journal) || !shipment.wait())
+        return 0;
+    uint64_t covered = shipment.baseline();
+    while (journal.waitBeyond(covered - 1, options.heartbeat) < covered && !stopping)
+        ;
+    int in = ::open(options.snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+    unlink(options.snapshotPath.c_str());
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0)
+    {
+        if (in >= 0)
+            ::close(in);
+        return 0;
+    }
+    ReplHeader header = replHeader(REPL_SNAPSHOT, covered, 0, st.st_size);
+    bool ok = replSend(fd, &header, sizeof(header));
+    vector<char> buffer(1 << 20);
+    for (off_t left = st.st_size; ok && left > 0;)
+    {
+        ssize_t n = ::read(in, buffer.data(), (size_t)min<off_t>(left, buffer.size()));
+        ok = n > 0 && replSend(fd, buffer.data(), n);
+        left -= max<ssize_t>(n, 0);
+    }
+    ::close(in);
+    return ok ? covered : 0;
+}
+
+void ReplicationServer::ship(Follower &follower)
+{
+    int fd = follower.fd;
+    ReplHeader hello;
+    char magic[sizeof(REPL_MAGIC)];
+    if (!replReceive(fd, &hello, sizeof(hello), options.heartbeat * 4) || hello.type != REPL_HELLO ||
+        hello.bytes != sizeof(magic) || !replReceive(fd, magic, sizeof(magic), options.heartbeat * 4) ||
+        memcmp(magic, REPL_MAGIC, sizeof(magic)) != 0)
+    {
+        follower.done = true;
+        return;
+    }
+    uint64_t shipped = hello.sequence;
+    size_t userPosition = hello.count;
+
+    int in = ::open(journal.path().c_str(), O_RDONLY | O_CLOEXEC);
+    JournalRecord first;
+    uint64_t durable = journal.waitBeyond(shipped, chrono::milliseconds(0));
+    uint64_t firstSequence = in >= 0 && pread(in, &first, sizeof(first), 0) == (ssize_t)sizeof(first) &&
+                                     first.checksum == journalChecksum(first)
+                                 ? first.sequence
+                                 : durable + 1;
+    bool needSnapshot = shipped + 1 < firstSequence || (shipped == 0 && durable > options.snapshotAfter);
+    bool refused = true;
+    if (in < 0)
+        sendError(fd, "The leader could not read its journal.");
+    else if (shipped > durable)
+        sendError(fd, "The follower holds records the leader never wrote; clear its files and restart it.");
+    else if (needSnapshot && shipped > 0)
+        sendError(fd, "The leader's journal no longer reaches back to the follower's last record; clear the "
+                      "follower's files and restart it.");
+    else if (needSnapshot && !(shipped = sendSnapshot(fd)))
+        sendError(fd, "The leader could not take a snapshot to send.");
+    else
+        refused = false;
+    if (refused)
+    {
+        if (in >= 0)
+            ::close(in);
+        follower.done = true;
+        return;
+    }
+
+    size_t offset = Journal::tailOffset(in, shipped);
+    uint64_t acked = shipped;
+    vector<JournalRecord> chunk(max<size_t>(options.maxBatch, 1));
+    string out;
+    bool ok = true;
+    while (ok && !stopping)
+    {
+        bool full = shipped - acked >= options.maxUnacked;
+        if (!(ok = readAcks(fd, acked, full ? options.heartbeat : chrono::milliseconds(0))) || full)
+            continue;
+
+        vector<UserFileRecord> logins = users.readRecords(userPosition, 1024);
+        if (!logins.empty())
+        {
+            ReplHeader header = replHeader(REPL_USERS, userPosition, logins.size(), logins.size() * sizeof(UserFileRecord));
+            ok = replSend(fd, &header, sizeof(header)) &&
+                 replSend(fd, logins.data(), logins.size() * sizeof(UserFileRecord));
+            userPosition += logins.size();
+            continue;
+        }
+
+        durable = journal.waitBeyond(shipped, options.heartbeat);
+        if (durable <= shipped)
+        {
+            ReplHeader header = replHeader(REPL_HEARTBEAT, durable);
+            ok = replSend(fd, &header, sizeof(header));
+            continue;
+        }
+        size_t want = (size_t)min<uint64_t>({chunk.size(), durable - shipped, options.maxUnacked - (shipped - acked)});
+        ssize_t n = pread(in, chunk.data(), want * sizeof(JournalRecord), offset);
+        size_t count = 0, read = max<ssize_t>(n, 0) / sizeof(JournalRecord);
+        for (size_t i = 0; i < read; ++i)
+        {
+            const JournalRecord &rec = chunk[i];
+            if (rec.checksum != journalChecksum(rec) || rec.sequence > durable)
+                break;
+            offset += sizeof(JournalRecord);
+            if (rec.sequence <= shipped)
+                continue; // a journal that starts before the follower's position
+            if (rec.sequence != shipped + 1)
+            {
+                ok = false;
+                break;
+            }
+            chunk[count++] = rec;
+            shipped = rec.sequence;
+        }
+        if (read == 0)
+            ok = false; // durable records the file doesn't hold: the journal was replaced
+        if (!ok || count == 0)
+            continue;
+        ReplHeader header = replHeader(REPL_RECORDS, shipped - count + 1, count, count * sizeof(JournalRecord));
+        out.assign(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.append(reinterpret_cast<const char *>(chunk.data()), count * sizeof(JournalRecord));
+        ok = replSend(fd, out.data(), out.size());
+        METRIC_COUNT(COUNTER_REPLICATION_SHIPPED, count);
+    }
+    ::close(in);
+    follower.done = true;
+}
+
+void ReplicationServer::acceptLoop()
+{
+    while (!stopping)
+    {
+        pollfd ready = {listenFd, POLLIN, 0};
+        if (poll(&ready, 1, 200) > 0)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                unique_ptr<Follower> follower(new Follower());
+                follower->fd = fd;
+                Follower *f = follower.get();
+                lock_guard<mutex> hold(followersLock);
+                follower->shipper = thread([this, f] { ship(*f); });
+                followers.push_back(std::move(follower));
+            }
+        }
+        // Reap the followers that have gone
+        lock_guard<mutex> hold(followersLock);
+        for (auto it = followers.begin(); it != followers.end();)
+        {
+            if (!(*it)->done)
+            {
+                ++it;
+                continue;
+            }
+            (*it)->shipper.join();
+            ::close((*it)->fd);
+            it = followers.erase(it);
+        }
+    }
+}
+
+ReplicationServer::ReplicationServer(Manager &m, Journal &j, UserStore &u, const Options &opts)
+    : manager(m), journal(j), users(u), options(opts)
+{}
+
+bool ReplicationServer::start()
+{
+    sockaddr_un addr;
+    if (!replSocketAddress(options.socketPath, addr))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    unlink(options.socketPath.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || ::bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0)
+    {
+        int saved = errno;
+        if (listenFd >= 0)
+            ::close(listenFd);
+        listenFd = -1;
+        errno = saved;
+        return false;
+    }
+    stopping = false;
+    acceptor = thread(&ReplicationServer::acceptLoop, this);
+    return true;
+}
+
+size_t ReplicationServer::followerCount()
+{
+    lock_guard<mutex> hold(followersLock);
+    size_t live = 0;
+    for (auto &follower : followers)
+        live += !follower->done;
+    return live;
+}
+
+void ReplicationServer::stop()
+{
+    if (listenFd < 0)
+        return;
+    stopping = true;
+    acceptor.join();
+    for (auto &follower : followers)
+    {
+        shutdown(follower->fd, SHUT_RDWR);
+        follower->shipper.join();
+        ::close(follower->fd);
+    }
+    followers.clear();
+    ::close(listenFd);
+    listenFd = -1;
+    unlink(options.socketPath.c_str());
+}
+
+// =========================
+// ReplicationClient Class
+// =========================
+string ReplicationClient::receiveSnapshot(const ReplHeader &header)
+{
+    snapshotter.wait();
+    if (journal.lastSequence() != 0)
+        return "the leader sent a snapshot to a follower that isn't empty";
+    string temporary = snapshotter.path() + ".tmp";
+    int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = out >= 0;
+    payload.resize(1 << 20);
+    for (uint64_t left = header.bytes; ok && left > 0;)
+    {
+        size_t n = (size_t)min<uint64_t>(left, payload.size());
+        ok = replReceive(fd, payload.data(), n, options.timeout) && ::write(out, payload.data(), n) == (ssize_t)n;
+        left -= n;
+    }
+    ok = ok && fdatasync(out) == 0;
+    if (out >= 0)
+        ::close(out);
+    uint64_t covered = 0;
+    if (!ok || rename(temporary.c_str(), snapshotter.path().c_str()) != 0 ||
+        !manager.loadSnapshot(snapshotter.path(), covered) || covered != header.sequence || !journal.restartAfter(covered))
+    {
+        unlink(temporary.c_str());
+        return "the leader's snapshot could not be installed";
+    }
+    snapshotter.setBaseline(covered);
+    cout << "Installed the leader's snapshot up to record " << covered << ".\n";
+    return "";
+}
+
+string ReplicationClient::applyRecords(const ReplHeader &header)
+{
+    const JournalRecord *recs = reinterpret_cast<const JournalRecord *>(payload.data());
+    for (uint32_t i = 0; i < header.count; ++i)
+    {
+        const JournalRecord &rec = recs[i];
+        if (rec.checksum != journalChecksum(rec) || rec.sequence != journal.lastSequence() + group.size() + 1)
+            return "a record arrived damaged or out of sequence";
+        group.push_back(rec);
+        if (rec.groupRemaining > 0 && group.size() < JOURNAL_MAX_GROUP)
+            continue;
+        if (group.size() == 1)
+            journal.enqueue(group[0]);
+        else
+            journal.enqueueGroup(group.data(), group.size());
+        for (const JournalRecord &member : group)
+            manager.apply(member);
+        group.clear();
+    }
+    METRIC_COUNT(COUNTER_REPLICATION_APPLIED, header.count);
+    leaderSequence = max(leaderSequence.load(), header.sequence + header.count - 1);
+    if (!journal.sync())
+        return "the journal could not be written";
+    ReplHeader ack = replHeader(REPL_ACK, journal.lastSequence());
+    if (!replSend(fd, &ack, sizeof(ack)))
+        return "the leader closed the connection";
+    snapshotter.maybeSnapshot(manager, journal);
+    return "";
+}
+
+string ReplicationClient::follow()
+{
+    ReplHeader hello = replHeader(REPL_HELLO, journal.lastSequence(), (uint32_t)users.recordCount(), sizeof(REPL_MAGIC));
+    if (!replSend(fd, &hello, sizeof(hello)) || !replSend(fd, REPL_MAGIC, sizeof(REPL_MAGIC)))
+        return "the leader closed the connection";
+    group.clear();
+    while (!stopping)
+    {
+        ReplHeader header;
+        if (!replReceive(fd, &header, sizeof(header), options.timeout))
+            return "the leader closed the connection or went quiet";
+        if (header.type == REPL_SNAPSHOT)
+        {
+            string failure = receiveSnapshot(header);
+            if (!failure.empty())
+                return failure;
+            continue;
+        }
+        if (header.bytes > REPL_MAX_PAYLOAD)
+            return "a message was too large";
+        payload.resize(header.bytes);
+        if (!replReceive(fd, payload.data(), payload.size(), options.timeout))
+            return "the leader closed the connection";
+        switch (header.type)
+        {
+        case REPL_RECORDS:
+        {
+            if (header.bytes != (uint64_t)header.count * sizeof(JournalRecord))
+                return "a message was malformed";
+            string failure = applyRecords(header);
+            if (!failure.empty())
+                return failure;
+            break;
+        }
+        case REPL_USERS:
+        {
+            vector<UserFileRecord> logins(header.count);
+            if (header.bytes != logins.size() * sizeof(UserFileRecord) || header.sequence != users.recordCount())
+                return "a message was malformed";
+            memcpy(logins.data(), payload.data(), payload.size());
+            if (!users.addRecords(logins))
+                return "the logins could not be saved";
+            break;
+        }
+        case REPL_HEARTBEAT:
+            leaderSequence = max(leaderSequence.load(), header.sequence);
+            break;
+        case REPL_ERROR:
+            gaveUp = true;
+            return string(payload.begin(), payload.end());
+        default:
+            return "a message was malformed";
+        }
+    }
+    return "";
+}
+
+void ReplicationClient::run()
+{
+    bool announced = false; // only the first of a run of failed connects is reported
+    while (!stopping && !gaveUp)
+    {
+        sockaddr_un addr;
+        int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s >= 0 && replSocketAddress(options.socketPath, addr) && ::connect(s, (sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            {
+                lock_guard<mutex> hold(socketLock);
+                fd = s;
+            }
+            cout << "Following the leader at " << options.socketPath << " from record " << journal.lastSequence()
+                 << ".\n";
+            string reason = follow();
+            {
+                lock_guard<mutex> hold(socketLock);
+                fd = -1;
+            }
+            ::close(s);
+            if (!stopping)
+                cout << "Lost the leader: " << reason << (gaveUp ? ".\n" : "; retrying.\n");
+            announced = false;
+            continue;
+        }
+        if (s >= 0)
+            ::close(s);
+        if (!announced)
+            cout << "Waiting for a leader at " << options.socketPath << ".\n";
+        announced = true;
+        for (auto waited = chrono::milliseconds(0); waited < options.retry && !stopping; waited += chrono::milliseconds(50))
+            this_thread::sleep_for(chrono::milliseconds(50));
+    }
+}
+
+ReplicationClient::ReplicationClient(Manager &m, Journal &j, UserStore &u, Snapshotter &s, const Options &opts)
+    : manager(m), journal(j), users(u), snapshotter(s), options(opts)
+{}
+
+void ReplicationClient::start()
+{
+    stopping = false;
+    loop = thread(&ReplicationClient::run, this);
+}
+
+uint64_t ReplicationClient::lag()
+{
+    uint64_t applied = journal.lastSequence(), leader = leaderSequence;
+    return leader > applied ? leader - applied : 0;
+}
+
+void ReplicationClient::stop()
+{
+    if (!loop.joinable())
+        return;
+    stopping = true;
+    {
+        lock_guard<mutex> hold(socketLock);
+        if (fd >= 0)
+            shutdown(fd, SHUT_RDWR);
+    }
+    loop.join();
+    snapshotter.wait();
+}
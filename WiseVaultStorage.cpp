@@ -0,0 +1,824 @@
+// Out-of-line members of the storage classes in WiseVault.h: the journal,
+// cold history segments, the user store and the session table.
+#include "WiseVault.h"
+
+using namespace std;
+
+// =========================
+// Journal Class
+// =========================
+void Journal::writerLoop() {
+    vector<JournalRecord> batch;
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        workReady.wait(guard, [this] { return stopping || !pending.empty(); });
+        if (pending.empty() && stopping)
+            return;
+        // Hold the batch open until the latency budget is spent or it fills up
+        workReady.wait_until(guard, batchOpened + options.commitWindow,
+                             [this] { return stopping || pending.size() >= options.maxBatch; });
+        batch.swap(pending);
+        uint64_t lastSequence = batch.back().sequence;
+        guard.unlock();
+
+        for (auto &rec : batch)
+            rec.checksum = journalChecksum(rec);
+
+        // After a failure the file may end in a torn record, and replay stops
+        // there, so nothing is written behind it
+        bool ok = false;
+        if (!failed) {
+            METRIC_TIME(METRIC_JOURNAL_FLUSH);
+            ok = writeAll(batch.data(), batch.size() * sizeof(JournalRecord)) && fdatasync(fd) == 0;
+            METRIC_COUNT(ok ? COUNTER_JOURNAL_RECORDS : COUNTER_JOURNAL_FAILURES, ok ? batch.size() : 1);
+            METRIC_COUNT(COUNTER_JOURNAL_BYTES, ok ? batch.size() * sizeof(JournalRecord) : 0);
+        }
+        batch.clear();
+
+        guard.lock();
+        if (ok) {
+            durableSequence = lastSequence;
+        } else if (!failed) {
+            failed = true;
+            cout << "Journal write failed; changes are no longer being persisted.\n";
+        }
+        batchDurable.notify_all();
+    }
+}
+
+bool Journal::writeAll(const void *data, size_t len) {
+    const char *p = static_cast<const char *>(data);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+size_t Journal::tailOffset(int in, uint64_t afterSequence) {
+    if (afterSequence == 0)
+        return 0;
+    JournalRecord probe;
+    off_t at = (off_t)(afterSequence - 1) * sizeof(JournalRecord);
+    if (pread(in, &probe, sizeof(probe), at) == (ssize_t)sizeof(probe) &&
+        probe.checksum == journalChecksum(probe) && probe.sequence == afterSequence)
+        return at + sizeof(JournalRecord);
+    return 0;
+}
+
+size_t Journal::replay(const string &path, const function<void(const JournalRecord &)> &apply,
+                       uint64_t afterSequence) {
+    int in = ::open(path.c_str(), O_RDONLY);
+    if (in < 0)
+        return 0;
+
+    size_t offset = tailOffset(in, afterSequence);
+    lseek(in, offset, SEEK_SET);
+
+    size_t validBytes = offset;
+    vector<JournalRecord> chunk(4096);
+    vector<JournalRecord> group; // an all-or-nothing group is applied only once complete
+    bool intact = true;
+    while (intact) {
+        ssize_t n = ::read(in, chunk.data(), chunk.size() * sizeof(JournalRecord));
+        if (n <= 0)
+            break;
+        size_t count = n / sizeof(JournalRecord);
+        for (size_t i = 0; i < count; ++i) {
+            const JournalRecord &rec = chunk[i];
+            if (rec.checksum != journalChecksum(rec)) {
+                intact = false;
+                break;
+            }
+            if (rec.groupRemaining > 0 || !group.empty()) {
+                group.push_back(rec);
+                if (rec.groupRemaining > 0)
+                    continue;
+                for (const auto &member : group)
+                    if (member.sequence > afterSequence)
+                        apply(member);
+                validBytes += group.size() * sizeof(JournalRecord);
+                group.clear();
+                continue;
+            }
+            if (rec.sequence > afterSequence)
+                apply(rec);
+            validBytes += sizeof(JournalRecord);
+        }
+        if (n % sizeof(JournalRecord) != 0)
+            break;
+    }
+    ::close(in);
+    return validBytes;
+}
+
+bool Journal::open(const Options &opts, const function<void(const JournalRecord &)> &recover,
+                   uint64_t afterSequence) {
+    options = opts;
+    uint64_t lastSequence = afterSequence;
+    size_t validBytes = replay(options.path, [&](const JournalRecord &rec) {
+        lastSequence = rec.sequence;
+        if (recover)
+            recover(rec);
+    }, afterSequence);
+
+    fd = ::open(options.path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    // Drop any torn tail so new records follow the last good one
+    if (ftruncate(fd, validBytes) != 0 || lseek(fd, validBytes, SEEK_SET) < 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    nextSequence = lastSequence + 1;
+    durableSequence = lastSequence;
+    stopping = false;
+    failed = false;
+    writer = thread(&Journal::writerLoop, this);
+    return true;
+}
+
+uint64_t Journal::waitBeyond(uint64_t sequence, chrono::milliseconds timeout) {
+    unique_lock<mutex> guard(lock);
+    batchDurable.wait_for(guard, timeout, [&] { return durableSequence > sequence || stopping; });
+    return durableSequence;
+}
+
+bool Journal::restartAfter(uint64_t sequence) {
+    if (!sync())
+        return false;
+    lock_guard<mutex> guard(lock);
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) < 0 || fdatasync(fd) != 0)
+        return false;
+    nextSequence = sequence + 1;
+    durableSequence = sequence;
+    return true;
+}
+
+uint64_t Journal::lastSequence() {
+    lock_guard<mutex> guard(lock);
+    return nextSequence - 1;
+}
+
+uint64_t Journal::enqueue(const JournalRecord &rec) {
+    lock_guard<mutex> guard(lock);
+    if (failed)
+        return nextSequence++;
+    if (pending.empty())
+        batchOpened = chrono::steady_clock::now();
+    pending.push_back(rec);
+    pending.back().sequence = nextSequence;
+    if (pending.size() == 1 || pending.size() >= options.maxBatch)
+        workReady.notify_one();
+    return nextSequence++;
+}
+
+uint64_t Journal::enqueueGroup(JournalRecord *recs, size_t count) {
+    lock_guard<mutex> guard(lock);
+    uint64_t first = nextSequence;
+    if (failed) {
+        nextSequence += count;
+        return first;
+    }
+    if (pending.empty())
+        batchOpened = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        recs[i].sequence = nextSequence++;
+        recs[i].groupRemaining = (uint16_t)(count - 1 - i);
+        pending.push_back(recs[i]);
+    }
+    workReady.notify_one();
+    return first;
+}
+
+bool Journal::waitDurable(uint64_t sequence) {
+    if (!options.waitForDurability)
+        return !failed;
+    METRIC_TIME(METRIC_JOURNAL_WAIT);
+    unique_lock<mutex> guard(lock);
+    batchDurable.wait(guard, [&] { return durableSequence >= sequence || failed; });
+    return durableSequence >= sequence;
+}
+
+uint64_t Journal::append(const JournalRecord &rec) {
+    uint64_t sequence = enqueue(rec);
+    waitDurable(sequence);
+    return sequence;
+}
+
+bool Journal::sync() {
+    unique_lock<mutex> guard(lock);
+    uint64_t target = nextSequence - 1;
+    workReady.notify_one();
+    batchDurable.wait(guard, [&] { return durableSequence >= target || failed; });
+    return durableSequence >= target;
+}
+
+void Journal::close() {
+    if (fd < 0)
+        return;
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    workReady.notify_one();
+    writer.join();
+    ::close(fd);
+    fd = -1;
+}
+
+// =========================
+// History Tier
+// =========================
+HistoryTier &HistoryTier::instance() {
+    static HistoryTier tier;
+    return tier;
+}
+
+bool HistoryTier::open(const Options &opts) {
+    lock_guard<mutex> hold(lock);
+    options = opts;
+    options.hotChunks = max<size_t>(options.hotChunks, 1);
+    options.segmentBytes = max(options.segmentBytes - options.segmentBytes % CHUNK_BYTES, CHUNK_BYTES);
+    options.trimEveryPasses = max<uint32_t>(options.trimEveryPasses, 1);
+    if (mkdir(options.directory.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    nextSegment = 1;
+    forEachSegmentFile([&](uint32_t id, const string &) { nextSegment = max(nextSegment, id + 1); });
+    opened = true;
+    return true;
+}
+
+bool HistoryTier::write(const TransactionRecord *const *chunks, size_t n, TransactionRecord **mapped) {
+    lock_guard<mutex> hold(lock);
+    vector<iovec> pieces;
+    while (n > 0) {
+        Segment *segment = writable();
+        if (!segment)
+            return false;
+        size_t room = options.segmentBytes / CHUNK_BYTES - segment->chunks;
+        size_t batch = min(n, room);
+        for (size_t done = 0; done < batch;) {
+            size_t part = min<size_t>(batch - done, IOV_MAX);
+            pieces.clear();
+            for (size_t i = 0; i < part; ++i)
+                pieces.push_back({const_cast<TransactionRecord *>(chunks[done + i]), CHUNK_BYTES});
+            off_t at = (off_t)(segment->chunks + done) * CHUNK_BYTES;
+            if (pwritev(segment->fd, pieces.data(), (int)part, at) != (ssize_t)(part * CHUNK_BYTES))
+                return false;
+            done += part;
+        }
+        if (fdatasync(segment->fd) != 0)
+            return false;
+        for (size_t i = 0; i < batch; ++i)
+            mapped[i] = segment->base + (segment->chunks + i) * HistoryArena::LARGE_CHUNK;
+        segment->chunks += batch;
+        chunks += batch;
+        mapped += batch;
+        n -= batch;
+    }
+    return true;
+}
+
+bool HistoryTier::locate(const TransactionRecord *p, Location &out) const {
+    for (const Segment &segment : segments)
+        if (p >= segment.base && p < segment.base + segment.chunks * HistoryArena::LARGE_CHUNK) {
+            out.segment = segment.id;
+            out.index = (uint32_t)((p - segment.base) / HistoryArena::LARGE_CHUNK);
+            return true;
+        }
+    return false;
+}
+
+TransactionRecord *HistoryTier::map(Location at) {
+    lock_guard<mutex> hold(lock);
+    if (!opened)
+        return nullptr;
+    Segment *segment = find(at.segment);
+    if (!segment) {
+        int fd = ::open(segmentPath(at.segment).c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat st;
+        void *base = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)CHUNK_BYTES)
+            base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            return nullptr;
+        }
+        segments.push_back({at.segment, fd, static_cast<TransactionRecord *>(base), (size_t)st.st_size,
+                            (size_t)st.st_size / CHUNK_BYTES, true});
+        segment = &segments.back();
+    }
+    if (at.index >= segment->chunks)
+        return nullptr;
+    return segment->base + (size_t)at.index * HistoryArena::LARGE_CHUNK;
+}
+
+void HistoryTier::removeUnused() {
+    lock_guard<mutex> hold(lock);
+    forEachSegmentFile([&](uint32_t id, const string &path) {
+        if (!find(id))
+            unlink(path.c_str());
+    });
+}
+
+void HistoryTier::dropPages(const TransactionRecord *chunk, size_t count) {
+    madvise(const_cast<TransactionRecord *>(chunk), count * CHUNK_BYTES, MADV_DONTNEED);
+}
+
+HistoryTier::~HistoryTier() {
+    for (Segment &segment : segments) {
+        munmap(segment.base, segment.mappedBytes);
+        ::close(segment.fd);
+    }
+}
+
+string HistoryTier::segmentPath(uint32_t id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/segment-%06u.wvh", id);
+    return options.directory + name;
+}
+
+HistoryTier::Segment *HistoryTier::find(uint32_t id) {
+    for (Segment &segment : segments)
+        if (segment.id == id)
+            return &segment;
+    return nullptr;
+}
+
+HistoryTier::Segment *HistoryTier::writable() {
+    if (!opened)
+        return nullptr;
+    if (!segments.empty() && !segments.back().sealed &&
+        segments.back().chunks < options.segmentBytes / CHUNK_BYTES)
+        return &segments.back();
+    uint32_t id = nextSegment++;
+    int fd = ::open(segmentPath(id).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return nullptr;
+    // Reserve the address range for the whole segment; only written chunks are read
+    void *base = mmap(nullptr, options.segmentBytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    // The new file's directory entry must be durable before a snapshot names it
+    int dirFd = ::open(options.directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+    segments.push_back({id, fd, static_cast<TransactionRecord *>(base), options.segmentBytes, 0, false});
+    return &segments.back();
+}
+
+// =========================
+// UserStore Class
+// =========================
+uint32_t UserStore::checksum(const UserFileRecord &rec) {
+    return crc32(reinterpret_cast<const uint8_t *>(&rec) + sizeof(rec.checksum), sizeof(rec) - sizeof(rec.checksum));
+}
+
+UserStore::Credential UserStore::hashNew(const User &user, random_device &random) const {
+    Credential cred;
+    cred.manager = user.isManager();
+    cred.iterations = options.iterations;
+    for (size_t i = 0; i < sizeof(cred.salt); i += sizeof(uint32_t)) {
+        uint32_t r = random();
+        memcpy(cred.salt + i, &r, sizeof(r));
+    }
+    pbkdf2Sha256(user.password, cred.salt, sizeof(cred.salt), cred.iterations, cred.hash);
+    return cred;
+}
+
+UserFileRecord UserStore::toRecord(const string &username, const Credential &cred) {
+    UserFileRecord rec = {};
+    JournalRecord::setField(rec.username, JOURNAL_USER_LEN, username);
+    rec.manager = cred.manager;
+    rec.iterations = cred.iterations;
+    memcpy(rec.salt, cred.salt, sizeof(rec.salt));
+    memcpy(rec.hash, cred.hash, sizeof(rec.hash));
+    rec.checksum = checksum(rec);
+    return rec;
+}
+
+bool UserStore::appendLocked(const vector<UserFileRecord> &recs) {
+    const char *p = reinterpret_cast<const char *>(recs.data());
+    size_t left = recs.size() * sizeof(UserFileRecord);
+    while (left > 0) {
+        ssize_t n = fd < 0 ? -1 : ::write(fd, p, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        left -= n;
+    }
+    fileRecords += recs.size();
+    return fdatasync(fd) == 0;
+}
+
+bool UserStore::sameHash(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0; // no early exit, so timing doesn't reveal how much matched
+    for (size_t i = 0; i < Sha256::DIGEST_LEN; ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+void UserStore::importLegacy() {
+    if (options.legacyPath.empty())
+        return;
+    ifstream inFile(options.legacyPath);
+    vector<User> legacy;
+    string uname, pwd, role;
+    while (inFile >> uname >> pwd >> role)
+        legacy.push_back(User(uname, pwd, role));
+    if (legacy.empty())
+        return;
+    size_t added = addMany(legacy);
+    cout << "Imported " << added << " users from " << options.legacyPath << " into " << options.path
+         << "; " << options.legacyPath << " can now be deleted.\n";
+}
+
+UserStore::UserStore(const Options &opts)
+    : options(opts) {
+    options.iterations = min(max(options.iterations, 1u), MAX_ITERATIONS);
+}
+
+UserStore::~UserStore() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void UserStore::load() {
+    unique_lock<shared_mutex> writeLock(lock);
+    fd = ::open(options.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cout << "Error opening user data file " << options.path << ".\n";
+        return;
+    }
+
+    UserFileHeader header = {};
+    if (st.st_size == 0) {
+        memcpy(header.magic, USER_FILE_MAGIC, sizeof(header.magic));
+        header.recordSize = sizeof(UserFileRecord);
+        if (::write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+            cout << "Error saving user data to file.\n";
+            return;
+        }
+        writeLock.unlock();
+        if (!options.seedDefaults)
+            return;
+        importLegacy();
+        // The default logins, unless the import brought their names along
+        addMany({User("Prithvi", "admin123", "manager"), User("Atharv", "user123", "user")});
+        return;
+    }
+
+    size_t count = (st.st_size - min<off_t>(st.st_size, sizeof(header))) / sizeof(UserFileRecord);
+    vector<UserFileRecord> recs(count);
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, USER_FILE_MAGIC, sizeof(header.magic)) != 0 || header.recordSize != sizeof(UserFileRecord)) {
+        cout << options.path << " is not a WiseVault user file.\n";
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    size_t bytes = count * sizeof(UserFileRecord), got = 0;
+    while (got < bytes) {
+        ssize_t n = pread(fd, reinterpret_cast<char *>(recs.data()) + got, bytes - got, sizeof(header) + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+
+    users.reserve(count);
+    size_t valid = 0;
+    while (valid < got / sizeof(UserFileRecord) && recs[valid].checksum == checksum(recs[valid])) {
+        const UserFileRecord &rec = recs[valid++];
+        Credential cred;
+        cred.manager = rec.manager != 0;
+        cred.iterations = rec.iterations;
+        memcpy(cred.salt, rec.salt, sizeof(cred.salt));
+        memcpy(cred.hash, rec.hash, sizeof(cred.hash));
+        users.emplace(JournalRecord::getField(rec.username, JOURNAL_USER_LEN), cred);
+    }
+    fileRecords = valid;
+    off_t end = sizeof(header) + valid * sizeof(UserFileRecord);
+    if (end != st.st_size && ftruncate(fd, end) != 0)
+        cout << "Error repairing user data file.\n";
+    lseek(fd, end, SEEK_SET);
+}
+
+bool UserStore::authenticate(const string &username, const string &password, User &out) const {
+    Credential cred;
+    bool found;
+    {
+        shared_lock<shared_mutex> readLock(lock);
+        auto it = users.find(username);
+        found = it != users.end();
+        if (found)
+            cred = it->second;
+    }
+    if (!found) {
+        // Spend the same time on unknown names as on wrong passwords
+        cred = Credential();
+        cred.iterations = options.iterations;
+    }
+    if (cred.iterations == 0 || cred.iterations > MAX_ITERATIONS)
+        return false;
+    uint8_t hash[Sha256::DIGEST_LEN];
+    pbkdf2Sha256(password, cred.salt, sizeof(cred.salt), cred.iterations, hash);
+    if (!found || !sameHash(hash, cred.hash))
+        return false;
+    out = User(username, "", cred.manager ? "manager" : "user");
+    return true;
+}
+
+bool UserStore::exists(const string &username) const {
+    shared_lock<shared_mutex> readLock(lock);
+    return users.count(username) != 0;
+}
+
+size_t UserStore::size() const {
+    shared_lock<shared_mutex> readLock(lock);
+    return users.size();
+}
+
+bool UserStore::add(const User &user) {
+    if (!fits(user.username) || exists(user.username))
+        return false;
+    random_device random;
+    Credential cred = hashNew(user, random); // hashed before locking; it's the slow part
+    unique_lock<shared_mutex> writeLock(lock);
+    if (!users.emplace(user.username, cred).second)
+        return false;
+    if (!appendLocked({toRecord(user.username, cred)}))
+        cout << "Error saving user data to file.\n";
+    return true;
+}
+
+size_t UserStore::addMany(const vector<User> &batch) {
+    vector<Credential> creds(batch.size());
+    parallelFor(batch.size(), max(1u, thread::hardware_concurrency()), 16, 1, [&](size_t begin, size_t end) {
+        random_device random;
+        for (size_t i = begin; i < end; ++i)
+            creds[i] = hashNew(batch[i], random);
+    });
+
+    unique_lock<shared_mutex> writeLock(lock);
+    vector<UserFileRecord> recs;
+    recs.reserve(batch.size());
+    users.reserve(users.size() + batch.size());
+    for (size_t i = 0; i < batch.size(); ++i)
+        if (fits(batch[i].username) && users.emplace(batch[i].username, creds[i]).second)
+            recs.push_back(toRecord(batch[i].username, creds[i]));
+    if (!recs.empty() && !appendLocked(recs))
+        cout << "Error saving user data to file.\n";
+    return recs.size();
+}
+
+size_t UserStore::recordCount() const {
+    shared_lock<shared_mutex> readLock(lock);
+    return fileRecords;
+}
+
+vector<UserFileRecord> UserStore::readRecords(size_t from, size_t max) const {
+    shared_lock<shared_mutex> readLock(lock);
+    vector<UserFileRecord> recs(from < fileRecords ? min(max, fileRecords - from) : 0);
+    size_t bytes = recs.size() * sizeof(UserFileRecord);
+    if (bytes && pread(fd, recs.data(), bytes, sizeof(UserFileHeader) + from * sizeof(UserFileRecord)) != (ssize_t)bytes)
+        recs.clear();
+    return recs;
+}
+
+bool UserStore::addRecords(const vector<UserFileRecord> &recs) {
+    unique_lock<shared_mutex> writeLock(lock);
+    for (const UserFileRecord &rec : recs) {
+        if (rec.checksum != checksum(rec))
+            return false;
+        Credential cred;
+        cred.manager = rec.manager != 0;
+        cred.iterations = rec.iterations;
+        memcpy(cred.salt, rec.salt, sizeof(cred.salt));
+        memcpy(cred.hash, rec.hash, sizeof(cred.hash));
+        users[JournalRecord::getField(rec.username, JOURNAL_USER_LEN)] = cred;
+    }
+    return appendLocked(recs);
+}
+
+// =========================
+// SessionTable Class
+// =========================
+time_t SessionTable::monotonicSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+SessionTable::Slot *SessionTable::slotAt(uint32_t index) const {
+    if (index >= options.capacity)
+        return nullptr;
+    Slot *page = pages[index / PAGE_SLOTS].load(memory_order_acquire);
+    return page ? &page[index % PAGE_SLOTS] : nullptr;
+}
+
+void SessionTable::beginWrite(Slot &slot) {
+    slot.version.store(slot.version.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void SessionTable::schedule(uint32_t index, const Slot &slot, uint32_t due) {
+    wheel[due % WHEEL_SLOTS].push_back(WheelEntry{index, slot.generation});
+}
+
+void SessionTable::closeLocked(uint32_t index, Slot &slot) {
+    beginWrite(slot);
+    slot.live = false;
+    endWrite(slot);
+    auto user = slotsByUser.find(slot.username);
+    if (user != slotsByUser.end()) {
+        vector<uint32_t> &list = user->second;
+        list.erase(find(list.begin(), list.end(), index));
+        if (list.empty())
+            slotsByUser.erase(user);
+    }
+    freeSlots.push_back(index);
+    --live;
+}
+
+size_t SessionTable::advanceLocked(uint32_t t) {
+    size_t expired = 0;
+    uint32_t steps = min<uint32_t>(t - wheelTick, WHEEL_SLOTS);
+    for (uint32_t i = 1; i <= steps; ++i) {
+        vector<WheelEntry> due;
+        due.swap(wheel[(wheelTick + i) % WHEEL_SLOTS]);
+        for (const WheelEntry &entry : due) {
+            Slot *slot = slotAt(entry.slot);
+            if (!slot->live || slot->generation != entry.generation)
+                continue; // logged out since
+            uint32_t expires = slot->lastUsed.load(memory_order_relaxed) + options.idleSeconds + 1;
+            if (expires <= t) {
+                closeLocked(entry.slot, *slot);
+                ++expired;
+            } else {
+                schedule(entry.slot, *slot, expires);
+            }
+        }
+    }
+    wheelTick = t;
+    return expired;
+}
+
+SessionTable::SessionTable(const Options &opts)
+    : options(opts), epoch(monotonicSeconds()) {
+    options.idleSeconds = max(options.idleSeconds, 1u);
+    size_t pageCount = (options.capacity + PAGE_SLOTS - 1) / PAGE_SLOTS;
+    pages.reset(new atomic<Slot *>[pageCount]);
+    for (size_t i = 0; i < pageCount; ++i)
+        pages[i].store(nullptr, memory_order_relaxed);
+    wheelTick = now();
+}
+
+SessionToken SessionTable::open(const string &username, bool manager, const vector<int> &accounts,
+                                const vector<int> &loans) {
+    lock_guard<mutex> guard(writeLock);
+    uint32_t t = now();
+    advanceLocked(t);
+
+    uint32_t index;
+    if (!freeSlots.empty()) {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    } else if (unusedSlot < options.capacity) {
+        index = unusedSlot++;
+        if (index % PAGE_SLOTS == 0) {
+            owned.emplace_back(new Slot[PAGE_SLOTS]);
+            pages[index / PAGE_SLOTS].store(owned.back().get(), memory_order_release);
+        }
+    } else {
+        return SessionToken();
+    }
+
+    Slot &slot = *slotAt(index);
+    beginWrite(slot);
+    slot.generation = slot.generation + 1 ? slot.generation + 1 : 1;
+    slot.secret = uint64_t(entropy()) << 32 | entropy();
+    slot.live = true;
+    slot.manager = manager;
+    JournalRecord::setField(slot.username, JOURNAL_USER_LEN, username);
+    const vector<int> *lists[2] = {&accounts, &loans};
+    for (SessionResource kind : {SESSION_ACCOUNT, SESSION_LOAN}) {
+        const vector<int> &ids = *lists[kind];
+        slot.count[kind] = (uint8_t)min(ids.size(), Slot::capacity(kind));
+        slot.overflow[kind] = ids.size() > Slot::capacity(kind);
+        copy(ids.begin(), ids.begin() + slot.count[kind], slot.ids(kind));
+    }
+    slot.lastUsed.store(t, memory_order_relaxed);
+    endWrite(slot);
+
+    slotsByUser[username].push_back(index);
+    schedule(index, slot, t + options.idleSeconds + 1);
+    ++live;
+
+    SessionToken token;
+    token.slot = index;
+    token.generation = slot.generation;
+    token.secret = slot.secret;
+    return token;
+}
+
+void SessionTable::close(const SessionToken &token) {
+    lock_guard<mutex> guard(writeLock);
+    Slot *slot = slotAt(token.slot);
+    if (slot && token.valid() && slot->live && slot->generation == token.generation && slot->secret == token.secret)
+        closeLocked(token.slot, *slot);
+}
+
+bool SessionTable::lookup(const SessionToken &token, Info &info) const {
+    char username[JOURNAL_USER_LEN];
+    bool manager = false;
+    if (!read(token, [&](const Slot &slot) {
+            memcpy(username, slot.username, sizeof(username));
+            manager = slot.manager;
+        }))
+        return false;
+    info.username = JournalRecord::getField(username, JOURNAL_USER_LEN);
+    info.manager = manager;
+    return true;
+}
+
+bool SessionTable::active(const SessionToken &token) const {
+    return read(token, [](const Slot &) {});
+}
+
+bool SessionTable::permits(const SessionToken &token, SessionResource kind, int32_t id, const string &owner) const {
+    bool allowed = false, compareOwner = false;
+    char username[JOURNAL_USER_LEN];
+    if (!read(token, [&](const Slot &slot) {
+            allowed = slot.manager;
+            const int32_t *ids = slot.ids(kind);
+            for (size_t i = 0; i < slot.count[kind] && !allowed; ++i)
+                allowed = ids[i] == id;
+            compareOwner = !allowed && slot.overflow[kind];
+            if (compareOwner)
+                memcpy(username, slot.username, sizeof(username));
+        }))
+        return false;
+    return allowed || (compareOwner && strncmp(username, owner.c_str(), JOURNAL_USER_LEN) == 0 &&
+                       owner.size() < JOURNAL_USER_LEN);
+}
+
+void SessionTable::grant(const string &username, SessionResource kind, int32_t id) {
+    lock_guard<mutex> guard(writeLock);
+    auto user = slotsByUser.find(username);
+    if (user == slotsByUser.end())
+        return;
+    for (uint32_t index : user->second) {
+        Slot &slot = *slotAt(index);
+        beginWrite(slot);
+        if (slot.count[kind] < Slot::capacity(kind))
+            slot.ids(kind)[slot.count[kind]++] = id;
+        else
+            slot.overflow[kind] = true;
+        endWrite(slot);
+    }
+}
+
+void SessionTable::revoke(const string &username, SessionResource kind, int32_t id) {
+    lock_guard<mutex> guard(writeLock);
+    auto user = slotsByUser.find(username);
+    if (user == slotsByUser.end())
+        return;
+    for (uint32_t index : user->second) {
+        Slot &slot = *slotAt(index);
+        int32_t *ids = slot.ids(kind);
+        beginWrite(slot);
+        for (size_t i = 0; i < slot.count[kind]; ++i) {
+            if (ids[i] == id) {
+                ids[i] = ids[--slot.count[kind]];
+                break;
+            }
+        }
+        endWrite(slot);
+    }
+}
+
+size_t SessionTable::expire() {
+    lock_guard<mutex> guard(writeLock);
+    return advanceLocked(now());
+}
+
+size_t SessionTable::size() {
+    lock_guard<mutex> guard(writeLock);
+    return live;
+}
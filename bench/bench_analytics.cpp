@@ -0,0 +1,137 @@
+// Column store aggregates over a book spread across a year: the first full
+// refresh, an incremental one after 1% more postings, book-wide queries on
+// one thread and on all of them, and the same per-day totals computed by
+// walking every account's history row by row. The last column is deposits/sec
+// on one thread while another refreshes and queries in a loop, against the
+// rate with nothing else running; on a single core the two share the CPU, so
+// run it with at least two.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_analytics.cpp WiseVault[A-Z]*.cpp -o bench_analytics
+//   ./bench_analytics [transactions=10000000] [accounts=100000] [threads=hardware]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long transactions = bench::argOr(argc, argv, 1, 10000000);
+    const long accountCount = max(1L, bench::argOr(argc, argv, 2, 100000));
+    const unsigned threads = (unsigned)max(1L, bench::argOr(argc, argv, 3, thread::hardware_concurrency()));
+    const time_t start = 1700000000;
+    const long rounds = max(1L, transactions / accountCount);
+
+    Manager manager;
+    vector<Account *> accounts(accountCount);
+    {
+        bench::QuietCout quiet;
+        const char *types[] = {"Saving", "Current", "Joint"};
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), types[i % 3], "user" + to_string(i % 1000));
+        for (long i = 0; i < accountCount; ++i)
+            accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+        for (long i = 0; i < accountCount / 4; ++i)
+            manager.applyLoan("Borrower", "user" + to_string(i % 1000), Money::fromRupees(10000 + i % 90000), 12);
+    }
+    bench::Rng rng;
+    // Round r of postings is stamped r/rounds of the way through the year
+    auto post = [&](long from, long to)
+    {
+        for (long r = from; r < to; ++r)
+            for (Account *acc : accounts)
+            {
+                time_t when = start + (time_t)(r * 365 * 86400.0 / rounds);
+                TxType type = rng.below(100) < 60 ? TX_DEPOSIT : TX_WITHDRAW;
+                lock_guard<RecordMutex> hold(acc->mutex());
+                acc->addTransactionRecord(TransactionRecord(acc->getAccountNumber(), type,
+                                                            Money::fromPaise(1 + (int64_t)rng.below(1000000)), when));
+            }
+    };
+    post(0, rounds);
+
+    ColumnStore store(threads), single(1);
+    auto begin = bench::Clock::now();
+    manager.refreshAnalytics(store);
+    double refreshS = bench::secondsSince(begin);
+    manager.refreshAnalytics(single);
+
+    ColumnStore::Filter deposits;
+    deposits.typeMask = 1u << TX_DEPOSIT;
+    vector<ColumnStore::Group> groups;
+    // Best of three, in ms
+    auto time = [&](auto query)
+    {
+        double best = 1e30;
+        for (int i = 0; i < 3; ++i)
+        {
+            auto t = bench::Clock::now();
+            query();
+            best = min(best, bench::secondsSince(t) * 1e3);
+        }
+        return best;
+    };
+    double totalMs = time([&] { store.sumTransactions(ColumnStore::Filter(), ColumnStore::GROUP_NONE, groups); });
+    uint64_t checksum = groups.empty() ? 0 : (uint64_t)groups[0].sum.paise();
+    double perDay1Ms = time([&] { single.sumTransactions(deposits, ColumnStore::GROUP_DAY, groups); });
+    double perDayMs = time([&] { store.sumTransactions(deposits, ColumnStore::GROUP_DAY, groups); });
+    size_t days = groups.size();
+    double byTypeMs = time([&] { store.sumTransactions(ColumnStore::Filter(), ColumnStore::GROUP_ACCOUNT_TYPE, groups); });
+    double balancesMs = time([&] { store.sumBalances(ColumnStore::GROUP_ACCOUNT_TYPE, groups); });
+    double exposureMs = time([&] { store.sumLoanExposure(ColumnStore::GROUP_OWNER, groups); });
+
+    // The same per-day deposit totals from the histories themselves
+    double rowScanMs = time([&]
+    {
+        vector<int64_t> perDay(400);
+        int32_t first = dayNumber(start);
+        for (Account *acc : accounts)
+            acc->getTransactionLog().forEach([&](const TransactionRecord &record)
+            {
+                if (record.getType() == TX_DEPOSIT)
+                    perDay[dayNumber(record.getTimestamp()) - first] += record.getAmount().paise();
+            });
+        bench::doNotOptimize(perDay[0]);
+    });
+
+    // The first refresh after a full one regrows the columns; time the one after
+    long more = max(1L, rounds / 100);
+    post(rounds, rounds + more);
+    manager.refreshAnalytics(store);
+    post(rounds + more, rounds + 2 * more);
+    begin = bench::Clock::now();
+    size_t added = manager.refreshAnalytics(store);
+    double incrementalMs = bench::secondsSince(begin) * 1e3;
+
+    // Posting alone, then alongside a reader that refreshes and queries nonstop
+    Transaction transaction;
+    const long deposits1 = 2000000;
+    auto depositRate = [&]
+    {
+        auto t = bench::Clock::now();
+        for (long i = 0; i < deposits1; ++i)
+            transaction.deposit(*accounts[rng.below(accountCount)], Money::fromPaise(1));
+        return deposits1 / bench::secondsSince(t);
+    };
+    double alone = depositRate();
+    atomic<bool> stop{false};
+    thread reader([&]
+    {
+        vector<ColumnStore::Group> readerGroups;
+        while (!stop)
+        {
+            manager.refreshAnalytics(store);
+            store.sumTransactions(ColumnStore::Filter(), ColumnStore::GROUP_NONE, readerGroups);
+        }
+    });
+    double withReader = depositRate();
+    stop = true;
+    reader.join();
+
+    cout << "transactions,threads,refresh_s,incremental_ms,incremental_rows,total_ms,per_day_1t_ms,per_day_ms,"
+            "by_account_type_ms,balances_ms,exposure_ms,row_scan_per_day_ms,days,deposits_per_sec,"
+            "deposits_per_sec_with_reader,checksum\n";
+    cout << rounds * accountCount << "," << threads << "," << refreshS << "," << incrementalMs << "," << added << ","
+         << totalMs << "," << perDay1Ms << "," << perDayMs << "," << byTypeMs << "," << balancesMs << "," << exposureMs
+         << "," << rowScanMs << "," << days << "," << alone << "," << withReader << "," << checksum << "\n";
+    return 0;
+}
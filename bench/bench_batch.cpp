@@ -0,0 +1,101 @@
+// Settlement-file ingestion: BatchIngest on CSV and binary input, with and
+// without a journal, vs. posting the same operations one call at a time.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_batch.cpp WiseVault[A-Z]*.cpp -o bench_batch
+//   ./bench_batch [operations=2000000] [accounts=100000] [dir=/tmp]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long opCount = bench::argOr(argc, argv, 1, 2000000);
+    const long accountCount = bench::argOr(argc, argv, 2, 100000);
+    const string dir = argc > 3 ? argv[3] : "/tmp";
+    const string csvPath = dir + "/wisevault_batch.csv", binPath = dir + "/wisevault_batch.bin";
+    const string journalPath = dir + "/wisevault_batch.journal";
+
+    // Deposits and withdrawals spread over the accounts, in both formats
+    {
+        bench::Rng rng;
+        ofstream csv(csvPath);
+        ofstream bin(binPath, ios::binary);
+        bin.write(BATCH_MAGIC, sizeof(BATCH_MAGIC));
+        for (long i = 0; i < opCount; ++i)
+        {
+            BatchRecord rec = {};
+            rec.op = rng.next() & 1 ? BATCH_DEPOSIT : BATCH_WITHDRAW;
+            rec.accountNumber = 1001 + (int32_t)rng.below(accountCount);
+            rec.amount = 1 + (int64_t)rng.below(100000);
+            csv << (rec.op == BATCH_DEPOSIT ? "deposit," : "withdraw,") << rec.accountNumber << ","
+                << Money::fromPaise(rec.amount) << "\n";
+            bin.write(reinterpret_cast<const char *>(&rec), sizeof(rec));
+        }
+    }
+
+    // A fresh book per run; returns operations per second
+    auto timeRun = [&](bool withJournal, auto ingest)
+    {
+        unlink(journalPath.c_str());
+        Journal journal;
+        Journal::Options options;
+        options.path = journalPath;
+        Manager manager;
+        Transaction transaction;
+        if (withJournal && journal.open(options))
+        {
+            manager.attachJournal(&journal);
+            transaction.attachJournal(&journal);
+        }
+        uint64_t sequence = 0;
+        for (long i = 0; i < accountCount; ++i)
+            manager.openAccount("Holder", Money::fromRupees(500), "Saving", "user" + to_string(i), sequence);
+        if (sequence)
+            journal.waitDurable(sequence);
+        auto start = bench::Clock::now();
+        long ops = ingest(manager, transaction, withJournal && journal.isOpen() ? &journal : nullptr);
+        return ops / bench::secondsSince(start);
+    };
+
+    ostringstream errors;
+    auto runFile = [&](const string &path)
+    {
+        return [&, path](Manager &manager, Transaction &transaction, Journal *journal)
+        {
+            BatchIngest ingest(manager, transaction, journal, errors);
+            BatchIngest::Result result;
+            ingest.run(path, result);
+            errors.str("");
+            return (long)result.records;
+        };
+    };
+    double csvRate = timeRun(false, runFile(csvPath));
+    double binRate = timeRun(false, runFile(binPath));
+    double csvJournalRate = timeRun(true, runFile(csvPath));
+    double binJournalRate = timeRun(true, runFile(binPath));
+
+    // The interactive path: every call waits for its own commit. Capped, as it is slow.
+    const long perCallOps = min(opCount, 2000L);
+    double perCallRate = timeRun(true, [&](Manager &manager, Transaction &transaction, Journal *)
+    {
+        bench::Rng rng;
+        for (long i = 0; i < perCallOps; ++i)
+        {
+            int accNo = 1001 + (int)rng.below(accountCount);
+            if (rng.next() & 1)
+                transaction.deposit(manager, accNo, Money::fromPaise(1 + rng.below(100000)));
+            else
+                transaction.withdraw(manager, accNo, Money::fromPaise(1 + rng.below(100000)));
+        }
+        return perCallOps;
+    });
+
+    cout << "operations,csv_ops_per_sec,binary_ops_per_sec,csv_journal_ops_per_sec,binary_journal_ops_per_sec,"
+            "per_call_journal_ops_per_sec\n";
+    cout << opCount << "," << csvRate << "," << binRate << "," << csvJournalRate << "," << binJournalRate << ","
+         << perCallRate << "\n";
+    for (const string &path : {csvPath, binPath, journalPath})
+        unlink(path.c_str());
+    return 0;
+}
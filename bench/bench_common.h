@@ -0,0 +1,63 @@
+// Shared helpers for the WiseVault benchmarks.
+// Each benchmark includes WiseVault.h and links the wisevault_core library, so
+// it measures exactly the classes the application ships with.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The core classes report to cout; silence it while building fixtures.
+class QuietCout
+{
+    std::streambuf *saved;
+
+public:
+    QuietCout() : saved(std::cout.rdbuf(nullptr)) {}
+    ~QuietCout()
+    {
+        std::cout.rdbuf(saved);
+        std::cout.clear();
+    }
+};
+
+// Small deterministic generator so every run sees the same workload.
+class Rng
+{
+    uint64_t state;
+
+public:
+    explicit Rng(uint64_t seed = 0x9E3779B97F4A7C15ull) : state(seed) {}
+    uint64_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    uint64_t below(uint64_t n) { return next() % n; }
+};
+
+// Keeps the optimiser from discarding a benchmarked result.
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+inline long argOr(int argc, char **argv, int index, long fallback)
+{
+    return argc > index ? std::atol(argv[index]) : fallback;
+}
+
+} // namespace bench
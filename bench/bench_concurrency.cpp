@@ -0,0 +1,56 @@
+// Multi-threaded deposit/withdraw throughput through Transaction, 1..N threads.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_concurrency.cpp WiseVault[A-Z]*.cpp -o bench_concurrency
+//   ./bench_concurrency [maxThreads=hardware_concurrency] [accounts=100000] [opsPerThread=1000000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long maxThreads = bench::argOr(argc, argv, 1, max(1u, thread::hardware_concurrency()));
+    const long accountCount = bench::argOr(argc, argv, 2, 100000);
+    const long opsPerThread = bench::argOr(argc, argv, 3, 1000000);
+
+    Manager manager;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(1000), "Saving", "user" + to_string(i));
+    }
+    Transaction transaction;
+
+    cout << "threads,ops,seconds,ops_per_sec,speedup\n";
+    double baseline = 0;
+    for (long threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        vector<thread> workers;
+        auto start = bench::Clock::now();
+        for (long t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t]
+            {
+                bench::Rng rng(0x1234 + t);
+                for (long i = 0; i < opsPerThread; ++i)
+                {
+                    int accNo = 1001 + (int)rng.below(accountCount);
+                    if (rng.next() & 1)
+                        transaction.deposit(manager, accNo, Money::fromRupees(5));
+                    else
+                        transaction.withdraw(manager, accNo, Money::fromRupees(5));
+                }
+            });
+        }
+        for (auto &w : workers)
+            w.join();
+        double seconds = bench::secondsSince(start);
+        double rate = threads * opsPerThread / seconds;
+        if (threads == 1)
+            baseline = rate;
+        cout << threads << "," << threads * opsPerThread << "," << seconds << "," << rate << "," << rate / baseline << "\n";
+        if (threads * 2 > maxThreads && threads != maxThreads)
+            threads = maxThreads / 2; // always finish on maxThreads
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Transaction history footprint and scan speed: the chunked TransactionLog vs.
+// the previous per-account vector of string-typed records.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_history.cpp WiseVault[A-Z]*.cpp -o bench_history
+//   ./bench_history [accounts=100000] [recordsPerAccount=200]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+// The layout TransactionRecord had before it became a POD
+struct LegacyRecord
+{
+    int accountNumber;
+    string type;
+    double amount;
+    time_t timestamp;
+    uint64_t linkID;
+};
+
+int main(int argc, char **argv)
+{
+    const long accountCount = bench::argOr(argc, argv, 1, 100000);
+    const long perAccount = bench::argOr(argc, argv, 2, 200);
+    const char *names[] = {"Deposit", "Withdraw", "Loan Payment", "Transfer Out", "Transfer In"};
+
+    bench::Rng rng;
+    auto start = bench::Clock::now();
+    vector<vector<LegacyRecord>> legacy(accountCount);
+    for (long r = 0; r < perAccount; ++r)
+        for (long a = 0; a < accountCount; ++a)
+            legacy[a].push_back(LegacyRecord{(int)a, names[r % 5], double(rng.below(100000)), time(nullptr), 0});
+    double legacyAppendNs = bench::secondsSince(start) * 1e9 / (accountCount * perAccount);
+    size_t legacyBytes = legacy.capacity() * sizeof(vector<LegacyRecord>);
+    for (const auto &log : legacy)
+        legacyBytes += log.capacity() * sizeof(LegacyRecord);
+
+    size_t arenaBefore = HistoryArena::instance().reservedBytes();
+    start = bench::Clock::now();
+    vector<TransactionLog> logs(accountCount);
+    for (long r = 0; r < perAccount; ++r)
+        for (long a = 0; a < accountCount; ++a)
+            logs[a].push_back(TransactionRecord((int)a, TxType(1 + r % 5), Money::fromPaise(rng.below(10000000)), time(nullptr)));
+    double appendNs = bench::secondsSince(start) * 1e9 / (accountCount * perAccount);
+    size_t chunkedBytes = HistoryArena::instance().reservedBytes() - arenaBefore + logs.capacity() * sizeof(TransactionLog);
+    for (const auto &log : logs)
+        chunkedBytes += (log.size() / HistoryArena::LARGE_CHUNK + 1) * sizeof(TransactionRecord *);
+
+    start = bench::Clock::now();
+    double legacyTotal = 0;
+    for (const auto &log : legacy)
+        for (const auto &rec : log)
+            legacyTotal += rec.type == "Deposit" ? rec.amount : -rec.amount;
+    double legacyScanNs = bench::secondsSince(start) * 1e9 / (accountCount * perAccount);
+
+    start = bench::Clock::now();
+    int64_t total = 0;
+    for (const auto &log : logs)
+        log.forEach([&](const TransactionRecord &rec)
+        {
+            total += rec.getType() == TX_DEPOSIT ? rec.getAmount().paise() : -rec.getAmount().paise();
+        });
+    double scanNs = bench::secondsSince(start) * 1e9 / (accountCount * perAccount);
+    bench::doNotOptimize(legacyTotal);
+    bench::doNotOptimize(total);
+
+    const double records = double(accountCount) * perAccount;
+    cout << "records,legacy_bytes_per_record,chunked_bytes_per_record,legacy_append_ns,chunked_append_ns,legacy_scan_ns,chunked_scan_ns\n";
+    cout << (long)records << "," << legacyBytes / records << "," << chunkedBytes / records << "," << legacyAppendNs << ","
+         << appendNs << "," << legacyScanNs << "," << scanNs << "\n";
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Global transaction ledger: deposits/sec from several threads with no global
+// history, with one appended under a shared mutex on the posting path, and
+// with the ledger ring feeding it from a drainer thread. The last columns are
+// how often a full ring made a posting wait and how long the drainer took to
+// catch up once posting stopped. On a single core the drainer takes its CPU
+// time from the posting threads, so there the ledger can't beat the mutex;
+// what it removes is the mutex's contention between cores.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_ledger.cpp WiseVault[A-Z]*.cpp -o bench_ledger
+//   ./bench_ledger [deposits=2000000] [threads=hardware] [capacity=16384]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long deposits = bench::argOr(argc, argv, 1, 2000000);
+    const unsigned threads = (unsigned)max(1L, bench::argOr(argc, argv, 2, thread::hardware_concurrency()));
+    const long capacity = max(2L, bench::argOr(argc, argv, 3, 16384));
+    const long accountCount = 10000;
+
+    Manager manager;
+    vector<Account *> accounts(accountCount);
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), "Saving", "user" + to_string(i));
+        for (long i = 0; i < accountCount; ++i)
+            accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+    }
+
+    // deposits/sec over all threads; each thread posts to its own slice of the accounts
+    auto rate = [&](Transaction &transaction, function<void(const TransactionRecord &)> after)
+    {
+        auto start = bench::Clock::now();
+        parallelFor(deposits, threads, 1, 1, [&](size_t from, size_t to)
+        {
+            bench::Rng rng(from + 1);
+            for (size_t i = from; i < to; ++i)
+            {
+                Account &acc = *accounts[rng.below(accountCount)];
+                Money amount = Money::fromPaise(1 + (int64_t)rng.below(100000));
+                transaction.deposit(acc, amount);
+                if (after)
+                    after(TransactionRecord(acc.getAccountNumber(), TX_DEPOSIT, amount));
+            }
+        });
+        return deposits / bench::secondsSince(start);
+    };
+
+    Transaction direct;
+    double directRate = rate(direct, nullptr);
+
+    TransactionLog lockedHistory;
+    mutex historyLock;
+    double lockedRate = rate(direct, [&](const TransactionRecord &record)
+    {
+        lock_guard<mutex> hold(historyLock);
+        lockedHistory.push_back(record);
+    });
+
+    Ledger ledger;
+    Ledger::Options options;
+    options.capacity = capacity;
+    manager.attachLedger(&ledger);
+    ledger.start(options);
+    Transaction published;
+    published.attachLedger(&ledger);
+    uint64_t stallsBefore = Metrics::snapshot().counters[COUNTER_LEDGER_STALLS];
+    double ledgerRate = rate(published, nullptr);
+    auto start = bench::Clock::now();
+    ledger.flush();
+    double catchUpMs = bench::secondsSince(start) * 1e3;
+    uint64_t stalls = Metrics::snapshot().counters[COUNTER_LEDGER_STALLS] - stallsBefore;
+    ledger.stop();
+
+    cout << "deposits,threads,capacity,direct_per_sec,locked_history_per_sec,ledger_per_sec,stalls,catch_up_ms\n";
+    cout << deposits << "," << threads << "," << capacity << "," << directRate << "," << lockedRate << "," << ledgerRate
+         << "," << stalls << "," << catchUpMs << "\n";
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Portfolio loan math: the old per-loan pow() EMI vs. LoanEngine's vector
+// kernels on 1 and N threads, a full Manager::repriceLoans, and schedules.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_loans.cpp WiseVault[A-Z]*.cpp -o bench_loans
+//   ./bench_loans [loans=2000000] [threads=hardware] [scheduleLoans=100000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long loanCount = bench::argOr(argc, argv, 1, 2000000);
+    const unsigned threads = (unsigned)bench::argOr(argc, argv, 2, thread::hardware_concurrency());
+    const long scheduleLoans = min(loanCount, bench::argOr(argc, argv, 3, 100000));
+
+    bench::Rng rng;
+    LoanEngine::Book book;
+    book.resize(loanCount);
+    for (long i = 0; i < loanCount; ++i)
+    {
+        book.loanID[i] = (int32_t)(i + 1);
+        book.outstanding[i] = 10000 + rng.below(5000000);
+        book.rate[i] = 6 + rng.below(1200) / 100.0;
+        book.months[i] = 12 * (1 + (int32_t)rng.below(30));
+    }
+
+    // The constructor's old formula: two pow() calls per loan, one loan at a time
+    auto start = bench::Clock::now();
+    for (long i = 0; i < loanCount; ++i)
+    {
+        double monthlyRate = (book.rate[i] / 12) / 100;
+        book.emi[i] = (book.outstanding[i] * monthlyRate * pow(1 + monthlyRate, book.months[i])) /
+                      (pow(1 + monthlyRate, book.months[i]) - 1);
+    }
+    double scalarMs = bench::secondsSince(start) * 1e3;
+    bench::doNotOptimize(book.emi[loanCount / 2]);
+
+    auto timeEmis = [&](unsigned threadCount)
+    {
+        LoanEngine engine(threadCount);
+        auto begin = bench::Clock::now();
+        engine.computeEmis(book.outstanding.data(), book.rate.data(), book.months.data(), book.emi.data(), book.size());
+        bench::doNotOptimize(book.emi[loanCount / 2]);
+        return bench::secondsSince(begin) * 1e3;
+    };
+    double vectorMs = timeEmis(1);
+    double parallelMs = timeEmis(threads);
+
+    Manager manager;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < loanCount; ++i)
+            manager.applyLoan("Holder", "user" + to_string(i % 1000), Money::fromPaise(1000000 + rng.below(500000000)),
+                              1 + (int)rng.below(30));
+    }
+    start = bench::Clock::now();
+    manager.repriceLoans(9.25);
+    double repriceMs = bench::secondsSince(start) * 1e3;
+
+    LoanEngine engine(threads);
+    book.resize(scheduleLoans);
+    vector<size_t> offsets;
+    vector<LoanEngine::ScheduleRow> rows;
+    start = bench::Clock::now();
+    engine.computeOutstanding(book);
+    engine.schedules(book, offsets, rows);
+    double scheduleSeconds = bench::secondsSince(start);
+
+    cout << "loans,threads,scalar_pow_ms,vector_1t_ms,vector_nt_ms,manager_reprice_ms,schedule_rows,schedule_rows_per_sec\n";
+    cout << loanCount << "," << threads << "," << scalarMs << "," << vectorMs << "," << parallelMs << "," << repriceMs << ","
+         << rows.size() << "," << rows.size() / scheduleSeconds << "\n";
+    return 0;
+}
@@ -0,0 +1,53 @@
+// Lookup latency vs. book size for Manager::findAccount / findLoan / getUserAccounts.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_lookup.cpp WiseVault[A-Z]*.cpp -o bench_lookup
+//   ./bench_lookup [maxAccounts=10000000] [lookups=1000000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long maxAccounts = bench::argOr(argc, argv, 1, 10000000);
+    const long lookups = bench::argOr(argc, argv, 2, 1000000);
+    const int usersPerBook = 1000;
+
+    cout << "accounts,findAccount_ns,findLoan_ns,getUserAccounts_ns\n";
+    for (long size = 10000; size <= maxAccounts; size *= 10)
+    {
+        Manager manager;
+        {
+            bench::QuietCout quiet;
+            for (long i = 0; i < size; ++i)
+            {
+                string owner = "user" + to_string(i % usersPerBook);
+                manager.createAccount("Holder", Money::fromRupees(1000), "Saving", owner);
+                manager.applyLoan("Holder", owner, Money::fromRupees(50000), 5);
+            }
+        }
+
+        bench::Rng rng;
+        long found = 0;
+        auto start = bench::Clock::now();
+        for (long i = 0; i < lookups; ++i)
+            found += manager.findAccount(1001 + (int)rng.below(size), "", true) != nullptr;
+        double accountNs = bench::secondsSince(start) * 1e9 / lookups;
+
+        start = bench::Clock::now();
+        for (long i = 0; i < lookups; ++i)
+            found += manager.findLoan(1 + (int)rng.below(size), "", true) != nullptr;
+        double loanNs = bench::secondsSince(start) * 1e9 / lookups;
+
+        // Owner lookups copy whole accounts, so use fewer iterations
+        const long ownerLookups = 1000;
+        start = bench::Clock::now();
+        for (long i = 0; i < ownerLookups; ++i)
+            found += manager.getUserAccounts("user" + to_string(rng.below(usersPerBook))).size();
+        double ownerNs = bench::secondsSince(start) * 1e9 / ownerLookups;
+
+        bench::doNotOptimize(found);
+        cout << size << "," << accountNs << "," << loanNs << "," << ownerNs << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Cost of the hot-path probes: an empty timed scope, deposits and lookups
+// with the probes in, recording from N threads at once, and a full snapshot.
+// Build it a second time with -DWISEVAULT_NO_METRICS for the baseline.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_metrics.cpp WiseVault[A-Z]*.cpp -o bench_metrics
+//   g++ -O2 -std=c++17 -pthread -DWISEVAULT_NO_METRICS bench/bench_metrics.cpp WiseVault[A-Z]*.cpp -o bench_metrics_off
+//   ./bench_metrics [operations=5000000] [threads=hardware] [accounts=10000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long operations = bench::argOr(argc, argv, 1, 5000000);
+    const unsigned threads = (unsigned)bench::argOr(argc, argv, 2, thread::hardware_concurrency());
+    const long accountCount = bench::argOr(argc, argv, 3, 10000);
+#ifdef WISEVAULT_NO_METRICS
+    const int enabled = 0;
+#else
+    const int enabled = 1;
+#endif
+
+    Manager manager;
+    Transaction transaction;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), "Saving", "user" + to_string(i));
+    }
+
+    // A probe around nothing
+    auto start = bench::Clock::now();
+    for (long i = 0; i < operations; ++i)
+    {
+        METRIC_TIME(METRIC_FIND_LOAN);
+        bench::doNotOptimize(i);
+    }
+    double probeNs = bench::secondsSince(start) * 1e9 / operations;
+
+    bench::Rng rng;
+    vector<Account *> accounts(accountCount);
+    for (long i = 0; i < accountCount; ++i)
+        accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+    // No journal attached, so this is the in-memory posting path alone
+    start = bench::Clock::now();
+    for (long i = 0; i < operations; ++i)
+        transaction.deposit(*accounts[rng.below(accountCount)], Money::fromPaise(1));
+    double depositNs = bench::secondsSince(start) * 1e9 / operations;
+
+    start = bench::Clock::now();
+    long found = 0;
+    for (long i = 0; i < operations; ++i)
+        found += manager.findAccount(1001 + (int)rng.below(accountCount), "", true) != nullptr;
+    double findNs = bench::secondsSince(start) * 1e9 / operations;
+    bench::doNotOptimize(found);
+
+    // Every thread records into its own block, so this should scale with threads
+    start = bench::Clock::now();
+    parallelFor(operations * threads, threads, 1, 1, [&](size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; ++i)
+        {
+            METRIC_TIME(METRIC_FIND_LOAN);
+            bench::doNotOptimize(i);
+        }
+    });
+    double recordsPerSec = operations * threads / bench::secondsSince(start);
+
+    start = bench::Clock::now();
+    Metrics::Snapshot snapshot = Metrics::snapshot();
+    double snapshotUs = bench::secondsSince(start) * 1e6;
+    bench::doNotOptimize(snapshot.count[METRIC_DEPOSIT]);
+
+    cout << "metrics,threads,probe_ns,deposit_ns,find_account_ns,records_nt_per_sec,snapshot_us,p50_deposit_ns,p99_deposit_ns\n";
+    cout << enabled << "," << threads << "," << probeNs << "," << depositNs << "," << findNs << "," << recordsPerSec << ","
+         << snapshotUs << "," << snapshot.quantileNs(METRIC_DEPOSIT, 0.5) << "," << snapshot.quantileNs(METRIC_DEPOSIT, 0.99)
+         << "\n";
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Bulk balance totals: summing doubles vs. Money::sum over int64 paise, and
+// Manager::totalBalance over a populated book.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_money.cpp WiseVault[A-Z]*.cpp -o bench_money
+//   ./bench_money [balances=10000000] [rounds=20] [accounts=1000000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long count = bench::argOr(argc, argv, 1, 10000000);
+    const long rounds = bench::argOr(argc, argv, 2, 20);
+    const long accountCount = bench::argOr(argc, argv, 3, 1000000);
+
+    bench::Rng rng;
+    vector<int64_t> paise(count);
+    vector<double> rupees(count);
+    for (long i = 0; i < count; ++i)
+    {
+        paise[i] = (int64_t)rng.below(10000000000ull); // up to INR 10 crore
+        rupees[i] = paise[i] / 100.0;
+    }
+
+    auto start = bench::Clock::now();
+    double doubleTotal = 0;
+    for (long r = 0; r < rounds; ++r)
+    {
+        double total = 0;
+        for (long i = 0; i < count; ++i)
+            total += rupees[i];
+        bench::doNotOptimize(total);
+        doubleTotal = total;
+    }
+    double doubleNs = bench::secondsSince(start) * 1e9 / (double(rounds) * count);
+
+    start = bench::Clock::now();
+    Money moneyTotal;
+    for (long r = 0; r < rounds; ++r)
+    {
+        Money::sum(paise.data(), paise.size(), moneyTotal);
+        bench::doNotOptimize(moneyTotal);
+    }
+    double moneyNs = bench::secondsSince(start) * 1e9 / (double(rounds) * count);
+
+    // Rounding drift of the double total against the exact one, in paise
+    double driftPaise = doubleTotal * 100.0 - (double)moneyTotal.paise();
+
+    Manager manager;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromPaise(paise[i % count]), "Saving", "user" + to_string(i % 1000));
+    }
+    start = bench::Clock::now();
+    Money bookTotal;
+    manager.totalBalance(bookTotal);
+    double bookMs = bench::secondsSince(start) * 1e3;
+    bench::doNotOptimize(bookTotal);
+
+    cout << "balances,double_sum_ns_per_value,money_sum_ns_per_value,double_drift_paise,accounts,totalBalance_ms\n";
+    cout << count << "," << doubleNs << "," << moneyNs << "," << driftPaise << ","
+         << accountCount << "," << bookMs << "\n";
+    return 0;
+}
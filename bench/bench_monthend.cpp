@@ -0,0 +1,93 @@
+// Month-end interest close: Manager::closeMonth, which reads each account's
+// running balance-days sum, vs. rebuilding daily balances from the history.
+// The book is backdated into last month, which is the month closed: a month
+// can't be closed before it ends.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_monthend.cpp WiseVault[A-Z]*.cpp -o bench_monthend
+//   ./bench_monthend [accounts=1000000] [postingsPerAccount=20]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long accountCount = bench::argOr(argc, argv, 1, 1000000);
+    const long perAccount = bench::argOr(argc, argv, 2, 20);
+
+    // Everything is dated in last month, the month that gets closed
+    time_t now = time(nullptr);
+    struct tm today;
+    gmtime_r(&now, &today);
+    const int year = today.tm_year + 1900 - (today.tm_mon == 0), month = today.tm_mon == 0 ? 12 : today.tm_mon;
+    const int period = year * 100 + month;
+    const int32_t endDay = dayNumber(now) - (today.tm_mday - 1); // the first of this month
+    const time_t monthStart = (time_t)daysFromCivil(year, month, 1) * 86400;
+    const time_t monthSpan = (endDay - dayNumber(monthStart)) * (time_t)86400;
+
+    // Built the way replay builds it, so the history can be backdated
+    Manager manager;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+        {
+            string owner = "user" + to_string(i % 100000);
+            JournalRecord open(JOURNAL_CREATE_ACCOUNT, 1001 + (int)i, 0, Money::fromRupees(1000));
+            open.timestamp = monthStart;
+            JournalRecord::setField(open.name, JOURNAL_NAME_LEN, "Holder");
+            JournalRecord::setField(open.type, JOURNAL_TYPE_LEN, i % 4 ? "Saving" : "Current");
+            JournalRecord::setField(open.username, JOURNAL_USER_LEN, owner);
+            manager.apply(open);
+            if (i % 10 == 0)
+            {
+                JournalRecord loan(JOURNAL_APPLY_LOAN, 0, 1 + (int)(i / 10), Money::fromRupees(50000));
+                loan.timestamp = monthStart;
+                loan.tenure = 5;
+                loan.rate = manager.getLoanRate();
+                JournalRecord::setField(loan.name, JOURNAL_NAME_LEN, "Holder");
+                JournalRecord::setField(loan.username, JOURNAL_USER_LEN, owner);
+                manager.apply(loan);
+            }
+        }
+        bench::Rng rng;
+        for (long t = 0; t < perAccount; ++t)
+            for (long i = 0; i < accountCount; ++i)
+            {
+                JournalRecord deposit(JOURNAL_DEPOSIT, 1001 + (int)i, 0, Money::fromPaise(1 + rng.below(100000)));
+                deposit.timestamp = monthStart + monthSpan * t / max(1L, perAccount);
+                manager.apply(deposit);
+            }
+    }
+
+    // The alternative: walk every account's history to rebuild its balance-days
+    auto start = bench::Clock::now();
+    __int128 scanned = 0;
+    for (long i = 0; i < accountCount; ++i)
+    {
+        Account *acc = manager.findAccount(1001 + (int)i, "", true);
+        int64_t balance = acc->getBalance().paise();
+        acc->getTransactionLog().forEach([&](const TransactionRecord &rec) { balance -= rec.getAmount().paise(); });
+        int32_t day = acc->getAccrual().day;
+        acc->getTransactionLog().forEach([&](const TransactionRecord &rec)
+        {
+            int32_t recDay = dayNumber(rec.getTimestamp());
+            scanned += (__int128)balance * (recDay - day);
+            day = recDay;
+            balance += rec.getAmount().paise();
+        });
+        scanned += (__int128)balance * (endDay - day);
+    }
+    double scanMs = bench::secondsSince(start) * 1e3;
+    bench::doNotOptimize(scanned);
+
+    size_t credited = 0;
+    Money paid;
+    start = bench::Clock::now();
+    manager.closeMonth(period, credited, paid);
+    double closeMs = bench::secondsSince(start) * 1e3;
+
+    cout << "accounts,postings,history_scan_ms,close_ms,accounts_credited,interest_paid\n";
+    cout << accountCount << "," << accountCount * perAccount << "," << scanMs << "," << closeMs << "," << credited << ","
+         << paid << "\n";
+    return 0;
+}
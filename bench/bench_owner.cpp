@@ -0,0 +1,103 @@
+// "My accounts" listings on heavy-history accounts: getUserAccounts copies
+// vs. forEachUserAccount views, by time and by heap allocations per call.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_owner.cpp WiseVault[A-Z]*.cpp -o bench_owner
+//   ./bench_owner [users=100] [accountsPerUser=8] [historyPerAccount=5000] [calls=2000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+// Counts every heap allocation made by the process
+static atomic<long> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+// GCC flags free() in a replacement delete as mismatched with new; it is the pair of the malloc above
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+
+int main(int argc, char **argv)
+{
+    const long userCount = bench::argOr(argc, argv, 1, 100);
+    const long perUser = bench::argOr(argc, argv, 2, 8);
+    const long history = bench::argOr(argc, argv, 3, 5000);
+    const long calls = bench::argOr(argc, argv, 4, 2000);
+
+    Manager manager;
+    Transaction transaction;
+    vector<string> owners(userCount);
+    {
+        bench::QuietCout quiet;
+        for (long u = 0; u < userCount; ++u)
+            owners[u] = "user" + to_string(u);
+        for (long i = 0; i < userCount * perUser; ++i)
+        {
+            manager.createAccount("Holder", Money::fromRupees(1000), "Saving", owners[i % userCount]);
+            manager.applyLoan("Holder", owners[i % userCount], Money::fromRupees(50000), 5);
+        }
+        bench::Rng rng;
+        for (long h = 0; h < history; ++h)
+            for (long i = 0; i < userCount * perUser; ++i)
+                transaction.deposit(*manager.findAccount(1001 + (int)i, "", true), Money::fromPaise(1 + rng.below(10000)));
+    }
+
+    // Sums the balances of a random user's accounts; returns ns per call
+    auto timeIt = [&](auto listing, long iterations, double &allocationsPerCall)
+    {
+        bench::Rng rng(7);
+        int64_t total = 0;
+        long before = allocations.load();
+        auto start = bench::Clock::now();
+        for (long c = 0; c < iterations; ++c)
+            total += listing(owners[rng.below(userCount)]);
+        double ns = bench::secondsSince(start) * 1e9 / iterations;
+        allocationsPerCall = double(allocations.load() - before) / iterations;
+        bench::doNotOptimize(total);
+        return ns;
+    };
+
+    double copyAllocs, viewAllocs, loanCopyAllocs, loanViewAllocs;
+    // Copies are slow with this much history, so fewer of them
+    double copyNs = timeIt([&](const string &owner)
+    {
+        int64_t sum = 0;
+        for (const Account &acc : manager.getUserAccounts(owner))
+            sum += acc.getBalance().paise();
+        return sum;
+    }, max(1L, calls / 10), copyAllocs);
+    double viewNs = timeIt([&](const string &owner)
+    {
+        int64_t sum = 0;
+        manager.forEachUserAccount(owner, [&](const Account &acc) { sum += acc.getBalance().paise(); });
+        return sum;
+    }, calls, viewAllocs);
+    double loanCopyNs = timeIt([&](const string &owner)
+    {
+        int64_t sum = 0;
+        for (const Loan &loan : manager.getUserLoans(owner))
+            sum += loan.getBalance().paise();
+        return sum;
+    }, calls, loanCopyAllocs);
+    double loanViewNs = timeIt([&](const string &owner)
+    {
+        int64_t sum = 0;
+        manager.forEachUserLoan(owner, [&](const Loan &loan) { sum += loan.getBalance().paise(); });
+        return sum;
+    }, calls, loanViewAllocs);
+
+    cout << "accounts_per_user,history_per_account,copy_us,copy_allocs,view_us,view_allocs,"
+            "loan_copy_us,loan_copy_allocs,loan_view_us,loan_view_allocs\n";
+    cout << perUser << "," << history << "," << copyNs / 1e3 << "," << copyAllocs << "," << viewNs / 1e3 << "," << viewAllocs
+         << "," << loanCopyNs / 1e3 << "," << loanCopyAllocs << "," << loanViewNs / 1e3 << "," << loanViewAllocs << "\n";
+    return 0;
+}
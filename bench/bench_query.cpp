@@ -0,0 +1,77 @@
+// History queries on one large account: TransactionLog::query vs. scanning the
+// whole log, for "latest 20" and for a month's statement.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_query.cpp WiseVault[A-Z]*.cpp -o bench_query
+//   ./bench_query [records=1000000] [queries=1000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long recordCount = bench::argOr(argc, argv, 1, 1000000);
+    const long queries = bench::argOr(argc, argv, 2, 1000);
+    const time_t span = 3 * 365 * 24 * 3600; // three years of history
+    const time_t start = 1600000000;
+    const time_t month = 30 * 24 * 3600;
+
+    bench::Rng rng;
+    TransactionLog log;
+    for (long i = 0; i < recordCount; ++i)
+        log.push_back(TransactionRecord(1001, TxType(1 + rng.below(5)), Money::fromPaise(rng.below(1000000)),
+                                        start + (time_t)(span * (double)i / recordCount)));
+
+    auto timeIt = [&](auto fn)
+    {
+        size_t found = 0;
+        auto begin = bench::Clock::now();
+        for (long q = 0; q < queries; ++q)
+            found += fn();
+        bench::doNotOptimize(found);
+        return bench::secondsSince(begin) * 1e6 / queries;
+    };
+
+    HistoryQuery latest;
+    double latestUs = timeIt([&] { return log.query(latest).records.size(); });
+    double latestScanUs = timeIt([&]
+    {
+        // The old approach: walk everything, keep the tail
+        vector<TransactionRecord> tail;
+        size_t seen = 0;
+        log.forEach([&](const TransactionRecord &rec)
+        {
+            if (seen++ + 20 >= log.size())
+                tail.push_back(rec);
+        });
+        return tail.size();
+    });
+
+    size_t statementSize = 0;
+    double statementUs = timeIt([&]
+    {
+        HistoryQuery statement;
+        statement.from = start + (time_t)rng.below(span - month);
+        statement.to = statement.from + month;
+        statement.limit = 0;
+        statement.newestFirst = false;
+        statementSize = log.query(statement).records.size();
+        return statementSize;
+    });
+    double statementScanUs = timeIt([&]
+    {
+        time_t from = start + (time_t)rng.below(span - month), to = from + month;
+        vector<TransactionRecord> rows;
+        log.forEach([&](const TransactionRecord &rec)
+        {
+            if (rec.getTimestamp() >= from && rec.getTimestamp() < to)
+                rows.push_back(rec);
+        });
+        return rows.size();
+    });
+
+    cout << "records,latest20_query_us,latest20_scan_us,statement_rows,statement_query_us,statement_scan_us\n";
+    cout << recordCount << "," << latestUs << "," << latestScanUs << "," << statementSize << "," << statementUs << ","
+         << statementScanUs << "\n";
+    return 0;
+}
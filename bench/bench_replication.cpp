@@ -0,0 +1,172 @@
+// Journal shipping to a follower over the replication socket, both ends in
+// this process: how long an empty follower takes to catch up from the
+// leader's journal alone and from a snapshot plus the journal tail, then
+// deposits/sec on the leader with a follower attached against the rate with
+// none, the largest lag seen while they run (sampled every millisecond) and
+// how long the follower takes to drain it afterwards. The last column is 1
+// if the follower's balances match the leader's. Files from the previous run
+// are deleted on start.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_replication.cpp WiseVault[A-Z]*.cpp -o bench_replication
+//   ./bench_replication [records=1000000] [accounts=10000] [directory=/tmp/wisevault_bench_repl]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+// One follower's state, under prefix in the bench directory
+struct Follower
+{
+    Journal journal;
+    Manager manager;
+    UserStore users;
+    Snapshotter snapshotter;
+    ReplicationClient client;
+
+    static UserStore::Options userOptions(const string &prefix)
+    {
+        UserStore::Options options;
+        options.path = prefix + ".users";
+        options.legacyPath = "";
+        options.seedDefaults = false;
+        return options;
+    }
+
+    static Snapshotter::Options snapshotOptions(const string &prefix)
+    {
+        Snapshotter::Options options;
+        options.path = prefix + ".snapshot";
+        options.everyRecords = UINT64_MAX;
+        return options;
+    }
+
+    static ReplicationClient::Options clientOptions(const string &socketPath)
+    {
+        ReplicationClient::Options options;
+        options.socketPath = socketPath;
+        return options;
+    }
+
+    Follower(const string &prefix, const string &socketPath)
+        : users(userOptions(prefix)), snapshotter(snapshotOptions(prefix)),
+          client(manager, journal, users, snapshotter, clientOptions(socketPath))
+    {
+        Journal::Options options;
+        options.path = prefix + ".journal";
+        journal.open(options);
+        manager.attachJournal(&journal);
+        users.load();
+    }
+
+    // Seconds until the follower holds every record up to sequence
+    double catchUp(uint64_t sequence)
+    {
+        auto start = bench::Clock::now();
+        while (journal.lastSequence() < sequence)
+            this_thread::sleep_for(chrono::microseconds(200));
+        return bench::secondsSince(start);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    const long records = max(1L, bench::argOr(argc, argv, 1, 1000000));
+    const long accountCount = max(1L, bench::argOr(argc, argv, 2, 10000));
+    const string directory = argc > 3 ? argv[3] : "/tmp/wisevault_bench_repl";
+    const string socketPath = directory + "/repl.sock";
+    mkdir(directory.c_str(), 0755);
+    for (const char *name : {"leader.journal", "leader.users", "log.journal", "log.users", "snap.journal", "snap.users",
+                             "snap.snapshot", "ship.snapshot"})
+        unlink((directory + "/" + name).c_str());
+
+    Journal journal;
+    Journal::Options journalOptions;
+    journalOptions.path = directory + "/leader.journal";
+    journalOptions.waitForDurability = false;
+    journal.open(journalOptions);
+    UserStore::Options userOptions;
+    userOptions.path = directory + "/leader.users";
+    userOptions.legacyPath = "";
+    UserStore users(userOptions);
+    Manager manager;
+    Transaction transaction;
+    manager.attachJournal(&journal);
+    transaction.attachJournal(&journal);
+    vector<Account *> accounts(accountCount);
+    {
+        bench::QuietCout quiet;
+        users.load();
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), "Saving", "user" + to_string(i % 1000));
+        for (long i = 0; i < accountCount; ++i)
+            accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+    }
+    bench::Rng rng;
+    auto post = [&]
+    {
+        auto start = bench::Clock::now();
+        uint64_t sequence = 0;
+        for (long i = 0; i < records; ++i)
+            transaction.deposit(*accounts[rng.below(accountCount)], Money::fromPaise(1 + rng.below(10000)), sequence);
+        journal.sync();
+        return records / bench::secondsSince(start);
+    };
+    double alone = post();
+
+    ReplicationServer::Options shipOptions;
+    shipOptions.socketPath = socketPath;
+    shipOptions.snapshotPath = directory + "/ship.snapshot";
+    double logCatchUp, snapshotCatchUp, withFollower, drain;
+    uint64_t maxLag = 0;
+    bool match = true;
+    {
+        bench::QuietCout quiet;
+        // The whole journal, record by record
+        shipOptions.snapshotAfter = UINT64_MAX;
+        {
+            ReplicationServer server(manager, journal, users, shipOptions);
+            server.start();
+            Follower follower(directory + "/log", socketPath);
+            follower.client.start();
+            logCatchUp = follower.catchUp(journal.lastSequence());
+            follower.client.stop();
+        }
+
+        // A snapshot, then the tail written after it
+        shipOptions.snapshotAfter = 0;
+        ReplicationServer server(manager, journal, users, shipOptions);
+        server.start();
+        Follower follower(directory + "/snap", socketPath);
+        follower.client.start();
+        snapshotCatchUp = follower.catchUp(journal.lastSequence());
+
+        atomic<bool> posting{true};
+        thread sampler([&]
+        {
+            while (posting)
+            {
+                maxLag = max(maxLag, journal.lastSequence() - min(journal.lastSequence(), follower.journal.lastSequence()));
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        });
+        withFollower = post();
+        posting = false;
+        sampler.join();
+        drain = follower.catchUp(journal.lastSequence());
+        follower.client.stop();
+
+        for (long i = 0; i < accountCount && match; ++i)
+        {
+            Account *copy = follower.manager.findAccount(1001 + (int)i, "", true);
+            match = copy && copy->getBalance() == accounts[i]->getBalance();
+        }
+    }
+
+    cout << "records,accounts,log_catchup_s,log_catchup_records_per_sec,snapshot_catchup_s,deposits_per_sec,"
+            "deposits_per_sec_with_follower,max_lag_records,drain_ms,match\n";
+    uint64_t journalRecords = records + accountCount;
+    cout << records << "," << accountCount << "," << logCatchUp << "," << journalRecords / logCatchUp << ","
+         << snapshotCatchUp << "," << alone << "," << withFollower << "," << maxLag << "," << drain * 1e3 << ","
+         << match << "\n";
+    return 0;
+}
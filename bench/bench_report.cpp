@@ -0,0 +1,75 @@
+// Bulk report throughput: ReportWriter in text, CSV and binary vs. the
+// record-by-record cout/ctime path it replaces.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_report.cpp WiseVault[A-Z]*.cpp -o bench_report
+//   ./bench_report [accounts=100000] [transactionsPerAccount=20] [out=/tmp/wisevault_report]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long accountCount = bench::argOr(argc, argv, 1, 100000);
+    const long perAccount = bench::argOr(argc, argv, 2, 20);
+    const string out = argc > 3 ? argv[3] : "/tmp/wisevault_report";
+
+    Manager manager;
+    Transaction transaction;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+        {
+            string owner = "user" + to_string(i);
+            manager.createAccount("Holder " + to_string(i), Money::fromRupees(1000), "Saving", owner);
+            manager.applyLoan("Holder " + to_string(i), owner, Money::fromRupees(50000), 5);
+        }
+        bench::Rng rng;
+        for (long t = 0; t < perAccount; ++t)
+            for (long i = 0; i < accountCount; ++i)
+                transaction.deposit(manager, 1001 + (int)i, Money::fromPaise(1 + rng.below(100000)));
+    }
+    const double records = double(accountCount) * (2 + perAccount);
+
+    // Old path: show*() through an ofstream-backed cout, endl and ctime per record
+    auto start = bench::Clock::now();
+    {
+        ofstream file(out + ".legacy.txt");
+        streambuf *saved = cout.rdbuf(file.rdbuf());
+        for (long i = 0; i < accountCount; ++i)
+        {
+            Account *acc = manager.findAccount(1001 + (int)i, "", true);
+            acc->showAccount();
+            cout << "----------------------------\n";
+        }
+        for (long i = 0; i < accountCount; ++i)
+        {
+            manager.findLoan(1 + (int)i, "", true)->showLoanDetails();
+            cout << "----------------------------\n";
+        }
+        for (long i = 0; i < accountCount; ++i)
+            manager.findAccount(1001 + (int)i, "", true)->getTransactionLog().forEach([](const TransactionRecord &rec)
+            {
+                rec.show();
+                cout.flush(); // the old show() paths ended records with endl
+            });
+        cout.rdbuf(saved);
+    }
+    double legacyRate = records / bench::secondsSince(start);
+
+    const char *names[] = {"text", "csv", "binary"};
+    double rates[3];
+    for (int format = REPORT_TEXT; format <= REPORT_BINARY; ++format)
+    {
+        start = bench::Clock::now();
+        manager.exportReport(out + "." + names[format], ReportFormat(format));
+        rates[format] = records / bench::secondsSince(start);
+    }
+
+    cout << "records,legacy_per_sec,text_per_sec,csv_per_sec,binary_per_sec\n";
+    cout << (long)records << "," << legacyRate << "," << rates[REPORT_TEXT] << "," << rates[REPORT_CSV] << ","
+         << rates[REPORT_BINARY] << "\n";
+    for (const char *name : {"legacy.txt", "text", "csv", "binary"})
+        unlink((out + "." + name).c_str());
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Cost of the risk rules stage: deposits and withdrawals on one thread with
+// no rules, the four-rule set below (limits raised so a benchmark's posting
+// rate doesn't trip them all) and sixteen rules over eight windows, one row
+// each. ns_per_posting is the whole posting; check_ns is the rules alone
+// (check and count on an already locked account). An account's first checked
+// posting fills its counters from its history; prime_us is that cost, timed
+// in a warm-up pass over every account. blocked and flagged are rule hits.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_rules.cpp WiseVault[A-Z]*.cpp -o bench_rules
+//   ./bench_rules [postings=2000000] [accounts=100000] [historyPerAccount=20]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+static const char FOUR_RULES[] =
+    "daily_cap  block withdraw,transfer_out sum 1d 10000000\n"
+    "burst      block any count 1m 100000\n"
+    "large      flag  deposit amount 90\n"
+    "huge       block any amount 99.5\n";
+
+// A sum and a count on each of eight windows, with limits nothing in the run reaches
+static string sixteenRules()
+{
+    const char *windows[] = {"1m", "5m", "15m", "1h", "6h", "1d", "7d", "30d"};
+    string text;
+    for (int i = 0; i < 8; ++i)
+    {
+        text += "sum_" + string(windows[i]) + " block any sum " + windows[i] + " 100000000\n";
+        text += "count_" + string(windows[i]) + " flag any count " + windows[i] + " 1000000\n";
+    }
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    const long postings = max(1L, bench::argOr(argc, argv, 1, 2000000));
+    const long accountCount = max(1L, bench::argOr(argc, argv, 2, 100000));
+    const long history = bench::argOr(argc, argv, 3, 20);
+
+    Manager manager;
+    vector<Account *> accounts(accountCount);
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100000), "Saving", "user" + to_string(i % 1000));
+        for (long i = 0; i < accountCount; ++i)
+            accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+    }
+    bench::Rng rng;
+    Transaction plain;
+    for (long h = 0; h < history; ++h)
+        for (Account *acc : accounts)
+            plain.deposit(*acc, Money::fromPaise(1 + rng.below(10000)));
+
+    cout << "rules,postings,accounts,ns_per_posting,check_ns,prime_us,blocked,flagged\n";
+    string configs[] = {"", FOUR_RULES, sixteenRules()};
+    for (const string &config : configs)
+    {
+        RiskRules rules;
+        istringstream in(config);
+        if (!rules.compile(in, cerr))
+            return 1;
+        Transaction transaction;
+        if (rules.size())
+            transaction.attachRules(&rules);
+
+        // Warm-up: every account's first checked posting
+        auto start = bench::Clock::now();
+        for (Account *acc : accounts)
+            transaction.deposit(*acc, Money::fromPaise(1));
+        double primeUs = bench::secondsSince(start) * 1e6 / accountCount;
+
+        start = bench::Clock::now();
+        for (long i = 0; i < postings; ++i)
+        {
+            Account &acc = *accounts[rng.below(accountCount)];
+            Money amount = Money::fromPaise(1 + (int64_t)rng.below(10000));
+            if (rng.below(100) < 50)
+                transaction.deposit(acc, amount);
+            else
+                transaction.withdraw(acc, amount);
+        }
+        double postingNs = bench::secondsSince(start) * 1e9 / postings;
+        uint64_t blocked = 0, flagged = 0;
+        for (size_t r = 0; r < rules.size(); ++r)
+            (rules.blocks(r) ? blocked : flagged) += rules.hits(r);
+
+        // The rules alone: check and count a withdrawal, then take it back out
+        double checkNs = 0;
+        if (rules.size())
+        {
+            uint64_t passed = 0;
+            start = bench::Clock::now();
+            for (long i = 0; i < postings; ++i)
+            {
+                Account &acc = *accounts[rng.below(accountCount)];
+                Money amount = Money::fromPaise(1 + (int64_t)rng.below(10000));
+                lock_guard<RecordMutex> hold(acc.mutex());
+                RiskRules::Verdict verdict;
+                if (rules.check(acc, TX_WITHDRAW, amount, verdict))
+                {
+                    rules.count(acc, TX_WITHDRAW, amount, verdict);
+                    rules.count(acc, TX_WITHDRAW, amount, verdict, -1);
+                    ++passed;
+                }
+            }
+            checkNs = bench::secondsSince(start) * 1e9 / postings;
+            bench::doNotOptimize(passed);
+        }
+
+        cout << rules.size() << "," << postings << "," << accountCount << "," << postingNs << "," << checkNs << ","
+             << primeUs << "," << blocked << "," << flagged << "\n";
+    }
+    return 0;
+}
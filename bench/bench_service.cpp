@@ -0,0 +1,175 @@
+// Load generator for the network service: C clients, each keeping D requests
+// in flight, post a deposit/withdraw/balance mix and report latency
+// percentiles and throughput. With port 0 it starts an in-process server
+// (journal in /tmp); otherwise it drives a running "WiseVault --serve".
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_service.cpp WiseVault[A-Z]*.cpp -o bench_service
+//   ./bench_service [clients=8] [depth=16] [requestsPerClient=20000] [workers=4] [port=0]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+static string credentials(const string &username, const string &password)
+{
+    string body;
+    FrameWriter writer(body, 0, 0);
+    writer.putString(username);
+    writer.putString(password);
+    return body.substr(SVC_HEADER_LEN); // just the body
+}
+
+int main(int argc, char **argv)
+{
+    const long clients = bench::argOr(argc, argv, 1, 8);
+    const long depth = max(1L, bench::argOr(argc, argv, 2, 16));
+    const long perClient = bench::argOr(argc, argv, 3, 20000);
+    const unsigned workers = (unsigned)bench::argOr(argc, argv, 4, 4);
+    uint16_t port = (uint16_t)bench::argOr(argc, argv, 5, 0);
+
+    const string usersPath = "/tmp/wisevault_service_users.db", journalPath = "/tmp/wisevault_service.journal";
+    UserStore::Options userOptions;
+    userOptions.path = usersPath;
+    userOptions.legacyPath = "";
+    Manager manager;
+    Transaction transaction;
+    UserStore users(userOptions);
+    Journal journal;
+    unique_ptr<NetServer> server;
+    if (port == 0)
+    {
+        unlink(usersPath.c_str());
+        unlink(journalPath.c_str());
+        users.load();
+        Journal::Options journalOptions;
+        journalOptions.path = journalPath;
+        if (!journal.open(journalOptions))
+        {
+            cerr << "Could not open " << journalPath << "\n";
+            return 1;
+        }
+        manager.attachJournal(&journal);
+        transaction.attachJournal(&journal);
+        NetServer::Options options;
+        options.port = 0;
+        options.workers = workers;
+        server.reset(new NetServer(manager, transaction, users, &journal, options));
+        if (!server->start())
+        {
+            cerr << "Could not start the server\n";
+            return 1;
+        }
+        port = server->port();
+    }
+
+    // Setup through the protocol: the default manager opens one account per client
+    vector<int32_t> accountOf(clients);
+    {
+        ServiceClient admin;
+        uint8_t status;
+        string response;
+        if (!admin.connect("127.0.0.1", port) || !admin.call(SVC_LOGIN, credentials("Prithvi", "admin123"), status, response) ||
+            status != SVC_OK)
+        {
+            cerr << "Could not log in as the default manager on port " << port << "\n";
+            return 1;
+        }
+        for (long c = 0; c < clients; ++c)
+        {
+            string body;
+            FrameWriter writer(body, 0, 0);
+            writer.putString("Load " + to_string(c));
+            writer.putString("Saving");
+            writer.putString("load" + to_string(c));
+            writer.put<int64_t>(Money::fromRupees(1000000).paise());
+            admin.call(SVC_CREATE_ACCOUNT, body.substr(SVC_HEADER_LEN), status, response);
+            if (status != SVC_OK)
+            {
+                cerr << "Could not create an account (status " << (int)status << ")\n";
+                return 1;
+            }
+            memcpy(&accountOf[c], response.data(), sizeof(int32_t));
+        }
+    }
+
+    vector<vector<double>> latencies(clients);
+    atomic<long> failures{0};
+    auto start = bench::Clock::now();
+    vector<thread> threads;
+    for (long c = 0; c < clients; ++c)
+        threads.emplace_back([&, c]
+        {
+            ServiceClient client;
+            uint8_t status;
+            string response;
+            const string username = "load" + to_string(c);
+            if (!client.connect("127.0.0.1", port))
+            {
+                failures += perClient;
+                return;
+            }
+            client.call(SVC_REGISTER, credentials(username, "load"), status, response); // SVC_EXISTS on a rerun
+            if (!client.call(SVC_LOGIN, credentials(username, "load"), status, response) || status != SVC_OK)
+            {
+                failures += perClient;
+                return;
+            }
+
+            bench::Rng rng(c + 1);
+            deque<bench::Clock::time_point> sentAt; // responses arrive in request order
+            latencies[c].reserve(perClient);
+            auto sendOne = [&]
+            {
+                string body;
+                body.append(reinterpret_cast<const char *>(&accountOf[c]), sizeof(int32_t));
+                uint64_t pick = rng.below(10);
+                uint8_t op = pick < 4 ? SVC_DEPOSIT : pick < 8 ? SVC_WITHDRAW : SVC_BALANCE;
+                if (op != SVC_BALANCE)
+                {
+                    int64_t amount = 1 + (int64_t)rng.below(100000);
+                    body.append(reinterpret_cast<const char *>(&amount), sizeof(amount));
+                }
+                sentAt.push_back(bench::Clock::now());
+                return client.send(op, body) != 0;
+            };
+            long sent = 0;
+            while (sent < min(depth, perClient) && sendOne())
+                ++sent;
+            uint32_t requestID;
+            for (long received = 0; received < sent; ++received)
+            {
+                if (!client.receive(requestID, status, response))
+                {
+                    failures += perClient - received;
+                    return;
+                }
+                latencies[c].push_back(bench::secondsSince(sentAt.front()) * 1e6);
+                sentAt.pop_front();
+                if (status != SVC_OK && status != SVC_REJECTED)
+                    ++failures;
+                if (sent < perClient && sendOne())
+                    ++sent;
+            }
+        });
+    for (auto &t : threads)
+        t.join();
+    double seconds = bench::secondsSince(start);
+
+    vector<double> all;
+    for (auto &l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all.empty() ? 0.0 : all[min(all.size() - 1, (size_t)(p * all.size()))]; };
+
+    if (server)
+    {
+        server->stop();
+        journal.close();
+        unlink(usersPath.c_str());
+        unlink(journalPath.c_str());
+    }
+    cout << "clients,depth,workers,requests,failures,requests_per_sec,p50_us,p99_us,max_us\n";
+    cout << clients << "," << depth << "," << workers << "," << all.size() << "," << failures << "," << all.size() / seconds
+         << "," << percentile(0.50) << "," << percentile(0.99) << "," << (all.empty() ? 0.0 : all.back()) << "\n";
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Session permission checks: findAccount by owner name vs. by session token,
+// single- and multi-threaded, plus the cost of opening and expiring sessions.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_session.cpp WiseVault[A-Z]*.cpp -o bench_session
+//   ./bench_session [users=100000] [threads=hardware] [checks=5000000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long userCount = bench::argOr(argc, argv, 1, 100000);
+    const unsigned threads = (unsigned)bench::argOr(argc, argv, 2, thread::hardware_concurrency());
+    const long checks = bench::argOr(argc, argv, 3, 5000000);
+    const long perUser = 3;
+
+    // Owner names long enough to defeat the small-string fast path, as real ones often are
+    auto ownerName = [](long i) { return "customer.account." + to_string(i); };
+    Manager manager;
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < userCount * perUser; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), "Saving", ownerName(i % userCount));
+    }
+
+    auto start = bench::Clock::now();
+    vector<SessionToken> sessions(userCount);
+    vector<string> names(userCount);
+    for (long u = 0; u < userCount; ++u)
+    {
+        names[u] = ownerName(u);
+        sessions[u] = manager.openSession(User(names[u], "", "user"));
+    }
+    double openNs = bench::secondsSince(start) * 1e9 / userCount;
+
+    // checks/sec over `threadCount` threads, each asking about its users' own accounts
+    auto rate = [&](unsigned threadCount, bool bySession)
+    {
+        atomic<long> granted{0};
+        auto begin = bench::Clock::now();
+        parallelFor(checks, threadCount, 1, 1, [&](size_t from, size_t to)
+        {
+            bench::Rng rng(from + 1);
+            long mine = 0;
+            for (size_t i = from; i < to; ++i)
+            {
+                long u = (long)rng.below(userCount);
+                int accNo = 1001 + (int)(u + userCount * (long)rng.below(perUser));
+                if (bySession)
+                    mine += manager.findAccount(accNo, sessions[u]) != nullptr;
+                else
+                    mine += manager.findAccount(accNo, names[u], false) != nullptr;
+            }
+            granted += mine;
+        });
+        double seconds = bench::secondsSince(begin);
+        if (granted != checks)
+            cerr << "permission mismatch: " << granted << " of " << checks << "\n";
+        return checks / seconds;
+    };
+    double nameRate = rate(1, false), sessionRate = rate(1, true);
+    double nameRateN = rate(threads, false), sessionRateN = rate(threads, true);
+
+    // Closing them all through the timer wheel
+    SessionTable::Options options;
+    options.idleSeconds = 1;
+    SessionTable table(options);
+    for (long u = 0; u < userCount; ++u)
+        table.open(names[u], false, {}, {});
+    this_thread::sleep_for(chrono::milliseconds(2100));
+    start = bench::Clock::now();
+    size_t expired = table.expire();
+    double expireNs = bench::secondsSince(start) * 1e9 / max<size_t>(expired, 1);
+
+    cout << "sessions,threads,open_ns,by_name_per_sec,by_session_per_sec,by_name_nt_per_sec,by_session_nt_per_sec,expired,expire_ns\n";
+    cout << userCount << "," << threads << "," << openNs << "," << nameRate << "," << sessionRate << "," << nameRateN << ","
+         << sessionRateN << "," << expired << "," << expireNs << "\n";
+    return 0;
+}
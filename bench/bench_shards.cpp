@@ -0,0 +1,159 @@
+// Sharded mode: a mixed workload (45% deposits, 30% withdrawals, 20%
+// transfers between random accounts, 5% balance checks) against one shared
+// Manager posted to directly from `threads` threads, then against
+// ShardedManager with 1, 2, 4, ... up to `threads` shards. Client threads
+// (half as many as shards, at least one) queue requests in batches of 256
+// and keep two batches in flight. With S shards, (S-1)/S of the transfers
+// cross shards. Scaling needs as many cores as shards plus clients.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_shards.cpp WiseVault[A-Z]*.cpp -o bench_shards
+//   ./bench_shards [operations=4000000] [threads=hardware] [accounts=100000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+enum MixOp
+{
+    MIX_DEPOSIT,
+    MIX_WITHDRAW,
+    MIX_TRANSFER,
+    MIX_BALANCE
+};
+
+static MixOp pick(bench::Rng &rng)
+{
+    uint64_t roll = rng.below(100);
+    return roll < 45 ? MIX_DEPOSIT : roll < 75 ? MIX_WITHDRAW : roll < 95 ? MIX_TRANSFER : MIX_BALANCE;
+}
+
+int main(int argc, char **argv)
+{
+    const long operations = bench::argOr(argc, argv, 1, 4000000);
+    const unsigned threads = (unsigned)max(1L, bench::argOr(argc, argv, 2, thread::hardware_concurrency()));
+    const long accountCount = max(2L, bench::argOr(argc, argv, 3, 100000));
+    const Money opening = Money::fromRupees(1000);
+
+    // One Manager shared by every posting thread, as the application runs today
+    double directRate;
+    {
+        Manager manager;
+        Transaction transaction;
+        uint64_t sequence = 0;
+        for (long i = 0; i < accountCount; ++i)
+            manager.openAccount("Holder", opening, "Saving", "user" + to_string(i), sequence);
+        auto start = bench::Clock::now();
+        parallelFor(operations, threads, 1, 1, [&](size_t from, size_t to)
+        {
+            bench::Rng rng(from + 1);
+            for (size_t i = from; i < to; ++i)
+            {
+                int accNo = 1001 + (int)rng.below(accountCount);
+                Money amount = Money::fromPaise(1 + (int64_t)rng.below(100000));
+                switch (pick(rng))
+                {
+                case MIX_DEPOSIT:
+                    transaction.deposit(manager, accNo, amount);
+                    break;
+                case MIX_WITHDRAW:
+                    transaction.withdraw(manager, accNo, amount);
+                    break;
+                case MIX_TRANSFER:
+                    transaction.transfer(manager, accNo, 1001 + (int)rng.below(accountCount), amount);
+                    break;
+                case MIX_BALANCE:
+                    manager.withAccount(accNo, [&](Account &acc) { bench::doNotOptimize(transaction.balance(acc)); });
+                    break;
+                }
+            }
+        });
+        directRate = operations / bench::secondsSince(start);
+    }
+
+    cout << "operations,threads,direct_per_sec\n" << operations << "," << threads << "," << directRate << "\n\n";
+    cout << "shards,clients,sharded_per_sec,speedup_vs_1_shard,failed,total_balance_ok\n";
+    double oneShard = 0;
+    for (unsigned shards = 1; shards <= threads; shards = shards * 2 > threads && shards < threads ? threads : shards * 2)
+    {
+        ShardedManager::Options options;
+        options.shards = shards;
+        ShardedManager bank(options);
+        vector<int> accNos(accountCount);
+        for (long i = 0; i < accountCount; ++i)
+            accNos[i] = bank.openAccount("Holder", opening, "Saving", "user" + to_string(i));
+
+        const unsigned clients = max(1u, shards / 2);
+        const size_t batch = 256;
+        atomic<size_t> failed{0};
+        auto start = bench::Clock::now();
+        parallelFor(operations, clients, 1, 1, [&](size_t from, size_t to)
+        {
+            bench::Rng rng(from + 1);
+            ShardedManager::Ticket tickets[2];
+            vector<ShardedManager::Request> requests[2];
+            vector<Money> balances[2] = {vector<Money>(batch), vector<Money>(batch)};
+            size_t failures = 0;
+            for (size_t i = from, round = 0; i < to; ++round)
+            {
+                // Two batches in flight: refill one while the shards work on the other
+                int slot = round & 1;
+                tickets[slot].wait();
+                failures += tickets[slot].failed.exchange(0);
+                requests[slot].clear();
+                for (; i < to && requests[slot].size() < batch; ++i)
+                {
+                    int accNo = accNos[rng.below(accountCount)];
+                    Money amount = Money::fromPaise(1 + (int64_t)rng.below(100000));
+                    switch (pick(rng))
+                    {
+                    case MIX_DEPOSIT:
+                        requests[slot].push_back(ShardedManager::deposit(accNo, amount, &tickets[slot]));
+                        break;
+                    case MIX_WITHDRAW:
+                        requests[slot].push_back(ShardedManager::withdraw(accNo, amount, &tickets[slot]));
+                        break;
+                    case MIX_TRANSFER:
+                        requests[slot].push_back(ShardedManager::transfer(accNo, accNos[rng.below(accountCount)], amount,
+                                                                          &tickets[slot]));
+                        break;
+                    case MIX_BALANCE:
+                        requests[slot].push_back(ShardedManager::balance(accNo, &balances[slot][requests[slot].size()],
+                                                                         &tickets[slot]));
+                        break;
+                    }
+                }
+                bank.submit(requests[slot].data(), requests[slot].size());
+            }
+            for (ShardedManager::Ticket &ticket : tickets)
+            {
+                ticket.wait();
+                failures += ticket.failed;
+            }
+            failed += failures;
+        });
+        double rate = operations / bench::secondsSince(start);
+        if (shards == 1)
+            oneShard = rate;
+        bank.stop();
+
+        // Deposits and withdrawals move the total; check it against the histories
+        Money total;
+        int64_t expected = 0;
+        for (int accNo : accNos)
+        {
+            Account *acc = bank.accountShard(accNo)->findAccount(accNo, "", true);
+            expected += opening.paise();
+            acc->getTransactionLog().forEach([&](const TransactionRecord &record)
+            {
+                if (record.getType() == TX_DEPOSIT)
+                    expected += record.getAmount().paise();
+                else if (record.getType() == TX_WITHDRAW)
+                    expected -= record.getAmount().paise();
+            });
+        }
+        bool totalOk = bank.totalBalance(total) && total.paise() == expected;
+        cout << shards << "," << clients << "," << rate << "," << rate / oneShard << "," << failed << ","
+             << (totalOk ? "yes" : "no") << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Startup time: snapshot load + journal tail vs. replaying the whole journal.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_startup.cpp WiseVault[A-Z]*.cpp -o bench_startup
+//   ./bench_startup [accounts=1000000] [transactionsPerAccount=4] [tailRecords=10000]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    const long accountCount = bench::argOr(argc, argv, 1, 1000000);
+    const long perAccount = bench::argOr(argc, argv, 2, 4);
+    const long tailRecords = bench::argOr(argc, argv, 3, 10000);
+    const string journalPath = "bench_startup.journal";
+    const string snapshotPath = "bench_startup.snapshot";
+    unlink(journalPath.c_str());
+    unlink(snapshotPath.c_str());
+
+    Journal::Options options;
+    options.path = journalPath;
+    options.waitForDurability = false;
+
+    uint64_t snapshotSequence = 0;
+    double saveSeconds = 0;
+    {
+        bench::QuietCout quiet;
+        Journal journal;
+        journal.open(options);
+        Manager manager;
+        Transaction transaction;
+        manager.attachJournal(&journal);
+        transaction.attachJournal(&journal);
+
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder " + to_string(i), Money::fromRupees(1000), "Saving", "user" + to_string(i % 100000));
+        bench::Rng rng;
+        for (long i = 0; i < accountCount * perAccount; ++i)
+            transaction.deposit(*manager.findAccount(1001 + (int)rng.below(accountCount), "", true), Money::fromRupees(10));
+
+        snapshotSequence = journal.lastSequence();
+        auto start = bench::Clock::now();
+        manager.saveSnapshot(snapshotPath, snapshotSequence);
+        saveSeconds = bench::secondsSince(start);
+
+        // Activity after the snapshot that startup has to replay from the journal
+        for (long i = 0; i < tailRecords; ++i)
+            transaction.withdraw(*manager.findAccount(1001 + (int)rng.below(accountCount), "", true), Money::fromRupees(1));
+        journal.sync();
+    }
+
+    double fullReplaySeconds, snapshotStartSeconds;
+    {
+        Manager manager;
+        auto start = bench::Clock::now();
+        Journal::replay(journalPath, [&](const JournalRecord &rec) { manager.apply(rec); });
+        fullReplaySeconds = bench::secondsSince(start);
+    }
+    {
+        Manager manager;
+        auto start = bench::Clock::now();
+        uint64_t sequence = 0;
+        manager.loadSnapshot(snapshotPath, sequence);
+        Journal::replay(journalPath, [&](const JournalRecord &rec) { manager.apply(rec); }, sequence);
+        snapshotStartSeconds = bench::secondsSince(start);
+    }
+
+    cout << "accounts,transactions,tail_records,snapshot_write_s,full_replay_s,snapshot_startup_s\n";
+    cout << accountCount << "," << accountCount * perAccount << "," << tailRecords << "," << saveSeconds << ","
+         << fullReplaySeconds << "," << snapshotStartSeconds << "\n";
+
+    unlink(journalPath.c_str());
+    unlink(snapshotPath.c_str());
+    return 0;
+}
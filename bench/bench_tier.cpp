@@ -0,0 +1,103 @@
+// History tier: memory held before and after paging idle accounts' history
+// out to segment files, how long the page-out takes, and full-history scans
+// of accounts still in memory vs. ones read back through the tier. Cold scans
+// fault their pages in from the page cache; dropping it first (as root,
+// /proc/sys/vm/drop_caches) shows the cost from disk. Segments left by the
+// previous run are deleted on start.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_tier.cpp WiseVault[A-Z]*.cpp -o bench_tier
+//   ./bench_tier [accounts=2000] [historyPerAccount=2000] [budgetMB=16] [directory=/tmp/wisevault_bench_tier]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+static double residentMB()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+int main(int argc, char **argv)
+{
+    const long accountCount = max(2L, bench::argOr(argc, argv, 1, 2000));
+    const long history = bench::argOr(argc, argv, 2, 2000);
+    const long budgetMB = max(1L, bench::argOr(argc, argv, 3, 16));
+    HistoryTier::Options options;
+    options.directory = argc > 4 ? argv[4] : "/tmp/wisevault_bench_tier";
+    options.memoryBudget = (size_t)budgetMB << 20;
+    options.trimEveryPasses = 1;
+    HistoryTier &tier = HistoryTier::instance();
+    if (!tier.open(options))
+    {
+        cerr << "Could not open " << options.directory << "\n";
+        return 1;
+    }
+    tier.removeUnused();
+
+    Manager manager;
+    Transaction transaction;
+    vector<Account *> accounts(accountCount);
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < accountCount; ++i)
+            manager.createAccount("Holder", Money::fromRupees(100), "Saving", "user" + to_string(i));
+        for (long i = 0; i < accountCount; ++i)
+            accounts[i] = manager.findAccount(1001 + (int)i, "", true);
+        bench::Rng rng;
+        for (long h = 0; h < history; ++h)
+            for (Account *acc : accounts)
+                transaction.deposit(*acc, Money::fromPaise(1 + rng.below(10000)));
+    }
+    HistoryArena &arena = HistoryArena::instance();
+    double arenaBefore = arena.liveBytes() / double(1 << 20), rssBefore = residentMB();
+
+    // The first tenth of the accounts stay in use; the rest go idle
+    const long hotCount = max(1L, accountCount / 10);
+    HistoryQuery scan;
+    scan.limit = 0;
+    HistoryPage page;
+    auto scanAll = [&](long from, long to)
+    {
+        auto start = bench::Clock::now();
+        size_t rows = 0;
+        for (long i = from; i < to; ++i)
+            if (manager.queryHistory(1001 + (int)i, "", true, scan, page))
+                rows += page.records.size();
+        bench::doNotOptimize(rows);
+        return bench::secondsSince(start) * 1e6 / (to - from);
+    };
+    tier.advance();
+    scanAll(0, hotCount);
+
+    auto start = bench::Clock::now();
+    size_t pagedOut = 0;
+    for (int pass = 0; pass < 1000; ++pass)
+    {
+        size_t chunks = manager.pageOutHistory();
+        pagedOut += chunks;
+        if (chunks == 0 && arena.liveBytes() <= options.memoryBudget)
+            break;
+        scanAll(0, hotCount); // the hot set stays in use while paging runs
+    }
+    double pageOutSeconds = bench::secondsSince(start);
+    manager.pageOutHistory(); // a last pass drops the idle accounts' resident cold pages
+    double arenaAfter = arena.liveBytes() / double(1 << 20), rssAfter = residentMB();
+
+    double hotScanUs = scanAll(0, hotCount);
+    double coldScanUs = scanAll(hotCount, accountCount);
+
+    cout << "accounts,records,arena_before_mb,rss_before_mb,arena_after_mb,rss_after_mb,paged_out_mb,page_out_s,"
+            "hot_scan_us,cold_scan_us\n";
+    cout << accountCount << "," << accountCount * history << "," << arenaBefore << "," << rssBefore << "," << arenaAfter
+         << "," << rssAfter << "," << pagedOut * HistoryArena::LARGE_BYTES / double(1 << 20) << "," << pageOutSeconds
+         << "," << hotScanUs << "," << coldScanUs << "\n";
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Contended transfers: Transaction::transfer vs. a withdraw followed by a deposit.
+// Threads move money in both directions between a small set of hot accounts,
+// which would deadlock without the global lock order.
+//
+//   g++ -O2 -std=c++17 -pthread bench/bench_transfer.cpp WiseVault[A-Z]*.cpp -o bench_transfer
+//   ./bench_transfer [threads=hardware_concurrency] [hotAccounts=16] [opsPerThread=500000] [journal=1]
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+template <typename Op>
+double run(long threads, long opsPerThread, Op op)
+{
+    vector<thread> workers;
+    auto start = bench::Clock::now();
+    for (long t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]
+        {
+            bench::Rng rng(0xABCD + t);
+            for (long i = 0; i < opsPerThread; ++i)
+                op(rng);
+        });
+    for (auto &w : workers)
+        w.join();
+    return threads * opsPerThread / bench::secondsSince(start);
+}
+
+int main(int argc, char **argv)
+{
+    const long threads = bench::argOr(argc, argv, 1, max(2u, thread::hardware_concurrency()));
+    const long hotAccounts = bench::argOr(argc, argv, 2, 16);
+    const long opsPerThread = bench::argOr(argc, argv, 3, 500000);
+    const bool useJournal = bench::argOr(argc, argv, 4, 1) != 0;
+
+    Journal journal;
+    Journal::Options options;
+    options.path = "bench_transfer.journal";
+    options.waitForDurability = false;
+    unlink(options.path.c_str());
+
+    Manager manager;
+    Transaction transaction;
+    if (useJournal && journal.open(options))
+    {
+        manager.attachJournal(&journal);
+        transaction.attachJournal(&journal);
+    }
+    {
+        bench::QuietCout quiet;
+        for (long i = 0; i < hotAccounts; ++i)
+            manager.createAccount("Holder", Money::fromRupees(1e12), "Current", "user" + to_string(i));
+    }
+
+    auto pick = [&](bench::Rng &rng, int &from, int &to)
+    {
+        from = 1001 + (int)rng.below(hotAccounts);
+        to = 1001 + (int)rng.below(hotAccounts - 1);
+        if (to >= from)
+            ++to;
+    };
+
+    double separate = run(threads, opsPerThread, [&](bench::Rng &rng)
+    {
+        int from, to;
+        pick(rng, from, to);
+        if (transaction.withdraw(manager, from, Money::fromRupees(1)))
+            transaction.deposit(manager, to, Money::fromRupees(1));
+    });
+    double atomicTransfer = run(threads, opsPerThread, [&](bench::Rng &rng)
+    {
+        int from, to;
+        pick(rng, from, to);
+        transaction.transfer(manager, from, to, Money::fromRupees(1));
+    });
+    double batched = run(threads, opsPerThread / 4, [&](bench::Rng &rng)
+    {
+        vector<TransferLeg> legs(4);
+        for (auto &leg : legs)
+        {
+            pick(rng, leg.fromAccNo, leg.toAccNo);
+            leg.amount = Money::fromRupees(1);
+        }
+        transaction.transferBatch(manager, legs);
+    }) * 4;
+
+    Money total;
+    for (long i = 0; i < hotAccounts; ++i)
+        total += transaction.balance(*manager.findAccount(1001 + (int)i, "", true));
+
+    cout << "threads,hot_accounts,journal,withdraw_deposit_per_sec,transfer_per_sec,batched_legs_per_sec,money_conserved\n";
+    cout << threads << "," << hotAccounts << "," << (journal.isOpen() ? 1 : 0) << "," << separate << ","
+         << atomicTransfer << "," << batched << "," << (total == Money::fromRupees(1e12) * hotAccounts ? "yes" : "no") << "\n";
+
+    journal.close();
+    unlink(options.path.c_str());
+    return 0;
+}
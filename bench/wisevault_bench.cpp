@@ -0,0 +1,234 @@
+// The regression suite: deterministic synthetic workloads over the core
+// library (account creation, mixed postings, lookups, loan origination,
+// history scans, reports), one CSV row each. Every run with the same scale
+// performs exactly the same operations, so the checksum column must match
+// between runs and only the timings may move.
+//
+//   cmake -S . -B build && cmake --build build --target wisevault_bench
+//   ./build/wisevault_bench [scale=100000] [repeats=5] [baseline.csv] [tolerance%=10] > results.csv
+//
+// scale is the number of accounts; the other workloads are sized from it.
+// The suite runs `repeats` times on fresh state and keeps each workload's
+// fastest time. Given an earlier run's output as baseline, it exits 1 if any
+// workload's ops_per_sec fell by more than tolerance percent or its checksum
+// changed.
+#include "../WiseVault.h"
+#include "bench_common.h"
+
+using namespace std;
+
+struct BenchResult
+{
+    string workload;
+    long operations = 0;
+    double seconds = 0;
+    uint64_t checksum = 0; // what the workload computed, for catching behaviour changes
+
+    double opsPerSec() const { return seconds > 0 ? operations / seconds : 0; }
+};
+
+// Runs body once and records how long it took; body returns the checksum
+template <typename Fn>
+static BenchResult measure(const string &workload, long operations, Fn body)
+{
+    BenchResult result;
+    result.workload = workload;
+    result.operations = operations;
+    auto start = bench::Clock::now();
+    result.checksum = body();
+    result.seconds = bench::secondsSince(start);
+    return result;
+}
+
+// Reads a previous run's CSV; false if it can't be opened
+static bool readBaseline(const string &path, unordered_map<string, BenchResult> &out)
+{
+    ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    getline(in, line); // header
+    while (getline(in, line))
+    {
+        stringstream fields(line);
+        BenchResult row;
+        string operations, seconds, opsPerSec, nsPerOp, checksum;
+        getline(fields, row.workload, ',');
+        getline(fields, operations, ',');
+        getline(fields, seconds, ',');
+        getline(fields, opsPerSec, ',');
+        getline(fields, nsPerOp, ',');
+        getline(fields, checksum, ',');
+        if (row.workload.empty())
+            continue;
+        row.operations = atol(operations.c_str());
+        row.seconds = atof(seconds.c_str());
+        row.checksum = strtoull(checksum.c_str(), nullptr, 10);
+        out[row.workload] = row;
+    }
+    return true;
+}
+
+// One pass over every workload, starting from an empty Manager
+static vector<BenchResult> runSuite(long accounts)
+{
+    const long postings = accounts * 10, lookups = accounts * 10, loans = accounts / 2;
+    const long owners = max(1L, accounts / 4);
+
+    vector<BenchResult> results;
+    Manager manager;
+    Transaction transaction;
+    bench::Rng rng(1);
+
+    results.push_back(measure("account_create", accounts, [&]
+    {
+        uint64_t sum = 0;
+        uint64_t sequence = 0;
+        for (long i = 0; i < accounts; ++i)
+        {
+            Money opening = Money::fromPaise(100000 + (int64_t)rng.below(10000000));
+            sum += manager.openAccount("Holder " + to_string(i), opening, i % 3 ? "Saving" : "Current",
+                                       "user" + to_string(i % owners), sequence);
+        }
+        return sum;
+    }));
+
+    // Collected once so the posting loop measures postings, not lookups
+    vector<Account *> byIndex(accounts);
+    for (long i = 0; i < accounts; ++i)
+        byIndex[i] = manager.findAccount(1001 + (int)i, "", true);
+
+    results.push_back(measure("deposit_withdraw", postings, [&]
+    {
+        uint64_t posted = 0;
+        for (long i = 0; i < postings; ++i)
+        {
+            Account &acc = *byIndex[rng.below(accounts)];
+            Money amount = Money::fromPaise(1 + (int64_t)rng.below(500000));
+            posted += rng.below(100) < 55 ? transaction.deposit(acc, amount) : transaction.withdraw(acc, amount);
+        }
+        return posted;
+    }));
+
+    // One lookup in ten misses
+    results.push_back(measure("find_account", lookups, [&]
+    {
+        uint64_t found = 0;
+        for (long i = 0; i < lookups; ++i)
+        {
+            long index = (long)rng.below(accounts + accounts / 9);
+            found += manager.findAccount(1001 + (int)index, "user" + to_string(index % owners), false) != nullptr;
+        }
+        return found;
+    }));
+
+    results.push_back(measure("loan_originate", loans, [&]
+    {
+        uint64_t sum = 0;
+        uint64_t sequence = 0;
+        for (long i = 0; i < loans; ++i)
+            sum += manager.openLoan("Borrower " + to_string(i), "user" + to_string(i % owners),
+                                    Money::fromRupees(10000 + (double)rng.below(5000000)), 1 + (int)rng.below(30), sequence);
+        return sum;
+    }));
+
+    results.push_back(measure("find_loan", lookups, [&]
+    {
+        uint64_t found = 0;
+        for (long i = 0; i < lookups; ++i)
+            found += manager.findLoan(1 + (int)rng.below(loans + loans / 9), "", true) != nullptr;
+        return found;
+    }));
+
+    // A withdrawals statement for every account: each query scans its whole history
+    results.push_back(measure("history_scan", accounts, [&]
+    {
+        uint64_t rows = 0;
+        HistoryQuery query;
+        query.typeMask = 1u << TX_WITHDRAW;
+        query.limit = 0;
+        HistoryPage page;
+        for (long i = 0; i < accounts; ++i)
+            if (manager.queryHistory(1001 + (int)i, "", true, query, page))
+                rows += page.records.size();
+        return rows;
+    }));
+
+    // Operations here are report rows: every account, loan and transaction
+    long reportRows = accounts + loans;
+    for (Account *acc : byIndex)
+        reportRows += (long)acc->getTransactionLog().size();
+    const string reportPath = "/tmp/wisevault_bench_report.csv";
+    results.push_back(measure("report_csv", reportRows, [&]
+    {
+        int fd = ::open(reportPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return (uint64_t)0;
+        manager.writeReport(fd, REPORT_CSV,
+                            Manager::REPORT_ACCOUNTS | Manager::REPORT_LOANS | Manager::REPORT_TRANSACTIONS);
+        ::close(fd);
+        return (uint64_t)0;
+    }));
+    {
+        // The line count is the checksum; counted outside the timing
+        ifstream report(reportPath);
+        results.back().checksum = count(istreambuf_iterator<char>(report), istreambuf_iterator<char>(), '\n');
+    }
+    unlink(reportPath.c_str());
+    return results;
+}
+
+int main(int argc, char **argv)
+{
+    const long accounts = max(4L, bench::argOr(argc, argv, 1, 100000));
+    const long repeats = max(1L, bench::argOr(argc, argv, 2, 5));
+    const string baselinePath = argc > 3 ? argv[3] : "";
+    const double tolerance = argc > 4 ? atof(argv[4]) : 10.0;
+
+    vector<BenchResult> results = runSuite(accounts);
+    for (long pass = 1; pass < repeats; ++pass)
+    {
+        vector<BenchResult> again = runSuite(accounts);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (again[i].checksum != results[i].checksum)
+                cerr << "NONDETERMINISTIC " << results[i].workload << ": checksum " << again[i].checksum << " then "
+                     << results[i].checksum << "\n";
+            results[i].seconds = min(results[i].seconds, again[i].seconds);
+        }
+    }
+
+    cout << "workload,operations,seconds,ops_per_sec,ns_per_op,checksum\n";
+    for (const BenchResult &r : results)
+        cout << r.workload << "," << r.operations << "," << r.seconds << "," << r.opsPerSec() << ","
+             << (r.operations ? r.seconds * 1e9 / r.operations : 0) << "," << r.checksum << "\n";
+
+    if (baselinePath.empty())
+        return 0;
+    unordered_map<string, BenchResult> baseline;
+    if (!readBaseline(baselinePath, baseline))
+    {
+        cerr << "Could not read baseline " << baselinePath << "\n";
+        return 2;
+    }
+    int failures = 0;
+    for (const BenchResult &r : results)
+    {
+        auto it = baseline.find(r.workload);
+        if (it == baseline.end())
+            continue;
+        const BenchResult &before = it->second;
+        double change = before.opsPerSec() > 0 ? (r.opsPerSec() / before.opsPerSec() - 1) * 100 : 0;
+        if (change < -tolerance)
+        {
+            cerr << "REGRESSION " << r.workload << ": " << fixed << setprecision(1) << -change << "% slower\n";
+            ++failures;
+        }
+        if (before.operations == r.operations && before.checksum != r.checksum)
+        {
+            cerr << "CHANGED " << r.workload << ": checksum " << r.checksum << ", was " << before.checksum << "\n";
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}
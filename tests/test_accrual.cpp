@@ -0,0 +1,120 @@
+// Month-end interest when postings land after a month has ended but before it
+// is closed: the closed month is paid for its own days only, and the days
+// after it are paid by the next close.
+//
+//   g++ -O2 -std=c++17 -pthread tests/test_accrual.cpp WiseVault[A-Z]*.cpp -o test_accrual && ./test_accrual
+#include "../WiseVault.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void expect(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        cerr << "FAIL: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Interest on balance-days the way Accrual::close rounds it
+static Money interestOn(__int128 balanceDays, double rate)
+{
+    const __int128 divisor = 365 * 10000;
+    return Money::fromPaise((int64_t)((balanceDays * llround(rate * 100) + divisor / 2) / divisor));
+}
+
+static void openAccount(Manager &manager, int accNo, Money balance, time_t when)
+{
+    JournalRecord rec(JOURNAL_CREATE_ACCOUNT, accNo, 0, balance);
+    rec.timestamp = when;
+    JournalRecord::setField(rec.name, JOURNAL_NAME_LEN, "Holder");
+    JournalRecord::setField(rec.type, JOURNAL_TYPE_LEN, "Saving");
+    JournalRecord::setField(rec.username, JOURNAL_USER_LEN, "holder");
+    manager.apply(rec);
+}
+
+static void openLoan(Manager &manager, int loanID, Money principal, time_t when)
+{
+    JournalRecord rec(JOURNAL_APPLY_LOAN, 0, loanID, principal);
+    rec.timestamp = when;
+    rec.tenure = 5;
+    rec.rate = manager.getLoanRate();
+    JournalRecord::setField(rec.name, JOURNAL_NAME_LEN, "Holder");
+    JournalRecord::setField(rec.username, JOURNAL_USER_LEN, "holder");
+    manager.apply(rec);
+}
+
+int main()
+{
+    // The two months before this one: everything opens at the start of the
+    // first, and the postings land on the 10th of the second
+    time_t now = time(nullptr);
+    struct tm today;
+    gmtime_r(&now, &today);
+    int year = today.tm_year + 1900, month = today.tm_mon + 1;
+    int periods[2];
+    int32_t starts[3];
+    starts[2] = daysFromCivil(year, month, 1);
+    for (int i = 1; i >= 0; --i)
+    {
+        if (--month == 0)
+        {
+            month = 12;
+            --year;
+        }
+        periods[i] = year * 100 + month;
+        starts[i] = daysFromCivil(year, month, 1);
+    }
+    const time_t opened = (time_t)starts[0] * 86400 + 3600;
+    const time_t posted = (time_t)(starts[1] + 9) * 86400 + 3600;
+    const int32_t firstDays = starts[1] - starts[0], secondDays = starts[2] - starts[1];
+
+    Manager manager;
+    const Money balance = Money::fromRupees(100000), deposit = Money::fromRupees(50000);
+    const Money principal = Money::fromRupees(200000), payment = Money::fromRupees(20000);
+    openAccount(manager, 1001, balance, opened); // posts after the first month ends
+    openAccount(manager, 1002, balance, opened); // doesn't
+    openLoan(manager, 1, principal, opened);
+    openLoan(manager, 2, principal, opened);
+    JournalRecord credit(JOURNAL_DEPOSIT, 1001, 0, deposit);
+    credit.timestamp = posted;
+    manager.apply(credit);
+    JournalRecord repay(JOURNAL_LOAN_PAYMENT, 0, 1, payment);
+    repay.timestamp = posted;
+    manager.apply(repay);
+
+    const double rate = manager.getSavingRate(), loanRate = manager.getLoanRate();
+    Account *posting = manager.findAccount(1001, "", true), *quiet = manager.findAccount(1002, "", true);
+    Loan *paying = manager.findLoan(1, "", true), *idle = manager.findLoan(2, "", true);
+
+    // The first month: both accounts and both loans are charged for its days alone
+    size_t credited = 0;
+    Money paid;
+    expect(manager.closeMonth(periods[0], credited, paid), "the first month closes");
+    const Money firstInterest = interestOn((__int128)balance.paise() * firstDays, rate);
+    expect(posting->getBalance() == balance + deposit + firstInterest, "a later posting doesn't change the first month's interest");
+    expect(quiet->getBalance() == balance + firstInterest, "the first month's interest is for its days alone");
+    const Money firstLoanInterest = interestOn((__int128)principal.paise() * firstDays, loanRate);
+    expect(paying->getInterestDue() == firstLoanInterest, "a later loan payment doesn't change the first month's interest");
+    expect(idle->getInterestDue() == firstLoanInterest, "the first month's loan interest is for its days alone");
+
+    // The second month: the days carried over are paid now. The first
+    // month's interest was credited at the close, so it earns nothing here.
+    expect(manager.closeMonth(periods[1], credited, paid), "the second month closes");
+    const __int128 postingDays = (__int128)balance.paise() * 9 + (__int128)(balance + deposit).paise() * (secondDays - 9);
+    expect(posting->getBalance() == balance + deposit + firstInterest + interestOn(postingDays, rate),
+           "the days after the first month are paid by the second close");
+    expect(quiet->getBalance() == balance + firstInterest + interestOn((__int128)balance.paise() * secondDays, rate),
+           "the second month's interest is for its days alone");
+    const __int128 loanDays =
+        (__int128)principal.paise() * 9 + (__int128)(principal - payment).paise() * (secondDays - 9);
+    expect(paying->getInterestDue() == firstLoanInterest + interestOn(loanDays, loanRate),
+           "the loan's days after the first month are charged by the second close");
+
+    if (failures)
+        return 1;
+    cout << "test_accrual: ok\n";
+    return 0;
+}